@@ -51,6 +51,8 @@
 #define FT_DEBUG_IO	0x04	/* I/O operations */
 
 extern unsigned int ft_debug_logging;	/* debug options */
+extern bool ft_ddp;			/* use DDP for write data */
+extern bool ft_zero_copy_reads;		/* map read data pages into frames */
 
 #define FT_ERR(fmt, args...) pr_err("%s: " fmt, __func__, ##args)
 
@@ -138,8 +140,9 @@ struct ft_cmd {
 	u32 max_lso_payload;		/* max offloaded (LSO) data payload */
 	u16 max_payload;		/* max transmitted data payload */
 	struct scst_cmd *scst_cmd;
-	spinlock_t lock;		/* protects state */
+	spinlock_t lock;		/* protects state and was_ddp_setup */
 	enum ft_cmd_state state;
+	bool was_ddp_setup;		/* write data DDP context exists */
 };
 
 extern struct list_head ft_lport_list;
@@ -181,6 +184,8 @@ bool ft_test_and_set_cmd_state(struct ft_cmd *fcmd, enum ft_cmd_state old,
 void ft_recv_req(struct ft_sess *sess, struct fc_frame *fp);
 void ft_recv_write_data(struct scst_cmd *cmd, struct fc_frame *fp);
 int ft_send_read_data(struct scst_cmd *cmd);
+void ft_ddp_setup(struct scst_cmd *cmd);
+void ft_ddp_done(struct ft_cmd *fcmd);
 
 /* #define FCST_INJECT_SEND_ERRORS 2 */
 
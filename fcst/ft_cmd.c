@@ -122,12 +122,14 @@ static void ft_cmd_done(struct ft_cmd *fcmd)
 	struct fc_lport *lport = fr_dev(fp);
 #endif
 
-	if (sp)
+	if (sp) {
+		ft_ddp_done(fcmd);
 #ifdef NEW_LIBFC_API
 		fc_exch_done(sp);
 #else
 		lport->tt.exch_done(sp);
 #endif
+	}
 
 	if (fr_seq(fp))
 #ifdef NEW_LIBFC_API
@@ -373,11 +375,17 @@ int ft_send_xfer_rdy(struct scst_cmd *cmd)
 #endif
 	fc_fill_fc_hdr(fp, FC_RCTL_DD_DATA_DESC, ep->did, ep->sid, FC_TYPE_FCP,
 		       FC_FC_EX_CTX | FC_FC_END_SEQ | FC_FC_SEQ_INIT, 0);
+
+	/* The DDP context must exist before the initiator sends data. */
+	ft_ddp_setup(cmd);
+
 #ifdef NEW_LIBFC_API
 	error = FCST_INJ_SEND_ERR(fc_seq_send(lport, fcmd->seq, fp));
 #else
 	error = FCST_INJ_SEND_ERR(lport->tt.seq_send(lport, fcmd->seq, fp));
 #endif
+	if (error)
+		ft_ddp_done(fcmd);
 	switch (error) {
 	case 0:
 		return SCST_TGT_RES_SUCCESS;
@@ -619,6 +627,14 @@ static void ft_recv_cmd(struct ft_sess *sess, struct fc_frame *fp)
 	}
 	scst_cmd_set_expected(cmd, data_dir, data_len);
 
+	/*
+	 * Read data pages can only be attached to frames if they are not
+	 * recycled through the sgv cache. See also ft_send_read_data().
+	 */
+	if (ft_zero_copy_reads && (data_dir & SCST_DATA_READ) &&
+	    lport->sg_supp && !(data_len % 4))
+		scst_cmd_set_no_sgv(cmd);
+
 	switch (fcp->fc_pri_ta & FCP_PTA_MASK) {
 	case FCP_PTA_SIMPLE:
 		scst_cmd_set_queue_type(cmd, SCST_CMD_QUEUE_SIMPLE);
@@ -52,7 +52,9 @@ int ft_send_read_data(struct scst_cmd *cmd)
 	size_t mem_len;
 	u32 mem_off;
 	size_t tlen;
+	struct scatterlist *sg;
 	struct page *page;
+	u32 pg_off;
 	int use_sg;
 	int error;
 	void *to = NULL;
@@ -74,7 +76,12 @@ int ft_send_read_data(struct scst_cmd *cmd)
 		FT_ERR("oid %x oxid %x resp_len %zd frame_off %u\n",
 		       ep->oid, ep->oxid, tlen, frame_off);
 
+	/*
+	 * sg tracks the SG entry of the buffer returned by scst_get_buf_*()
+	 * such that frames can reference the pages of highmem buffers too.
+	 */
 	mem_len = scst_get_buf_first(cmd, &from);
+	sg = scst_cmd_get_sg(cmd);
 	mem_off = 0;
 	if (!mem_len) {
 		FT_IO_DBG("mem_len 0\n");
@@ -96,6 +103,7 @@ int ft_send_read_data(struct scst_cmd *cmd)
 			mem_len = scst_get_buf_next(cmd, &from);
 			if (!mem_len)
 				return SCST_TGT_RES_SUCCESS;
+			sg = sg_next(sg);
 		}
 		mem_len -= tlen;
 		mem_off = tlen;
@@ -107,18 +115,19 @@ int ft_send_read_data(struct scst_cmd *cmd)
 #endif
 	}
 
-	/* no scatter/gather in skb for odd word length due to fc_seq_send() */
-	use_sg = !(remaining % 4) && lport->sg_supp;
 	/*
-	 * Note: since libfc_function_template.seq_send() sends frames
-	 * asynchronously and since the SCST data buffer is freed as soon as
-	 * scst_tgt_cmd_done() has been invoked, data has to be copied into
-	 * the skb instead of only copying a pointer to the data. To do: defer
-	 * invocation of scst_tgt_cmd_done() until sending the data frames
-	 * finished once the paged fragment destructor or an equivalent is
-	 * upstream.
+	 * No scatter/gather in skb for odd word length due to fc_seq_send().
+	 * Since libfc_function_template.seq_send() sends frames asynchronously
+	 * the data pages may still be referenced by an skb after
+	 * scst_tgt_cmd_done() has been invoked and the SCST data buffer has
+	 * been freed. The page reference held by the skb keeps such a page
+	 * alive, but that only prevents data corruption if the page is not
+	 * reused through the sgv cache (see also ft_recv_cmd()) and if it is
+	 * not owned by the dev handler. Otherwise copy the data.
 	 */
-	use_sg = false;
+	use_sg = !(remaining % 4) && lport->sg_supp &&
+		 scst_cmd_get_no_sgv(cmd) &&
+		 !scst_cmd_get_dh_data_buff_alloced(cmd);
 
 	while (remaining) {
 		if (!loop_limit) {
@@ -135,6 +144,7 @@ int ft_send_read_data(struct scst_cmd *cmd)
 				FT_ERR("mem_len 0 from get_buf_next\n");
 				break;
 			}
+			sg = sg_next(sg);
 		}
 		if (!frame_len) {
 			frame_len = fcmd->max_lso_payload;
@@ -156,14 +166,14 @@ int ft_send_read_data(struct scst_cmd *cmd)
 		BUG_ON(tlen > frame_len);
 
 		if (use_sg) {
-			page = virt_to_page(from + mem_off);
+			pg_off = sg->offset + mem_off;
+			page = nth_page(sg_page(sg), pg_off >> PAGE_SHIFT);
+			pg_off &= ~PAGE_MASK;
 			get_page(page);
-			tlen = min_t(size_t, tlen,
-				     PAGE_SIZE - (mem_off & ~PAGE_MASK));
+			tlen = min_t(size_t, tlen, PAGE_SIZE - pg_off);
 			skb_fill_page_desc(fp_skb(fp),
 					   skb_shinfo(fp_skb(fp))->nr_frags,
-					   page, offset_in_page(from + mem_off),
-					   tlen);
+					   page, pg_off, tlen);
 			fr_len(fp) += tlen;
 			fp_skb(fp)->data_len += tlen;
 			fp_skb(fp)->truesize +=
@@ -216,6 +226,97 @@ int ft_send_read_data(struct scst_cmd *cmd)
 	return SCST_TGT_RES_SUCCESS;
 }
 
+/*
+ * Set up direct data placement of the write data into the SCST buffer if the
+ * NIC supports it. Must be called before the transfer ready is sent.
+ */
+void ft_ddp_setup(struct scst_cmd *cmd)
+{
+	struct ft_cmd *fcmd = scst_cmd_get_tgt_priv(cmd);
+	struct fc_exch *ep = fc_seq_exch(fcmd->seq);
+	struct fc_lport *lport = ep->lp;
+
+	if (!ft_ddp || scst_cmd_get_data_direction(cmd) != SCST_DATA_WRITE)
+		return;
+	if (!lport->lro_enabled || ep->xid > lport->lro_xid ||
+	    !lport->tt.ddp_target)
+		return;
+	if (lport->tt.ddp_target(lport, ep->xid, scst_cmd_get_sg(cmd),
+				 scst_cmd_get_sg_cnt(cmd))) {
+		FT_IO_DBG("oxid %x xid %x: DDP set up for %u bytes\n",
+			  ep->oxid, ep->xid, scst_cmd_get_bufflen(cmd));
+		fcmd->was_ddp_setup = true;
+	}
+}
+
+/*
+ * Invalidate the DDP context of a command, if any. Updates write_data_len
+ * with the number of bytes the NIC placed in the SCST buffer.
+ */
+void ft_ddp_done(struct ft_cmd *fcmd)
+{
+	struct fc_exch *ep;
+	struct fc_lport *lport;
+	bool was_ddp_setup;
+
+	/* Called both from softirq and from process context. */
+	spin_lock_bh(&fcmd->lock);
+	was_ddp_setup = fcmd->was_ddp_setup;
+	fcmd->was_ddp_setup = false;
+	spin_unlock_bh(&fcmd->lock);
+
+	if (!was_ddp_setup)
+		return;
+
+	ep = fc_seq_exch(fcmd->seq);
+	lport = ep->lp;
+	fcmd->write_data_len = lport->tt.ddp_done(lport, ep->xid);
+}
+
+/*
+ * Notify SCST once all write data has been received.
+ */
+static void ft_write_data_done(struct scst_cmd *cmd, struct ft_cmd *fcmd,
+			       unsigned int bufflen)
+{
+	if (fcmd->write_data_len != bufflen)
+		return;
+
+	spin_lock(&fcmd->lock);
+	if (fcmd->state == FT_STATE_NEED_DATA) {
+		fcmd->state = FT_STATE_DATA_IN;
+		scst_rx_data(cmd, SCST_RX_STATUS_SUCCESS, SCST_CONTEXT_THREAD);
+	}
+	spin_unlock(&fcmd->lock);
+}
+
+/*
+ * Receive the frame that ends a write data sequence placed by DDP. Only the
+ * header of that frame is delivered; the payload of all write data frames
+ * is already in the SCST buffer.
+ */
+static void ft_recv_write_data_ddp(struct scst_cmd *cmd, struct fc_frame *fp)
+{
+	struct ft_cmd *fcmd = scst_cmd_get_tgt_priv(cmd);
+	struct fc_frame_header *fh = fc_frame_header_get(fp);
+	u32 f_ctl = ntoh24(fh->fh_f_ctl);
+
+	if (fc_frame_payload_get(fp, 1))
+		FT_ERR("oxid %x f_ctl %x: unexpected payload in DDP write data frame\n",
+		       fc_seq_exch(fcmd->seq)->oxid, f_ctl);
+
+	ft_ddp_done(fcmd);
+
+	/*
+	 * Without sequence initiative DDP failed. Drop the frame and let the
+	 * initiator abort the exchange.
+	 */
+	if (f_ctl & FC_FC_SEQ_INIT)
+		ft_write_data_done(cmd, fcmd, scst_cmd_get_bufflen(cmd));
+
+	fc_frame_free(fp);
+}
+
 /*
  * Receive write data frame.
  */
@@ -233,6 +334,12 @@ void ft_recv_write_data(struct scst_cmd *cmd, struct fc_frame *fp)
 	int dir;
 	u8 *buf;
 
+	fcmd = scst_cmd_get_tgt_priv(cmd);
+	if (fcmd->was_ddp_setup) {
+		ft_recv_write_data_ddp(cmd, fp);
+		return;
+	}
+
 	dir = scst_cmd_get_data_direction(cmd);
 	if (dir == SCST_DATA_BIDI) {
 		mem_len = scst_get_out_buf_first(cmd, &buf);
@@ -243,7 +350,6 @@ void ft_recv_write_data(struct scst_cmd *cmd, struct fc_frame *fp)
 	}
 	to = buf;
 
-	fcmd = scst_cmd_get_tgt_priv(cmd);
 	fh = fc_frame_header_get(fp);
 
 	if (!(ntoh24(fh->fh_f_ctl) & FC_FC_REL_OFF))
@@ -299,15 +405,7 @@ void ft_recv_write_data(struct scst_cmd *cmd, struct fc_frame *fp)
 		else
 			scst_put_buf(cmd, buf);
 	}
-	if (fcmd->write_data_len == bufflen) {
-		spin_lock(&fcmd->lock);
-		if (fcmd->state == FT_STATE_NEED_DATA) {
-			fcmd->state = FT_STATE_DATA_IN;
-			scst_rx_data(cmd, SCST_RX_STATUS_SUCCESS,
-				     SCST_CONTEXT_THREAD);
-		}
-		spin_unlock(&fcmd->lock);
-	}
+	ft_write_data_done(cmd, fcmd, bufflen);
 drop:
 	fc_frame_free(fp);
 }
@@ -25,6 +25,14 @@ unsigned int ft_debug_logging;
 module_param_named(debug_logging, ft_debug_logging, int, 0644);
 MODULE_PARM_DESC(debug_logging, "log levels bigmask");
 
+bool ft_ddp;
+module_param_named(ddp, ft_ddp, bool, 0644);
+MODULE_PARM_DESC(ddp, "let the NIC place write data directly in the SCST buffer if it supports FCoE DDP (default: false)");
+
+bool ft_zero_copy_reads;
+module_param_named(zero_copy_reads, ft_zero_copy_reads, bool, 0644);
+MODULE_PARM_DESC(zero_copy_reads, "attach read data pages to the transmitted frames instead of copying the data (default: false)");
+
 DEFINE_MUTEX(ft_lport_lock);
 
 static struct notifier_block ft_notifier = {
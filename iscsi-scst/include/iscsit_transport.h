@@ -33,6 +33,15 @@ struct iscsit_transport {
 	void (*iscsit_set_sense_data)(struct iscsi_cmnd *rsp,
 				      const u8 *sense_buf, int sense_len);
 	int (*iscsit_receive_cmnd_data)(struct iscsi_cmnd *cmnd);
+	int (*iscsit_receive_data_out)(struct iscsi_cmnd *data_out,
+				       struct iscsi_cmnd *orig_req,
+				       u32 offset);
+	/*
+	 * Optional. Lets the transport provide the data buffer of a WRITE
+	 * command, whose data all came as immediate data. Returns 0 if the
+	 * buffer was set, > 0 if SCST should allocate it, < 0 on error.
+	 */
+	int (*iscsit_alloc_imm_data_buf)(struct iscsi_cmnd *req);
 	void (*iscsit_make_conn_wr_active)(struct iscsi_conn *conn);
 	void (*iscsit_free_cmd)(struct iscsi_cmnd *cmnd);
 
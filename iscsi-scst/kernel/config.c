@@ -79,9 +79,29 @@ static ssize_t iscsi_open_state_show(struct kobject *kobj, struct kobj_attribute
 static struct kobj_attribute iscsi_open_state_attr =
 	__ATTR(open_state, 0444, iscsi_open_state_show, NULL);
 
+static ssize_t iscsi_thread_pools_show(struct kobject *kobj, struct kobj_attribute *attr,
+				       char *buf)
+{
+	return iscsi_thread_pools_stats_show(buf);
+}
+
+static struct kobj_attribute iscsi_thread_pools_attr =
+	__ATTR(thread_pools, 0444, iscsi_thread_pools_show, NULL);
+
+static ssize_t iscsi_tx_zerocopy_show(struct kobject *kobj, struct kobj_attribute *attr,
+				      char *buf)
+{
+	return iscsi_tx_zerocopy_stats_show(buf);
+}
+
+static struct kobj_attribute iscsi_tx_zerocopy_attr =
+	__ATTR(tx_zerocopy, 0444, iscsi_tx_zerocopy_show, NULL);
+
 const struct attribute *iscsi_attrs[] = {
 	&iscsi_version_attr.attr,
 	&iscsi_open_state_attr.attr,
+	&iscsi_thread_pools_attr.attr,
+	&iscsi_tx_zerocopy_attr.attr,
 	NULL,
 };
 
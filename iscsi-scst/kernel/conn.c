@@ -221,6 +221,91 @@ static ssize_t iscsi_conn_state_show(struct kobject *kobj, struct kobj_attribute
 static struct kobj_attribute iscsi_conn_state_attr =
 	__ATTR(state, 0444, iscsi_conn_state_show, NULL);
 
+static ssize_t iscsi_conn_itt_lookups_show(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   char *buf)
+{
+	struct iscsi_conn *conn;
+	unsigned long lookups, cmnds;
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	spin_lock_bh(&conn->cmd_list_lock);
+	lookups = conn->itt_lookups;
+	cmnds = conn->itt_lookup_cmnds;
+	spin_unlock_bh(&conn->cmd_list_lock);
+
+	return sysfs_emit(buf, "%lu %lu\n", lookups, cmnds);
+}
+
+static struct kobj_attribute iscsi_conn_itt_lookups_attr =
+	__ATTR(itt_lookups, 0444, iscsi_conn_itt_lookups_show, NULL);
+
+static ssize_t iscsi_conn_tx_pdus_per_send_show(struct kobject *kobj,
+						struct kobj_attribute *attr,
+						char *buf)
+{
+	struct iscsi_conn *conn;
+	ssize_t ret = 0;
+	int i;
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	/* Updated only by the write thread, so a racy snapshot */
+	for (i = 0; i < ISCSI_TX_BATCH_HIST_SIZE; i++) {
+		unsigned int lo = 1 << i;
+
+		if (i == ISCSI_TX_BATCH_HIST_SIZE - 1)
+			ret += sysfs_emit_at(buf, ret, "%u+: %lu\n", lo,
+					     READ_ONCE(conn->tx_batch_hist[i]));
+		else
+			ret += sysfs_emit_at(buf, ret, "%u-%u: %lu\n", lo,
+					     2 * lo - 1,
+					     READ_ONCE(conn->tx_batch_hist[i]));
+	}
+
+	return ret;
+}
+
+static struct kobj_attribute iscsi_conn_tx_pdus_per_send_attr =
+	__ATTR(tx_pdus_per_send, 0444, iscsi_conn_tx_pdus_per_send_show, NULL);
+
+static ssize_t iscsi_conn_inflight_show(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					char *buf)
+{
+	struct iscsi_conn *conn;
+	struct iscsi_cmnd *cmnd;
+	unsigned long data_out = 0;
+	int sndbuf = 0;
+
+	conn = container_of(kobj, struct iscsi_conn, conn_kobj);
+
+	/*
+	 * The R2T lengths are updated by the read thread only, so the sum
+	 * is a racy snapshot.
+	 */
+	spin_lock_bh(&conn->cmd_list_lock);
+	list_for_each_entry(cmnd, &conn->cmd_list, cmd_list_entry) {
+		unsigned int to_receive = READ_ONCE(cmnd->r2t_len_to_receive);
+		unsigned int to_send = READ_ONCE(cmnd->r2t_len_to_send);
+
+		if (to_receive > to_send)
+			data_out += to_receive - to_send;
+	}
+	spin_unlock_bh(&conn->cmd_list_lock);
+
+	if (conn->sock)
+		sndbuf = READ_ONCE(conn->sock->sk->sk_wmem_queued);
+
+	return sysfs_emit(buf, "%ld %lu %d\n",
+			  atomic_long_read(&conn->tx_inflight_bytes),
+			  data_out, sndbuf);
+}
+
+static struct kobj_attribute iscsi_conn_inflight_attr =
+	__ATTR(inflight, 0444, iscsi_conn_inflight_show, NULL);
+
 static void conn_sysfs_del(struct iscsi_conn *conn)
 {
 	DECLARE_COMPLETION_ONSTACK(c);
@@ -313,6 +398,27 @@ restart:
 		goto out_err;
 	}
 
+	res = sysfs_create_file(&conn->conn_kobj, &iscsi_conn_itt_lookups_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			    iscsi_conn_itt_lookups_attr.attr.name, addr);
+		goto out_err;
+	}
+
+	res = sysfs_create_file(&conn->conn_kobj, &iscsi_conn_tx_pdus_per_send_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			    iscsi_conn_tx_pdus_per_send_attr.attr.name, addr);
+		goto out_err;
+	}
+
+	res = sysfs_create_file(&conn->conn_kobj, &iscsi_conn_inflight_attr.attr);
+	if (res != 0) {
+		PRINT_ERROR("Unable create sysfs attribute %s for conn %s",
+			    iscsi_conn_inflight_attr.attr.name, addr);
+		goto out_err;
+	}
+
 out:
 	TRACE_EXIT_RES(res);
 	return res;
@@ -341,6 +447,47 @@ struct iscsi_conn *conn_lookup(struct iscsi_session *session, u16 cid)
 	return NULL;
 }
 
+static unsigned long iscsi_conn_tx_load(struct iscsi_conn *conn)
+{
+	unsigned long load = atomic_long_read(&conn->tx_inflight_bytes);
+
+	if (conn->sock)
+		load += READ_ONCE(conn->sock->sk->sk_wmem_queued);
+
+	return load;
+}
+
+/*
+ * Returns the alive connection of a session with the least data waiting to
+ * be sent, or NULL if there is none. Only for the PDUs that aren't bound by
+ * connection allegiance to the connection of a task, like asynchronous
+ * messages.
+ *
+ * target_mutex supposed to be locked.
+ */
+struct iscsi_conn *iscsi_sess_select_conn(struct iscsi_session *session)
+{
+	struct iscsi_conn *conn, *res = NULL;
+	unsigned long load, min_load = ULONG_MAX;
+
+	lockdep_assert_held(&session->target->target_mutex);
+
+	/* On equal load prefer the latest conn, as conn_lookup() does */
+	list_for_each_entry_reverse(conn, &session->conn_list, conn_list_entry) {
+		if (test_bit(ISCSI_CONN_SHUTTINGDOWN, &conn->conn_aflags) ||
+		    conn->conn_reinst_successor)
+			continue;
+
+		load = iscsi_conn_tx_load(conn);
+		if (load < min_load) {
+			min_load = load;
+			res = conn;
+		}
+	}
+
+	return res;
+}
+
 void iscsi_make_conn_rd_active(struct iscsi_conn *conn)
 {
 	struct iscsi_thread_pool *p = conn->conn_thr_pool;
@@ -464,14 +611,19 @@ static void iscsi_data_ready(struct sock *sk, int len)
 
 	TRACE_ENTRY();
 
-	iscsi_make_conn_rd_active(conn);
-
+	/*
+	 * Call the original callback first: if kTLS is attached to the
+	 * socket, it is tls_data_ready(), which has to parse the record
+	 * before the read thread can receive it.
+	 */
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
 	conn->old_data_ready(sk);
 #else
 	conn->old_data_ready(sk, len);
 #endif
 
+	iscsi_make_conn_rd_active(conn);
+
 	TRACE_EXIT();
 }
 
@@ -509,6 +661,31 @@ static void iscsi_write_space_ready(struct sock *sk)
 	TRACE_EXIT();
 }
 
+/*
+ * Requests on each of the timeout lists share the same timeout and are added
+ * in the write_start order, so only the list head can be the earliest one.
+ * Returns the earliest expiring of the heads or NULL, if both lists are empty.
+ */
+static struct iscsi_cmnd *conn_first_timeout_cmnd(struct iscsi_conn *conn)
+{
+	struct iscsi_cmnd *cmnd, *nop;
+
+	lockdep_assert_held(&conn->write_list_lock);
+
+	cmnd = list_first_entry_or_null(&conn->write_timeout_list,
+					struct iscsi_cmnd,
+					write_timeout_list_entry);
+	nop = list_first_entry_or_null(&conn->nop_timeout_list,
+				       struct iscsi_cmnd,
+				       write_timeout_list_entry);
+	if (!cmnd ||
+	    (nop && time_before(iscsi_get_timeout_time(nop),
+				iscsi_get_timeout_time(cmnd))))
+		cmnd = nop;
+
+	return cmnd;
+}
+
 static void conn_rsp_timer_fn(struct timer_list *timer)
 {
 	struct iscsi_conn *conn = container_of(timer, typeof(*conn), rsp_timer);
@@ -521,12 +698,10 @@ static void conn_rsp_timer_fn(struct timer_list *timer)
 
 	spin_lock_bh(&conn->write_list_lock);
 
-	if (!list_empty(&conn->write_timeout_list)) {
+	cmnd = conn_first_timeout_cmnd(conn);
+	if (cmnd) {
 		unsigned long timeout_time;
 
-		cmnd = list_first_entry(&conn->write_timeout_list, struct iscsi_cmnd,
-					write_timeout_list_entry);
-
 		timeout_time = iscsi_get_timeout_time(cmnd) + ISCSI_ADD_SCHED_TIME;
 
 		if (unlikely(time_after_eq(j, iscsi_get_timeout_time(cmnd)))) {
@@ -553,7 +728,7 @@ static void conn_rsp_timer_fn(struct timer_list *timer)
 			 * Timer might have been restarted while we were
 			 * entering here.
 			 *
-			 * Since we have not empty write_timeout_list, we are
+			 * Since we have not empty timeout lists, we are
 			 * safe to restart the timer, because we not race with
 			 * timer_delete_sync() in conn_free().
 			 */
@@ -623,7 +798,7 @@ again:
 	spin_lock(&conn->write_list_lock);
 
 	aborted_cmds_pending = false;
-	list_for_each_entry(cmnd, &conn->write_timeout_list, write_timeout_list_entry) {
+	list_for_each_entry(cmnd, &conn->tm_wait_list, tm_wait_list_entry) {
 		/*
 		 * This should not happen, because DATA OUT commands can't get
 		 * into write_timeout_list.
@@ -770,6 +945,8 @@ static int conn_setup_sock(struct iscsi_conn *conn)
 
 void iscsi_tcp_conn_free(struct iscsi_conn *conn)
 {
+	atomic_dec(&conn->conn_thr_pool->nr_conns);
+
 	fput(conn->file);
 	conn->file = NULL;
 	conn->sock = NULL;
@@ -800,6 +977,8 @@ void conn_free(struct iscsi_conn *conn)
 	sBUG_ON(!list_empty(&conn->cmd_list));
 	sBUG_ON(!list_empty(&conn->write_list));
 	sBUG_ON(!list_empty(&conn->write_timeout_list));
+	sBUG_ON(!list_empty(&conn->nop_timeout_list));
+	sBUG_ON(!list_empty(&conn->tm_wait_list));
 	sBUG_ON(conn->conn_reinst_successor);
 	sBUG_ON(!test_bit(ISCSI_CONN_SHUTTINGDOWN, &conn->conn_aflags));
 
@@ -830,7 +1009,7 @@ int iscsi_init_conn(struct iscsi_session *session,
 		    struct iscsi_kern_conn_info *info,
 		    struct iscsi_conn *conn)
 {
-	int res;
+	int res, i;
 
 	atomic_set(&conn->conn_ref_cnt, 0);
 	conn->session = session;
@@ -851,9 +1030,13 @@ int iscsi_init_conn(struct iscsi_session *session,
 	conn->target = session->target;
 	spin_lock_init(&conn->cmd_list_lock);
 	INIT_LIST_HEAD(&conn->cmd_list);
+	for (i = 0; i < ARRAY_SIZE(conn->itt_hash); i++)
+		INIT_LIST_HEAD(&conn->itt_hash[i]);
 	spin_lock_init(&conn->write_list_lock);
 	INIT_LIST_HEAD(&conn->write_list);
 	INIT_LIST_HEAD(&conn->write_timeout_list);
+	INIT_LIST_HEAD(&conn->nop_timeout_list);
+	INIT_LIST_HEAD(&conn->tm_wait_list);
 	timer_setup(&conn->rsp_timer, conn_rsp_timer_fn, 0);
 	init_waitqueue_head(&conn->read_state_waitQ);
 	init_completion(&conn->ready_to_free);
@@ -923,6 +1106,9 @@ int iscsi_conn_alloc(struct iscsi_session *session, struct iscsi_kern_conn_info
 	if (res != 0)
 		goto out_fput;
 
+	conn->conn_thr_pool = iscsi_select_thread_pool(session->sess_thr_pool,
+						       conn->sock->sk);
+
 	list_add_tail(&conn->conn_list_entry, &session->conn_list);
 
 	*new_conn = conn;
@@ -55,9 +55,25 @@ int digest_init(struct iscsi_conn *conn)
 	return 0;
 }
 
-static __be32 evaluate_crc32_from_sg(struct scatterlist *sg, int nbytes, uint32_t padding)
+/**
+ * digest_update() - fold a chunk of PDU data into a running CRC32C
+ * @crc:  running CRC, ~0 for the first chunk
+ * @data: the chunk
+ * @len:  length of the chunk in bytes
+ */
+u32 digest_update(u32 crc, const void *data, unsigned int len)
 {
-	u32 crc = ~0;
+#if defined(CONFIG_LIBCRC32C_MODULE) || defined(CONFIG_LIBCRC32C) ||	\
+	defined(CONFIG_CRC32_MODULE) || defined(CONFIG_CRC32)
+	crc = crc32c(crc, data, len);
+#endif
+	return crc;
+}
+
+/* Adds the padding of an @nbytes long segment and returns the digest */
+static __be32 digest_final(u32 crc, int nbytes, uint32_t padding)
+{
+	int pad_bytes = ((nbytes + 3) & -4) - nbytes;
 
 #ifdef CONFIG_SCST_ISCSI_DEBUG_DIGEST_FAILURES
 	if (((scst_random() % 100000) == 752)) {
@@ -66,25 +82,26 @@ static __be32 evaluate_crc32_from_sg(struct scatterlist *sg, int nbytes, uint32_
 	}
 #endif
 
-#if defined(CONFIG_LIBCRC32C_MODULE) || defined(CONFIG_LIBCRC32C) ||	\
-	defined(CONFIG_CRC32_MODULE) || defined(CONFIG_CRC32)
-	{
-		int pad_bytes = ((nbytes + 3) & -4) - nbytes;
+	if (pad_bytes)
+		crc = digest_update(crc, &padding, pad_bytes);
 
-		while (nbytes > 0) {
-			int d = min(nbytes, (int)(sg->length));
+	return (__force __be32)~cpu_to_le32(crc);
+}
 
-			crc = crc32c(crc, sg_virt(sg), d);
-			nbytes -= d;
-			sg++;
-		}
+static __be32 evaluate_crc32_from_sg(struct scatterlist *sg, int nbytes, uint32_t padding)
+{
+	int len = nbytes;
+	u32 crc = ~0;
+
+	while (len > 0) {
+		int d = min(len, (int)(sg->length));
 
-		if (pad_bytes)
-			crc = crc32c(crc, (u8 *)&padding, pad_bytes);
+		crc = digest_update(crc, sg_virt(sg), d);
+		len -= d;
+		sg++;
 	}
-#endif
 
-	return (__force __be32)~cpu_to_le32(crc);
+	return digest_final(crc, nbytes, padding);
 }
 
 static __be32 digest_header(struct iscsi_pdu *pdu)
@@ -152,29 +169,30 @@ void digest_tx_header(struct iscsi_cmnd *cmnd)
 	TRACE_DBG("TX header digest for cmd %p: %x", cmnd, cmnd->hdigest);
 }
 
-int digest_rx_data(struct iscsi_cmnd *cmnd)
+/*
+ * Returns the command whose buffer holds the data of @cmnd and the offset of
+ * that data in it, or NULL if the RX data digest check must be skipped.
+ */
+static struct iscsi_cmnd *digest_rx_data_req(struct iscsi_cmnd *cmnd,
+					     u32 *offset)
 {
 	struct iscsi_cmnd *req;
 	struct iscsi_data_out_hdr *req_hdr;
-	u32 offset;
-	__be32 crc;
-	int res = 0;
 
 	switch (cmnd_opcode(cmnd)) {
 	case ISCSI_OP_SCSI_DATA_OUT:
 		req = cmnd->cmd_req;
 		if (unlikely(!req)) {
 			/* It can be for prelim completed commands */
-			req = cmnd;
-			goto out;
+			return NULL;
 		}
 		req_hdr = (struct iscsi_data_out_hdr *)&cmnd->pdu.bhs;
-		offset = be32_to_cpu(req_hdr->buffer_offset);
+		*offset = be32_to_cpu(req_hdr->buffer_offset);
 		break;
 
 	default:
 		req = cmnd;
-		offset = 0;
+		*offset = 0;
 	}
 
 	/*
@@ -185,7 +203,35 @@ int digest_rx_data(struct iscsi_cmnd *cmnd)
 	 * do it).
 	 */
 	if (unlikely(req->prelim_compl_flags != 0))
-		goto out;
+		return NULL;
+
+	return req;
+}
+
+static int digest_rx_data_check(struct iscsi_cmnd *cmnd, __be32 crc,
+				u32 offset)
+{
+	if (unlikely(crc != cmnd->ddigest)) {
+		PRINT_ERROR("RX data digest failed, stable pages disabled?");
+		TRACE_MGMT_DBG("Calculated crc %x, ddigest %x, offset %d", crc,
+			       cmnd->ddigest, offset);
+		iscsi_dump_pdu(&cmnd->pdu);
+		return -EIO;
+	}
+
+	TRACE_DBG("RX data digest OK for cmd %p", cmnd);
+	return 0;
+}
+
+int digest_rx_data(struct iscsi_cmnd *cmnd)
+{
+	struct iscsi_cmnd *req;
+	u32 offset;
+	__be32 crc;
+
+	req = digest_rx_data_req(cmnd, &offset);
+	if (!req)
+		return 0;
 
 	/*
 	 * Temporary to not crash with write residual overflows. ToDo. Until
@@ -199,46 +245,45 @@ int digest_rx_data(struct iscsi_cmnd *cmnd)
 		PRINT_WARNING("Skipping RX data digest check for residual overflow command op %x (data size %d, buffer size %d)",
 			      cmnd_hdr(req)->scb[0], offset + cmnd->pdu.datasize,
 			      req->bufflen);
-		goto out;
+		return 0;
 	}
 
 	crc = digest_data(req, cmnd->pdu.datasize, offset, cmnd->conn->rpadding);
 
-	if (unlikely(crc != cmnd->ddigest)) {
-		PRINT_ERROR("RX data digest failed, stable pages disabled?");
-		TRACE_MGMT_DBG("Calculated crc %x, ddigest %x, offset %d", crc,
-			       cmnd->ddigest, offset);
-		iscsi_dump_pdu(&cmnd->pdu);
-		res = -EIO;
-	} else {
-		TRACE_DBG("RX data digest OK for cmd %p", cmnd);
-	}
-
-out:
-	return res;
+	return digest_rx_data_check(cmnd, crc, offset);
 }
 
-void digest_tx_data(struct iscsi_cmnd *cmnd)
+/**
+ * digest_rx_data_crc() - check the RX data digest against a running CRC
+ * @cmnd: command whose data segment has been received
+ * @crc:  CRC32C accumulated with digest_update() over the data segment as it
+ *        was copied out of the socket
+ *
+ * Since @crc covers the bytes as they came off the wire, no data buffer is
+ * read here. That also makes the check valid for residual overflows, where
+ * the excess data went to a dummy page.
+ */
+int digest_rx_data_crc(struct iscsi_cmnd *cmnd, u32 crc)
 {
-	struct iscsi_data_in_hdr *hdr;
 	u32 offset;
 
-	TRACE_DBG("%s:%d req %p, own_sg %d, sg %p, sgcnt %d cmnd %p, own_sg %d, sg %p, sgcnt %d",
-		  __func__, __LINE__,
-		cmnd->parent_req, cmnd->parent_req->own_sg,
-		cmnd->parent_req->sg, cmnd->parent_req->sg_cnt,
-		cmnd, cmnd->own_sg, cmnd->sg, cmnd->sg_cnt);
+	if (!digest_rx_data_req(cmnd, &offset))
+		return 0;
 
-	switch (cmnd_opcode(cmnd)) {
-	case ISCSI_OP_SCSI_DATA_IN:
-		hdr = (struct iscsi_data_in_hdr *)&cmnd->pdu.bhs;
-		offset = be32_to_cpu(hdr->buffer_offset);
-		break;
-	default:
-		offset = 0;
-	}
+	return digest_rx_data_check(cmnd,
+			digest_final(crc, cmnd->pdu.datasize,
+				     cmnd->conn->rpadding), offset);
+}
 
-	cmnd->ddigest = digest_data(cmnd, cmnd->pdu.datasize, offset, 0);
-	TRACE_DBG("TX data digest for cmd %p: %x (offset %d, opcode %x)", cmnd,
-		  cmnd->ddigest, offset, cmnd_opcode(cmnd));
+/**
+ * digest_tx_data_crc() - set the TX data digest from a running CRC
+ * @cmnd: command whose data segment has been sent
+ * @crc:  CRC32C accumulated with digest_update() over the data segment as it
+ *        was handed to the socket
+ */
+void digest_tx_data_crc(struct iscsi_cmnd *cmnd, u32 crc)
+{
+	cmnd->ddigest = digest_final(crc, cmnd->pdu.datasize, 0);
+	TRACE_DBG("TX data digest for cmd %p: %x (opcode %x)", cmnd,
+		  cmnd->ddigest, cmnd_opcode(cmnd));
 }
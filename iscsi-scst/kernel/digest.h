@@ -25,10 +25,13 @@ void digest_alg_available(int *val);
 
 int digest_init(struct iscsi_conn *conn);
 
+u32 digest_update(u32 crc, const void *data, unsigned int len);
+
 int digest_rx_header(struct iscsi_cmnd *cmnd);
 int digest_rx_data(struct iscsi_cmnd *cmnd);
+int digest_rx_data_crc(struct iscsi_cmnd *cmnd, u32 crc);
 
 void digest_tx_header(struct iscsi_cmnd *cmnd);
-void digest_tx_data(struct iscsi_cmnd *cmnd);
+void digest_tx_data_crc(struct iscsi_cmnd *cmnd, u32 crc);
 
 #endif /* __ISCSI_DIGEST_H__ */
@@ -52,6 +52,21 @@ static struct kmem_cache *iscsi_thread_pool_cache;
 
 static struct iscsi_thread_pool *iscsi_main_thread_pool;
 
+static bool conn_thread_affinity;
+module_param(conn_thread_affinity, bool, 0444);
+MODULE_PARM_DESC(conn_thread_affinity,
+		 "Process each connection by a single read and write thread, bound to the CPU that receives its traffic (default: false)");
+
+bool iscsi_tx_zerocopy;
+module_param_named(tx_zerocopy, iscsi_tx_zerocopy, bool, 0444);
+MODULE_PARM_DESC(tx_zerocopy,
+		 "Send data with MSG_ZEROCOPY and release the data buffers only after the network stack is done with them (default: false)");
+
+bool iscsi_adaptive_cmd_window;
+module_param_named(adaptive_cmd_window, iscsi_adaptive_cmd_window, bool, 0644);
+MODULE_PARM_DESC(adaptive_cmd_window,
+		 "Adapt the command window of each session to the command latency and SGV memory pressure (default: false)");
+
 struct kmem_cache *iscsi_conn_cache;
 struct kmem_cache *iscsi_sess_cache;
 
@@ -96,6 +111,10 @@ static void req_del_from_write_timeout_list(struct iscsi_cmnd *req)
 
 	list_del(&req->write_timeout_list_entry);
 	req->on_write_timeout_list = 0;
+	if (req->on_tm_wait_list) {
+		list_del(&req->tm_wait_list_entry);
+		req->on_tm_wait_list = 0;
+	}
 
 out_unlock:
 	spin_unlock_bh(&conn->write_list_lock);
@@ -313,6 +332,7 @@ void iscsi_cmnd_init(struct iscsi_conn *conn, struct iscsi_cmnd *cmnd,
 
 		INIT_LIST_HEAD(&cmnd->rsp_cmd_list);
 		INIT_LIST_HEAD(&cmnd->rx_ddigest_cmd_list);
+		INIT_LIST_HEAD(&cmnd->itt_hash_list_entry);
 		cmnd->target_task_tag = ISCSI_RESERVED_TAG_CPU32;
 
 		spin_lock_bh(&conn->cmd_list_lock);
@@ -427,6 +447,7 @@ void cmnd_done(struct iscsi_cmnd *cmnd)
 
 		spin_lock_bh(&conn->cmd_list_lock);
 		list_del(&cmnd->cmd_list_entry);
+		list_del(&cmnd->itt_hash_list_entry);
 		spin_unlock_bh(&conn->cmd_list_lock);
 
 		conn_put(conn);
@@ -520,6 +541,12 @@ void cmnd_done(struct iscsi_cmnd *cmnd)
 
 		EXTRACHECKS_BUG_ON(cmnd->dec_active_cmds);
 
+		if (cmnd->tx_inflight_bytes) {
+			atomic_long_sub(cmnd->tx_inflight_bytes,
+					&cmnd->conn->tx_inflight_bytes);
+			cmnd->tx_inflight_bytes = 0;
+		}
+
 		if (cmnd == parent->main_rsp) {
 			TRACE_DBG("Finishing main rsp %p (req %p)",
 				  cmnd, parent);
@@ -772,18 +799,6 @@ static void iscsi_cmnds_init_write(struct list_head *send, int flags)
 
 	sBUG_ON(list_empty(send));
 
-	if (!(conn->ddigest_type & DIGEST_NONE)) {
-		list_for_each(pos, send) {
-			rsp = list_entry(pos, struct iscsi_cmnd, write_list_entry);
-
-			if (rsp->pdu.datasize != 0) {
-				TRACE_DBG("Doing data digest (%p:%x)",
-					  rsp, cmnd_opcode(rsp));
-				digest_tx_data(rsp);
-			}
-		}
-	}
-
 	spin_lock_bh(&conn->write_list_lock);
 	list_for_each_safe(pos, next, send) {
 		rsp = list_entry(pos, struct iscsi_cmnd, write_list_entry);
@@ -1241,10 +1256,16 @@ out:
 	return res;
 }
 
+/* Called under sn_lock */
 static inline int iscsi_get_allowed_cmds(struct iscsi_session *sess)
 {
-	int res = max(-1,
-		      (int)sess->tgt_params.queued_cmnds - atomic_read(&sess->active_cmds) - 1);
+	int window = sess->tgt_params.queued_cmnds;
+	int res;
+
+	if (iscsi_adaptive_cmd_window && sess->cmd_window)
+		window = min_t(int, window, sess->cmd_window);
+
+	res = max(-1, window - atomic_read(&sess->active_cmds) - 1);
 
 	TRACE_DBG("allowed cmds %d (sess %p, active_cmds %d)", res,
 		  sess, atomic_read(&sess->active_cmds));
@@ -1273,6 +1294,78 @@ __be32 cmnd_set_sn(struct iscsi_cmnd *cmnd, int set_stat_sn)
 }
 EXPORT_SYMBOL(cmnd_set_sn);
 
+/*
+ * Adaptive command window: once per window of completed commands the
+ * window shrinks by a quarter if the average execution latency got much
+ * higher than the lowest seen or SGV allocations failed on scst_max_cmd_mem,
+ * and grows by an eighth if the latency is close to the lowest. So slow
+ * backends get short queues and fast ones the full queued_cmnds window.
+ */
+#define ISCSI_CMD_WINDOW_MIN		4
+/* Latency jitter that is never taken as congestion */
+#define ISCSI_CMD_WINDOW_LAT_SLACK_NS	(100 * NSEC_PER_USEC)
+
+/*
+ * Only READ and WRITE type commands go to the backend media, so only their
+ * latency is sampled. Otherwise e.g. TEST UNIT READY or INQUIRY would pull
+ * the latency base far below what any media access can reach.
+ */
+static bool iscsi_cmd_window_sample(struct scst_cmd *scst_cmd)
+{
+	scst_data_direction dir = scst_cmd_get_data_direction(scst_cmd);
+
+	return (dir == SCST_DATA_READ || dir == SCST_DATA_WRITE) &&
+	       !(scst_cmd->op_flags & SCST_LBA_NOT_VALID) &&
+	       scst_cmd_get_bufflen(scst_cmd) != 0;
+}
+
+static void iscsi_cmd_window_update(struct iscsi_session *sess, u64 lat)
+{
+	unsigned int max_window = sess->tgt_params.queued_cmnds;
+	unsigned int window, sgv_failures;
+	u64 base, avg;
+
+	spin_lock(&sess->sn_lock);
+
+	window = min(sess->cmd_window ? : max_window, max_window);
+
+	base = sess->cmd_lat_base_ns;
+	if (base == 0 || lat < base)
+		base = lat;
+	else
+		/* Let the base follow a lasting change of the backend slowly */
+		base += (lat - base) >> 10;
+	sess->cmd_lat_base_ns = base;
+
+	avg = sess->cmd_lat_avg_ns;
+	avg = avg ? avg - (avg >> 3) + (lat >> 3) : lat;
+	sess->cmd_lat_avg_ns = avg;
+
+	if (++sess->cmd_window_compl < window)
+		goto out_unlock;
+
+	sess->cmd_window_compl = 0;
+
+	sgv_failures = sgv_hiwmk_failures();
+	if (sgv_failures != sess->cmd_window_sgv_failures ||
+	    avg > 2 * base + ISCSI_CMD_WINDOW_LAT_SLACK_NS) {
+		sess->cmd_window_sgv_failures = sgv_failures;
+		window = max(window - window / 4,
+			     min_t(unsigned int, ISCSI_CMD_WINDOW_MIN, max_window));
+		sess->cmd_window_shrinks++;
+	} else if (avg < base + base / 2 + ISCSI_CMD_WINDOW_LAT_SLACK_NS) {
+		window = min(window + window / 8 + 1, max_window);
+	}
+
+	TRACE_DBG("sess %p: window %u, latency base %llu, avg %llu", sess,
+		  window, base, avg);
+
+	sess->cmd_window = window;
+
+out_unlock:
+	spin_unlock(&sess->sn_lock);
+}
+
 /* Called under sn_lock */
 static void update_stat_sn(struct iscsi_cmnd *cmnd)
 {
@@ -1291,17 +1384,50 @@ static void update_stat_sn(struct iscsi_cmnd *cmnd)
 	}
 }
 
-static struct iscsi_cmnd *cmnd_find_itt_get(struct iscsi_conn *conn, __be32 itt)
+/*
+ * Adds a request, whose BHS has just been received, to the ITT hash of its
+ * connection. Requests with the same ITT, like a command and its Data-Out
+ * PDUs, stay in the receive order.
+ */
+static void cmnd_insert_itt_hash(struct iscsi_cmnd *cmnd)
 {
-	struct iscsi_cmnd *cmnd, *found_cmnd = NULL;
+	struct iscsi_conn *conn = cmnd->conn;
 
 	spin_lock_bh(&conn->cmd_list_lock);
-	list_for_each_entry(cmnd, &conn->cmd_list, cmd_list_entry) {
-		if (cmnd->pdu.bhs.itt == itt && !cmnd_get_check(cmnd)) {
-			found_cmnd = cmnd;
-			break;
-		}
+	list_add_tail(&cmnd->itt_hash_list_entry,
+		      &conn->itt_hash[cmnd_hashfn((__force u32)cmnd->pdu.bhs.itt)]);
+	spin_unlock_bh(&conn->cmd_list_lock);
+}
+
+/* Must be called under cmd_list_lock */
+static struct iscsi_cmnd *__cmnd_find_itt(struct iscsi_conn *conn, __be32 itt,
+					  struct iscsi_cmnd *cmnd_to_find)
+{
+	struct list_head *head;
+	struct iscsi_cmnd *cmnd;
+
+	lockdep_assert_held(&conn->cmd_list_lock);
+
+	head = &conn->itt_hash[cmnd_hashfn((__force u32)itt)];
+
+	conn->itt_lookups++;
+	list_for_each_entry(cmnd, head, itt_hash_list_entry) {
+		conn->itt_lookup_cmnds++;
+		if (cmnd->pdu.bhs.itt != itt)
+			continue;
+		if (cmnd_to_find ? cmnd == cmnd_to_find : !cmnd_get_check(cmnd))
+			return cmnd;
 	}
+
+	return NULL;
+}
+
+static struct iscsi_cmnd *cmnd_find_itt_get(struct iscsi_conn *conn, __be32 itt)
+{
+	struct iscsi_cmnd *found_cmnd;
+
+	spin_lock_bh(&conn->cmd_list_lock);
+	found_cmnd = __cmnd_find_itt(conn, itt, NULL);
 	spin_unlock_bh(&conn->cmd_list_lock);
 
 	return found_cmnd;
@@ -1640,12 +1766,20 @@ out:
 	return res;
 }
 
+static int iscsi_tcp_receive_data_out(struct iscsi_cmnd *data_out,
+				      struct iscsi_cmnd *orig_req, u32 offset)
+{
+	return cmnd_prepare_recv_pdu(data_out->conn, orig_req, offset,
+				     data_out->pdu.datasize);
+}
+
 static void send_r2t(struct iscsi_cmnd *req)
 {
 	struct iscsi_session *sess = req->conn->session;
 	struct iscsi_cmnd *rsp;
 	struct iscsi_r2t_hdr *rsp_hdr;
 	u32 offset, burst;
+	unsigned int max_r2t;
 	LIST_HEAD(send);
 
 	TRACE_ENTRY();
@@ -1664,11 +1798,28 @@ static void send_r2t(struct iscsi_cmnd *req)
 	 * called here.
 	 */
 
-	EXTRACHECKS_BUG_ON(req->outstanding_r2t >
-			   sess->sess_params.max_outstanding_r2t);
+	/*
+	 * MaxOutstandingR2T doesn't include the implied initial R2T of the
+	 * unsolicited data, so R2Ts for the rest of the data can be sent
+	 * while the unsolicited data are still being received.
+	 */
+	max_r2t = sess->sess_params.max_outstanding_r2t +
+		  req->unsolicited_data_pending;
+
+	EXTRACHECKS_BUG_ON(req->outstanding_r2t > max_r2t);
 
-	if (req->outstanding_r2t == sess->sess_params.max_outstanding_r2t)
+	if (req->outstanding_r2t == max_r2t) {
+		if (req->r2t_stall_start_ns == 0)
+			req->r2t_stall_start_ns = ktime_to_ns(ktime_get());
 		goto out;
+	}
+
+	if (req->r2t_stall_start_ns != 0) {
+		atomic64_inc(&sess->r2t_stalls);
+		atomic64_add(ktime_to_ns(ktime_get()) - req->r2t_stall_start_ns,
+			     &sess->r2t_stall_ns);
+		req->r2t_stall_start_ns = 0;
+	}
 
 	burst = sess->sess_params.max_burst_length;
 	offset = be32_to_cpu(cmnd_hdr(req)->data_length) -
@@ -1703,8 +1854,10 @@ static void send_r2t(struct iscsi_cmnd *req)
 		list_add_tail(&rsp->write_list_entry, &send);
 		req->outstanding_r2t++;
 
-	} while (req->outstanding_r2t < sess->sess_params.max_outstanding_r2t &&
-		 req->r2t_len_to_send != 0);
+	} while (req->outstanding_r2t < max_r2t && req->r2t_len_to_send != 0);
+
+	if (req->r2t_len_to_send != 0)
+		req->r2t_stall_start_ns = ktime_to_ns(ktime_get());
 
 	iscsi_cmnds_init_write(&send, ISCSI_INIT_WRITE_WAKE);
 
@@ -1722,6 +1875,9 @@ static int iscsi_pre_exec(struct scst_cmd *scst_cmd)
 
 	EXTRACHECKS_BUG_ON(scst_cmd_atomic(scst_cmd));
 
+	if (iscsi_adaptive_cmd_window && iscsi_cmd_window_sample(scst_cmd))
+		req->exec_start_ns = ktime_to_ns(ktime_get());
+
 	/* If data digest isn't used this list will be empty */
 	list_for_each_entry_safe(c, t, &req->rx_ddigest_cmd_list, rx_ddigest_cmd_list_entry) {
 		TRACE_DBG("Checking digest of RX ddigest cmd %p", c);
@@ -1877,6 +2033,7 @@ int iscsi_cmnd_set_write_buf(struct iscsi_cmnd *req)
 
 	if (unsolicited_data_expected) {
 		req->outstanding_r2t = 1;
+		req->unsolicited_data_pending = 1;
 		req->r2t_len_to_send = req->r2t_len_to_receive -
 			min_t(unsigned int,
 			      session->sess_params.first_burst_length - req->pdu.datasize,
@@ -1936,12 +2093,15 @@ int cmnd_rx_continue(struct iscsi_cmnd *req)
 			goto out_close;
 		}
 
-		if (req->pdu.datasize) {
+		if (req->pdu.datasize)
 			res = cmnd_prepare_recv_pdu(conn, req, 0, req->pdu.datasize);
-			/* For performance better to send R2Ts ASAP */
-			if (likely(res == 0) && req->r2t_len_to_send != 0)
-				send_r2t(req);
-		}
+		/*
+		 * For performance better to send R2Ts ASAP, i.e. already
+		 * while the immediate and unsolicited data are being received.
+		 * The data buffer has just been allocated.
+		 */
+		if (likely(res == 0) && req->r2t_len_to_send != 0)
+			send_r2t(req);
 	} else {
 		req->sg = scst_cmd_get_sg(scst_cmd);
 		req->sg_cnt = scst_cmd_get_sg_cnt(scst_cmd);
@@ -2026,6 +2186,10 @@ static int scsi_cmnd_start(struct iscsi_cmnd *req)
 	} else if (req_hdr->flags & ISCSI_CMD_WRITE) {
 		dir = SCST_DATA_WRITE;
 		scst_cmd_set_expected(scst_cmd, dir, be32_to_cpu(req_hdr->data_length));
+		if (conn->transport->iscsit_alloc_imm_data_buf &&
+		    (req_hdr->flags & ISCSI_CMD_FINAL) &&
+		    req->pdu.datasize == be32_to_cpu(req_hdr->data_length))
+			scst_cmd_set_tgt_need_alloc_data_buf(scst_cmd);
 	} else {
 		dir = SCST_DATA_NONE;
 		scst_cmd_set_expected(scst_cmd, dir, 0);
@@ -2166,8 +2330,11 @@ static int data_out_start(struct iscsi_cmnd *cmnd)
 #endif
 
 go:
-	if (req_hdr->flags & ISCSI_FLG_FINAL)
+	if (req_hdr->flags & ISCSI_FLG_FINAL) {
 		orig_req->outstanding_r2t--;
+		if (req_hdr->ttt == ISCSI_RESERVED_TAG)
+			orig_req->unsolicited_data_pending = 0;
+	}
 
 	EXTRACHECKS_BUG_ON(orig_req->data_out_in_data_receiving);
 	orig_req->data_out_in_data_receiving = 1;
@@ -2178,8 +2345,8 @@ go:
 	if (unlikely(orig_req->prelim_compl_flags != 0))
 		res = iscsi_preliminary_complete(cmnd, orig_req, true);
 	else
-		res = cmnd_prepare_recv_pdu(conn, orig_req, offset,
-					    cmnd->pdu.datasize);
+		res = conn->transport->iscsit_receive_data_out(cmnd, orig_req,
+							       offset);
 
 out:
 	TRACE_EXIT_RES(res);
@@ -2299,6 +2466,11 @@ static void __cmnd_abort(struct iscsi_cmnd *cmnd)
 	TRACE_MGMT_DBG("Setting conn_tm_active for conn %p", conn);
 	conn->conn_tm_active = 1;
 
+	/* write_list_lock is an inner lock for rd_lock */
+	spin_lock(&conn->write_list_lock);
+	req_add_to_tm_wait_list(cmnd);
+	spin_unlock(&conn->write_list_lock);
+
 	spin_unlock_bh(&conn->conn_thr_pool->rd_lock);
 
 	/*
@@ -2437,19 +2609,17 @@ static void iscsi_cmnd_abort_fn(struct work_struct *work)
 	/*
 	 * cmnd pointer is valid only under cmd_list_lock, but we can't know the
 	 * corresponding conn without dereferencing cmnd at first, so let's
-	 * check all conns and cmnds to find out if our cmnd is still valid
-	 * under lock.
+	 * check all conns to find out if our cmnd is still valid under lock.
+	 * The tag of scst_cmd is the ITT of cmnd, so only its hash bucket needs
+	 * to be checked.
 	 */
 	list_for_each_entry(conn, &session->conn_list, conn_list_entry) {
-		struct iscsi_cmnd *c;
-
 		spin_lock_bh(&conn->cmd_list_lock);
-		list_for_each_entry(c, &conn->cmd_list, cmd_list_entry) {
-			if (c == cmnd) {
-				__cmnd_abort(cmnd);
-				done = true;
-				break;
-			}
+		if (__cmnd_find_itt(conn,
+				    (__force __be32)(u32)scst_cmd_get_tag(scst_cmd),
+				    cmnd)) {
+			__cmnd_abort(cmnd);
+			done = true;
 		}
 		spin_unlock_bh(&conn->cmd_list_lock);
 		if (done)
@@ -2803,18 +2973,6 @@ out:
 	TRACE_EXIT();
 }
 
-static inline void set_cork(struct socket *sock, int on)
-{
-	int opt = on;
-	mm_segment_t oldfs;
-
-	oldfs = get_fs();
-	set_fs(KERNEL_DS);
-	sock->ops->setsockopt(sock, SOL_TCP, TCP_CORK,
-			      KERNEL_SOCKPTR(&opt), sizeof(opt));
-	set_fs(oldfs);
-}
-
 void cmnd_tx_start(struct iscsi_cmnd *cmnd)
 {
 	struct iscsi_conn *conn = cmnd->conn;
@@ -2824,8 +2982,6 @@ void cmnd_tx_start(struct iscsi_cmnd *cmnd)
 
 	iscsi_extracheck_is_wr_thread(conn);
 
-	set_cork(conn->sock, 1);
-
 	conn->write_iop = conn->write_iov;
 	conn->write_iop->iov_base = &cmnd->pdu.bhs;
 	conn->write_iop->iov_len = sizeof(cmnd->pdu.bhs);
@@ -2929,8 +3085,6 @@ void cmnd_tx_end(struct iscsi_cmnd *cmnd)
 			mark_conn_closed(conn);
 		}
 	}
-
-	set_cork(cmnd->conn->sock, 0);
 }
 
 /*
@@ -3098,6 +3252,8 @@ int cmnd_rx_start(struct iscsi_cmnd *cmnd)
 
 	iscsi_dump_pdu(&cmnd->pdu);
 
+	cmnd_insert_itt_hash(cmnd);
+
 	res = check_segment_length(cmnd);
 	if (res != 0)
 		goto out;
@@ -3204,16 +3360,25 @@ static ssize_t iscsi_tcp_get_initiator_ip(struct iscsi_conn *conn, char *buf, in
 
 static int iscsi_alloc_data_buf(struct scst_cmd *cmd)
 {
+	if (!(scst_cmd_get_data_direction(cmd) & SCST_DATA_READ)) {
+		struct iscsi_cmnd *req = scst_cmd_get_tgt_priv(cmd);
+
+		/* All the data came as immediate data, see scsi_cmnd_start() */
+		return req->conn->transport->iscsit_alloc_imm_data_buf(req);
+	}
+
 	/*
 	 * sock->ops->sendpage() is async zero copy operation,
 	 * so we must be sure not to free and reuse
 	 * the command's buffer before the sending was completed
 	 * by the network layers. It is possible only if we
 	 * don't use SGV cache.
+	 *
+	 * With tx_zerocopy the command isn't done until the MSG_ZEROCOPY
+	 * completion arrives, so the SGV cache can be used.
 	 */
-	EXTRACHECKS_BUG_ON(!(scst_cmd_get_data_direction(cmd) &
-			     SCST_DATA_READ));
-	scst_cmd_set_no_sgv(cmd);
+	if (!iscsi_tx_zerocopy)
+		scst_cmd_set_no_sgv(cmd);
 	return 1;
 }
 
@@ -3375,10 +3540,27 @@ static int iscsi_xmit_response(struct scst_cmd *scst_cmd)
 
 	scst_cmd_set_tgt_priv(scst_cmd, NULL);
 
+	if (req->exec_start_ns != 0) {
+		iscsi_cmd_window_update(conn->session,
+			ktime_to_ns(ktime_get()) - req->exec_start_ns);
+		req->exec_start_ns = 0;
+	}
+
 	EXTRACHECKS_BUG_ON(req->scst_state != ISCSI_CMD_STATE_RESTARTED);
 
-	if (unlikely(scst_cmd_aborted_on_xmit(scst_cmd)))
+	if (unlikely(scst_cmd_aborted_on_xmit(scst_cmd))) {
+		/*
+		 * Same as in __cmnd_abort(): iscsi_check_tm_data_wait_timeouts()
+		 * only looks at tm_wait_list, so req must be put there if it
+		 * is still waiting for data.
+		 */
+		spin_lock_bh(&conn->conn_thr_pool->rd_lock);
 		set_bit(ISCSI_CMD_ABORTED, &req->prelim_compl_flags);
+		spin_lock(&conn->write_list_lock);
+		req_add_to_tm_wait_list(req);
+		spin_unlock(&conn->write_list_lock);
+		spin_unlock_bh(&conn->conn_thr_pool->rd_lock);
+	}
 
 	if (unlikely(req->prelim_compl_flags != 0)) {
 		if (test_bit(ISCSI_CMD_ABORTED, &req->prelim_compl_flags)) {
@@ -3673,7 +3855,6 @@ static int iscsi_scsi_aen(struct scst_aen *aen)
 	int sense_len = scst_aen_get_sense_len(aen);
 	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_aen_get_sess(aen));
 	struct iscsi_conn *conn;
-	bool found;
 	struct iscsi_cmnd *fake_req, *rsp;
 	struct iscsi_async_msg_hdr *rsp_hdr;
 
@@ -3684,15 +3865,9 @@ static int iscsi_scsi_aen(struct scst_aen *aen)
 
 	mutex_lock(&sess->target->target_mutex);
 
-	found = false;
-	list_for_each_entry_reverse(conn, &sess->conn_list, conn_list_entry) {
-		if (!test_bit(ISCSI_CONN_SHUTTINGDOWN, &conn->conn_aflags) &&
-		    !conn->conn_reinst_successor) {
-			found = true;
-			break;
-		}
-	}
-	if (!found) {
+	/* Async messages may be sent on any conn, so pick the least busy */
+	conn = iscsi_sess_select_conn(sess);
+	if (!conn) {
 		TRACE_MGMT_DBG("Unable to find alive conn for sess %p", sess);
 		goto out_err_unlock;
 	}
@@ -3998,12 +4173,27 @@ static struct iscsit_transport iscsi_tcp_transport = {
 	.iscsit_set_sense_data = iscsi_tcp_set_sense_data,
 	.iscsit_set_req_data = iscsi_tcp_set_req_data,
 	.iscsit_receive_cmnd_data = cmnd_rx_continue,
+	.iscsit_receive_data_out = iscsi_tcp_receive_data_out,
 };
 
-static void __iscsi_threads_pool_put(struct iscsi_thread_pool *p)
+/* Stop and free all threads of pool @p */
+static void iscsi_stop_pool_threads(struct iscsi_thread_pool *p)
 {
 	struct iscsi_thread *t, *tt;
 
+	mutex_lock(&p->tp_mutex);
+	list_for_each_entry_safe(t, tt, &p->threads_list, threads_list_entry) {
+		kthread_stop(t->thr);
+		list_del(&t->threads_list_entry);
+		kfree(t);
+	}
+	mutex_unlock(&p->tp_mutex);
+}
+
+static void __iscsi_threads_pool_put(struct iscsi_thread_pool *p)
+{
+	int i;
+
 	TRACE_ENTRY();
 
 	p->thread_pool_ref--;
@@ -4015,13 +4205,13 @@ static void __iscsi_threads_pool_put(struct iscsi_thread_pool *p)
 
 	TRACE_DBG("Freeing iSCSI thread pool %p", p);
 
-	mutex_lock(&p->tp_mutex);
-	list_for_each_entry_safe(t, tt, &p->threads_list, threads_list_entry) {
-		kthread_stop(t->thr);
-		list_del(&t->threads_list_entry);
-		kfree(t);
+	iscsi_stop_pool_threads(p);
+
+	for (i = 0; i < p->nr_affine_pools; i++) {
+		iscsi_stop_pool_threads(p->affine_pools[i]);
+		kmem_cache_free(iscsi_thread_pool_cache, p->affine_pools[i]);
 	}
-	mutex_unlock(&p->tp_mutex);
+	kfree(p->affine_pools);
 
 	list_del(&p->thread_pools_list_entry);
 
@@ -4042,13 +4232,195 @@ void iscsi_threads_pool_put(struct iscsi_thread_pool *p)
 	TRACE_EXIT();
 }
 
+static void iscsi_init_thread_pool(struct iscsi_thread_pool *p, bool dedicated,
+				   const cpumask_t *cpu_mask, int pool_id)
+{
+	spin_lock_init(&p->rd_lock);
+	INIT_LIST_HEAD(&p->rd_list);
+	init_waitqueue_head(&p->rd_waitQ);
+	spin_lock_init(&p->wr_lock);
+	INIT_LIST_HEAD(&p->wr_list);
+	init_waitqueue_head(&p->wr_waitQ);
+	if (!cpu_mask)
+		cpumask_setall(&p->cpu_mask);
+	else
+		cpumask_copy(&p->cpu_mask, cpu_mask);
+	p->pool_id = pool_id;
+	p->affine_cpu = -1;
+	atomic_set(&p->nr_conns, 0);
+	p->thread_pool_ref = 1;
+	mutex_init(&p->tp_mutex);
+	INIT_LIST_HEAD(&p->threads_list);
+	p->dedicated = dedicated;
+}
+
+/*
+ * Start @count read and @count write threads for pool @p. The threads are
+ * numbered starting from @first.
+ */
+static int iscsi_start_pool_threads(struct iscsi_thread_pool *p, int count,
+				    int first)
+{
+	struct iscsi_thread *t;
+	int i, j, res = 0;
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < count; i++) {
+			t = kmalloc(sizeof(*t), GFP_KERNEL);
+			if (!t) {
+				res = -ENOMEM;
+				PRINT_ERROR("Failed to allocate thread (size %zd)",
+					    sizeof(*t));
+				goto out;
+			}
+
+			t->thr = kthread_run(j ? istwr : istrd, p,
+					     "iscsi%s%d_%d", j ? "wr" : "rd",
+					     p->pool_id, first + i);
+			if (IS_ERR(t->thr)) {
+				res = PTR_ERR(t->thr);
+				PRINT_ERROR("kthread_run() failed: %d", res);
+				kfree(t);
+				goto out;
+			}
+
+			mutex_lock(&p->tp_mutex);
+			list_add_tail(&t->threads_list_entry, &p->threads_list);
+			mutex_unlock(&p->tp_mutex);
+		}
+	}
+
+out:
+	return res;
+}
+
+/*
+ * Create one pool with a single read and a single write thread for each
+ * online CPU in the CPU mask of @p.
+ */
+static int iscsi_create_affine_pools(struct iscsi_thread_pool *p)
+{
+	struct iscsi_thread_pool *ap;
+	int cpu, res = 0;
+
+	p->affine_pools = kcalloc(cpumask_weight(&p->cpu_mask),
+				  sizeof(*p->affine_pools), GFP_KERNEL);
+	if (!p->affine_pools) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	for_each_cpu_and(cpu, &p->cpu_mask, cpu_online_mask) {
+		ap = kmem_cache_zalloc(iscsi_thread_pool_cache, GFP_KERNEL);
+		if (!ap) {
+			PRINT_ERROR("Unable to allocate iSCSI thread pool (size %zd)",
+				    sizeof(*ap));
+			res = -ENOMEM;
+			goto out;
+		}
+		iscsi_init_thread_pool(ap, false, cpumask_of(cpu), p->pool_id);
+		ap->affine_cpu = cpu;
+		p->affine_pools[p->nr_affine_pools++] = ap;
+
+		res = iscsi_start_pool_threads(ap, 1, cpu);
+		if (res != 0)
+			goto out;
+	}
+
+out:
+	return res;
+}
+
+/**
+ * iscsi_select_thread_pool() - Select the thread pool for a connection.
+ * @p: Thread pool of the session the connection belongs to.
+ * @sk: Socket of the connection.
+ *
+ * In connection affinity mode returns the affine pool bound to the CPU that
+ * processes the receive traffic of @sk, i.e. the CPU on which
+ * iscsi_data_ready() runs. If that CPU is not known or is not served by any
+ * affine pool, the receive queue of @sk is used to spread connections over
+ * the affine pools and, if not known either, the least loaded affine pool
+ * is selected. Otherwise returns @p.
+ */
+struct iscsi_thread_pool *iscsi_select_thread_pool(struct iscsi_thread_pool *p,
+						   struct sock *sk)
+{
+	struct iscsi_thread_pool *ap, *res = NULL;
+	int i, cpu = -1, rxq = -1;
+
+	if (p->nr_affine_pools == 0) {
+		res = p;
+		goto out;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	cpu = READ_ONCE(sk->sk_incoming_cpu);
+#endif
+	for (i = 0; i < p->nr_affine_pools && cpu >= 0; i++) {
+		if (p->affine_pools[i]->affine_cpu == cpu) {
+			res = p->affine_pools[i];
+			goto out_get;
+		}
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0)
+	rxq = sk_rx_queue_get(sk);
+#endif
+	if (rxq >= 0) {
+		res = p->affine_pools[rxq % p->nr_affine_pools];
+		goto out_get;
+	}
+
+	for (i = 0; i < p->nr_affine_pools; i++) {
+		ap = p->affine_pools[i];
+		if (!res || atomic_read(&ap->nr_conns) <
+			    atomic_read(&res->nr_conns))
+			res = ap;
+	}
+
+out_get:
+	TRACE_DBG("Selected iSCSI thread pool %p (CPU %d) for sk %p (incoming CPU %d, RX queue %d)",
+		  res, res->affine_cpu, sk, cpu, rxq);
+
+out:
+	atomic_inc(&res->nr_conns);
+	return res;
+}
+
+/* Report the load statistics of all iSCSI thread pools. */
+ssize_t iscsi_thread_pools_stats_show(char *buf)
+{
+	struct iscsi_thread_pool *p, *ap;
+	ssize_t ret = 0;
+	int i;
+
+	mutex_lock(&iscsi_threads_pool_mutex);
+	list_for_each_entry(p, &iscsi_thread_pools_list, thread_pools_list_entry) {
+		ret += sysfs_emit_at(buf, ret, "%d - %d %lu %lu\n", p->pool_id,
+				     atomic_read(&p->nr_conns),
+				     READ_ONCE(p->rd_io_count),
+				     READ_ONCE(p->wr_io_count));
+		for (i = 0; i < p->nr_affine_pools; i++) {
+			ap = p->affine_pools[i];
+			ret += sysfs_emit_at(buf, ret, "%d %d %d %lu %lu\n",
+					     ap->pool_id, ap->affine_cpu,
+					     atomic_read(&ap->nr_conns),
+					     READ_ONCE(ap->rd_io_count),
+					     READ_ONCE(ap->wr_io_count));
+		}
+	}
+	mutex_unlock(&iscsi_threads_pool_mutex);
+
+	return ret;
+}
+
 int iscsi_threads_pool_get(bool dedicated, const cpumask_t *cpu_mask,
 			   struct iscsi_thread_pool **out_pool)
 {
 	int res;
 	struct iscsi_thread_pool *p;
-	struct iscsi_thread *t;
-	int i, j, count;
+	int i, count;
 	static int major; /* Protected by iscsi_threads_pool_mutex */
 
 	TRACE_ENTRY();
@@ -4090,20 +4462,7 @@ create:
 		goto out_unlock;
 	}
 
-	spin_lock_init(&p->rd_lock);
-	INIT_LIST_HEAD(&p->rd_list);
-	init_waitqueue_head(&p->rd_waitQ);
-	spin_lock_init(&p->wr_lock);
-	INIT_LIST_HEAD(&p->wr_list);
-	init_waitqueue_head(&p->wr_waitQ);
-	if (!cpu_mask)
-		cpumask_setall(&p->cpu_mask);
-	else
-		cpumask_copy(&p->cpu_mask, cpu_mask);
-	p->thread_pool_ref = 1;
-	mutex_init(&p->tp_mutex);
-	INIT_LIST_HEAD(&p->threads_list);
-	p->dedicated = dedicated;
+	iscsi_init_thread_pool(p, dedicated, cpu_mask, major);
 
 	if (dedicated) {
 		count = 1;
@@ -4117,36 +4476,23 @@ create:
 
 	list_add_tail(&p->thread_pools_list_entry, &iscsi_thread_pools_list);
 
-	for (j = 0; j < 2; j++) {
-		for (i = 0; i < count; i++) {
-			t = kmalloc(sizeof(*t), GFP_KERNEL);
-			if (!t) {
-				res = -ENOMEM;
-				PRINT_ERROR("Failed to allocate thread (size %zd)",
-					    sizeof(*t));
-				goto out_free;
-			}
-
-			t->thr = kthread_run(j ? istwr : istrd, p,
-					     "iscsi%s%d_%d", j ? "wr" : "rd",
-					     major, i);
-			if (IS_ERR(t->thr)) {
-				res = PTR_ERR(t->thr);
-				PRINT_ERROR("kthread_run() failed: %d", res);
-				kfree(t);
-				goto out_free;
-			}
+	if (conn_thread_affinity && !dedicated) {
+		res = iscsi_create_affine_pools(p);
+		if (res != 0)
+			goto out_free;
+	}
 
-			mutex_lock(&p->tp_mutex);
-			list_add_tail(&t->threads_list_entry, &p->threads_list);
-			mutex_unlock(&p->tp_mutex);
-		}
+	if (p->nr_affine_pools == 0) {
+		res = iscsi_start_pool_threads(p, count, 0);
+		if (res != 0)
+			goto out_free;
 	}
 
 	major++;
 	res = 0;
 
-	TRACE_DBG("Created iSCSI thread pool %p", p);
+	TRACE_DBG("Created iSCSI thread pool %p (%d affine pools)", p,
+		  p->nr_affine_pools);
 
 out_unlock:
 	mutex_unlock(&iscsi_threads_pool_mutex);
@@ -4168,6 +4514,13 @@ static int __init iscsi_init(void)
 
 	PRINT_INFO("iSCSI SCST Target - version %s", ISCSI_VERSION_STRING);
 
+#ifndef ISCSI_TX_ZEROCOPY
+	if (iscsi_tx_zerocopy) {
+		PRINT_WARNING("tx_zerocopy isn't supported by this kernel, ignoring it");
+		iscsi_tx_zerocopy = false;
+	}
+#endif
+
 	err = iscsit_reg_transport(&iscsi_tcp_transport);
 	if (err)
 		goto out;
@@ -91,6 +91,29 @@ struct iscsi_thread_pool {
 	cpumask_t cpu_mask;
 	bool dedicated;
 
+	/* Pool number, used in the thread names */
+	int pool_id;
+
+	/*
+	 * CPU the threads of this pool are bound to if this is one of the
+	 * affine_pools of another pool, -1 otherwise.
+	 */
+	int affine_cpu;
+
+	/*
+	 * In connection affinity mode connections do not share rd_list and
+	 * wr_list of this pool. Instead, each connection is assigned to one
+	 * of these pools, each served by a single read and a single write
+	 * thread bound to one CPU. Set at pool creation time.
+	 */
+	int nr_affine_pools;
+	struct iscsi_thread_pool **affine_pools;
+
+	/* Load statistics */
+	atomic_t nr_conns;
+	unsigned long rd_io_count; /* protected by rd_lock */
+	unsigned long wr_io_count; /* protected by wr_lock */
+
 	int thread_pool_ref;
 
 	/* Entry in iscsi_thread_pools_list */
@@ -152,6 +175,24 @@ struct iscsi_session {
 	u32 tm_sn;
 	struct iscsi_cmnd *tm_rsp;
 
+	/*
+	 * Adaptive command window, see iscsi_cmd_window_update(). All
+	 * protected by sn_lock. cmd_window 0 means queued_cmnds.
+	 */
+	unsigned int cmd_window;
+	unsigned int cmd_window_compl;
+	unsigned int cmd_window_sgv_failures;
+	unsigned long cmd_window_shrinks;
+	u64 cmd_lat_base_ns;
+	u64 cmd_lat_avg_ns;
+
+	/*
+	 * Number of times and total time write commands waited for an R2T
+	 * because MaxOutstandingR2T was reached.
+	 */
+	atomic64_t r2t_stalls;
+	atomic64_t r2t_stall_ns;
+
 	/* Read only, if there are connection(s) */
 	struct iscsi_sess_params sess_params;
 
@@ -181,6 +222,14 @@ struct iscsi_session {
 
 #define ISCSI_CONN_IOV_MAX			(PAGE_SIZE / sizeof(struct kvec))
 
+/*
+ * MSG_ZEROCOPY transmit with a caller supplied struct ubuf_info, see
+ * write_data(). Needs msghdr based page sending.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define ISCSI_TX_ZEROCOPY
+#endif
+
 #define ISCSI_CONN_RD_STATE_IDLE		0
 #define ISCSI_CONN_RD_STATE_IN_LIST		1
 #define ISCSI_CONN_RD_STATE_PROCESSING		2
@@ -207,14 +256,34 @@ struct iscsi_conn {
 
 	/* Protected by cmd_list_lock */
 	struct list_head cmd_list; /* in/outcoming pdus */
+	/* Requests of cmd_list with a received BHS, hashed by ITT */
+	struct list_head itt_hash[1 << ISCSI_HASH_ORDER];
+	/* Number of ITT lookups and of requests examined by them */
+	unsigned long itt_lookups;
+	unsigned long itt_lookup_cmnds;
 
 	atomic_t conn_ref_cnt;
 
 	spinlock_t write_list_lock;
 	/* List of data pdus to be sent. Protected by write_list_lock */
 	struct list_head write_list;
-	/* List of data pdus being sent. Protected by write_list_lock */
+	/*
+	 * Bytes of the PDUs queued on write_list that haven't been sent and
+	 * released by the network stack yet.
+	 */
+	atomic_long_t tx_inflight_bytes;
+	/*
+	 * Requests waiting for their responses to be sent or for data from
+	 * the initiator, one FIFO per timeout: write_timeout_list for the
+	 * response timeout and nop_timeout_list for Nop-In pings. So each
+	 * list is sorted by timeout time, only its first entry needs to be
+	 * checked and adding or deleting a request is O(1). tm_wait_list
+	 * links the aborted requests of both lists. All protected by
+	 * write_list_lock.
+	 */
 	struct list_head write_timeout_list;
+	struct list_head nop_timeout_list;
+	struct list_head tm_wait_list;
 
 	/* Protected by write_list_lock */
 	struct timer_list rsp_timer;
@@ -244,6 +313,18 @@ struct iscsi_conn {
 	u32 write_size;
 	u32 write_offset;
 	int write_state;
+	/*
+	 * Number of PDUs of the current batch, i.e. sent back to back with
+	 * MSG_MORE, and whether another PDU follows the current one.
+	 */
+	unsigned int tx_batch_pdus;
+	bool tx_more;
+	/* Number of batches of 1, 2-3, 4-7, ... PDUs */
+#define ISCSI_TX_BATCH_HIST_SIZE	6
+	unsigned long tx_batch_hist[ISCSI_TX_BATCH_HIST_SIZE];
+	/* CRC32C of the data sent so far and the offset it reaches */
+	u32 write_ddigest_crc;
+	u32 write_ddigest_offset;
 
 	/* Both don't need any protection */
 	struct file *file;
@@ -295,6 +376,9 @@ struct iscsi_conn {
 #endif
 	struct task_struct *rx_task;
 	uint32_t rpadding;
+	/* CRC32C of the data received so far, valid if rx_ddigest_fused */
+	u32 rx_ddigest_crc;
+	bool rx_ddigest_fused;
 
 	struct iscsi_target *target;
 
@@ -391,6 +475,11 @@ struct iscsi_cmnd {
 	 */
 	unsigned int data_out_in_data_receiving:1;
 	unsigned int force_release_done:1;
+	/*
+	 * Set while the unsolicited Data-Out burst, i.e. the implied initial
+	 * R2T, is outstanding.
+	 */
+	unsigned int unsolicited_data_pending:1;
 
 #ifdef CONFIG_SCST_EXTRACHECKS
 	unsigned int release_called:1;
@@ -444,9 +533,14 @@ struct iscsi_cmnd {
 		struct list_head write_timeout_list_entry;
 	};
 
-	/* Both protected by conn->write_list_lock */
+	/* All protected by conn->write_list_lock */
 	unsigned int on_write_timeout_list:1;
+	unsigned int on_tm_wait_list:1;
 	unsigned long write_start;
+	struct list_head tm_wait_list_entry;
+
+	/* Bytes accounted in conn->tx_inflight_bytes for this rsp */
+	unsigned int tx_inflight_bytes;
 
 	/*
 	 * All unprotected, since could be accessed from only a single
@@ -473,6 +567,12 @@ struct iscsi_cmnd {
 
 			struct iscsi_cmnd *main_rsp;
 
+			/* Set by iscsi_pre_exec() for the command window */
+			u64 exec_start_ns;
+
+			/* Since when send_r2t() waits for MaxOutstandingR2T */
+			u64 r2t_stall_start_ns;
+
 			/*
 			 * Protected on modify by conn->write_list_lock, hence
 			 * modified independently to the above field, hence the
@@ -503,7 +603,18 @@ struct iscsi_cmnd {
 	__be32 hdigest;
 	__be32 ddigest;
 
+#ifdef ISCSI_TX_ZEROCOPY
+	/*
+	 * Completion of the data sent with MSG_ZEROCOPY. Holds a reference
+	 * to this cmnd until the network stack has released all skbs
+	 * pointing to the data. Set up and used only by the write thread.
+	 */
+	struct ubuf_info tx_zc_ubuf;
+	bool tx_zc_used;
+#endif
+
 	struct list_head cmd_list_entry;
+	struct list_head itt_hash_list_entry;
 	struct list_head nop_req_list_entry;
 
 	unsigned int not_received_data_len;
@@ -550,11 +661,17 @@ int set_scst_preliminary_status_rsp(struct iscsi_cmnd *req, bool get_data, int k
 int iscsi_threads_pool_get(bool dedicated, const cpumask_t *cpu_mask,
 			   struct iscsi_thread_pool **out_pool);
 void iscsi_threads_pool_put(struct iscsi_thread_pool *p);
+struct iscsi_thread_pool *iscsi_select_thread_pool(struct iscsi_thread_pool *p,
+						   struct sock *sk);
+ssize_t iscsi_thread_pools_stats_show(char *buf);
+extern bool iscsi_tx_zerocopy;
+extern bool iscsi_adaptive_cmd_window;
 
 /* conn.c */
 extern struct kobj_type iscsi_conn_ktype;
 
 struct iscsi_conn *conn_lookup(struct iscsi_session *session, u16 cid);
+struct iscsi_conn *iscsi_sess_select_conn(struct iscsi_session *session);
 void conn_reinst_finished(struct iscsi_conn *conn);
 int __add_conn(struct iscsi_session *session, struct iscsi_kern_conn_info *info);
 int __del_conn(struct iscsi_session *session, struct iscsi_kern_conn_info *info);
@@ -570,6 +687,7 @@ void __iscsi_write_space_ready(struct iscsi_conn *conn);
 
 /* nthread.c */
 int iscsi_send(struct iscsi_conn *conn);
+ssize_t iscsi_tx_zerocopy_stats_show(char *buf);
 int istrd(void *arg);
 int istwr(void *arg);
 void iscsi_task_mgmt_affected_cmds_done(struct scst_mgmt_cmd *scst_mcmd);
@@ -709,6 +827,13 @@ static inline void cmd_add_on_write_list(struct iscsi_conn *conn, struct iscsi_c
 	list_add_tail(&cmnd->write_list_entry, &conn->write_list);
 	cmnd->on_write_list = 1;
 
+	if (!cmnd->tx_inflight_bytes) {
+		cmnd->tx_inflight_bytes = sizeof(struct iscsi_hdr) +
+			cmnd->pdu.ahssize + cmnd->pdu.datasize;
+		atomic_long_add(cmnd->tx_inflight_bytes,
+				&conn->tx_inflight_bytes);
+	}
+
 	parent->not_processed_rsp_cnt++;
 	TRACE_DBG("not processed rsp cnt %d (parent %p)",
 		  parent->not_processed_rsp_cnt, parent);
@@ -766,6 +891,15 @@ static inline unsigned long iscsi_get_timeout_time(struct iscsi_cmnd *req)
 	return req->write_start + iscsi_get_timeout(req);
 }
 
+/* Called under write_list_lock */
+static inline void req_add_to_tm_wait_list(struct iscsi_cmnd *req)
+{
+	if (req->on_write_timeout_list && !req->on_tm_wait_list) {
+		list_add_tail(&req->tm_wait_list_entry, &req->conn->tm_wait_list);
+		req->on_tm_wait_list = 1;
+	}
+}
+
 static inline int test_write_ready(struct iscsi_conn *conn)
 {
 	/*
@@ -79,6 +79,7 @@ enum isert_wr_op {
 	ISER_WR_SEND,
 	ISER_WR_RDMA_WRITE,
 	ISER_WR_RDMA_READ,
+	ISER_WR_SQ_FLUSH,
 };
 
 struct isert_device;
@@ -94,6 +95,7 @@ struct isert_wr {
 	struct isert_device	*isert_dev;
 
 	struct ib_sge		*sge_list;
+	u32			sq_seq; /* SQ posting order, see isert_post_send() */
 	union {
 		struct ib_recv_wr recv_wr;
 #ifdef USE_PRE_440_WR_STRUCTURE
@@ -109,6 +111,19 @@ struct isert_wr {
 
 #define ISER_MIN_SQ_SIZE	16
 
+/*
+ * Only every ISER_SEND_SIGNAL_INTERVAL'th SCSI response SEND is posted
+ * signaled, the ones in between are retired when a later send queue
+ * completion arrives.
+ */
+#define ISER_SEND_SIGNAL_INTERVAL	16
+
+/* Max number of work completions handled per CQ work invocation */
+#define ISER_CQ_POLL_BUDGET	(4 * ISER_SQ_SIZE)
+
+/* Enough for the headers and ISCSI_LOGIN_MAX_RDSL of data */
+#define ISER_MAX_RX_SGE		3
+
 struct isert_cmnd {
 	struct iscsi_cmnd	iscsi ____cacheline_aligned;
 
@@ -134,8 +149,19 @@ struct isert_cmnd {
 	u32			rem_read_stag;  /* read rkey */
 	u64			rem_read_va;
 
+	/*
+	 * RX only: the received immediate data, passed to SCST as the
+	 * command's data buffer, and the length of the solicited data
+	 * being fetched by RDMA READ.
+	 */
+	struct scatterlist	*imm_sg;
+	int			imm_sg_max;
+	unsigned int		imm_data_in_place:1;
+	u32			rdma_rd_len;
+
 	int			is_fake_rx;
 	struct list_head	pool_node; /* pool list */
+	struct list_head	unsig_node; /* in conn tx_unsig_list */
 };
 
 enum isert_conn_state {
@@ -152,6 +178,7 @@ struct isert_cq {
 	struct workqueue_struct	*cq_workqueue;
 	struct work_struct	cq_comp_work;
 	int			idx;
+	int			cpu; /* where cq_comp_work runs */
 };
 
 #define ISERT_CONNECTION_ABORTED	0
@@ -179,6 +206,17 @@ struct isert_conn {
 	struct list_head	tx_free_list;
 	struct list_head	tx_busy_list;
 
+	/* Serializes SQ posts, protects the following 4 fields */
+	spinlock_t		sq_lock ____cacheline_aligned;
+	/* SCSI responses posted unsignaled, in posting order */
+	struct list_head	tx_unsig_list;
+	u32			sq_seq;
+	/* Unsignaled SENDs posted since the last signaled one */
+	int			sq_unsig_cnt;
+	/* Signaled send queue WRs not yet completed */
+	int			sq_sig_inflight;
+	int			sq_signal_interval;
+
 	struct rdma_cm_id	*cm_id;
 	struct isert_device	*isert_dev;
 	struct ib_qp		*qp;
@@ -220,6 +258,7 @@ struct isert_conn {
 	struct work_struct	release_work;
 	struct isert_wr		drain_wr_sq;
 	struct isert_wr		drain_wr_rq;
+	struct isert_wr		flush_wr_sq;
 	struct kref		kref;
 
 	struct isert_portal	*portal;
@@ -246,6 +285,7 @@ struct isert_device {
 	int			num_cqs;
 	int			*cq_qps;
 	struct isert_cq		*cq_desc;
+	int			numa_node;
 };
 
 struct isert_global {
@@ -260,6 +300,12 @@ struct isert_global {
 	struct workqueue_struct	*conn_wq;
 };
 
+static inline int isert_ib_dev_node(struct ib_device *ib_dev)
+{
+	return ib_dev->dev.parent ? dev_to_node(ib_dev->dev.parent) :
+		NUMA_NO_NODE;
+}
+
 #define _ptr_to_u64(p)		((u64)(unsigned long)(p))
 #define _u64_to_ptr(v)		((void *)(unsigned long)(v))
 
@@ -300,9 +346,10 @@ void isert_conn_disconnect(struct isert_conn *isert_conn);
 void isert_post_drain(struct isert_conn *isert_conn);
 void isert_sched_conn_free(struct isert_conn *isert_conn);
 
-static inline struct isert_conn *isert_conn_zalloc(void)
+static inline struct isert_conn *isert_conn_zalloc(int node)
 {
-	return kmem_cache_zalloc(isert_conn_cache, GFP_KERNEL);
+	return kmem_cache_alloc_node(isert_conn_cache,
+				     GFP_KERNEL | __GFP_ZERO, node);
 }
 
 static inline void isert_conn_kfree(struct isert_conn *isert_conn)
@@ -340,9 +387,15 @@ static inline void isert_buf_init_sg(struct isert_buf *isert_buf,
 }
 
 /* iser pdu */
-static inline struct isert_cmnd *isert_pdu_alloc(void)
+static inline struct isert_cmnd *isert_pdu_alloc(int node)
 {
-	return kmem_cache_zalloc(isert_cmnd_cache, GFP_KERNEL);
+	struct isert_cmnd *pdu;
+
+	pdu = kmem_cache_alloc_node(isert_cmnd_cache, GFP_KERNEL | __GFP_ZERO,
+				    node);
+	if (pdu)
+		INIT_LIST_HEAD(&pdu->unsig_node);
+	return pdu;
 }
 
 static inline void isert_pdu_kfree(struct isert_cmnd *cmnd)
@@ -361,7 +414,7 @@ int isert_pdu_send(struct isert_conn *isert_conn,
 
 int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 		       struct isert_conn *isert_conn,
-		       enum isert_wr_op op);
+		       enum isert_wr_op op, u32 offset);
 int isert_pdu_post_rdma_write(struct isert_conn *isert_conn,
 			      struct isert_cmnd *isert_cmd,
 			      struct isert_cmnd *isert_rsp,
@@ -44,13 +44,14 @@ static int isert_buf_alloc_pg(struct ib_device *ib_dev,
 			      struct isert_buf *isert_buf, size_t size,
 			      enum dma_data_direction dma_dir)
 {
+	int node = isert_ib_dev_node(ib_dev);
 	int res = 0;
 	int i;
 	struct page *page;
 
 	isert_buf->sg_cnt = DIV_ROUND_UP(size, PAGE_SIZE);
-	isert_buf->sg = kmalloc_array(isert_buf->sg_cnt, sizeof(*isert_buf->sg),
-				      GFP_KERNEL);
+	isert_buf->sg = kmalloc_array_node(isert_buf->sg_cnt,
+					   sizeof(*isert_buf->sg), GFP_KERNEL, node);
 	if (unlikely(!isert_buf->sg)) {
 		PRINT_ERROR("Failed to allocate buffer SG");
 		res = -ENOMEM;
@@ -61,7 +62,7 @@ static int isert_buf_alloc_pg(struct ib_device *ib_dev,
 	for (i = 0; i < isert_buf->sg_cnt; ++i) {
 		size_t page_len = min_t(size_t, size, PAGE_SIZE);
 
-		page = alloc_page(GFP_KERNEL);
+		page = alloc_pages_node(node, GFP_KERNEL, 0);
 		if (unlikely(!page)) {
 			PRINT_ERROR("Failed to allocate page");
 			res = -ENOMEM;
@@ -106,17 +107,19 @@ static int isert_buf_malloc(struct ib_device *ib_dev,
 			    struct isert_buf *isert_buf, size_t size,
 			    enum dma_data_direction dma_dir)
 {
+	int node = isert_ib_dev_node(ib_dev);
 	int res = 0;
 
 	isert_buf->sg_cnt = 1;
-	isert_buf->sg = kmalloc(sizeof(isert_buf->sg[0]), GFP_KERNEL);
+	isert_buf->sg = kmalloc_node(sizeof(isert_buf->sg[0]), GFP_KERNEL,
+				     node);
 	if (unlikely(!isert_buf->sg)) {
 		PRINT_ERROR("Failed to allocate buffer SG");
 		res = -ENOMEM;
 		goto out;
 	}
 
-	isert_buf->addr = kmalloc(size, GFP_KERNEL);
+	isert_buf->addr = kmalloc_node(size, GFP_KERNEL, node);
 	if (unlikely(!isert_buf->addr)) {
 		PRINT_ERROR("Failed to allocate data buffer");
 		res = -ENOMEM;
@@ -236,7 +236,11 @@ int isert_pdu_tx(struct iscsi_cmnd *iscsi_cmnd)
 	return err;
 }
 
-int isert_request_data_out(struct iscsi_cmnd *iscsi_cmnd)
+/*
+ * Fetches the solicited data, i.e. the data from offset up to the end of the
+ * buffer, by RDMA READ.
+ */
+int isert_request_data_out(struct iscsi_cmnd *iscsi_cmnd, u32 offset)
 {
 	struct isert_cmnd *isert_cmnd = container_of(iscsi_cmnd,
 						    struct isert_cmnd, iscsi);
@@ -244,7 +248,11 @@ int isert_request_data_out(struct iscsi_cmnd *iscsi_cmnd)
 						struct isert_conn, iscsi);
 	int ret;
 
-	ret = isert_prepare_rdma(isert_cmnd, isert_conn, ISER_WR_RDMA_READ);
+	isert_cmnd->rdma_rd_len = be32_to_cpu(cmnd_hdr(iscsi_cmnd)->data_length) -
+				  offset;
+
+	ret = isert_prepare_rdma(isert_cmnd, isert_conn, ISER_WR_RDMA_READ,
+				 offset);
 	if (unlikely(ret < 0))
 		return ret;
 
@@ -253,6 +261,113 @@ int isert_request_data_out(struct iscsi_cmnd *iscsi_cmnd)
 	return ret;
 }
 
+u32 isert_get_rdma_rd_len(struct iscsi_cmnd *iscsi_cmnd)
+{
+	struct isert_cmnd *isert_cmnd = container_of(iscsi_cmnd,
+						    struct isert_cmnd, iscsi);
+
+	return isert_cmnd->rdma_rd_len;
+}
+
+/*
+ * Copies the data received in the rx pdu, i.e. immediate data or the data
+ * of a Data-Out PDU, into the buffer of req at offset. Nothing to do, if the
+ * immediate data are already the buffer of req.
+ */
+void isert_get_rx_data(struct iscsi_cmnd *pdu, struct iscsi_cmnd *req,
+		       u32 offset)
+{
+	struct isert_cmnd *isert_pdu = container_of(pdu, struct isert_cmnd,
+						   iscsi);
+	struct isert_buf *isert_buf = &isert_pdu->buf;
+	unsigned int src_offset = ISER_HDRS_SZ + pdu->pdu.ahssize;
+	unsigned int size = pdu->pdu.datasize;
+	int i;
+
+	TRACE_ENTRY();
+
+	if (isert_pdu->imm_data_in_place || offset >= req->bufflen)
+		goto out;
+
+	/* Residual overflow data are dropped */
+	size = min(size, req->bufflen - offset);
+
+	for (i = 0; size && i < isert_buf->sg_cnt; ++i) {
+		struct scatterlist *sg = &isert_buf->sg[i];
+		unsigned int len;
+
+		if (src_offset >= sg->length) {
+			src_offset -= sg->length;
+			continue;
+		}
+
+		len = min(size, sg->length - src_offset);
+		sg_pcopy_from_buffer(req->sg, req->sg_cnt,
+				     sg_virt(sg) + src_offset, len, offset);
+		offset += len;
+		size -= len;
+		src_offset = 0;
+	}
+
+out:
+	TRACE_EXIT();
+}
+
+/*
+ * Passes the received immediate data to SCST as the data buffer of req,
+ * if they are the whole data of the command, so they are never copied.
+ * Returns 1 if the data have to be copied instead, e.g. because the dev
+ * handler has allocated the data buffer. SCST then ignores the target
+ * driver buffer.
+ */
+int isert_alloc_imm_data_buf(struct iscsi_cmnd *req)
+{
+	struct isert_cmnd *isert_pdu = container_of(req, struct isert_cmnd,
+						   iscsi);
+	struct isert_buf *isert_buf = &isert_pdu->buf;
+	struct scst_cmd *scst_cmd = req->scst_cmd;
+	unsigned int offset = ISER_HDRS_SZ;
+	int bufflen = scst_cmd_get_bufflen(scst_cmd);
+	int i, sg_cnt = 0;
+	int res = 1;
+
+	TRACE_ENTRY();
+
+	if (unlikely(req->pdu.ahssize || bufflen == 0 ||
+		     bufflen > req->pdu.datasize ||
+		     scst_cmd_needs_dif_buf(scst_cmd) ||
+		     scst_cmd_get_dh_data_buff_alloced(scst_cmd)))
+		goto out;
+
+	sg_init_table(isert_pdu->imm_sg, isert_pdu->imm_sg_max);
+	for (i = 0; bufflen > 0 && i < isert_buf->sg_cnt; ++i) {
+		struct scatterlist *sg = &isert_buf->sg[i];
+		unsigned int len;
+
+		if (offset >= sg->length) {
+			offset -= sg->length;
+			continue;
+		}
+
+		len = min_t(unsigned int, bufflen, sg->length - offset);
+		sg_set_page(&isert_pdu->imm_sg[sg_cnt++], sg_page(sg), len,
+			    sg->offset + offset);
+		bufflen -= len;
+		offset = 0;
+	}
+	sg_mark_end(&isert_pdu->imm_sg[sg_cnt - 1]);
+
+	TRACE_DBG("req %p: immediate data in place (sg_cnt %d)", req, sg_cnt);
+
+	scst_cmd_set_tgt_sg(scst_cmd, isert_pdu->imm_sg, sg_cnt);
+	isert_pdu->imm_data_in_place = 1;
+	res = 0;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 int isert_send_data_in(struct iscsi_cmnd *iscsi_cmnd,
 		       struct iscsi_cmnd *iscsi_rsp)
 {
@@ -264,7 +379,8 @@ int isert_send_data_in(struct iscsi_cmnd *iscsi_cmnd,
 						    struct isert_cmnd, iscsi);
 	int ret;
 
-	ret = isert_prepare_rdma(isert_cmnd, isert_conn, ISER_WR_RDMA_WRITE);
+	ret = isert_prepare_rdma(isert_cmnd, isert_conn, ISER_WR_RDMA_WRITE,
+				 0);
 	if (unlikely(ret < 0))
 		return ret;
 
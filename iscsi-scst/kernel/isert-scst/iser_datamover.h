@@ -65,7 +65,11 @@ struct iscsi_cmnd *isert_alloc_scsi_fake_pdu(struct iscsi_conn *iscsi_conn);
 
 int isert_pdu_tx(struct iscsi_cmnd *pdu);
 
-int isert_request_data_out(struct iscsi_cmnd *cmd);
+int isert_request_data_out(struct iscsi_cmnd *cmd, u32 offset);
+u32 isert_get_rdma_rd_len(struct iscsi_cmnd *cmd);
+void isert_get_rx_data(struct iscsi_cmnd *pdu, struct iscsi_cmnd *req,
+		       u32 offset);
+int isert_alloc_imm_data_buf(struct iscsi_cmnd *req);
 int isert_send_data_in(struct iscsi_cmnd *cmd, struct iscsi_cmnd *rsp);
 int isert_send_status(struct iscsi_cmnd *rsp);
 
@@ -166,19 +166,20 @@ static inline int isert_pdu_prepare_send(struct isert_conn *isert_conn, struct i
 static int isert_alloc_for_rdma(struct isert_cmnd *pdu, int sge_cnt,
 				struct isert_conn *isert_conn)
 {
+	int node = isert_conn->isert_dev->numa_node;
 	struct isert_wr *wr;
 	struct ib_sge *sg_pool;
 	int i, ret = 0;
 	int wr_cnt;
 
-	sg_pool = kmalloc_array(sge_cnt, sizeof(*sg_pool), GFP_KERNEL);
+	sg_pool = kmalloc_array_node(sge_cnt, sizeof(*sg_pool), GFP_KERNEL, node);
 	if (unlikely(!sg_pool)) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
 	wr_cnt = DIV_ROUND_UP(sge_cnt, isert_conn->max_sge);
-	wr = kmalloc_array(wr_cnt, sizeof(*wr), GFP_KERNEL);
+	wr = kmalloc_array_node(wr_cnt, sizeof(*wr), GFP_KERNEL, node);
 	if (unlikely(!wr)) {
 		ret = -ENOMEM;
 		goto out_free_sg_pool;
@@ -229,9 +230,13 @@ static inline void isert_link_send_pdu_wrs(struct isert_cmnd *from_pdu,
 #endif
 }
 
+/*
+ * Prepares RDMA of the command's buffer starting from offset, which is
+ * non-zero for the RDMA READ of a WRITE with immediate or unsolicited data.
+ */
 int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 		       struct isert_conn *isert_conn,
-		       enum isert_wr_op op)
+		       enum isert_wr_op op, u32 offset)
 {
 	struct isert_buf *isert_buf = &isert_pdu->rdma_buf;
 	struct isert_device *isert_dev = isert_conn->isert_dev;
@@ -247,6 +252,9 @@ int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 
 	if (op == ISER_WR_RDMA_WRITE)
 		isert_buf->dma_dir = DMA_TO_DEVICE;
+	else if (offset)
+		/* Keep the already received data before offset */
+		isert_buf->dma_dir = DMA_BIDIRECTIONAL;
 	else
 		isert_buf->dma_dir = DMA_FROM_DEVICE;
 
@@ -266,10 +274,16 @@ int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 		goto out;
 	}
 
+	/* Skip the SG entries entirely before offset */
+	for (sg_offset = 0; sg_offset < isert_buf->sg_cnt; ++sg_offset) {
+		if (offset < sg_dma_len(&isert_buf->sg[sg_offset]))
+			break;
+		offset -= sg_dma_len(&isert_buf->sg[sg_offset]);
+	}
+
 	buff_offset = 0;
 	sg_cnt = 0;
-	for (wr_cnt = 0, sg_offset = 0; sg_offset < isert_buf->sg_cnt;
-	     ++wr_cnt) {
+	for (wr_cnt = 0; sg_offset < isert_buf->sg_cnt; ++wr_cnt) {
 		sg_cnt = min((int)isert_conn->max_sge,
 			     isert_buf->sg_cnt - sg_offset);
 		err = isert_wr_init(&isert_pdu->wr[wr_cnt], op, isert_buf,
@@ -279,6 +293,12 @@ int isert_prepare_rdma(struct isert_cmnd *isert_pdu,
 			wr_cnt = err;
 			goto out;
 		}
+		if (wr_cnt == 0 && offset) {
+			/* The remote address is already relative to offset */
+			isert_pdu->wr[0].sge_list[0].addr += offset;
+			isert_pdu->wr[0].sge_list[0].length -= offset;
+			err -= offset;
+		}
 		buff_offset = err;
 		sg_offset += sg_cnt;
 	}
@@ -316,6 +336,9 @@ void isert_pdu_free(struct isert_cmnd *pdu)
 	kfree(pdu->sg_pool);
 	pdu->sg_pool = NULL;
 
+	kfree(pdu->imm_sg);
+	pdu->imm_sg = NULL;
+
 	isert_pdu_kfree(pdu);
 }
 
@@ -327,7 +350,7 @@ struct isert_cmnd *isert_rx_pdu_alloc(struct isert_conn *isert_conn,
 
 	TRACE_ENTRY();
 
-	pdu = isert_pdu_alloc();
+	pdu = isert_pdu_alloc(isert_conn->isert_dev->numa_node);
 	if (unlikely(!pdu)) {
 		PRINT_ERROR("Failed to alloc pdu");
 		goto out;
@@ -346,17 +369,28 @@ struct isert_cmnd *isert_rx_pdu_alloc(struct isert_conn *isert_conn,
 		goto buf_alloc_failed;
 	}
 
+	pdu->imm_sg = kmalloc_array_node(pdu->buf.sg_cnt, sizeof(*pdu->imm_sg),
+					 GFP_KERNEL, isert_conn->isert_dev->numa_node);
+	if (unlikely(!pdu->imm_sg)) {
+		PRINT_ERROR("Failed to alloc immediate data sg for rx pdu");
+		goto pdu_init_failed;
+	}
+	pdu->imm_sg_max = pdu->buf.sg_cnt;
+
 	err = isert_rx_pdu_init(pdu, isert_conn);
 	if (unlikely(err)) {
 		PRINT_ERROR("Failed to init rx pdu wr:%p size:%zd err:%d",
 			    &pdu->wr, size, err);
-		goto pdu_init_failed;
+		goto imm_sg_free;
 	}
 
 	list_add_tail(&pdu->pool_node, &isert_conn->rx_buf_list);
 
 	goto out;
 
+imm_sg_free:
+	kfree(pdu->imm_sg);
+	pdu->imm_sg = NULL;
 pdu_init_failed:
 	isert_buf_release(&pdu->buf);
 buf_alloc_failed:
@@ -375,7 +409,7 @@ struct isert_cmnd *isert_tx_pdu_alloc(struct isert_conn *isert_conn,
 
 	TRACE_ENTRY();
 
-	pdu = isert_pdu_alloc();
+	pdu = isert_pdu_alloc(isert_conn->isert_dev->numa_node);
 	if (unlikely(!pdu)) {
 		PRINT_ERROR("Failed to alloc pdu");
 		goto out;
@@ -439,13 +473,54 @@ int isert_alloc_conn_resources(struct isert_conn *isert_conn)
 	/* RFC states that minimum receive data size is 512 */
 	int t_datasz = 512;
 	int i_datasz = ISER_HDRS_SZ + SCST_SENSE_BUFFERSIZE;
+	int rx_per_cmd = 2, max_per_cmd;
 	int i, err = 0;
 	int to_alloc;
 
 	TRACE_ENTRY();
 
+	/*
+	 * Immediate data and unsolicited Data-Out PDUs are received by SEND,
+	 * so the RX buffers must be able to hold the whole PDU.
+	 */
+	if (isert_conn->immediate_data || !isert_conn->initial_r2t) {
+		t_datasz = ISER_HDRS_SZ + isert_conn->target_recv_data_length;
+		if (unlikely(DIV_ROUND_UP(t_datasz, PAGE_SIZE) > ISER_MAX_RX_SGE)) {
+			PRINT_ERROR("TargetRecvDataSegmentLength %u is too big for immediate and unsolicited data",
+				    isert_conn->target_recv_data_length);
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
 	isert_conn->repost_threshold = 32;
-	to_alloc = isert_conn->queue_depth * 2 + isert_conn->repost_threshold;
+
+	/*
+	 * Unsolicited Data-Out PDUs, up to FirstBurstLength per command,
+	 * need an RX buffer each. iscsi-scstd limits FirstBurstLength to
+	 * TargetRecvDataSegmentLength, but the initiator may rely on the
+	 * RFC default instead of negotiating it. Don't fail the login then,
+	 * but size the ring for as many unsolicited PDUs as fit in it. If
+	 * all commands carry full unsolicited bursts at once, the RNR
+	 * retries of the initiator hold back the excess.
+	 */
+	if (!isert_conn->initial_r2t)
+		rx_per_cmd = max_t(int, rx_per_cmd, 1 +
+				   DIV_ROUND_UP(isert_conn->first_burst_length,
+						isert_conn->target_recv_data_length));
+
+	max_per_cmd = (ISER_MAX_WCE - isert_conn->repost_threshold) /
+		      max(isert_conn->queue_depth, 1);
+	if (rx_per_cmd > max_per_cmd && max_per_cmd >= 2) {
+		PRINT_WARNING("Only %d of %d RX buffers per command for FirstBurstLength %u and QueuedCommands %d",
+			      max_per_cmd, rx_per_cmd,
+			      isert_conn->first_burst_length,
+			      isert_conn->queue_depth);
+		rx_per_cmd = max_per_cmd;
+	}
+
+	to_alloc = isert_conn->queue_depth * rx_per_cmd +
+		   isert_conn->repost_threshold;
 
 	if (unlikely(to_alloc > ISER_MAX_WCE)) {
 		PRINT_ERROR("QueuedCommands larger than %d not supported",
@@ -497,6 +572,8 @@ static int isert_reinit_rx_pdu(struct isert_cmnd *pdu)
 
 	pdu->is_rstag_valid = 0;
 	pdu->is_wstag_valid = 0;
+	pdu->imm_data_in_place = 0;
+	pdu->rdma_rd_len = 0;
 
 	memset(&pdu->iscsi, 0, sizeof(pdu->iscsi));
 
@@ -112,6 +112,43 @@ static int isert_num_send_posted_on_err(struct ib_send_wr *first_ib_wr,
 	return num_posted;
 }
 
+static inline bool isert_sq_seq_before(u32 seq1, u32 seq2)
+{
+	return (s32)(seq1 - seq2) < 0;
+}
+
+/*
+ * Decide whether the last WR of a send queue post is signaled. Only the
+ * SEND of a SCSI response may go unsignaled: its completion does nothing
+ * but release the response, which can as well be done when a later
+ * signaled WR completes, since an RC send queue completes in order. To
+ * make sure that a later completion does come, a SEND is signaled anyway
+ * if no other signaled WR is in flight.
+ *
+ * Must be called with sq_lock held.
+ */
+static bool isert_sq_signal_wr(struct isert_conn *isert_conn,
+			       struct isert_wr *wr, struct ib_send_wr *ib_wr)
+{
+	struct isert_cmnd *pdu = wr->pdu;
+
+	wr->sq_seq = isert_conn->sq_seq++;
+
+	if (wr->wr_op == ISER_WR_SEND && pdu && !pdu->is_fake_rx &&
+	    cmnd_opcode(&pdu->iscsi) == ISCSI_OP_SCSI_RSP &&
+	    isert_conn->sq_sig_inflight > 0 &&
+	    ++isert_conn->sq_unsig_cnt < isert_conn->sq_signal_interval) {
+		ib_wr->send_flags &= ~IB_SEND_SIGNALED;
+		list_add_tail(&pdu->unsig_node, &isert_conn->tx_unsig_list);
+		return false;
+	}
+
+	ib_wr->send_flags |= IB_SEND_SIGNALED;
+	isert_conn->sq_unsig_cnt = 0;
+	isert_conn->sq_sig_inflight++;
+	return true;
+}
+
 int isert_post_send(struct isert_conn *isert_conn,
 		    struct isert_wr *first_wr,
 		    int num_wr)
@@ -122,7 +159,10 @@ int isert_post_send(struct isert_conn *isert_conn,
 	struct ib_send_wr *first_ib_wr = &first_wr->send_wr.wr;
 #endif
 	BAD_WR_MODIFIER struct ib_send_wr *bad_wr;
+	struct ib_send_wr *last_ib_wr;
+	struct isert_wr *last_wr;
 	int num_posted;
+	bool signaled;
 	int err;
 
 	TRACE_ENTRY();
@@ -134,7 +174,23 @@ int isert_post_send(struct isert_conn *isert_conn,
 	}
 #endif
 
+	for (last_ib_wr = first_ib_wr; last_ib_wr->next;
+	     last_ib_wr = last_ib_wr->next)
+		;
+	last_wr = _u64_to_ptr(last_ib_wr->wr_id);
+
+	spin_lock(&isert_conn->sq_lock);
+	signaled = isert_sq_signal_wr(isert_conn, last_wr, last_ib_wr);
 	err = ib_post_send(isert_conn->qp, first_ib_wr, &bad_wr);
+	if (unlikely(err)) {
+		/* The last WR is never posted if the post failed */
+		if (signaled)
+			isert_conn->sq_sig_inflight--;
+		else
+			list_del_init(&last_wr->pdu->unsig_node);
+	}
+	spin_unlock(&isert_conn->sq_lock);
+
 	if (unlikely(err)) {
 		num_posted = isert_num_send_posted_on_err(first_ib_wr, bad_wr);
 
@@ -147,6 +203,42 @@ int isert_post_send(struct isert_conn *isert_conn,
 	return err;
 }
 
+/*
+ * Post a signaled zero-length RDMA WRITE to retire the unsignaled SENDs
+ * left behind the last signaled WR. Must be called with sq_lock held.
+ */
+static void isert_post_sq_flush(struct isert_conn *isert_conn)
+{
+	BAD_WR_MODIFIER struct ib_send_wr *bad_wr;
+	struct isert_wr *flush_wr_sq = &isert_conn->flush_wr_sq;
+	int err;
+
+	isert_wr_set_fields(flush_wr_sq, isert_conn, NULL);
+	flush_wr_sq->wr_op = ISER_WR_SQ_FLUSH;
+	flush_wr_sq->sq_seq = isert_conn->sq_seq++;
+#ifdef USE_PRE_440_WR_STRUCTURE
+	flush_wr_sq->send_wr.wr_id = _ptr_to_u64(flush_wr_sq);
+	flush_wr_sq->send_wr.opcode = IB_WR_RDMA_WRITE;
+	flush_wr_sq->send_wr.send_flags = IB_SEND_SIGNALED;
+	err = ib_post_send(isert_conn->qp,
+			   &flush_wr_sq->send_wr, &bad_wr);
+#else
+	flush_wr_sq->send_wr.wr.wr_id = _ptr_to_u64(flush_wr_sq);
+	flush_wr_sq->send_wr.wr.opcode = IB_WR_RDMA_WRITE;
+	flush_wr_sq->send_wr.wr.send_flags = IB_SEND_SIGNALED;
+	err = ib_post_send(isert_conn->qp,
+			   &flush_wr_sq->send_wr.wr, &bad_wr);
+#endif
+	if (unlikely(err)) {
+		/* The drain WR will retire them when the conn is closed */
+		PRINT_ERROR("conn:%p failed to post flush wr, err:%d",
+			    isert_conn, err);
+		return;
+	}
+
+	isert_conn->sq_sig_inflight++;
+}
+
 static void isert_post_drain_sq(struct isert_conn *isert_conn)
 {
 	BAD_WR_MODIFIER struct ib_send_wr *bad_wr;
@@ -155,6 +247,8 @@ static void isert_post_drain_sq(struct isert_conn *isert_conn)
 
 	isert_wr_set_fields(drain_wr_sq, isert_conn, NULL);
 	drain_wr_sq->wr_op = ISER_WR_SEND;
+	spin_lock(&isert_conn->sq_lock);
+	drain_wr_sq->sq_seq = isert_conn->sq_seq++;
 #ifdef USE_PRE_440_WR_STRUCTURE
 	drain_wr_sq->send_wr.wr_id = _ptr_to_u64(drain_wr_sq);
 	drain_wr_sq->send_wr.opcode = IB_WR_SEND;
@@ -166,6 +260,9 @@ static void isert_post_drain_sq(struct isert_conn *isert_conn)
 	err = ib_post_send(isert_conn->qp,
 			   &drain_wr_sq->send_wr.wr, &bad_wr);
 #endif
+	if (likely(!err))
+		isert_conn->sq_sig_inflight++;
+	spin_unlock(&isert_conn->sq_lock);
 	if (unlikely(err)) {
 		PRINT_ERROR("Failed to post drain wr to send queue, err:%d",
 			    err);
@@ -263,8 +360,7 @@ static int isert_pdu_handle_tm_func(struct isert_cmnd *pdu)
 
 static int isert_pdu_handle_data_out(struct isert_cmnd *pdu)
 {
-	PRINT_INFO("iser iscsi data out not supported");
-	return -EINVAL; /* meanwhile disconnect immediately */
+	return isert_pdu_rx(&pdu->iscsi);
 }
 
 static int isert_pdu_handle_logout(struct isert_cmnd *pdu)
@@ -421,9 +517,8 @@ static void isert_recv_completion_handler(struct isert_wr *wr)
 	TRACE_EXIT();
 }
 
-static void isert_send_completion_handler(struct isert_wr *wr)
+static void isert_send_completion_handler(struct isert_cmnd *isert_pdu)
 {
-	struct isert_cmnd *isert_pdu = wr->pdu;
 	struct iscsi_cmnd *iscsi_pdu = &isert_pdu->iscsi;
 	struct iscsi_cmnd *iscsi_req_pdu = iscsi_pdu->parent_req;
 	struct isert_cmnd *isert_req_pdu = container_of(iscsi_req_pdu,
@@ -440,6 +535,47 @@ static void isert_send_completion_handler(struct isert_wr *wr)
 	TRACE_EXIT();
 }
 
+/*
+ * Retire the unsignaled SENDs posted before @wr, whose send queue
+ * completion has just been reaped, successfully or not.
+ */
+static void isert_sq_completed(struct isert_wr *wr, bool failed)
+{
+	struct isert_conn *isert_conn = wr->conn;
+	struct isert_cmnd *pdu, *tmp;
+	LIST_HEAD(retired);
+
+	TRACE_ENTRY();
+
+	spin_lock(&isert_conn->sq_lock);
+	list_for_each_entry_safe(pdu, tmp, &isert_conn->tx_unsig_list,
+				 unsig_node) {
+		if (!isert_sq_seq_before(pdu->wr[0].sq_seq, wr->sq_seq))
+			break;
+		list_move_tail(&pdu->unsig_node, &retired);
+	}
+
+	if (wr->pdu && !list_empty(&wr->pdu->unsig_node)) {
+		/* Unsignaled WR, completed with an error */
+		list_del_init(&wr->pdu->unsig_node);
+	} else if (--isert_conn->sq_sig_inflight == 0 &&
+		   !list_empty(&isert_conn->tx_unsig_list) &&
+		   !test_bit(ISERT_DRAIN_POSTED, &isert_conn->flags)) {
+		isert_post_sq_flush(isert_conn);
+	}
+	spin_unlock(&isert_conn->sq_lock);
+
+	list_for_each_entry_safe(pdu, tmp, &retired, unsig_node) {
+		list_del_init(&pdu->unsig_node);
+		if (unlikely(failed))
+			isert_pdu_err(&pdu->iscsi);
+		else
+			isert_send_completion_handler(pdu);
+	}
+
+	TRACE_EXIT();
+}
+
 static void isert_rdma_rd_completion_handler(struct isert_wr *wr)
 {
 	struct isert_buf *isert_buf = wr->buf;
@@ -485,14 +621,19 @@ static void isert_handle_wc(struct ib_wc *wc)
 		isert_recv_completion_handler(wr);
 		break;
 	case ISER_WR_SEND:
-		isert_send_completion_handler(wr);
+		isert_sq_completed(wr, false);
+		isert_send_completion_handler(wr->pdu);
 		break;
 	case ISER_WR_RDMA_WRITE:
 		isert_rdma_wr_completion_handler(wr);
 		break;
 	case ISER_WR_RDMA_READ:
+		isert_sq_completed(wr, false);
 		isert_rdma_rd_completion_handler(wr);
 		break;
+	case ISER_WR_SQ_FLUSH:
+		isert_sq_completed(wr, false);
+		break;
 	default:
 		isert_conn = wr->conn;
 		PRINT_ERROR("unexpected work req op:%d, wc op:%d, wc:%p wr_id:%p conn:%p",
@@ -648,6 +789,7 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 	struct isert_device *isert_dev = wr->isert_dev;
 	struct ib_device *ib_dev = isert_dev->ib_dev;
 	u32 num_sge;
+	int send_flags;
 
 	TRACE_ENTRY();
 
@@ -662,6 +804,7 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 
 	switch (wr->wr_op) {
 	case ISER_WR_SEND:
+		isert_sq_completed(wr, true);
 #ifdef USE_PRE_440_WR_STRUCTURE
 		num_sge = wr->send_wr.num_sge;
 #else
@@ -676,6 +819,19 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 		}
 		break;
 	case ISER_WR_RDMA_READ:
+#ifdef USE_PRE_440_WR_STRUCTURE
+		send_flags = wr->send_wr.send_flags;
+#else
+		send_flags = wr->send_wr.wr.send_flags;
+#endif
+		/*
+		 * Flushed WRs complete even if unsignaled. Only the last,
+		 * signaled, WR of an RDMA READ chain was accounted in
+		 * sq_sig_inflight and completes the task.
+		 */
+		if (!(send_flags & IB_SEND_SIGNALED))
+			break;
+		isert_sq_completed(wr, true);
 		if (isert_buf->sg_cnt != 0) {
 			ib_dma_unmap_sg(ib_dev, isert_buf->sg,
 					isert_buf->sg_cnt, isert_buf->dma_dir);
@@ -705,6 +861,9 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 		 * wait until SEND error arrives to complete the task.
 		 */
 		break;
+	case ISER_WR_SQ_FLUSH:
+		isert_sq_completed(wr, true);
+		break;
 	default:
 		PRINT_ERROR("unexpected opcode %d, wc:%p wr_id:%p conn:%p",
 			    wr->wr_op, wc, wr, isert_conn);
@@ -714,15 +873,33 @@ static void isert_handle_wc_error(struct ib_wc *wc)
 	TRACE_EXIT();
 }
 
-static int isert_poll_cq(struct isert_cq *cq)
+static void isert_cq_queue_work(struct isert_cq *cq_desc)
 {
-	int err;
+	int cpu = cq_desc->cpu;
+
+	if (unlikely(!cpu_online(cpu)))
+		cpu = smp_processor_id();
+	queue_work_on(cpu, cq_desc->cq_workqueue, &cq_desc->cq_comp_work);
+}
+
+/*
+ * Returns the number of work completions handled, at most @budget, or a
+ * negative error code.
+ */
+static int isert_poll_cq(struct isert_cq *cq, int budget)
+{
+	int err, polled = 0;
 	struct ib_wc *wc, *last_wc;
 
 	TRACE_ENTRY();
 
 	do {
-		err = ib_poll_cq(cq->cq, ARRAY_SIZE(cq->wc), cq->wc);
+		err = ib_poll_cq(cq->cq, min_t(int, ARRAY_SIZE(cq->wc),
+					       budget - polled), cq->wc);
+		if (unlikely(err < 0)) {
+			polled = err;
+			break;
+		}
 		last_wc = &cq->wc[err];
 		for (wc = cq->wc; wc < last_wc; ++wc) {
 			if (likely(wc->status == IB_WC_SUCCESS))
@@ -730,11 +907,11 @@ static int isert_poll_cq(struct isert_cq *cq)
 			else
 				isert_handle_wc_error(wc);
 		}
+		polled += err;
+	} while (err > 0 && polled < budget);
 
-	} while (err > 0);
-
-	TRACE_EXIT_RES(err);
-	return err;
+	TRACE_EXIT_RES(polled);
+	return polled;
 }
 
 /* callback function for isert_dev->[cq]->cq_comp_work */
@@ -746,11 +923,13 @@ static void isert_cq_comp_work_cb(struct work_struct *work)
 
 	TRACE_ENTRY();
 
-	ret = isert_poll_cq(cq_desc);
+	ret = isert_poll_cq(cq_desc, ISER_CQ_POLL_BUDGET);
 	if (unlikely(ret < 0)) { /* poll error */
 		PRINT_ERROR("ib_poll_cq failed");
 		goto out;
 	}
+	if (ret == ISER_CQ_POLL_BUDGET)
+		goto requeue;
 
 	ib_req_notify_cq(cq_desc->cq,
 			 IB_CQ_NEXT_COMP | IB_CQ_REPORT_MISSED_EVENTS);
@@ -759,7 +938,16 @@ static void isert_cq_comp_work_cb(struct work_struct *work)
 	 * so we need to make sure we don't miss any events between
 	 * last call to ib_poll_cq() and ib_req_notify_cq()
 	 */
-	isert_poll_cq(cq_desc);
+	ret = isert_poll_cq(cq_desc, ISER_CQ_POLL_BUDGET);
+	if (ret < ISER_CQ_POLL_BUDGET)
+		goto out;
+
+requeue:
+	/*
+	 * Budget exhausted: give the other work items sharing this CPU a
+	 * chance and continue polling in the next run.
+	 */
+	isert_cq_queue_work(cq_desc);
 
 out:
 	TRACE_EXIT();
@@ -769,8 +957,7 @@ static void isert_cq_comp_handler(struct ib_cq *cq, void *context)
 {
 	struct isert_cq *cq_desc = context;
 
-	queue_work_on(smp_processor_id(), cq_desc->cq_workqueue,
-		      &cq_desc->cq_comp_work);
+	isert_cq_queue_work(cq_desc);
 }
 
 static const char *ib_event_type_str(enum ib_event_type ev_type)
@@ -905,12 +1092,14 @@ static struct isert_device *isert_device_create(struct ib_device *ib_dev)
 
 	TRACE_ENTRY();
 
-	isert_dev = kzalloc(sizeof(*isert_dev), GFP_KERNEL);
+	isert_dev = kzalloc_node(sizeof(*isert_dev), GFP_KERNEL,
+				 isert_ib_dev_node(ib_dev));
 	if (unlikely(!isert_dev)) {
 		PRINT_ERROR("Failed to allocate iser dev");
 		err = -ENOMEM;
 		goto out;
 	}
+	isert_dev->numa_node = isert_ib_dev_node(ib_dev);
 
 #ifdef HAVE_IB_QUERY_DEVICE
 	err = ib_query_device(ib_dev, &isert_dev->device_attr);
@@ -971,6 +1160,11 @@ static struct isert_device *isert_device_create(struct ib_device *ib_dev)
 
 		cq_desc->dev = isert_dev;
 		cq_desc->idx = i;
+		/*
+		 * Process the completions of vector i on the CPU its interrupt
+		 * is spread to by default, the HCA's local CPUs coming first.
+		 */
+		cq_desc->cpu = cpumask_local_spread(i, isert_dev->numa_node);
 		INIT_WORK(&cq_desc->cq_comp_work, isert_cq_comp_work_cb);
 
 		cq_desc->cq_workqueue = alloc_workqueue("isert_cq_%p", 0
@@ -1105,15 +1299,34 @@ static void isert_device_release(struct isert_device *isert_dev)
 	TRACE_EXIT();
 }
 
+static bool isert_cq_is_local(struct isert_device *isert_dev, int idx)
+{
+	return isert_dev->numa_node == NUMA_NO_NODE ||
+	       cpu_to_node(isert_dev->cq_desc[idx].cpu) == isert_dev->numa_node;
+}
+
+/*
+ * Pick the least loaded CQ, preferring the ones processed on the NUMA node
+ * of the HCA.
+ */
 static int isert_get_cq_idx(struct isert_device *isert_dev)
 {
-	int i, min_idx;
+	int i, min_idx = -1;
 
-	min_idx = 0;
 	mutex_lock(&dev_list_mutex);
-	for (i = 0; i < isert_dev->num_cqs; ++i)
-		if (isert_dev->cq_qps[i] < isert_dev->cq_qps[min_idx])
+	for (i = 0; i < isert_dev->num_cqs; ++i) {
+		if (!isert_cq_is_local(isert_dev, i))
+			continue;
+		if (min_idx < 0 ||
+		    isert_dev->cq_qps[i] < isert_dev->cq_qps[min_idx])
 			min_idx = i;
+	}
+	if (min_idx < 0) {
+		min_idx = 0;
+		for (i = 0; i < isert_dev->num_cqs; ++i)
+			if (isert_dev->cq_qps[i] < isert_dev->cq_qps[min_idx])
+				min_idx = i;
+	}
 	isert_dev->cq_qps[min_idx]++;
 	mutex_unlock(&dev_list_mutex);
 
@@ -1143,7 +1356,7 @@ static int isert_conn_qp_create(struct isert_conn *isert_conn)
 	isert_conn->cq_desc = &isert_dev->cq_desc[cq_idx];
 
 	qp_attr.cap.max_send_sge = isert_conn->max_sge;
-	qp_attr.cap.max_recv_sge = 3;
+	qp_attr.cap.max_recv_sge = ISER_MAX_RX_SGE;
 	qp_attr.sq_sig_type = IB_SIGNAL_REQ_WR;
 	qp_attr.qp_type = IB_QPT_RC;
 
@@ -1166,6 +1379,9 @@ static int isert_conn_qp_create(struct isert_conn *isert_conn)
 	} while (err == -ENOMEM);
 
 	isert_conn->qp = cm_id->qp;
+	/* Keep unsignaled SENDs well below the send queue size */
+	isert_conn->sq_signal_interval = min_t(int, ISER_SEND_SIGNAL_INTERVAL,
+					       qp_attr.cap.max_send_wr / 4);
 
 	PRINT_INFO("iser created cm_id:%p qp:0x%X", cm_id, cm_id->qp->qp_num);
 
@@ -1187,7 +1403,9 @@ isert_init_conn(struct isert_conn *isert_conn)
 	INIT_LIST_HEAD(&isert_conn->rx_buf_list);
 	INIT_LIST_HEAD(&isert_conn->tx_free_list);
 	INIT_LIST_HEAD(&isert_conn->tx_busy_list);
+	INIT_LIST_HEAD(&isert_conn->tx_unsig_list);
 	spin_lock_init(&isert_conn->tx_lock);
+	spin_lock_init(&isert_conn->sq_lock);
 	spin_lock_init(&isert_conn->post_recv_lock);
 	init_waitqueue_head(&isert_conn->rem_wait);
 	kref_init(&isert_conn->kref);
@@ -1203,7 +1421,7 @@ static struct isert_conn *isert_conn_create(struct rdma_cm_id *cm_id,
 
 	TRACE_ENTRY();
 
-	isert_conn = isert_conn_zalloc();
+	isert_conn = isert_conn_zalloc(isert_dev->numa_node);
 	if (unlikely(!isert_conn)) {
 		PRINT_ERROR("Unable to allocate iser conn, cm_id:%p", cm_id);
 		err = -ENOMEM;
@@ -332,14 +332,32 @@ int isert_pdu_rx(struct iscsi_cmnd *cmnd)
 		res = iscsi_cmnd_set_write_buf(cmnd);
 		if (unlikely(res))
 			goto out;
-		res = isert_request_data_out(cmnd);
-		cmnd->r2t_len_to_receive = 0;
-		cmnd->r2t_len_to_send = 0;
-		cmnd->outstanding_r2t = 0;
-	} else {
-		cmnd_rx_end(cmnd);
+
+		if (cmnd->pdu.datasize)
+			isert_get_rx_data(cmnd, cmnd, 0);
+
+		if (cmnd->r2t_len_to_send != 0) {
+			u32 len = cmnd->r2t_len_to_send;
+			u32 offset = be32_to_cpu(cmnd_hdr(cmnd)->data_length) - len;
+
+			/*
+			 * The solicited data are fetched by RDMA READ, which
+			 * is accounted as an outstanding R2T. The unsolicited
+			 * Data-Out PDUs can be received meanwhile.
+			 */
+			cmnd->r2t_len_to_send = 0;
+			if (likely(offset < cmnd->bufflen)) {
+				cmnd->outstanding_r2t++;
+				res = isert_request_data_out(cmnd, offset);
+				goto out;
+			}
+			/* Residual overflow, nothing to fetch */
+			cmnd->r2t_len_to_receive -= len;
+		}
 	}
 
+	cmnd_rx_end(cmnd);
+
 out:
 	TRACE_EXIT_RES(res);
 	return res;
@@ -353,12 +371,26 @@ int isert_data_out_ready(struct iscsi_cmnd *cmnd)
 #ifdef CONFIG_SCST_EXTRACHECKS
 	cmnd->conn->rd_task = current;
 #endif
+	cmnd->outstanding_r2t--;
+	if (unlikely(cmnd->prelim_compl_flags != 0)) {
+		/* See the corresponding comment in data_out_end() */
+		cmnd->r2t_len_to_receive = cmnd->outstanding_r2t;
+	} else {
+		cmnd->r2t_len_to_receive -= isert_get_rdma_rd_len(cmnd);
+	}
 	cmnd_rx_end(cmnd);
 
 	TRACE_EXIT_RES(res);
 	return res;
 }
 
+static int isert_receive_data_out(struct iscsi_cmnd *data_out,
+				  struct iscsi_cmnd *orig_req, u32 offset)
+{
+	isert_get_rx_data(data_out, orig_req, offset);
+	return 0;
+}
+
 int isert_data_in_sent(struct iscsi_cmnd *din)
 {
 	return 0;
@@ -466,6 +498,8 @@ static struct iscsit_transport isert_transport = {
 	.iscsit_set_sense_data = isert_set_sense_data,
 	.iscsit_set_req_data = isert_set_req_data,
 	.iscsit_receive_cmnd_data = isert_receive_cmnd_data,
+	.iscsit_receive_data_out = isert_receive_data_out,
+	.iscsit_alloc_imm_data_buf = isert_alloc_imm_data_buf,
 	.iscsit_close_all_portals = isert_close_all_portals,
 };
 
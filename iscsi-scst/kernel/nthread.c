@@ -19,7 +19,9 @@
 #include <linux/file.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <net/tcp.h>
 #include <net/tcp_states.h>
+#include <net/inet_connection_sock.h>
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/iscsit_transport.h>
 #else
@@ -28,6 +30,9 @@
 #include "iscsi_trace_flag.h"
 #include "iscsi.h"
 #include "digest.h"
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+#include <linux/tls.h>
+#endif
 
 #undef DEFAULT_SYMBOL_NAMESPACE
 #define DEFAULT_SYMBOL_NAMESPACE	SCST_NAMESPACE
@@ -503,6 +508,93 @@ out:
 }
 EXPORT_SYMBOL(iscsi_get_send_cmnd);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+/*
+ * Folds the @len bytes sock_recvmsg() has just copied to @kv + @off into the
+ * running RX data digest, while they are still cache hot.
+ */
+static void iscsi_rx_ddigest_update(struct iscsi_conn *conn,
+				    const struct kvec *kv, size_t off, int len)
+{
+	while (len > 0) {
+		int d = min_t(int, len, kv->iov_len - off);
+
+		conn->rx_ddigest_crc = digest_update(conn->rx_ddigest_crc,
+						     kv->iov_base + off, d);
+		len -= d;
+		off = 0;
+		kv++;
+	}
+}
+#endif
+
+static void iscsi_rx_start_data(struct iscsi_conn *conn)
+{
+	conn->read_state = RX_DATA;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	conn->rx_ddigest_fused = !(conn->ddigest_type & DIGEST_NONE);
+	conn->rx_ddigest_crc = ~0;
+#else
+	/* sock_recvmsg() modifies the iovec, so digest the data afterwards */
+	conn->rx_ddigest_fused = false;
+#endif
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+/* TLS record content types and the TLS 1.3 KeyUpdate handshake type */
+#define ISCSI_TLS_RECORD_ALERT		21
+#define ISCSI_TLS_RECORD_HANDSHAKE	22
+#define ISCSI_TLS_HANDSHAKE_KEY_UPDATE	24
+
+/*
+ * kTLS fails sock_recvmsg() with -EIO if the next record isn't application
+ * data and the caller doesn't supply a control message buffer. Read that
+ * record together with its TLS_GET_RECORD_TYPE control message and report
+ * it. The connection gets closed in any case: an alert ends the TLS session
+ * and post-handshake messages like a TLS 1.3 KeyUpdate are not supported,
+ * since the keys can only be renegotiated by iscsi-scstd.
+ */
+static void iscsi_tls_rx_control(struct iscsi_conn *conn)
+{
+	char cbuf[CMSG_SPACE(sizeof(u8))] = {};
+	struct cmsghdr *cmsg = (struct cmsghdr *)cbuf;
+	struct msghdr msg = {
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	mm_segment_t oldfs;
+	u8 buf[16], type = 0;
+	struct kvec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	int res;
+
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	res = kernel_recvmsg(conn->sock, &msg, &iov, 1, sizeof(buf),
+			     MSG_DONTWAIT | MSG_NOSIGNAL);
+	set_fs(oldfs);
+
+	if (msg.msg_controllen < sizeof(cbuf) && cmsg->cmsg_level == SOL_TLS &&
+	    cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+		type = *(u8 *)CMSG_DATA(cmsg);
+
+	if (type == ISCSI_TLS_RECORD_ALERT && res >= 2 && buf[1] == 0)
+		PRINT_INFO("TLS close_notify alert received from initiator %s (conn %p)",
+			   conn->session->initiator_name, conn);
+	else if (type == ISCSI_TLS_RECORD_ALERT && res >= 2)
+		PRINT_ERROR("TLS alert (level %d, description %d) received from initiator %s (conn %p)",
+			    buf[0], buf[1], conn->session->initiator_name,
+			    conn);
+	else if (type == ISCSI_TLS_RECORD_HANDSHAKE && res >= 1 &&
+		 buf[0] == ISCSI_TLS_HANDSHAKE_KEY_UPDATE)
+		PRINT_ERROR("TLS KeyUpdate received from initiator %s (conn %p), which is not supported",
+			    conn->session->initiator_name, conn);
+	else
+		PRINT_ERROR("Unexpected TLS record (type %d, res %d) received from initiator %s (conn %p)",
+			    type, res, conn->session->initiator_name, conn);
+}
+#endif
+
 /* Returns number of bytes left to receive or <0 for error */
 static int do_recv(struct iscsi_conn *conn)
 {
@@ -510,7 +602,10 @@ static int do_recv(struct iscsi_conn *conn)
 	mm_segment_t oldfs;
 	struct msghdr *msg;
 	int read_size;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	const struct kvec *first_kvec;
+	size_t first_off;
+#else
 	struct iovec *first_iov;
 	int first_len;
 #endif
@@ -532,6 +627,8 @@ restart:
 	msg = &conn->read_msg;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
 	read_size = msg->msg_iter.count;
+	first_kvec = msg->msg_iter.kvec;
+	first_off = msg->msg_iter.iov_offset;
 #else
 	read_size = conn->read_size;
 	first_iov = msg->msg_iov;
@@ -563,6 +660,9 @@ restart:
 		 */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
 		sBUG_ON(msg->msg_iter.count + res != read_size);
+		if (conn->read_state == RX_DATA && conn->rx_ddigest_fused)
+			iscsi_rx_ddigest_update(conn, first_kvec, first_off,
+						res);
 		res = msg->msg_iter.count;
 #else
 		sBUG_ON((res >= first_len) && (first_iov->iov_len != 0));
@@ -580,8 +680,14 @@ restart:
 			goto restart;
 		default:
 			if (!conn->closing) {
-				PRINT_ERROR("sock_recvmsg() failed: %d (conn %p)",
-					    res, conn);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+				if (res == -EIO &&
+				    inet_csk(conn->sock->sk)->icsk_ulp_ops)
+					iscsi_tls_rx_control(conn);
+				else
+#endif
+					PRINT_ERROR("sock_recvmsg() failed: %d (conn %p)",
+						    res, conn);
 				mark_conn_closed(conn);
 			}
 			if (res == 0)
@@ -604,16 +710,24 @@ static int iscsi_rx_check_ddigest(struct iscsi_conn *conn)
 	if (res == 0) {
 		conn->read_state = RX_END;
 
-		if (cmnd->pdu.datasize <= 16 * 1024) {
+		if (conn->rx_ddigest_fused ||
+		    cmnd->pdu.datasize <= 16 * 1024) {
 			/*
-			 * It's cache hot, so let's compute it inline. The
-			 * choice here about what will expose more latency:
-			 * possible cache misses or the digest calculation.
+			 * If do_recv() has accumulated the digest, only the
+			 * comparison is left. Otherwise the data are cache
+			 * hot, so let's compute it inline. The choice here
+			 * about what will expose more latency: possible cache
+			 * misses or the digest calculation.
 			 */
-			TRACE_DBG("cmnd %p, opcode %x: checking RX ddigest inline",
-				  cmnd, cmnd_opcode(cmnd));
+			TRACE_DBG("cmnd %p, opcode %x: checking RX ddigest inline (fused %d)",
+				  cmnd, cmnd_opcode(cmnd),
+				  conn->rx_ddigest_fused);
 			cmnd->ddigest_checked = 1;
-			res = digest_rx_data(cmnd);
+			if (conn->rx_ddigest_fused)
+				res = digest_rx_data_crc(cmnd,
+							 conn->rx_ddigest_crc);
+			else
+				res = digest_rx_data(cmnd);
 			if (unlikely(res != 0)) {
 				struct iscsi_cmnd *orig_req;
 
@@ -718,7 +832,7 @@ static int process_read_io(struct iscsi_conn *conn, int *closed)
 				if (cmnd->pdu.datasize == 0)
 					conn->read_state = RX_END;
 				else
-					conn->read_state = RX_DATA;
+					iscsi_rx_start_data(conn);
 			} else if (res > 0) {
 				conn->read_state = RX_CMD_CONTINUE;
 			} else {
@@ -740,7 +854,7 @@ static int process_read_io(struct iscsi_conn *conn, int *closed)
 				if (cmnd->pdu.datasize == 0)
 					conn->read_state = RX_END;
 				else
-					conn->read_state = RX_DATA;
+					iscsi_rx_start_data(conn);
 			}
 			break;
 
@@ -893,6 +1007,8 @@ static void scst_do_job_rd(struct iscsi_thread_pool *p)
 
 		spin_lock_bh(&p->rd_lock);
 
+		p->rd_io_count++;
+
 		if (unlikely(closed))
 			continue;
 
@@ -959,6 +1075,7 @@ int istrd(void *arg)
 void req_add_to_write_timeout_list(struct iscsi_cmnd *req)
 {
 	struct iscsi_conn *conn;
+	unsigned long timeout_time;
 	bool set_conn_tm_active = false;
 
 	TRACE_ENTRY();
@@ -982,72 +1099,34 @@ void req_add_to_write_timeout_list(struct iscsi_cmnd *req)
 	req->on_write_timeout_list = 1;
 	req->write_start = jiffies;
 
-	if (unlikely(cmnd_opcode(req) == ISCSI_OP_NOP_OUT)) {
-		unsigned long req_tt = iscsi_get_timeout_time(req);
-		struct iscsi_cmnd *r;
-		bool inserted = false;
-
-		list_for_each_entry(r, &conn->write_timeout_list, write_timeout_list_entry) {
-			unsigned long tt = iscsi_get_timeout_time(r);
-
-			if (time_after(tt, req_tt)) {
-				TRACE_DBG("Add NOP IN req %p (tt %ld) before req %p (tt %ld)",
-					  req, req_tt, r, tt);
-				list_add_tail(&req->write_timeout_list_entry,
-					      &r->write_timeout_list_entry);
-				inserted = true;
-				break;
-			}
-
-			TRACE_DBG("Skipping op %x req %p (tt %ld)",
-				  cmnd_opcode(r), r, tt);
-		}
-		if (!inserted) {
-			TRACE_DBG("Add NOP IN req %p in the tail", req);
-			list_add_tail(&req->write_timeout_list_entry, &conn->write_timeout_list);
-		}
+	/* All requests of a list have the same timeout, so append */
+	if (unlikely(cmnd_opcode(req) == ISCSI_OP_NOP_OUT))
+		list_add_tail(&req->write_timeout_list_entry, &conn->nop_timeout_list);
+	else
+		list_add_tail(&req->write_timeout_list_entry, &conn->write_timeout_list);
 
-		/* We suppose that nop_in_timeout must be <= data_rsp_timeout */
-		req_tt += ISCSI_ADD_SCHED_TIME;
-		if (timer_pending(&conn->rsp_timer) &&
-		    time_after(conn->rsp_timer.expires, req_tt)) {
-			TRACE_DBG("Timer adjusted for sooner expired NOP IN req %p",
-				  req);
-			mod_timer(&conn->rsp_timer, req_tt);
-		}
+	if (unlikely(conn->conn_tm_active ||
+		     test_bit(ISCSI_CMD_ABORTED, &req->prelim_compl_flags))) {
+		set_conn_tm_active = true;
+		timeout_time = req->write_start + ISCSI_TM_DATA_WAIT_TIMEOUT;
+		if (test_bit(ISCSI_CMD_ABORTED, &req->prelim_compl_flags))
+			req_add_to_tm_wait_list(req);
 	} else {
-		list_add_tail(&req->write_timeout_list_entry, &conn->write_timeout_list);
+		timeout_time = iscsi_get_timeout_time(req);
 	}
 
-	if (!timer_pending(&conn->rsp_timer)) {
-		unsigned long timeout_time;
-
-		if (unlikely(conn->conn_tm_active ||
-			     test_bit(ISCSI_CMD_ABORTED, &req->prelim_compl_flags))) {
-			set_conn_tm_active = true;
-			timeout_time = req->write_start +
-					ISCSI_TM_DATA_WAIT_TIMEOUT;
-		} else {
-			timeout_time = iscsi_get_timeout_time(req);
-		}
-
-		timeout_time += ISCSI_ADD_SCHED_TIME;
+	timeout_time += ISCSI_ADD_SCHED_TIME;
 
+	if (!timer_pending(&conn->rsp_timer)) {
 		TRACE_DBG("Starting timer on %ld (con %p, write_start %ld)",
 			  timeout_time, conn, req->write_start);
-
 		conn->rsp_timer.expires = timeout_time;
 		add_timer(&conn->rsp_timer);
-	} else if (unlikely(test_bit(ISCSI_CMD_ABORTED, &req->prelim_compl_flags))) {
-		unsigned long timeout_time = jiffies +
-			ISCSI_TM_DATA_WAIT_TIMEOUT + ISCSI_ADD_SCHED_TIME;
-
-		set_conn_tm_active = true;
-		if (time_after(conn->rsp_timer.expires, timeout_time)) {
-			TRACE_MGMT_DBG("Mod timer on %ld (conn %p)",
-				       timeout_time, conn);
-			mod_timer(&conn->rsp_timer, timeout_time);
-		}
+	} else if (time_after(conn->rsp_timer.expires, timeout_time)) {
+		/* E.g. a Nop-In, since nop_in_timeout <= data_rsp_timeout */
+		TRACE_DBG("Mod timer on %ld (conn %p, req %p)", timeout_time,
+			  conn, req);
+		mod_timer(&conn->rsp_timer, timeout_time);
 	}
 
 	spin_unlock_bh(&conn->write_list_lock);
@@ -1068,6 +1147,143 @@ out:
 	TRACE_EXIT();
 }
 
+/*
+ * Folds the part of the @len bytes at @page + @offset that has not been
+ * digested yet into the running TX data digest right before handing them to
+ * the socket. @pos is the offset of these bytes in the command buffer. A
+ * partially sent chunk is revisited after -EAGAIN, hence the check.
+ */
+static void iscsi_tx_ddigest_update(struct iscsi_conn *conn, struct page *page,
+				    unsigned int offset, size_t len, u32 pos)
+{
+	u32 done;
+
+	if (conn->write_ddigest_offset >= pos + len)
+		return;
+
+	EXTRACHECKS_BUG_ON(conn->write_ddigest_offset < pos);
+	done = conn->write_ddigest_offset - pos;
+
+	conn->write_ddigest_crc = digest_update(conn->write_ddigest_crc,
+				page_address(page) + offset + done, len - done);
+	conn->write_ddigest_offset = pos + len;
+}
+
+#ifdef ISCSI_TX_ZEROCOPY
+/* Bytes sent with MSG_ZEROCOPY and sends that fell back to copying */
+static atomic_long_t iscsi_tx_zc_bytes;
+static atomic_long_t iscsi_tx_zc_fallbacks;
+/* Commands completed and skbs whose data had to be copied after all */
+static atomic_long_t iscsi_tx_zc_completions;
+static atomic_long_t iscsi_tx_zc_copied;
+
+/* Might be called on SIRQ */
+static void iscsi_tx_zc_complete(struct sk_buff *skb, struct ubuf_info *uarg,
+				 bool zerocopy_success)
+{
+	struct iscsi_cmnd *cmnd = container_of(uarg, struct iscsi_cmnd,
+					       tx_zc_ubuf);
+
+	if (skb && !zerocopy_success)
+		atomic_long_inc(&iscsi_tx_zc_copied);
+
+	if (!refcount_dec_and_test(&uarg->refcnt))
+		return;
+
+	TRACE_DBG("MSG_ZEROCOPY completion for cmd %p", cmnd);
+	atomic_long_inc(&iscsi_tx_zc_completions);
+	cmnd_put(cmnd);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static const struct ubuf_info_ops iscsi_tx_zc_ubuf_ops = {
+	.complete = iscsi_tx_zc_complete,
+};
+#endif
+
+static struct ubuf_info *iscsi_tx_zc_get_ubuf(struct iscsi_cmnd *cmnd)
+{
+	struct ubuf_info *uarg = &cmnd->tx_zc_ubuf;
+
+	if (!cmnd->tx_zc_used) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+		uarg->ops = &iscsi_tx_zc_ubuf_ops;
+#else
+		uarg->callback = iscsi_tx_zc_complete;
+#endif
+		uarg->flags = SKBFL_ZEROCOPY_FRAG | SKBFL_DONT_ORPHAN;
+		/* Dropped by iscsi_tx_zc_put() */
+		refcount_set(&uarg->refcnt, 1);
+		cmnd_get(cmnd);
+		cmnd->tx_zc_used = true;
+	}
+
+	return uarg;
+}
+
+/*
+ * Drops the write thread's reference to the MSG_ZEROCOPY completion of
+ * cmnd. The cmnd, hence its data buffer, stays alive until the network stack
+ * drops the references of the skbs.
+ */
+static void iscsi_tx_zc_put(struct iscsi_cmnd *cmnd)
+{
+	if (cmnd->tx_zc_used)
+		iscsi_tx_zc_complete(NULL, &cmnd->tx_zc_ubuf, true);
+}
+
+/*
+ * Returns the flags to send the data of a command buffer with if tx_zerocopy
+ * is enabled. Without scatter/gather and checksum offload TCP would copy
+ * the data anyway, so use a plain copying send then. The same applies if
+ * an upper layer protocol like kTLS is attached to the socket, since it
+ * rejects MSG_ZEROCOPY.
+ */
+static int iscsi_tx_zc_flags(struct sock *sk)
+{
+	netdev_features_t caps = READ_ONCE(sk->sk_route_caps);
+
+	if ((caps & NETIF_F_SG) && (caps & NETIF_F_CSUM_MASK) &&
+	    !inet_csk(sk)->icsk_ulp_ops)
+		return MSG_ZEROCOPY;
+
+	atomic_long_inc(&iscsi_tx_zc_fallbacks);
+	return 0;
+}
+#else
+static inline void iscsi_tx_zc_put(struct iscsi_cmnd *cmnd)
+{
+}
+#endif
+
+ssize_t iscsi_tx_zerocopy_stats_show(char *buf)
+{
+#ifdef ISCSI_TX_ZEROCOPY
+	return sysfs_emit(buf, "%d %ld %ld %ld %ld\n", iscsi_tx_zerocopy,
+			  atomic_long_read(&iscsi_tx_zc_bytes),
+			  atomic_long_read(&iscsi_tx_zc_fallbacks),
+			  atomic_long_read(&iscsi_tx_zc_completions),
+			  atomic_long_read(&iscsi_tx_zc_copied));
+#else
+	return sysfs_emit(buf, "%d\n", iscsi_tx_zerocopy);
+#endif
+}
+
+/*
+ * Max number of PDUs of a connection sent back to back with MSG_MORE before
+ * the connection yields to the others of its thread pool.
+ */
+#define ISCSI_TX_BATCH_MAX	32
+
+/*
+ * Returns MSG_MORE unless @pdu_end is set, i.e. the bytes to be sent end the
+ * current PDU, and no other PDU of the batch follows.
+ */
+static inline int iscsi_tx_more(const struct iscsi_conn *conn, bool pdu_end)
+{
+	return pdu_end && !conn->tx_more ? 0 : MSG_MORE;
+}
+
 static int write_data(struct iscsi_conn *conn)
 {
 	struct socket *sock;
@@ -1085,7 +1301,7 @@ static int write_data(struct iscsi_conn *conn)
 	size_t saved_size, size, sg_size;
 	size_t sendsize, length;
 	int offset, idx, flags, res = 0;
-	bool ref_cmd_to_parent;
+	bool ref_cmd_to_parent, pdu_end;
 
 	TRACE_ENTRY();
 
@@ -1107,18 +1323,31 @@ static int write_data(struct iscsi_conn *conn)
 	size = conn->write_size;
 	saved_size = size;
 
+	/* Whether the data are the last bytes of the PDU */
+	pdu_end = !write_cmnd->pdu.datasize ||
+		(!(write_cmnd->pdu.datasize & 3) &&
+		 conn->ddigest_type == DIGEST_NONE);
+
 	if (conn->write_iop) {
-		struct file *file = conn->file;
 		struct kvec *iop = conn->write_iop;
 		int count = conn->write_iop_used;
-		loff_t off;
+		struct msghdr iov_msg;
+		size_t iov_size;
+		int i;
 
 		sBUG_ON(count > ARRAY_SIZE(conn->write_iov));
 
 		while (true) {
-			off = 0;
+			iov_size = 0;
+			for (i = 0; i < count; i++)
+				iov_size += iop[i].iov_len;
 
-			res = scst_writev(file, iop, count, &off);
+			memset(&iov_msg, 0, sizeof(iov_msg));
+			iov_msg.msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT |
+				iscsi_tx_more(conn, iov_size == size && pdu_end);
+
+			res = kernel_sendmsg(conn->sock, &iov_msg, iop, count,
+					     iov_size);
 			TRACE_WRITE("sid %#Lx, cid %u, res %d, iov_len %zd",
 				    (unsigned long long)conn->session->sid,
 				    conn->cid, res, iop->iov_len);
@@ -1172,7 +1401,8 @@ static int write_data(struct iscsi_conn *conn)
 	    (!parent_req->scst_cmd || parent_req->scst_state == ISCSI_CMD_STATE_AEN ||
 	     !scst_cmd_get_dh_data_buff_alloced(parent_req->scst_cmd)))
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
-		flags |= MSG_SPLICE_PAGES;
+		flags |= iscsi_tx_zerocopy ? iscsi_tx_zc_flags(sock->sk) :
+					     MSG_SPLICE_PAGES;
 #else
 		sock_sendpage = sock->ops->sendpage;
 	else
@@ -1215,10 +1445,12 @@ static int write_data(struct iscsi_conn *conn)
 	while (true) {
 		sendsize = min_t(size_t, size, length);
 
-		if (sendsize == size)
-			flags &= ~MSG_MORE;
-		else
-			flags |= MSG_MORE;
+		flags &= ~MSG_MORE;
+		flags |= iscsi_tx_more(conn, sendsize == size && pdu_end);
+
+		if (!(conn->ddigest_type & DIGEST_NONE))
+			iscsi_tx_ddigest_update(conn, page, offset, sendsize,
+					conn->write_offset + sg_size - size);
 
 		while (sendsize) {
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
@@ -1226,6 +1458,8 @@ static int write_data(struct iscsi_conn *conn)
 #else
 			memset(&msg, 0, sizeof(struct msghdr));
 			msg.msg_flags = flags;
+			if (flags & MSG_ZEROCOPY)
+				msg.msg_ubuf = iscsi_tx_zc_get_ubuf(write_cmnd);
 
 			bvec_set_page(&bvec, page, sendsize, offset);
 			iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, &bvec, 1, sendsize);
@@ -1247,6 +1481,11 @@ static int write_data(struct iscsi_conn *conn)
 				goto out_err;
 			}
 
+#ifdef ISCSI_TX_ZEROCOPY
+			if (flags & MSG_ZEROCOPY)
+				atomic_long_add(res, &iscsi_tx_zc_bytes);
+#endif
+
 			offset += res;
 			sendsize -= res;
 			size -= res;
@@ -1334,6 +1573,8 @@ static int tx_ddigest(struct iscsi_cmnd *cmnd, int state)
 
 	TRACE_DBG("Sending data digest %x (cmd %p)", cmnd->ddigest, cmnd);
 
+	msg.msg_flags |= iscsi_tx_more(cmnd->conn, true);
+
 	iov.iov_base = (char *)(&cmnd->ddigest) + (sizeof(u32) - rest);
 	iov.iov_len = rest;
 
@@ -1380,6 +1621,9 @@ static int tx_padding(struct iscsi_cmnd *cmnd, int state)
 
 	TRACE_DBG("Sending %d padding bytes (cmd %p)", rest, cmnd);
 
+	msg.msg_flags |= iscsi_tx_more(cmnd->conn,
+				       cmnd->conn->ddigest_type == DIGEST_NONE);
+
 	iov.iov_base = (char *)&padding;
 	iov.iov_len = rest;
 
@@ -1412,6 +1656,46 @@ static int iscsi_do_send(struct iscsi_conn *conn, int state)
 	return res;
 }
 
+/* Pushes out the data that have been queued on the socket with MSG_MORE */
+static void iscsi_tx_push(struct iscsi_conn *conn)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	tcp_sock_set_cork(conn->sock->sk, false);
+#else
+	int opt = 1;
+	mm_segment_t oldfs;
+
+	/* Setting TCP_NODELAY, which is already set, pushes pending frames */
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	conn->sock->ops->setsockopt(conn->sock, SOL_TCP, TCP_NODELAY,
+				    KERNEL_SOCKPTR(&opt), sizeof(opt));
+	set_fs(oldfs);
+#endif
+}
+
+/*
+ * Ends the current batch of PDUs. If @push is true, the last PDU of the batch
+ * has been sent with MSG_MORE, because another PDU was expected to follow.
+ */
+static void iscsi_tx_flush(struct iscsi_conn *conn, bool push)
+{
+	int i;
+
+	iscsi_extracheck_is_wr_thread(conn);
+
+	if (!conn->tx_batch_pdus)
+		return;
+
+	if (push)
+		iscsi_tx_push(conn);
+
+	i = min_t(int, ilog2(conn->tx_batch_pdus),
+		  ISCSI_TX_BATCH_HIST_SIZE - 1);
+	conn->tx_batch_hist[i]++;
+	conn->tx_batch_pdus = 0;
+}
+
 /*
  * No locks, conn is wr processing.
  *
@@ -1436,11 +1720,24 @@ int iscsi_send(struct iscsi_conn *conn)
 	case TX_INIT:
 		sBUG_ON(cmnd);
 		conn->write_cmnd = iscsi_get_send_cmnd(conn);
-		if (!conn->write_cmnd)
+		if (!conn->write_cmnd) {
+			/* The expected PDU has been released meanwhile */
+			iscsi_tx_flush(conn, true);
 			goto out;
+		}
 
 		cmnd = conn->write_cmnd;
+		/*
+		 * Send with MSG_MORE while more responses are ready, so small
+		 * PDUs of several commands share TCP segments. No
+		 * write_list_lock, in the worst case the batch ends early.
+		 */
+		conn->tx_batch_pdus++;
+		conn->tx_more = conn->tx_batch_pdus < ISCSI_TX_BATCH_MAX &&
+				!list_empty(&conn->write_list);
 		cmnd_tx_start(cmnd);
+		conn->write_ddigest_crc = ~0;
+		conn->write_ddigest_offset = conn->write_offset;
 		if (!(conn->hdigest_type & DIGEST_NONE))
 			init_tx_hdigest(cmnd);
 		conn->write_state = TX_BHS_DATA;
@@ -1465,6 +1762,7 @@ int iscsi_send(struct iscsi_conn *conn)
 			break;
 		fallthrough;
 	case TX_INIT_DDIGEST:
+		digest_tx_data_crc(cmnd, conn->write_ddigest_crc);
 		cmnd->conn->write_size = sizeof(u32);
 		conn->write_state = TX_DDIGEST;
 		fallthrough;
@@ -1487,11 +1785,16 @@ int iscsi_send(struct iscsi_conn *conn)
 	}
 	cmnd_tx_end(cmnd);
 
+	iscsi_tx_zc_put(cmnd);
 	rsp_cmnd_release(cmnd);
 
 	conn->write_cmnd = NULL;
 	conn->write_state = TX_INIT;
 
+	/* The last PDU of a batch has been sent without MSG_MORE */
+	if (!conn->tx_more)
+		iscsi_tx_flush(conn, false);
+
 out:
 	TRACE_EXIT_RES(res);
 	return res;
@@ -1533,9 +1836,17 @@ static void scst_do_job_wr(struct iscsi_thread_pool *p)
 
 		conn_get(conn);
 
-		rc = iscsi_send(conn);
+		/*
+		 * Send the ready PDUs of the connection back to back, until
+		 * the batch ends.
+		 */
+		do {
+			rc = iscsi_send(conn);
+		} while (rc > 0 && conn->tx_batch_pdus);
 
 		spin_lock_bh(&p->wr_lock);
+
+		p->wr_io_count++;
 #ifdef CONFIG_SCST_EXTRACHECKS
 		conn->wr_task = NULL;
 #endif
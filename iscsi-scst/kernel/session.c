@@ -75,6 +75,9 @@ static int iscsi_session_alloc(struct iscsi_target *target, struct iscsi_kern_se
 
 	session->next_ttt = 1;
 
+	/* sgv_hiwmk_failures() counts since module load, not per session */
+	session->cmd_window_sgv_failures = sgv_hiwmk_failures();
+
 	session->scst_sess = scst_register_session(target->scst_tgt, 0, name, session, NULL, NULL);
 	if (!session->scst_sess) {
 		PRINT_ERROR("%s", "scst_register_session() failed");
@@ -487,22 +490,26 @@ static ssize_t iscsi_sess_thread_pid_show(struct kobject *kobj, struct kobj_attr
 	struct scst_session *scst_sess = container_of(kobj, struct scst_session, sess_kobj);
 	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_sess);
 	struct iscsi_thread_pool *thr_pool = sess->sess_thr_pool;
+	struct iscsi_thread_pool *p;
 	struct iscsi_thread *t;
 	ssize_t res = -ENOENT;
+	int i;
 
 	if (!thr_pool)
 		goto out;
 
 	res = 0;
 
-	mutex_lock(&thr_pool->tp_mutex);
-	list_for_each_entry(t, &thr_pool->threads_list, threads_list_entry)
-		res += sysfs_emit_at(buf, res, "%d%s",
-				     task_pid_vnr(t->thr),
-				     list_is_last(&t->threads_list_entry,
-						  &thr_pool->threads_list) ?
-				     "\n" : " ");
-	mutex_unlock(&thr_pool->tp_mutex);
+	for (i = -1; i < thr_pool->nr_affine_pools; i++) {
+		p = i < 0 ? thr_pool : thr_pool->affine_pools[i];
+		mutex_lock(&p->tp_mutex);
+		list_for_each_entry(t, &p->threads_list, threads_list_entry)
+			res += sysfs_emit_at(buf, res, "%s%d", res ? " " : "",
+					     task_pid_vnr(t->thr));
+		mutex_unlock(&p->tp_mutex);
+	}
+	if (res)
+		res += sysfs_emit_at(buf, res, "\n");
 
 out:
 	return res;
@@ -511,6 +518,45 @@ out:
 static struct kobj_attribute iscsi_sess_thread_pid =
 	__ATTR(thread_pid, 0444, iscsi_sess_thread_pid_show, NULL);
 
+static ssize_t iscsi_sess_cmd_window_show(struct kobject *kobj, struct kobj_attribute *attr,
+					  char *buf)
+{
+	struct scst_session *scst_sess = container_of(kobj, struct scst_session, sess_kobj);
+	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_sess);
+	unsigned int window;
+	unsigned long shrinks;
+	u64 base, avg;
+
+	spin_lock(&sess->sn_lock);
+	window = sess->cmd_window ? : sess->tgt_params.queued_cmnds;
+	shrinks = sess->cmd_window_shrinks;
+	base = sess->cmd_lat_base_ns;
+	avg = sess->cmd_lat_avg_ns;
+	spin_unlock(&sess->sn_lock);
+
+	return sysfs_emit(buf, "%u %llu %llu %lu\n", window,
+			  div_u64(base, NSEC_PER_USEC),
+			  div_u64(avg, NSEC_PER_USEC), shrinks);
+}
+
+static struct kobj_attribute iscsi_sess_cmd_window =
+	__ATTR(cmd_window, 0444, iscsi_sess_cmd_window_show, NULL);
+
+static ssize_t iscsi_sess_r2t_stall_show(struct kobject *kobj, struct kobj_attribute *attr,
+					 char *buf)
+{
+	struct scst_session *scst_sess = container_of(kobj, struct scst_session, sess_kobj);
+	struct iscsi_session *sess = scst_sess_get_tgt_priv(scst_sess);
+
+	return sysfs_emit(buf, "%lld %lld\n",
+			  (long long)atomic64_read(&sess->r2t_stalls),
+			  (long long)div_u64(atomic64_read(&sess->r2t_stall_ns),
+					     NSEC_PER_USEC));
+}
+
+static struct kobj_attribute iscsi_sess_r2t_stall =
+	__ATTR(r2t_stall, 0444, iscsi_sess_r2t_stall_show, NULL);
+
 const struct attribute *iscsi_sess_attrs[] = {
 	&iscsi_sess_attr_initial_r2t.attr,
 	&iscsi_sess_attr_immediate_data.attr,
@@ -524,5 +570,7 @@ const struct attribute *iscsi_sess_attrs[] = {
 	&iscsi_attr_sess_sid.attr,
 	&iscsi_sess_attr_reinstating.attr,
 	&iscsi_sess_thread_pid.attr,
+	&iscsi_sess_cmd_window.attr,
+	&iscsi_sess_r2t_stall.attr,
 	NULL,
 };
@@ -23,6 +23,7 @@
 #include <sys/stat.h>
 
 #include "iscsid.h"
+#include "tls.h"
 
 #define ISCSI_CONN_NEW		1
 #define ISCSI_CONN_EXIT		5
@@ -58,6 +59,7 @@ void conn_free(struct connection *conn)
 	free(conn->user);
 	if (conn->auth_method == AUTH_CHAP)
 		free(conn->auth.chap.challenge);
+	tls_conn_free(conn);
 	free(conn);
 	return;
 }
@@ -39,6 +39,7 @@
 
 #include "iscsid.h"
 #include "iscsi_adm.h"
+#include "tls.h"
 
 static char *server_addresses[ADDR_MAX];
 uint16_t server_port = ISCSI_LISTEN_PORT;
@@ -62,6 +63,8 @@ static struct option const long_options[] = {
 	{"gid", required_argument, 0, 'g'},
 	{"address", required_argument, 0, 'a'},
 	{"port", required_argument, 0, 'p'},
+	{"tls-cert", required_argument, 0, 'C'},
+	{"tls-key", required_argument, 0, 'K'},
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
 	{0, 0, 0, 0},
@@ -85,6 +88,10 @@ iSCSI target daemon.\n\
   -g, --gid=gid              run as gid, default is current user group\n\
   -a, --address=address ...  listen on specified space-separated list of local address instead of all\n\
   -p, --port=port            listen on specified port instead of 3260\n\
+  -C, --tls-cert=file        require TLS on iSCSI/TCP connections, using the\n\
+                             PEM certificate (chain) in file\n\
+  -K, --tls-key=file         PEM private key for --tls-cert, if not in the\n\
+                             certificate file\n\
   -h, --help                 display this help and exit\n\
 ");
 	}
@@ -506,6 +513,12 @@ static void accept_connection(int listen)
 	conn->is_discovery = tcp_is_discovery;
 	conn_read_pdu(conn);
 
+	if (tls_enabled()) {
+		if (tls_conn_start(conn) != 0)
+			goto out_free;
+		conn->iostate = IOSTATE_TLS_HANDSHAKE;
+	}
+
 	incoming_cnt++;
 
 out:
@@ -677,6 +690,19 @@ again:
 		}
 
 		break;
+
+	case IOSTATE_TLS_HANDSHAKE:
+		res = tls_conn_handshake(conn, &pollfd->events);
+		if (res < 0) {
+			conn->state = STATE_DROP;
+			goto out;
+		}
+		if (res > 0) {
+			conn_read_pdu(conn);
+			pollfd->events = POLLIN;
+		}
+		break;
+
 	default:
 		log_error("illegal iostate %d for port %d!\n", conn->iostate,
 			pollfd->fd);
@@ -824,6 +850,7 @@ static void init_max_params(void)
 	    (session_keys[key_max_xmit_data_length].max != -1) ||
 	    (session_keys[key_max_burst_length].local_def != -1) ||
 	    (session_keys[key_max_burst_length].max != -1) ||
+	    (session_keys[key_first_burst_length].local_def != -1) ||
 	    (session_keys[key_first_burst_length].max != -1)) {
 		log_error("Wrong session_keys initialization");
 		exit(-1);
@@ -849,10 +876,12 @@ static void init_max_params(void)
 	session_keys[key_max_burst_length].local_def = iscsi_init_params.max_data_seg_len;
 	session_keys[key_max_burst_length].max = iscsi_init_params.max_data_seg_len;
 
-	/* FirstBurstLength */
-	session_keys[key_first_burst_length].local_def =
-		min((int)session_keys[key_first_burst_length].local_def,
-		    iscsi_init_params.max_data_seg_len);
+	/*
+	 * FirstBurstLength. As large as MaxBurstLength, so that with the
+	 * default ImmediateData=Yes and InitialR2T=No writes up to that
+	 * size need no R2T round trip at all.
+	 */
+	session_keys[key_first_burst_length].local_def = iscsi_init_params.max_data_seg_len;
 	session_keys[key_first_burst_length].max = iscsi_init_params.max_data_seg_len;
 
 	return;
@@ -862,6 +891,7 @@ int main(int argc, char **argv)
 {
 	int ch, longindex;
 	char *config = NULL;
+	char *tls_cert = NULL, *tls_key = NULL;
 	uid_t uid = 0;
 	gid_t gid = 0;
 	int err;
@@ -883,7 +913,7 @@ int main(int argc, char **argv)
 	int rc = sigaction(SIGPIPE, &act, NULL);
 	assert(rc == 0);
 
-	while ((ch = getopt_long(argc, argv, "c:fd:s:u:g:a:p:vh", long_options, &longindex)) >= 0) {
+	while ((ch = getopt_long(argc, argv, "c:fd:s:u:g:a:p:C:K:vh", long_options, &longindex)) >= 0) {
 		switch (ch) {
 		case 'c':
 			config = optarg;
@@ -925,6 +955,12 @@ int main(int argc, char **argv)
 		case 'p':
 			server_port = (uint16_t)strtoul(optarg, NULL, 0);
 			break;
+		case 'C':
+			tls_cert = optarg;
+			break;
+		case 'K':
+			tls_key = optarg;
+			break;
 		case 'v':
 			printf("%s version %s\n", program_name, ISCSI_VERSION_STRING);
 			exit(0);
@@ -1025,6 +1061,18 @@ int main(int argc, char **argv)
 		setsid();
 	}
 
+	if (tls_cert || tls_key) {
+		if (!tls_cert) {
+			log_error("--tls-key requires --tls-cert");
+			exit(1);
+		}
+		if (tls_init(tls_cert, tls_key) != 0) {
+			log_error("Unable to set up TLS (is %s built with "
+				  "ISCSI_TLS=1?)", program_name);
+			exit(1);
+		}
+	}
+
 	err = config_load(config);
 	if (err != 0)
 		exit(1);
@@ -383,11 +383,16 @@ static void text_scan_login(struct connection *conn)
 						goto out;
 					}
 					break;
-				case key_initial_r2t:
-					val = 1;
-					break;
-				case key_immediate_data:
-					val = 0;
+				case key_first_burst_length:
+					/*
+					 * Each immediate data or unsolicited
+					 * Data-Out PDU takes an RX buffer of
+					 * TargetRecvDataSegmentLength bytes.
+					 * Let the unsolicited data fit in one
+					 * of them; the rest is fetched by an
+					 * RDMA READ.
+					 */
+					val = min(val, conn->session_params[key_target_recv_data_length].val);
 					break;
 				}
 			} else if (idx == key_rdma_extensions && val != 0) {
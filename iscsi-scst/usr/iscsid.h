@@ -128,6 +128,9 @@ struct connection {
 
 	bool is_iser;
 
+	/* SSL object while the TLS handshake is in progress */
+	void *tls;
+
 	int (*cork_transmit)(int fd);
 	int (*uncork_transmit)(int fd);
 	int (*getsockname)(int fd, struct sockaddr *name, socklen_t *namelen);
@@ -140,6 +143,7 @@ struct connection {
 #define IOSTATE_WRITE_BHS	3
 #define IOSTATE_WRITE_AHS	4
 #define IOSTATE_WRITE_DATA	5
+#define IOSTATE_TLS_HANDSHAKE	6
 
 #define STATE_FREE		0
 #define STATE_SECURITY		1
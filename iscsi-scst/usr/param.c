@@ -376,7 +376,7 @@ struct iscsi_key session_keys[] = {
 	{"MaxRecvDataSegmentLength", 8192, -1, 512, -1, 1, &minimum_ops},
 	{"MaxXmitDataSegmentLength", 8192, -1, 512, -1, 1, &minimum_ops},
 	{"MaxBurstLength", 262144, -1, 512, -1, 1, &minimum_ops},
-	{"FirstBurstLength", 65536, 65536, 512, -1, 1, &minimum_ops},
+	{"FirstBurstLength", 65536, -1, 512, -1, 1, &minimum_ops},
 	{"DefaultTime2Wait", 2, 0, 0, 0, 0, &maximum_ops},
 	{"DefaultTime2Retain", 20, 0, 0, 0, 0, &minimum_ops},
 	{"MaxOutstandingR2T", 1, 32, 1, 65535, 1, &minimum_ops},
@@ -390,7 +390,7 @@ struct iscsi_key session_keys[] = {
 	{"OFMarkInt", 2048, 2048, 1, 65535, 0, &marker_ops},
 	{"IFMarkInt", 2048, 2048, 1, 65535, 0, &marker_ops},
 	{"RDMAExtensions", 0, 0, 0, 0, 1, &and_ops},
-	{"TargetRecvDataSegmentLength", 8192, 512, 512, -1, 0, &minimum_ops},
+	{"TargetRecvDataSegmentLength", 8192, 8192, 512, -1, 0, &minimum_ops},
 	{"InitiatorRecvDataSegmentLength", 8192, -1, 512, -1, 0, &minimum_ops},
 	{"MaxAHSLength", 256, 0, 0, -1, 0, &minimum_ops},
 	{"TaggedBufferForSolicitedDataOnly", 0, 0, 0, 0, 0, &and_ops},
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ *  tls - TLS handshake for iSCSI connections, which are then handed over to
+ *  the kernel with kernel TLS (kTLS) installed on the socket.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#ifdef CONFIG_ISCSI_TLS
+
+#include <poll.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "iscsid.h"
+#include "tls.h"
+
+static SSL_CTX *tls_ctx;
+
+static void tls_log_errors(const char *what)
+{
+	unsigned long e;
+
+	while ((e = ERR_get_error()) != 0)
+		log_error("%s: %s", what, ERR_error_string(e, NULL));
+}
+
+int tls_init(const char *cert_file, const char *key_file)
+{
+	SSL_CTX *ctx;
+
+	ctx = SSL_CTX_new(TLS_server_method());
+	if (ctx == NULL) {
+		tls_log_errors("SSL_CTX_new() failed");
+		goto out_err;
+	}
+
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+	/* Receive offload of TLS 1.3 needs OpenSSL 3.2 or later */
+	SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+#endif
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	/*
+	 * The kernel only handles application data records, so there must
+	 * not be any TLS 1.3 post-handshake messages like session tickets.
+	 * Read-ahead must stay disabled as well, otherwise OpenSSL could
+	 * consume login PDU records that the kernel has to see.
+	 */
+	SSL_CTX_set_num_tickets(ctx, 0);
+	SSL_CTX_set_read_ahead(ctx, 0);
+
+	if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1) {
+		tls_log_errors(cert_file);
+		goto out_free;
+	}
+
+	if (SSL_CTX_use_PrivateKey_file(ctx, key_file ? : cert_file,
+					SSL_FILETYPE_PEM) != 1) {
+		tls_log_errors(key_file ? : cert_file);
+		goto out_free;
+	}
+
+	if (SSL_CTX_check_private_key(ctx) != 1) {
+		tls_log_errors("Private key does not match the certificate");
+		goto out_free;
+	}
+
+	tls_ctx = ctx;
+	log_info("TLS enabled for iSCSI connections, certificate %s",
+		 cert_file);
+	return 0;
+
+out_free:
+	SSL_CTX_free(ctx);
+
+out_err:
+	return -1;
+}
+
+bool tls_enabled(void)
+{
+	return tls_ctx != NULL;
+}
+
+int tls_conn_start(struct connection *conn)
+{
+	SSL *ssl;
+
+	ssl = SSL_new(tls_ctx);
+	if (ssl == NULL) {
+		tls_log_errors("SSL_new() failed");
+		return -1;
+	}
+
+	if (SSL_set_fd(ssl, conn->fd) != 1) {
+		tls_log_errors("SSL_set_fd() failed");
+		SSL_free(ssl);
+		return -1;
+	}
+
+	conn->tls = ssl;
+	return 0;
+}
+
+/*
+ * Advances the handshake of a non-blocking connection. Returns 0 if
+ * the handshake needs to wait for *events on the socket, 1 if it is
+ * complete and kTLS is active for both directions and -1 on error.
+ */
+int tls_conn_handshake(struct connection *conn, short *events)
+{
+	SSL *ssl = conn->tls;
+	int rc;
+
+	rc = SSL_accept(ssl);
+	if (rc != 1) {
+		switch (SSL_get_error(ssl, rc)) {
+		case SSL_ERROR_WANT_READ:
+			*events = POLLIN;
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			*events = POLLOUT;
+			return 0;
+		default:
+			tls_log_errors("TLS handshake failed");
+			return -1;
+		}
+	}
+
+	if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) ||
+	    !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+		log_error("Unable to offload %s %s to kTLS, is the tls "
+			  "kernel module loaded?", SSL_get_version(ssl),
+			  SSL_get_cipher_name(ssl));
+		return -1;
+	}
+
+	log_info("TLS connection established (%s, %s)", SSL_get_version(ssl),
+		 SSL_get_cipher_name(ssl));
+
+	/*
+	 * From now on the kernel encrypts and decrypts the records. The
+	 * socket BIO does not own the fd, so freeing the SSL object leaves
+	 * the socket intact. No close_notify is sent for the same reason.
+	 */
+	tls_conn_free(conn);
+	return 1;
+}
+
+void tls_conn_free(struct connection *conn)
+{
+	SSL_free(conn->tls);
+	conn->tls = NULL;
+}
+
+#endif /* CONFIG_ISCSI_TLS */
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, version 2
+ *  of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef ISCSI_TLS_H
+#define ISCSI_TLS_H
+
+#include <stdbool.h>
+
+struct connection;
+
+#ifdef CONFIG_ISCSI_TLS
+
+int tls_init(const char *cert_file, const char *key_file);
+bool tls_enabled(void);
+int tls_conn_start(struct connection *conn);
+int tls_conn_handshake(struct connection *conn, short *events);
+void tls_conn_free(struct connection *conn);
+
+#else
+
+static inline int tls_init(const char *cert_file, const char *key_file)
+{
+	return -1;
+}
+
+static inline bool tls_enabled(void)
+{
+	return false;
+}
+
+static inline int tls_conn_start(struct connection *conn)
+{
+	return -1;
+}
+
+static inline int tls_conn_handshake(struct connection *conn, short *events)
+{
+	return -1;
+}
+
+static inline void tls_conn_free(struct connection *conn)
+{
+}
+
+#endif
+
+#endif
@@ -151,6 +151,12 @@ static struct kobj_attribute sqa_hw_node_name_attr =
 	__ATTR(node_name, S_IRUGO|S_IWUSR, sqa_node_name_show,
 	       sqa_node_name_store);
 
+static ssize_t sqa_atio_stats_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf);
+
+static struct kobj_attribute sqa_atio_stats_attr =
+	__ATTR(atio_stats, S_IRUGO, sqa_atio_stats_show, NULL);
+
 #if EXCLUDED
 static ssize_t sqa_vp_parent_host_show(struct kobject *kobj,
 				       struct kobj_attribute *attr, char *buf);
@@ -162,6 +168,7 @@ static struct kobj_attribute sqa_vp_parent_host_attr =
 static const struct attribute *sqa_tgt_attrs[] = {
 	&sqa_expl_conf_attr.attr,
 	&sqa_abort_isp_attr.attr,
+	&sqa_atio_stats_attr.attr,
 	NULL,
 };
 
@@ -180,6 +187,19 @@ static enum scst_exec_context scst_work_context = SCST_CONTEXT_THREAD;
 static enum scst_exec_context scst_work_context = SCST_CONTEXT_TASKLET;
 #endif
 
+/*
+ * If the adapter has multiple queue pairs, qlt_handle_cmd_for_atio() queues
+ * the work item that calls sqa_qla2xxx_handle_cmd() on the CPU of the queue
+ * pair the LUN of the command has been assigned to. With this parameter set,
+ * SCST processes the command in that work item instead of an SCST thread,
+ * such that parsing, execution and the CTIO for the command stay on the CPU
+ * that services the queue pair.
+ */
+static bool qpair_direct_exec;
+module_param(qpair_direct_exec, bool, 0644);
+MODULE_PARM_DESC(qpair_direct_exec,
+		 "Process new commands on the CPU of their queue pair instead of in an SCST thread (default: false).");
+
 
 static struct cmd_state_name {
 	uint8_t state;
@@ -286,6 +306,12 @@ static inline void qla_tgt_set_cmd_prot_op(struct qla_tgt_cmd *cmd,
 
 
 	case SCST_DIF_ACTION_PASS_CHECK:
+	case SCST_DIF_ACTION_PASS:
+		/*
+		 * The firmware has no "pass without checking" mode. Whether
+		 * or not the HBA verifies passed through tags is controlled by
+		 * the ql2xenablehba_err_chk parameter of qla2xxx_scst.
+		 */
 		switch (dir) {
 		case SCST_DATA_READ:
 			cmd->se_cmd.prot_op = TARGET_PROT_DOUT_PASS;
@@ -311,25 +337,6 @@ static inline void qla_tgt_set_cmd_prot_op(struct qla_tgt_cmd *cmd,
 		break;
 
 
-	case SCST_DIF_ACTION_PASS: // nocheck
-		switch (dir) {
-		case SCST_DATA_READ:
-		case SCST_DATA_WRITE:
-		case SCST_DATA_BIDI:
-			//cmd->prot_op = TARGET_PROT_PASS_NOCHECK; TODO
-			//cmd->se_cmd.prot_op = TARGET_PROT_PASS_NOCHECK; TODO
-			break;
-		case SCST_DATA_NONE:
-			cmd->se_cmd.prot_op = TARGET_PROT_NORMAL;
-			break;
-		default:
-			EXTRACHECKS_BUG_ON(dir);
-			cmd->se_cmd.prot_op = TARGET_PROT_NORMAL;
-			break;
-		}
-		break;
-
-
 	default:
 		cmd->se_cmd.prot_op = TARGET_PROT_NORMAL;
 		EXTRACHECKS_BUG_ON(action);
@@ -417,6 +424,19 @@ static inline int scst_cmd_get_ppl_offset(struct scst_cmd *scst_cmd)
 	return 0;
 }
 
+static enum scst_exec_context sqa_new_cmd_context(struct qla_tgt_cmd *cmd)
+{
+#ifndef CONFIG_QLA_TGT_DEBUG_WORK_IN_THREAD
+	/*
+	 * sqa_qla2xxx_handle_cmd() is only called from qlt_do_work(), i.e.
+	 * in process context and without qpair or hardware locks held.
+	 */
+	if (READ_ONCE(qpair_direct_exec) && cmd->vha->flags.qpairs_available)
+		return SCST_CONTEXT_DIRECT;
+#endif
+	return scst_work_context;
+}
+
 static int sqa_qla2xxx_handle_cmd(scsi_qla_host_t *vha,
 	struct qla_tgt_cmd *cmd, unsigned char *cdb,
 	uint32_t data_length, int task_codes,
@@ -500,7 +520,7 @@ static int sqa_qla2xxx_handle_cmd(scsi_qla_host_t *vha,
 	      vha->host_no, vha->vp_idx, cmd, cmd->atio.u.isp24.exchange_addr,
 	      scst_cmd_get_queue_type(cmd->scst_cmd));
 
-	scst_cmd_init_done(cmd->scst_cmd, scst_work_context);
+	scst_cmd_init_done(cmd->scst_cmd, sqa_new_cmd_context(cmd));
 
 out:
 	TRACE_EXIT_RES(res);
@@ -1211,6 +1231,65 @@ static ssize_t sqa_abort_isp_store(struct kobject *kobj,
 #endif
 }
 
+static ssize_t sqa_atio_stats_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	static const char *const bucket_names[QLA_TGT_ATIO_HIST_SIZE] = {
+		"0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127",
+		"128+"
+	};
+	struct scst_tgt *scst_tgt;
+	struct sqa_scst_tgt *sqa_tgt;
+	struct qla_tgt *tgt;
+	struct qla_hw_data *ha;
+	struct scsi_qla_host *vha;
+	struct qla_qpair *qpair;
+	uint64_t num_q_full_sent;
+	ssize_t ret = 0;
+	int i;
+
+	scst_tgt = container_of(kobj, struct scst_tgt, tgt_kobj);
+	sqa_tgt = scst_tgt_get_tgt_priv(scst_tgt);
+	tgt = sqa_tgt->qla_tgt;
+	ha = tgt->ha;
+	vha = tgt->vha;
+
+	num_q_full_sent = ha->base_qpair->tgt_counters.num_q_full_sent;
+	for (i = 0; i < ha->max_qpairs; i++) {
+		qpair = ha->queue_pair_map[i];
+		if (!qpair)
+			continue;
+		num_q_full_sent += qpair->tgt_counters.num_q_full_sent;
+	}
+
+	ret += sysfs_emit_at(buf, ret, "atio_batch_hist");
+	for (i = 0; i < QLA_TGT_ATIO_HIST_SIZE; i++)
+		ret += sysfs_emit_at(buf, ret, " %s:%llu", bucket_names[i],
+				     ha->tgt.atio_batch_hist[i]);
+	ret += sysfs_emit_at(buf, ret, "\n");
+	ret += sysfs_emit_at(buf, ret, "atio_deferred %llu\n",
+			     ha->tgt.num_atio_deferred);
+	ret += sysfs_emit_at(buf, ret, "pending_cmds %u\n",
+			     ha->tgt.num_pend_cmds);
+	ret += sysfs_emit_at(buf, ret, "max_pending_cmds %u\n",
+			     vha->qla_stats.stat_max_pend_cmds);
+	ret += sysfs_emit_at(buf, ret, "qfull_thresh_hits %llu\n",
+			     ha->tgt.num_qfull_thresh_hits);
+	ret += sysfs_emit_at(buf, ret, "busy_sent %llu\n", num_q_full_sent);
+	ret += sysfs_emit_at(buf, ret, "qfull_cmds_alloc %u\n",
+			     ha->tgt.num_qfull_cmds_alloc);
+	ret += sysfs_emit_at(buf, ret, "max_qfull_cmds_alloc %u\n",
+			     vha->qla_stats.stat_max_qfull_cmds_alloc);
+	ret += sysfs_emit_at(buf, ret, "qfull_cmds_dropped %u\n",
+			     ha->tgt.num_qfull_cmds_dropped);
+	ret += sysfs_emit_at(buf, ret, "max_qfull_cmds_dropped %u\n",
+			     vha->qla_stats.stat_max_qfull_cmds_dropped);
+	ret += sysfs_emit_at(buf, ret, "exch_leak_resets %u\n",
+			     ha->tgt.num_exch_leak_resets);
+
+	return ret;
+}
+
 static int sqa_get_target_name(uint8_t *wwn, char **ppwwn_name)
 {
 	*ppwwn_name = kasprintf(GFP_KERNEL,
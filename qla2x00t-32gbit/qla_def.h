@@ -4110,6 +4110,23 @@ struct qlt_hw_data {
 	int num_act_qpairs;
 #define DEFAULT_NAQP 2
 	spinlock_t atio_lock ____cacheline_aligned;
+
+	/*
+	 * ATIO batching statistics. atio_batch_hist[0] counts passes over
+	 * the ATIO queue that found no entries and atio_batch_hist[i] for
+	 * i > 0 counts passes that processed [2^(i-1), 2^i) entries, the
+	 * last bucket being open-ended. Updated by the ATIO queue processing
+	 * code.
+	 */
+#define QLA_TGT_ATIO_HIST_SIZE 9
+	uint64_t atio_batch_hist[QLA_TGT_ATIO_HIST_SIZE];
+	uint64_t num_atio_deferred;
+	/* Protected by hardware_lock. */
+	uint64_t num_qfull_thresh_hits;
+	uint32_t num_exch_leak_resets;
+	/* Software ATIO interrupt coalescing, see ql2xatio_coalesce_usecs. */
+	struct hrtimer atio_coalesce_timer;
+	bool atio_coalesce_armed;
 };
 
 #define MAX_QFULL_CMDS_ALLOC	8192
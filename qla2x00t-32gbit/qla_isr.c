@@ -4899,6 +4899,8 @@ qla2x00_free_irqs(scsi_qla_host_t *vha)
 #endif
 	}
 
+	qlt_atio_coalesce_stop(ha);
+
 free_irqs:
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
 	pci_disable_msix(ha->pdev);
@@ -3070,6 +3070,7 @@ qla2x00_probe_one(struct pci_dev *pdev, const struct pci_device_id *id)
 	spin_lock_init(&ha->tgt.q_full_lock);
 	spin_lock_init(&ha->tgt.sess_lock);
 	spin_lock_init(&ha->tgt.atio_lock);
+	qlt_atio_coalesce_init(ha);
 
 	spin_lock_init(&ha->sadb_lock);
 	INIT_LIST_HEAD(&ha->sadb_tx_index_list);
@@ -68,6 +68,19 @@ MODULE_PARM_DESC(ql2xuctrlirq,
     "Valid with qlini_mode=disabled."
     "1(default): enable");
 
+static int ql2xatio_coalesce_usecs;
+module_param(ql2xatio_coalesce_usecs, int, 0644);
+MODULE_PARM_DESC(ql2xatio_coalesce_usecs,
+    "Defer ATIO queue processing by this many microseconds if at least "
+    "ql2xatio_coalesce_pend commands are pending. "
+    "Default is 0 - process the ATIO queue on every interrupt.");
+
+static int ql2xatio_coalesce_pend = 64;
+module_param(ql2xatio_coalesce_pend, int, 0644);
+MODULE_PARM_DESC(ql2xatio_coalesce_pend,
+    "Minimum number of pending commands for ATIO coalescing to be applied."
+    " Default is 64.");
+
 int ql2x_ini_mode = QLA2XXX_INI_MODE_EXCLUSIVE;
 
 static int qla_sam_status = SAM_STAT_BUSY;
@@ -3901,6 +3914,8 @@ static void qlt_chk_exch_leak_thresh_hold(struct scsi_qla_host *vha)
 		    "Chip reset due to exchange starvation: %d/%d.\n",
 		    total_leaked, vha->hw->cur_fw_xcb_count);
 
+		vha->hw->tgt.num_exch_leak_resets++;
+
 		if (IS_P3P_TYPE(vha->hw))
 			set_bit(FCOE_CTX_RESET_NEEDED, &vha->dpc_flags);
 		else
@@ -6800,6 +6815,7 @@ qlt_chk_qfull_thresh_hold(struct scsi_qla_host *vha, struct qla_qpair *qpair,
 
 	if (!ha_locked)
 		spin_lock_irqsave(&ha->hardware_lock, flags);
+	ha->tgt.num_qfull_thresh_hits++;
 	qlt_send_busy(qpair, atio, qla_sam_status);
 	if (!ha_locked)
 		spin_unlock_irqrestore(&ha->hardware_lock, flags);
@@ -7945,7 +7961,7 @@ qlt_24xx_process_atio_queue(struct scsi_qla_host *vha, uint8_t ha_locked)
 {
 	struct qla_hw_data *ha = vha->hw;
 	struct atio_from_isp *pkt;
-	int cnt, i;
+	int cnt, i, n = 0;
 
 	if (!ha->flags.fw_started)
 		return;
@@ -7987,10 +8003,14 @@ qlt_24xx_process_atio_queue(struct scsi_qla_host *vha, uint8_t ha_locked)
 			pkt = (struct atio_from_isp *)ha->tgt.atio_ring_ptr;
 		}
 		wmb();
+		n++;
 	}
 
 	/* Adjust ring index */
 	wrt_reg_dword(ISP_ATIO_Q_OUT(vha), ha->tgt.atio_ring_index);
+
+	ha->tgt.atio_batch_hist[n ? min(ilog2(n) + 1,
+					QLA_TGT_ATIO_HIST_SIZE - 1) : 0]++;
 }
 
 void
@@ -8300,6 +8320,68 @@ qlt_probe_one_stage1(struct scsi_qla_host *base_vha, struct qla_hw_data *ha)
 	qla_update_vp_map(base_vha, SET_VP_IDX);
 }
 
+static enum hrtimer_restart qlt_atio_coalesce_timer_fn(struct hrtimer *timer)
+{
+	struct qla_hw_data *ha = container_of(timer, struct qla_hw_data,
+					      tgt.atio_coalesce_timer);
+	scsi_qla_host_t *vha = pci_get_drvdata(ha->pdev);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ha->tgt.atio_lock, flags);
+	ha->tgt.atio_coalesce_armed = false;
+	qlt_24xx_process_atio_queue(vha, 0);
+	spin_unlock_irqrestore(&ha->tgt.atio_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+void qlt_atio_coalesce_init(struct qla_hw_data *ha)
+{
+	hrtimer_setup(&ha->tgt.atio_coalesce_timer, qlt_atio_coalesce_timer_fn,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+}
+
+/*
+ * Must be called after the ATIO interrupt has been freed. Drops a pending
+ * deferred pass over the ATIO queue, if any, such that the next ATIO
+ * interrupt processes the queue again.
+ */
+void qlt_atio_coalesce_stop(struct qla_hw_data *ha)
+{
+	unsigned long flags;
+
+	hrtimer_cancel(&ha->tgt.atio_coalesce_timer);
+
+	spin_lock_irqsave(&ha->tgt.atio_lock, flags);
+	ha->tgt.atio_coalesce_armed = false;
+	spin_unlock_irqrestore(&ha->tgt.atio_lock, flags);
+}
+
+/*
+ * Returns true if processing of the ATIO queue has been deferred to
+ * atio_coalesce_timer. Software coalescing only kicks in if enough commands
+ * are pending such that adding a few microseconds of latency is cheaper than
+ * taking an interrupt for every few ATIOs. Must be called with atio_lock held.
+ */
+static bool qlt_atio_coalesce(struct qla_hw_data *ha)
+{
+	int usecs = READ_ONCE(ql2xatio_coalesce_usecs);
+
+	if (usecs <= 0 ||
+	    ha->tgt.num_pend_cmds < READ_ONCE(ql2xatio_coalesce_pend))
+		return false;
+
+	if (!ha->tgt.atio_coalesce_armed) {
+		ha->tgt.atio_coalesce_armed = true;
+		ha->tgt.num_atio_deferred++;
+		hrtimer_start(&ha->tgt.atio_coalesce_timer,
+			      ns_to_ktime(usecs * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	}
+
+	return true;
+}
+
 irqreturn_t
 qla83xx_msix_atio_q(int irq, void *dev_id)
 {
@@ -8314,7 +8396,8 @@ qla83xx_msix_atio_q(int irq, void *dev_id)
 
 	spin_lock_irqsave(&ha->tgt.atio_lock, flags);
 
-	qlt_24xx_process_atio_queue(vha, 0);
+	if (!qlt_atio_coalesce(ha))
+		qlt_24xx_process_atio_queue(vha, 0);
 
 	spin_unlock_irqrestore(&ha->tgt.atio_lock, flags);
 
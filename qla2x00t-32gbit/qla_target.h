@@ -1200,6 +1200,8 @@ extern void qlt_vport_create(struct scsi_qla_host *, struct qla_hw_data *);
 extern u8 qlt_rff_id(struct scsi_qla_host *);
 extern void qlt_init_atio_q_entries(struct scsi_qla_host *);
 extern void qlt_24xx_process_atio_queue(struct scsi_qla_host *, uint8_t);
+extern void qlt_atio_coalesce_init(struct qla_hw_data *);
+extern void qlt_atio_coalesce_stop(struct qla_hw_data *);
 extern void qlt_24xx_config_rings(struct scsi_qla_host *);
 extern void qlt_24xx_config_nvram_stage1(struct scsi_qla_host *,
 	struct nvram_24xx *);
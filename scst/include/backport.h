@@ -32,6 +32,7 @@
 #include <linux/blk-mq.h>
 #endif
 #include <linux/bsg-lib.h>	/* struct bsg_job */
+#include <linux/cpumask.h>
 #include <linux/debugfs.h>
 #include <linux/dmapool.h>
 #include <linux/eventpoll.h>
@@ -456,6 +457,27 @@ static inline void be32_to_cpu_array(u32 *dst, const __be32 *src, size_t len)
 #define __nonstring
 #endif
 
+/* <linux/cpumask.h> */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 1, 0) &&	\
+	(!defined(RHEL_MAJOR) || RHEL_MAJOR -0 < 7 ||	\
+	 (RHEL_MAJOR -0 == 7 && RHEL_MINOR -0 < 2))
+/*
+ * See also commit da91309e0a7e ("cpumask: Utility function to set n'th cpu -
+ * local cpu first") # v4.1. This version ignores @node.
+ */
+static inline unsigned int cpumask_local_spread(unsigned int i, int node)
+{
+	int cpu;
+
+	i %= num_online_cpus();
+	for_each_online_cpu(cpu)
+		if (i-- == 0)
+			return cpu;
+	return cpumask_first(cpu_online_mask);
+}
+#endif
+
 /* <linux/debugfs.h> */
 
 /*
@@ -671,6 +693,21 @@ kernel_write_backport(struct file *file, const void *buf, size_t count,
 #define kernel_write kernel_write_backport
 #endif
 
+/* <linux/hrtimer.h> */
+
+#include <linux/hrtimer.h>
+
+/* hrtimer_setup() has been introduced in kernel v6.13. */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
 /* <linux/iocontext.h> */
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 21, 0) || \
@@ -1494,6 +1531,45 @@ static inline void kmem_cache_destroy_backport(struct kmem_cache *s)
 #define kmem_cache_destroy kmem_cache_destroy_backport
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+/*
+ * See also commit 91c6a05f72a9 ("mm: add kmalloc_array_node and
+ * kcalloc_node") # v4.15.
+ */
+static inline void *kmalloc_array_node_backport(size_t n, size_t size,
+						gfp_t flags, int node)
+{
+	if (size != 0 && n > SIZE_MAX / size)
+		return NULL;
+	return kmalloc_node(n * size, flags, node);
+}
+
+static inline void *kcalloc_node_backport(size_t n, size_t size, gfp_t flags,
+					  int node)
+{
+	return kmalloc_array_node_backport(n, size, flags | __GFP_ZERO, node);
+}
+
+#define kmalloc_array_node kmalloc_array_node_backport
+#define kcalloc_node kcalloc_node_backport
+#endif
+
+/*
+ * kvmalloc_array_node() is recent and, like the other allocation functions,
+ * a macro since the memory allocation profiling support in v6.10.
+ */
+#ifndef kvmalloc_array_node
+static inline void *kvmalloc_array_node_backport(size_t n, size_t size,
+						 gfp_t flags, int node)
+{
+	if (size != 0 && n > SIZE_MAX / size)
+		return NULL;
+	return kvmalloc_node(n * size, flags, node);
+}
+
+#define kvmalloc_array_node kvmalloc_array_node_backport
+#endif
+
 /*
  * See also commit 8eb8284b4129 ("usercopy: Prepare for usercopy
  * whitelisting").
@@ -1489,6 +1489,15 @@ struct scst_dev_type {
 				      const struct scst_opcode_descriptor **supp_opcodes,
 				      int supp_opcodes_cnt);
 
+	/*
+	 * Called to return the current capacity of the device in blocks.
+	 * Used by the copy manager to validate the ranges of ROD token
+	 * based copy commands. Must not sleep.
+	 *
+	 * OPTIONAL
+	 */
+	uint64_t (*get_nr_blocks)(struct scst_device *dev);
+
 	/*
 	 * Called when new device is attaching to the dev handler
 	 * Returns 0 on success, error code otherwise.
@@ -1999,6 +2008,13 @@ struct scst_lksb {
 	struct dlm_lksb  lksb;
 	struct completion compl;
 	struct scst_pr_dlm_data *pr_dlm;
+	/*
+	 * Only used for PR_LOCK: set if the PR update joined the lock cycle
+	 * of a concurrent PR update instead of locking PR_LOCK itself.
+	 */
+	bool batched;
+	/* Sequence number of the lock cycle that has been joined. */
+	unsigned int batch_seq;
 };
 
 /*
@@ -2609,6 +2625,14 @@ struct scst_mgmt_cmd {
 	};
 };
 
+/*
+ * Initial and maximum size, as log2, of the hash tables for dev's registrants
+ * lookup by transport ID and by key. The tables grow with the number of
+ * registrants.
+ */
+#define	SCST_PR_REG_HASH_MIN_BITS 5
+#define	SCST_PR_REG_HASH_MAX_BITS 16
+
 /*
  * Persistent reservations registrant
  */
@@ -2620,9 +2644,18 @@ struct scst_dev_registrant {
 	/* tgt_dev (I_T nexus) for this registrant, if any */
 	struct scst_tgt_dev *tgt_dev;
 
-	/* List entry for dev_registrants_list */
+	/* List entry for dev_registrants_list or, once removed, pr_jnl_del_list */
 	struct list_head dev_registrants_list_entry;
 
+	/* List entries for dev_reg_tid_hash and dev_reg_key_hash */
+	struct list_head dev_reg_tid_hash_entry;
+	struct list_head dev_reg_key_hash_entry;
+
+	/* State of this registrant as of the last PR journal write */
+	__be64 jnl_key;
+	unsigned int jnl_saved:1;
+	unsigned int jnl_is_holder:1;
+
 	/* 2 auxiliary fields used to rollback changes for errors, etc. */
 	struct list_head aux_list_entry;
 	__be64 rollback_key;
@@ -2993,6 +3026,19 @@ struct scst_device {
 	/* List of dev's registrants */
 	struct list_head dev_registrants_list;
 
+	/* The same registrants hashed by transport ID and by key */
+	struct list_head *dev_reg_tid_hash;
+	struct list_head *dev_reg_key_hash;
+
+	/* log2 of the size of the hash tables above */
+	unsigned int dev_reg_hash_bits;
+
+	/* Number of entries in dev_registrants_list */
+	int dev_registrants_cnt;
+
+	/* Initial storage for dev_reg_tid_hash and dev_reg_key_hash */
+	struct list_head dev_reg_hash_init[2 << SCST_PR_REG_HASH_MIN_BITS];
+
 	/* End of persistent reservation fields protected by dev_pr_mutex. */
 
 	/* NUMA node id of this device, if any (default - NUMA_NO_NODE) */
@@ -3014,6 +3060,23 @@ struct scst_device {
 	char *pr_file_name;
 	char *pr_file_name1;
 
+	/*
+	 * Journal of the PR changes since pr_file_name has been written, see
+	 * scst_pr_sync_device_file(). Protected by dev_pr_mutex.
+	 */
+	char *pr_jnl_file_name;
+	struct file *pr_jnl_file;
+	loff_t pr_jnl_pos;
+
+	/* Removed registrants, whose removal hasn't been journaled yet */
+	struct list_head pr_jnl_del_list;
+
+	/* Reservation state as of the last journal write */
+	uint8_t pr_jnl_aptpl;
+	uint8_t pr_jnl_is_set;
+	uint8_t pr_jnl_type;
+	uint8_t pr_jnl_scope;
+
 	/**************************************************************/
 
 	/* List of blocked commands, protected by dev_lock. */
@@ -3141,11 +3204,16 @@ struct scst_tgt_dev {
 	/* How many cmds alive on this dev in this session */
 	atomic_t tgt_dev_cmd_count ____cacheline_aligned_in_smp;
 
-	/* ALUA command filter */
+	/*
+	 * ALUA target group this LUN belongs to or NULL if no ALUA state has
+	 * been configured for it. The ALUA command filter is looked up via
+	 * the target group such that an ALUA state change does not have to
+	 * touch every tgt_dev. Protected by scst_dg_mutex and RCU.
+	 */
 #define SCST_ALUA_CHECK_OK	0
 #define SCST_ALUA_CHECK_DELAYED 1
 #define SCST_ALUA_CHECK_ERROR	-1
-	int (*alua_filter)(struct scst_cmd *cmd);
+	struct scst_target_group *alua_tg;
 
 	struct scst_order_data *curr_order_data;
 	struct scst_order_data tgt_dev_order_data;
@@ -3400,6 +3468,11 @@ struct scst_target_group {
 	char			*name;
 	uint16_t		group_id;
 	enum scst_tg_state	state;
+	/*
+	 * ALUA command filter for @state, read without locking by the
+	 * tgt_devs that have alua_tg pointing at this target group.
+	 */
+	int (*alua_filter)(struct scst_cmd *cmd);
 	bool			preferred;
 	struct list_head	entry;
 	struct list_head	tgt_list;
@@ -5735,5 +5808,6 @@ struct scst_ext_copy_seg_descr {
 void scst_ext_copy_remap_done(struct scst_cmd *ec_cmd, struct scst_ext_copy_data_descr *dds,
 			      int dds_cnt);
 int scst_ext_copy_get_cur_seg_data_len(struct scst_cmd *ec_cmd);
+int scst_cm_fill_tpc_vpd(const struct scst_device *dev, uint8_t *buf, int size);
 
 #endif /* __SCST_H */
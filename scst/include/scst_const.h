@@ -337,6 +337,12 @@ static inline int scst_sense_response_code(const uint8_t *sense)
 #define scst_sense_parameter_list_length_invalid ILLEGAL_REQUEST, 0x1A, 0
 #define scst_sense_invalid_opcode		ILLEGAL_REQUEST, 0x20, 0
 #define scst_sense_block_out_range_error	ILLEGAL_REQUEST, 0x21, 0
+#define scst_sense_invalid_token_operation	ILLEGAL_REQUEST, 0x23, 0
+#define scst_sense_unsupported_token_type	ILLEGAL_REQUEST, 0x23, 0x1
+#define scst_sense_token_unknown		ILLEGAL_REQUEST, 0x23, 0x4
+#define scst_sense_token_corrupt		ILLEGAL_REQUEST, 0x23, 0x5
+#define scst_sense_token_expired		ILLEGAL_REQUEST, 0x23, 0x7
+#define scst_sense_invalid_token_length		ILLEGAL_REQUEST, 0x23, 0xA
 /* Don't use it directly, use scst_set_invalid_field_in_cdb() instead! */
 #define scst_sense_invalid_field_in_cdb		ILLEGAL_REQUEST, 0x24, 0
 #define scst_sense_lun_not_supported		ILLEGAL_REQUEST, 0x25, 0
@@ -351,6 +357,7 @@ static inline int scst_sense_response_code(const uint8_t *sense)
 #define scst_sense_inline_data_length_exceeded	ILLEGAL_REQUEST, 0x26, 0xB
 #define scst_sense_saving_params_unsup		ILLEGAL_REQUEST, 0x39, 0
 #define scst_sense_invalid_message		ILLEGAL_REQUEST, 0x49, 0
+#define scst_sense_insufficient_rod_token_res	ILLEGAL_REQUEST, 0x55, 0xC
 #define scst_sense_parameter_list_length_invalid ILLEGAL_REQUEST, 0x1A, 0
 #define scst_sense_invalid_field_in_command_information_unit ILLEGAL_REQUEST, 0xE, 0x3
 
@@ -440,6 +447,17 @@ static inline int scst_sense_response_code(const uint8_t *sense)
 #define RECEIVE_COPY_RESULTS  0x84
 #endif
 
+/* Service actions of EXTENDED_COPY (0x83) */
+#define EC_SA_EXTENDED_COPY_LID1	0x00
+#define EC_SA_POPULATE_TOKEN		0x10
+#define EC_SA_WRITE_USING_TOKEN		0x11
+
+/* Service actions of RECEIVE_COPY_RESULTS (0x84) */
+#define RCR_SA_COPY_STATUS		0x00
+#define RCR_SA_OPERATING_PARAMETERS	0x03
+#define RCR_SA_FAILED_SEGMENT_DETAILS	0x04
+#define RCR_SA_RECEIVE_ROD_TOKEN_INFO	0x07
+
 #ifndef SYNCHRONIZE_CACHE_16
 #define SYNCHRONIZE_CACHE_16  0x91
 #endif
@@ -157,4 +157,19 @@ struct scst_event_reg_vdev_payload {
 	uint8_t device_name[SCST_MAX_NAME+10];
 };
 
+#define SCST_EVENT_ALUA_STATE_CHANGED	7
+struct scst_event_alua_state_changed_payload {
+	uint8_t dg_name[64];
+	uint8_t tg_name[64];
+	uint8_t prev_state[32];
+	uint8_t new_state[32];
+	uint16_t group_id;
+	/* Number of LUNs in the target group */
+	uint32_t nr_luns;
+	/* Time until the new state was visible to all LUNs */
+	aligned_u64 publish_us;
+	/* Time until UAs were queued and device callbacks finished */
+	aligned_u64 total_us;
+};
+
 #endif /* __SCST_EVENT_H */
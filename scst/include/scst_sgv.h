@@ -101,6 +101,7 @@ struct scatterlist *sgv_pool_alloc(struct sgv_pool *pool, unsigned int size,
 void sgv_pool_free(struct sgv_pool_obj *sgv, struct scst_mem_lim *mem_lim);
 
 void *sgv_get_priv(struct sgv_pool_obj *sgv);
+unsigned int sgv_hiwmk_failures(void);
 
 void scst_init_mem_lim(struct scst_mem_lim *mem_lim);
 
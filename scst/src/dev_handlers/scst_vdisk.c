@@ -169,6 +169,7 @@ struct scst_vdisk_dev {
 	unsigned int nullio:1;
 	unsigned int blockio:1;
 	unsigned int blk_integrity:1;
+	unsigned int dif_passthrough:1;
 	unsigned int cdrom_empty:1;
 	unsigned int dummy:1;
 	unsigned int read_zero:1;
@@ -303,11 +304,15 @@ static ssize_t vdisk_sysfs_gen_tp_soft_threshold_reached_UA(struct kobject *kobj
 							    const char *buf, size_t count);
 static ssize_t vdev_dif_filename_show(struct kobject *kobj, struct kobj_attribute *attr,
 				      char *buf);
+static ssize_t vdev_dif_passthrough_show(struct kobject *kobj, struct kobj_attribute *attr,
+					 char *buf);
 static struct kobj_attribute gen_tp_soft_threshold_reached_UA_attr =
 	__ATTR(gen_tp_soft_threshold_reached_UA, 0200, NULL,
 	       vdisk_sysfs_gen_tp_soft_threshold_reached_UA);
 static struct kobj_attribute vdev_dif_filename_attr =
 	__ATTR(dif_filename, 0444, vdev_dif_filename_show, NULL);
+static struct kobj_attribute vdev_dif_passthrough_attr =
+	__ATTR(dif_passthrough, 0444, vdev_dif_passthrough_show, NULL);
 
 /*
  * Protects vdisks addition/deletion and related activities, like search.
@@ -1047,6 +1052,56 @@ static int vdisk_init_block_integrity(struct scst_vdisk_dev *virt_dev)
 }
 #endif /* defined(CONFIG_BLK_DEV_INTEGRITY) */
 
+/*
+ * In DIF pass-through mode the target hardware checks the DIF tags, SCST
+ * neither generates nor verifies them and the tags received from the target
+ * driver are attached to the bios submitted to an integrity capable block
+ * device. Hence no guard tag is ever computed by the CPU. Reject every
+ * configuration that would make SCST or vdisk process tags in software.
+ */
+static int vdisk_check_dif_passthrough(struct scst_vdisk_dev *virt_dev)
+{
+	int res = -EINVAL;
+
+	TRACE_ENTRY();
+
+	if (!virt_dev->blockio) {
+		PRINT_ERROR("dif_passthrough is supported only for BLOCKIO devices (dev %s)",
+			    virt_dev->name);
+		goto out;
+	}
+
+	if (virt_dev->dif_mode == SCST_DIF_MODE_NONE)
+		virt_dev->dif_mode = SCST_DIF_MODE_TGT | SCST_DIF_MODE_DEV_CHECK |
+				     SCST_DIF_MODE_DEV_STORE;
+
+	if (virt_dev->dif_mode & SCST_DIF_MODE_SCST) {
+		PRINT_ERROR("dif_passthrough is not compatible with DIF mode %s (dev %s)",
+			    SCST_DIF_MODE_SCST_STR, virt_dev->name);
+		goto out;
+	}
+
+	if (!(virt_dev->dif_mode & SCST_DIF_MODE_TGT) ||
+	    !(virt_dev->dif_mode & SCST_DIF_MODE_DEV_STORE)) {
+		PRINT_ERROR("dif_passthrough requires DIF modes %s and %s (dev %s)",
+			    SCST_DIF_MODE_TGT_STR, SCST_DIF_MODE_DEV_STORE_STR,
+			    virt_dev->name);
+		goto out;
+	}
+
+	if (virt_dev->dif_filename) {
+		PRINT_ERROR("dif_passthrough is not compatible with dif_filename (dev %s)",
+			    virt_dev->name);
+		goto out;
+	}
+
+	res = 0;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 /*
  * Reexamine size, flush support and thin provisioning support for
  * vdisk_fileio, vdisk_blockio and vdisk_cdrom devices. Do not modify the size
@@ -1113,6 +1168,12 @@ static int vdisk_attach(struct scst_device *dev)
 	dev->block_size = 1 << dev->block_shift;
 	dev->cluster_mode = virt_dev->initial_cluster_mode;
 
+	if (virt_dev->dif_passthrough) {
+		res = vdisk_check_dif_passthrough(virt_dev);
+		if (res != 0)
+			goto out;
+	}
+
 	if (virt_dev->dif_type == 0 &&
 	    (virt_dev->dif_mode != SCST_DIF_MODE_NONE || virt_dev->dif_filename)) {
 		PRINT_ERROR("Device %s cannot have DIF TYPE 0 if DIF MODE is not NONE or DIF FILENAME is not NULL",
@@ -1128,6 +1189,13 @@ static int vdisk_attach(struct scst_device *dev)
 		res = vdisk_init_block_integrity(virt_dev);
 		if (res != 0)
 			goto out;
+
+		if (virt_dev->dif_passthrough && !virt_dev->blk_integrity) {
+			PRINT_ERROR("dif_passthrough requires a block device with T10-PI integrity support (dev %s)",
+				    dev->virt_name);
+			res = -EINVAL;
+			goto out;
+		}
 	} else if (virt_dev->dif_mode & SCST_DIF_MODE_DEV_CHECK) {
 		PRINT_ERROR("dev_check supported only for BLOCKIO devices (dev %s)!",
 			    dev->virt_name);
@@ -1180,6 +1248,16 @@ next:
 		}
 	}
 
+	if (virt_dev->dif_passthrough) {
+		res = scst_create_dev_attr(dev, &vdev_dif_passthrough_attr);
+		if (res != 0) {
+			PRINT_ERROR("Can't create attr %s for dev %s",
+				    vdev_dif_passthrough_attr.attr.name,
+				    dev->virt_name);
+			goto out;
+		}
+	}
+
 	if (!virt_dev->async && virt_dev->o_direct_flag) {
 		PRINT_ERROR("%s: using o_direct without setting async is not supported",
 			    virt_dev->filename);
@@ -2505,6 +2583,13 @@ static int vdisk_get_supported_opcodes(struct scst_cmd *cmd,
 	return 0;
 }
 
+static uint64_t vdisk_get_nr_blocks(struct scst_device *dev)
+{
+	struct scst_vdisk_dev *virt_dev = dev->dh_priv;
+
+	return READ_ONCE(virt_dev->nblocks);
+}
+
 static int vcdrom_get_supported_opcodes(struct scst_cmd *cmd,
 					const struct scst_opcode_descriptor ***out_supp_opcodes,
 					int *out_supp_opcodes_cnt)
@@ -3609,6 +3694,7 @@ static int vdisk_sup_vpd(uint8_t *buf, struct scst_cmd *cmd,
 	*p++ = 0x83; /* device identification */
 	*p++ = 0x86; /* extended inquiry */
 	if (cmd->dev->type == TYPE_DISK) {
+		*p++ = 0x8F; /* third-party copy */
 		*p++ = 0xB0; /* block limits */
 		*p++ = 0xB1; /* block device characteristics */
 		if (virt_dev->thin_provisioned)
@@ -4012,6 +4098,8 @@ static enum compl_status_e vdisk_exec_inquiry(struct vdisk_cmd_params *p)
 			resp_len = vdisk_dev_id_vpd(buf, cmd, virt_dev);
 		} else if (cmd->cdb[2] == 0x86) {
 			resp_len = vdisk_ext_inq(buf, cmd, virt_dev);
+		} else if (cmd->cdb[2] == 0x8F && dev->type == TYPE_DISK) {
+			resp_len = scst_cm_fill_tpc_vpd(dev, buf, INQ_BUF_SZ);
 		} else if (cmd->cdb[2] == 0xB0 && dev->type == TYPE_DISK) {
 			resp_len = vdisk_block_limits(buf, cmd, virt_dev);
 		} else if (cmd->cdb[2] == 0xB1 && dev->type == TYPE_DISK) {
@@ -5701,8 +5789,12 @@ defined(CONFIG_SUSE_KERNEL) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 4, 0)
 }
 
 #if defined(CONFIG_BLK_DEV_INTEGRITY)
-static void vdisk_blk_add_dif(struct bio *bio, gfp_t gfp_mask, const struct scst_device *dev,
-			      struct scatterlist **pdsg, int *pdsg_offs, int *pdsg_len, bool last)
+/*
+ * Returns 0 if the DIF tags have been attached to @bio or -ENOMEM if @bio
+ * will be submitted without them.
+ */
+static int vdisk_blk_add_dif(struct bio *bio, gfp_t gfp_mask, const struct scst_device *dev,
+			     struct scatterlist **pdsg, int *pdsg_offs, int *pdsg_len, bool last)
 {
 	int block_shift = dev->block_shift;
 	struct scatterlist *orig_dsg = *pdsg;
@@ -5710,6 +5802,7 @@ static void vdisk_blk_add_dif(struct bio *bio, gfp_t gfp_mask, const struct scst
 	int sg_offs = *pdsg_offs, sg_len = *pdsg_len;
 	int pages, left, len, tags_len, rc;
 	struct bio_integrity_payload *bip;
+	int res = -ENOMEM;
 
 	TRACE_ENTRY();
 
@@ -5790,14 +5883,18 @@ static void vdisk_blk_add_dif(struct bio *bio, gfp_t gfp_mask, const struct scst
 		sg_offs = sg->offset;
 	}
 
+	res = 0;
+
 out:
-	TRACE_EXIT();
+	TRACE_EXIT_RES(res);
+	return res;
 }
 #else /* defined(CONFIG_BLK_DEV_INTEGRITY) */
-static void vdisk_blk_add_dif(struct bio *bio, gfp_t gfp_mask, const struct scst_device *dev,
-			      struct scatterlist **pdsg, int *pdsg_offs, int *pdsg_len, bool last)
+static int vdisk_blk_add_dif(struct bio *bio, gfp_t gfp_mask, const struct scst_device *dev,
+			     struct scatterlist **pdsg, int *pdsg_offs, int *pdsg_len, bool last)
 {
 	BUG();
+	return -EINVAL;
 }
 #endif /* defined(CONFIG_BLK_DEV_INTEGRITY) */
 
@@ -5830,6 +5927,12 @@ static void blockio_exec_rw(struct vdisk_cmd_params *p, bool write, bool fua)
 
 	if (dif) {
 		dsg = cmd->dif_sg;
+		if (unlikely(!dsg)) {
+			PRINT_ERROR("No DIF buffer for cmd %p (op %s, dev %s)",
+				    cmd, scst_get_opcode_name(cmd), dev->virt_name);
+			scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_hardw_error));
+			goto finish_cmd;
+		}
 		dsg_offs = dsg->offset;
 		dsg_len = dsg->length;
 	}
@@ -5953,9 +6056,13 @@ static void blockio_exec_rw(struct vdisk_cmd_params *p, bool write, bool fua)
 			rc = bio_add_page(bio, pg, bytes, off);
 			if (rc < bytes) {
 				WARN_ON(rc != 0);
-				if (dif)
-					vdisk_blk_add_dif(bio, gfp_mask, dev, &dsg, &dsg_offs,
-							  &dsg_len, false);
+				if (dif &&
+				    vdisk_blk_add_dif(bio, gfp_mask, dev, &dsg, &dsg_offs,
+						      &dsg_len, false) != 0 &&
+				    virt_dev->dif_passthrough) {
+					scst_set_busy(cmd);
+					goto free_bio;
+				}
 				need_new_bio = 1;
 				lba_start0 += thislen >> block_shift;
 				thislen = 0;
@@ -5973,8 +6080,17 @@ static void blockio_exec_rw(struct vdisk_cmd_params *p, bool write, bool fua)
 		length = scst_get_sg_page_next(cmd, &page, &offset);
 	}
 
-	if (dif)
-		vdisk_blk_add_dif(bio, gfp_mask, dev, &dsg, &dsg_offs, &dsg_len, true);
+	/*
+	 * Without DIF pass-through the block layer generates or verifies the
+	 * tags of a bio without integrity payload. In pass-through mode that
+	 * would discard the tags received from the initiator, so fail instead.
+	 */
+	if (dif &&
+	    vdisk_blk_add_dif(bio, gfp_mask, dev, &dsg, &dsg_offs, &dsg_len, true) != 0 &&
+	    virt_dev->dif_passthrough) {
+		scst_set_busy(cmd);
+		goto free_bio;
+	}
 
 	/* +1 to prevent erroneous too early command completion */
 	atomic_set(&blockio_work->bios_inflight, bios + 1);
@@ -7088,6 +7204,9 @@ static int vdev_parse_add_dev_params(struct scst_vdisk_dev *virt_dev, char *para
 		} else if (!strcasecmp("dif_type", p)) {
 			virt_dev->dif_type = ull_val;
 			TRACE_DBG("DIF type %d", virt_dev->dif_type);
+		} else if (!strcasecmp("dif_passthrough", p)) {
+			virt_dev->dif_passthrough = !!ull_val;
+			TRACE_DBG("DIF PASSTHROUGH %d", virt_dev->dif_passthrough);
 		} else if (!strcasecmp("dif_static_app_tag", p)) {
 			virt_dev->dif_static_app_tag_combined = cpu_to_be64(ull_val);
 			TRACE_DBG("DIF static app tag %llx",
@@ -9437,6 +9556,27 @@ static ssize_t vdev_dif_filename_show(struct kobject *kobj, struct kobj_attribut
 	return ret;
 }
 
+static ssize_t vdev_dif_passthrough_show(struct kobject *kobj, struct kobj_attribute *attr,
+					 char *buf)
+{
+	struct scst_device *dev;
+	struct scst_vdisk_dev *virt_dev;
+	ssize_t ret;
+
+	TRACE_ENTRY();
+
+	dev = container_of(kobj, struct scst_device, dev_kobj);
+	virt_dev = dev->dh_priv;
+
+	ret = sysfs_emit(buf, "%d\n", virt_dev->dif_passthrough);
+
+	if (virt_dev->dif_passthrough)
+		ret += sysfs_emit_at(buf, ret, "%s\n", SCST_SYSFS_KEY_MARK);
+
+	TRACE_EXIT_RES(ret);
+	return ret;
+}
+
 static ssize_t vdev_lb_per_pb_exp_store(struct kobject *kobj, struct kobj_attribute *attr,
 					const char *buf, size_t count)
 {
@@ -9661,6 +9801,7 @@ static struct scst_dev_type vdisk_file_devtype = {
 	.ext_copy_remap =	vdev_ext_copy_remap,
 #endif
 	.get_supported_opcodes = vdisk_get_supported_opcodes,
+	.get_nr_blocks =	vdisk_get_nr_blocks,
 	.devt_priv =		(void *)fileio_ops,
 	.add_device =		vdisk_add_fileio_device,
 	.del_device =		vdisk_del_device,
@@ -9714,6 +9855,7 @@ static const char *const blockio_add_dev_params[] = {
 	"cluster_mode",
 	"dif_filename",
 	"dif_mode",
+	"dif_passthrough",
 	"dif_static_app_tag",
 	"dif_type",
 	"filename",
@@ -9746,6 +9888,7 @@ static struct scst_dev_type vdisk_blk_devtype = {
 	.on_alua_state_change_finish = blockio_on_alua_state_change_finish,
 	.task_mgmt_fn_done =	vdisk_task_mgmt_fn_done,
 	.get_supported_opcodes = vdisk_get_supported_opcodes,
+	.get_nr_blocks =	vdisk_get_nr_blocks,
 	.devt_priv =		(void *)blockio_ops,
 	.add_device =		vdisk_add_blockio_device,
 	.del_device =		vdisk_del_device,
@@ -9819,6 +9962,7 @@ static struct scst_dev_type vdisk_null_devtype = {
 	.task_mgmt_fn_done =	vdisk_task_mgmt_fn_done,
 	.devt_priv =		(void *)nullio_ops,
 	.get_supported_opcodes = vdisk_get_supported_opcodes,
+	.get_nr_blocks =	vdisk_get_nr_blocks,
 	.add_device =		vdisk_add_nullio_device,
 	.del_device =		vdisk_del_device,
 	.dev_attrs =		vdisk_nullio_attrs,
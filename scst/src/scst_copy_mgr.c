@@ -9,6 +9,7 @@
 #include <linux/init.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/random.h>
 
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/scst.h>
@@ -44,6 +45,26 @@
 /* MAXIMUM DESCRIPTOR LIST LENGTH */
 #define SCST_MAX_SEG_DESC_LEN 0xFFFF
 
+/* MAXIMUM SEGMENT LENGTH */
+#define SCST_CM_MAX_SEG_LEN		(256 * 1024 * 1024)
+
+/*
+ * ROD token (POPULATE TOKEN / WRITE USING TOKEN) limits. See also the
+ * Block Device ROD Token Limits descriptor in scst_cm_fill_tpc_vpd().
+ */
+#define SCST_CM_ROD_TOKEN_LEN		512
+#define SCST_CM_ROD_TYPE_AUR		0x00800000 /* access upon reference */
+#define SCST_CM_ROD_DEF_TIMEOUT		60	/* in seconds */
+#define SCST_CM_ROD_MAX_TIMEOUT		600	/* in seconds */
+#define SCST_CM_MAX_ROD_TOKENS		1024
+#define SCST_CM_MAX_ROD_RANGES		64
+#define SCST_CM_MAX_TOKEN_TRANSFER_SIZE	(1024 * 1024 * 1024) /* in bytes */
+#define SCST_CM_OPT_TOKEN_TRANSFER_SIZE	(64 * 1024 * 1024) /* in bytes */
+
+/* Offsets in the WRITE USING TOKEN parameter list */
+#define SCST_CM_WUT_TOKEN_OFFS		16
+#define SCST_CM_WUT_RANGES_OFFS		536
+
 static struct scst_tgt *scst_cm_tgt;
 static struct scst_session *scst_cm_sess;
 
@@ -89,8 +110,50 @@ struct scst_cm_list_id {
 	int cm_status;
 	unsigned short cm_sense_len;
 	uint8_t cm_sense[SCST_SENSE_BUFFERSIZE];
+
+	/*
+	 * ROD token operations only: service action of the command, which
+	 * created this list id, and data for RECEIVE ROD TOKEN INFORMATION.
+	 */
+	uint8_t cm_sa;
+	int cm_block_shift;
+	uint64_t cm_token_blocks;
+	uint8_t *cm_rod_token;
 };
 
+struct scst_cm_rod_range {
+	uint64_t lba;
+	uint32_t blocks;
+};
+
+/*
+ * ROD token, created by POPULATE TOKEN. Access upon reference semantic,
+ * i.e. it only records the source ranges, the data itself are read by
+ * WRITE USING TOKEN.
+ *
+ * Protected by scst_cm_lock.
+ */
+struct scst_cm_rod_token {
+	struct list_head cm_tok_list_entry;
+
+	/* Source device. Tokens are deleted, when it leaves the copy manager */
+	struct scst_device *cm_tok_dev;
+
+	unsigned long cm_tok_timeout; /* inactivity timeout, in jiffies */
+	unsigned long cm_tok_expires; /* in jiffies */
+
+	uint64_t cm_tok_blocks;
+	int cm_tok_ranges_cnt;
+	struct scst_cm_rod_range cm_tok_ranges[SCST_CM_MAX_ROD_RANGES];
+
+	uint8_t cm_tok_data[SCST_CM_ROD_TOKEN_LEN];
+};
+
+/* Protected by scst_cm_lock */
+static LIST_HEAD(scst_cm_rod_token_list);
+static int scst_cm_rod_tokens_cnt;
+static uint64_t scst_cm_next_rod_token_id;
+
 struct scst_cm_internal_cmd_priv {
 	/* Must be the first for scst_finish_internal_cmd()! */
 	scst_i_finish_fn_t cm_finish_fn;
@@ -705,11 +768,9 @@ out:
 	TRACE_EXIT();
 }
 
-static void scst_cm_store_list_id_details(struct scst_cmd *ec_cmd)
+static void __scst_cm_store_list_id_details(struct scst_cmd *ec_cmd,
+					    struct scst_cm_list_id *l)
 {
-	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
-	struct scst_cm_list_id *l = priv->cm_list_id;
-
 	TRACE_ENTRY();
 
 	if (l) {
@@ -738,6 +799,13 @@ static void scst_cm_store_list_id_details(struct scst_cmd *ec_cmd)
 	TRACE_EXIT();
 }
 
+static void scst_cm_store_list_id_details(struct scst_cmd *ec_cmd)
+{
+	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
+
+	__scst_cm_store_list_id_details(ec_cmd, priv->cm_list_id);
+}
+
 static void scst_cm_ec_cmd_done(struct scst_cmd *ec_cmd)
 {
 #ifdef CONFIG_SCST_EXTRACHECKS
@@ -796,8 +864,9 @@ static void scst_cm_in_flight_cmd_finished(struct scst_cmd *ec_cmd)
 	if (f > 0)
 		goto out;
 
+	/* cm_written accumulates the whole ec_cmd, not only this segment */
 	if (priv->cm_list_id)
-		priv->cm_list_id->cm_written_size += priv->cm_written;
+		priv->cm_list_id->cm_written_size = priv->cm_written;
 
 	scst_cm_ec_sched_next_seg(ec_cmd);
 
@@ -1573,6 +1642,8 @@ out:
 	TRACE_EXIT();
 }
 
+static void scst_cm_populate_token(struct scst_cmd *cmd);
+
 enum scst_exec_res scst_cm_ext_copy_exec(struct scst_cmd *ec_cmd)
 {
 	enum scst_exec_res res = SCST_EXEC_COMPLETED;
@@ -1581,6 +1652,11 @@ enum scst_exec_res scst_cm_ext_copy_exec(struct scst_cmd *ec_cmd)
 
 	TRACE_ENTRY();
 
+	if (ec_cmd->cdb[1] == EC_SA_POPULATE_TOKEN) {
+		scst_cm_populate_token(ec_cmd);
+		goto out_local_done;
+	}
+
 	if (unlikely(!priv))
 		goto out_local_done;
 
@@ -1821,16 +1897,15 @@ static void scst_cm_del_free_list_id(struct scst_cm_list_id *l)
 
 	list_del(&l->sess_cm_list_id_entry);
 
+	kfree(l->cm_rod_token);
 	kfree(l);
 
 	TRACE_EXIT();
 }
 
-static void scst_cm_sched_del_list_id(struct scst_cmd *ec_cmd)
+static void __scst_cm_sched_del_list_id(struct scst_cmd *ec_cmd, struct scst_cm_list_id *l)
 {
 	struct scst_session *sess = ec_cmd->sess;
-	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
-	struct scst_cm_list_id *l = priv->cm_list_id;
 	unsigned long flags;
 
 	TRACE_ENTRY();
@@ -1874,6 +1949,13 @@ out:
 	TRACE_EXIT();
 }
 
+static void scst_cm_sched_del_list_id(struct scst_cmd *ec_cmd)
+{
+	struct scst_cm_ec_cmd_priv *priv = ec_cmd->cmd_data_descriptors;
+
+	__scst_cm_sched_del_list_id(ec_cmd, priv->cm_list_id);
+}
+
 static struct scst_cm_list_id *scst_cm_add_list_id(struct scst_cmd *cmd, int list_id)
 {
 	struct scst_cm_list_id *res;
@@ -1974,6 +2056,405 @@ void scst_cm_free_pending_list_ids(struct scst_session *sess)
 	TRACE_EXIT();
 }
 
+/*
+ * ROD token based copy offload (ODX): POPULATE TOKEN, WRITE USING TOKEN and
+ * RECEIVE ROD TOKEN INFORMATION. WRITE USING TOKEN is converted into a set
+ * of block to block segments and then processed by the EXTENDED COPY
+ * machinery.
+ */
+
+/* scst_cm_lock supposed to be held */
+static void scst_cm_del_free_rod_token(struct scst_cm_rod_token *tok)
+{
+	TRACE_ENTRY();
+
+	lockdep_assert_held(&scst_cm_lock);
+
+	TRACE_DBG("Freeing ROD token %p", tok);
+
+	list_del(&tok->cm_tok_list_entry);
+	scst_cm_rod_tokens_cnt--;
+
+	kfree(tok);
+
+	TRACE_EXIT();
+}
+
+/* scst_cm_lock supposed to be held */
+static void scst_cm_del_expired_rod_tokens(void)
+{
+	struct scst_cm_rod_token *tok, *t;
+
+	TRACE_ENTRY();
+
+	list_for_each_entry_safe(tok, t, &scst_cm_rod_token_list, cm_tok_list_entry) {
+		if (time_after_eq(jiffies, tok->cm_tok_expires)) {
+			TRACE_DBG("ROD token %p expired", tok);
+			scst_cm_del_free_rod_token(tok);
+		}
+	}
+
+	TRACE_EXIT();
+}
+
+/* Deletes all ROD tokens referring to dev, because it leaves the copy manager */
+static void scst_cm_del_dev_rod_tokens(struct scst_device *dev)
+{
+	struct scst_cm_rod_token *tok, *t;
+
+	TRACE_ENTRY();
+
+	spin_lock_irq(&scst_cm_lock);
+	list_for_each_entry_safe(tok, t, &scst_cm_rod_token_list, cm_tok_list_entry) {
+		if (tok->cm_tok_dev == dev)
+			scst_cm_del_free_rod_token(tok);
+	}
+	spin_unlock_irq(&scst_cm_lock);
+
+	TRACE_EXIT();
+}
+
+/*
+ * Returns the copy manager's tgt_dev of dev and, optionally, copies its first
+ * designator into the creator logical unit descriptor of a ROD token.
+ *
+ * Must be called under scst_cm_mutex.
+ */
+static struct scst_tgt_dev *__scst_cm_find_cm_tgt_dev(const struct scst_device *dev,
+						      uint8_t *creator_descr)
+{
+	struct scst_tgt_dev *res = NULL;
+	struct scst_cm_desig *des;
+
+	TRACE_ENTRY();
+
+	lockdep_assert_held(&scst_cm_mutex);
+
+	list_for_each_entry(des, &scst_cm_desig_list, cm_desig_list_entry) {
+		if (des->desig_tgt_dev->dev != dev)
+			continue;
+
+		res = des->desig_tgt_dev;
+		if (creator_descr) {
+			/* Identification descriptor CSCD descriptor format */
+			creator_descr[0] = 0xE4;
+			creator_descr[1] = dev->type;
+			memcpy(&creator_descr[4], des->desig, min(des->desig_len, 20));
+			put_unaligned_be24(dev->block_size, &creator_descr[29]);
+		}
+		break;
+	}
+
+	TRACE_EXIT_HRES(res);
+	return res;
+}
+
+static struct scst_tgt_dev *scst_cm_find_cm_tgt_dev(const struct scst_device *dev,
+						    uint8_t *creator_descr)
+{
+	struct scst_tgt_dev *res;
+
+	mutex_lock(&scst_cm_mutex);
+	res = __scst_cm_find_cm_tgt_dev(dev, creator_descr);
+	mutex_unlock(&scst_cm_mutex);
+
+	return res;
+}
+
+/* Parse the POPULATE TOKEN parameter list and create the ROD token */
+static void scst_cm_populate_token(struct scst_cmd *cmd)
+{
+	struct scst_device *dev = cmd->dev;
+	struct scst_cm_rod_token *tok;
+	struct scst_cm_list_id *l;
+	ssize_t length;
+	uint8_t *buf, *rod_token;
+	uint32_t timeout;
+	int list_id;
+	int rdl, cnt, i;
+	uint64_t blocks = 0, nr_blocks = ULLONG_MAX;
+
+	TRACE_ENTRY();
+
+	list_id = get_unaligned_be32(&cmd->cdb[6]);
+
+	length = scst_get_buf_full_sense(cmd, &buf);
+	if (unlikely(length <= 0))
+		goto out;
+
+	TRACE_BUFF_FLAG(TRACE_DEBUG, "buf", buf, length);
+
+	if (length < 16) {
+		PRINT_WARNING("Too small POPULATE TOKEN data len %d", (int)length);
+		scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_parameter_list_length_invalid));
+		goto out_put;
+	}
+
+	if ((buf[2] & 2) != 0) { /* RTV */
+		uint32_t rod_type = get_unaligned_be32(&buf[8]);
+
+		if (rod_type != 0 && rod_type != SCST_CM_ROD_TYPE_AUR) {
+			PRINT_WARNING("Not supported ROD type %x", rod_type);
+			scst_set_invalid_field_in_parm_list(cmd, 8, 0);
+			goto out_put;
+		}
+	}
+
+	timeout = get_unaligned_be32(&buf[4]);
+	if (timeout == 0) {
+		timeout = SCST_CM_ROD_DEF_TIMEOUT;
+	} else if (timeout > SCST_CM_ROD_MAX_TIMEOUT) {
+		PRINT_WARNING("Too big ROD token inactivity timeout %d", timeout);
+		scst_set_invalid_field_in_parm_list(cmd, 4, 0);
+		goto out_put;
+	}
+
+	rdl = get_unaligned_be16(&buf[14]);
+	if ((rdl % 16) != 0 || (rdl + 16) > length) {
+		PRINT_WARNING("Invalid block device range descriptors len %d", rdl);
+		scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_parameter_list_length_invalid));
+		goto out_put;
+	}
+
+	cnt = rdl / 16;
+	if (cnt == 0) {
+		PRINT_WARNING("No block device range descriptors");
+		scst_set_invalid_field_in_parm_list(cmd, 14, 0);
+		goto out_put;
+	} else if (cnt > SCST_CM_MAX_ROD_RANGES) {
+		PRINT_WARNING("Too many block device range descriptors %d", cnt);
+		scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_too_many_segment_descriptors));
+		goto out_put;
+	}
+
+	tok = kzalloc(sizeof(*tok), GFP_KERNEL);
+	if (!tok) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate ROD token");
+		scst_set_busy(cmd);
+		goto out_put;
+	}
+
+	if (dev->handler->get_nr_blocks)
+		nr_blocks = dev->handler->get_nr_blocks(dev);
+
+	for (i = 0; i < cnt; i++) {
+		const uint8_t *r = &buf[16 + i * 16];
+		uint64_t lba = get_unaligned_be64(&r[0]);
+		uint32_t nb = get_unaligned_be32(&r[8]);
+
+		if (lba > nr_blocks || nb > nr_blocks - lba) {
+			PRINT_WARNING("Range %d (lba %lld, blocks %d) is beyond the end of device %s (%lld blocks)",
+				      i, (unsigned long long)lba, nb, dev->virt_name,
+				      (unsigned long long)nr_blocks);
+			scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_block_out_range_error));
+			goto out_free_tok;
+		}
+
+		tok->cm_tok_ranges[i].lba = lba;
+		tok->cm_tok_ranges[i].blocks = nb;
+		blocks += nb;
+	}
+
+	if (blocks == 0) {
+		PRINT_WARNING("Zero blocks to populate token");
+		scst_set_invalid_field_in_parm_list(cmd, 16 + 8, 0);
+		goto out_free_tok;
+	} else if (blocks > (SCST_CM_MAX_TOKEN_TRANSFER_SIZE >> dev->block_shift)) {
+		PRINT_WARNING("Too many blocks %lld to populate token",
+			      (unsigned long long)blocks);
+		scst_set_invalid_field_in_parm_list(cmd, 16 + 8, 0);
+		goto out_free_tok;
+	}
+
+	tok->cm_tok_dev = dev;
+	tok->cm_tok_ranges_cnt = cnt;
+	tok->cm_tok_blocks = blocks;
+	tok->cm_tok_timeout = timeout * HZ;
+
+	rod_token = tok->cm_tok_data;
+	if (!scst_cm_find_cm_tgt_dev(dev, &rod_token[16])) {
+		PRINT_WARNING("Device %s is not registered in the copy manager",
+			      dev->virt_name);
+		scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_invalid_token_operation));
+		goto out_free_tok;
+	}
+
+	put_unaligned_be32(SCST_CM_ROD_TYPE_AUR, &rod_token[0]);
+	put_unaligned_be16(SCST_CM_ROD_TOKEN_LEN - 8, &rod_token[6]);
+	put_unaligned_be64(blocks << dev->block_shift, &rod_token[56]);
+	/* Vendor specific part, makes the token hard to forge */
+	get_random_bytes(&rod_token[128], SCST_CM_ROD_TOKEN_LEN - 128);
+
+	l = scst_cm_add_list_id(cmd, list_id);
+	if (!l)
+		goto out_free_tok;
+
+	l->cm_sa = EC_SA_POPULATE_TOKEN;
+	l->cm_block_shift = dev->block_shift;
+
+	spin_lock_irq(&scst_cm_lock);
+
+	scst_cm_del_expired_rod_tokens();
+	if (scst_cm_rod_tokens_cnt >= SCST_CM_MAX_ROD_TOKENS) {
+		spin_unlock_irq(&scst_cm_lock);
+		PRINT_WARNING("Too many ROD tokens (dev %s, initiator %s)",
+			      dev->virt_name, cmd->sess->initiator_name);
+		scst_set_cmd_error(cmd, SCST_LOAD_SENSE(scst_sense_insufficient_rod_token_res));
+		kfree(tok);
+		goto out_list_id_done;
+	}
+
+	put_unaligned_be64(scst_cm_next_rod_token_id++, &rod_token[8]);
+	tok->cm_tok_expires = jiffies + tok->cm_tok_timeout;
+	list_add_tail(&tok->cm_tok_list_entry, &scst_cm_rod_token_list);
+	scst_cm_rod_tokens_cnt++;
+
+	spin_unlock_irq(&scst_cm_lock);
+
+	/*
+	 * Kept for RECEIVE ROD TOKEN INFORMATION, which can outlive tok. It
+	 * doesn't look at it before the list id's state becomes DONE.
+	 */
+	l->cm_token_blocks = blocks;
+	l->cm_rod_token = kmemdup(rod_token, SCST_CM_ROD_TOKEN_LEN, GFP_KERNEL);
+	if (!l->cm_rod_token) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate ROD token copy");
+		scst_set_busy(cmd);
+	}
+
+	TRACE(TRACE_DEBUG | TRACE_SCSI,
+	      "ROD token %p created (dev %s, list id %d, ranges %d, blocks %lld, timeout %ds)",
+	      tok, dev->virt_name, list_id, cnt, (unsigned long long)blocks, timeout);
+
+out_list_id_done:
+	__scst_cm_store_list_id_details(cmd, l);
+	__scst_cm_sched_del_list_id(cmd, l);
+
+out_put:
+	scst_put_buf_full(cmd, buf);
+
+out:
+	TRACE_EXIT();
+	return;
+
+out_free_tok:
+	kfree(tok);
+	goto out_put;
+}
+
+static void scst_cm_rcv_rod_token_info(struct scst_cmd *cmd)
+{
+	ssize_t length = 0;
+	uint8_t *buf, *tbuf;
+	int list_id;
+	int size, offs;
+	struct scst_cm_list_id *l;
+	struct scst_session *sess = cmd->sess;
+	bool found = false;
+
+	TRACE_ENTRY();
+
+	list_id = get_unaligned_be32(&cmd->cdb[2]);
+
+	size = 32 + SCST_SENSE_BUFFERSIZE + 4 + 2 + SCST_CM_ROD_TOKEN_LEN;
+
+	tbuf = kzalloc(size, GFP_KERNEL);
+	if (!tbuf) {
+		TRACE(TRACE_OUT_OF_MEM,
+		      "Unable to allocate RECEIVE ROD TOKEN INFORMATION buffer (size %d)", size);
+		goto out_busy;
+	}
+
+	spin_lock_irq(&scst_cm_lock);
+	list_for_each_entry(l, &sess->sess_cm_list_id_list, sess_cm_list_id_entry) {
+		if (l->cm_lid == list_id) {
+			TRACE_DBG("list id %p found (id %d)", l, list_id);
+			found = true;
+			break;
+		}
+	}
+	if (found) {
+		if (l->cm_sa != EC_SA_POPULATE_TOKEN && l->cm_sa != EC_SA_WRITE_USING_TOKEN) {
+			found = false;
+			goto skip;
+		}
+
+		tbuf[4] = l->cm_sa; /* RESPONSE TO SERVICE ACTION */
+		if (l->cm_list_id_state == SCST_CM_LIST_ID_STATE_ACTIVE)
+			tbuf[5] = 0x10; /* in progress, foreground */
+		else if (l->cm_status == 0)
+			tbuf[5] = 1; /* finished, no errors */
+		else
+			tbuf[5] = 2; /* finished with errors */
+
+		tbuf[12] = l->cm_status;
+		EXTRACHECKS_BUG_ON(l->cm_sense_len > SCST_SENSE_BUFFERSIZE);
+		tbuf[13] = l->cm_sense_len;
+		tbuf[14] = l->cm_sense_len;
+		tbuf[15] = 0xF1; /* TRANSFER COUNT UNITS: logical blocks */
+		if (l->cm_sa == EC_SA_POPULATE_TOKEN)
+			put_unaligned_be64(l->cm_token_blocks, &tbuf[16]);
+		else
+			put_unaligned_be64(l->cm_written_size >> l->cm_block_shift, &tbuf[16]);
+		put_unaligned_be16(l->cm_segs_processed, &tbuf[24]);
+		if (l->cm_sense_len > 0)
+			memcpy(&tbuf[32], l->cm_sense, l->cm_sense_len);
+
+		offs = 32 + l->cm_sense_len;
+		if (l->cm_list_id_state != SCST_CM_LIST_ID_STATE_ACTIVE && l->cm_rod_token &&
+		    l->cm_status == 0) {
+			/* ROD TOKEN DESCRIPTORS LENGTH */
+			put_unaligned_be32(2 + SCST_CM_ROD_TOKEN_LEN, &tbuf[offs]);
+			memcpy(&tbuf[offs + 4 + 2], l->cm_rod_token, SCST_CM_ROD_TOKEN_LEN);
+			size = offs + 4 + 2 + SCST_CM_ROD_TOKEN_LEN;
+		} else {
+			size = offs + 4;
+		}
+		put_unaligned_be32(size - 4, &tbuf[0]);
+
+		if (l->cm_list_id_state != SCST_CM_LIST_ID_STATE_ACTIVE &&
+		    (cmd->bufflen == 0 || cmd->bufflen >= size))
+			l->cm_can_be_immed_free = 1;
+
+		if (l->cm_can_be_immed_free && l->cm_done)
+			scst_cm_del_free_list_id(l);
+	}
+
+skip:
+	l = NULL; /* after unlock it can be immediately get dead */
+
+	spin_unlock_irq(&scst_cm_lock);
+
+	if (!found)
+		goto out_list_id_not_found;
+
+	length = scst_get_buf_full_sense(cmd, &buf);
+	if (unlikely(length <= 0))
+		goto out_free;
+
+	length = min_t(int, size, length);
+
+	memcpy(buf, tbuf, length);
+	scst_set_resp_data_len(cmd, length);
+
+	scst_put_buf_full(cmd, buf);
+
+out_free:
+	kfree(tbuf);
+
+	TRACE_EXIT();
+	return;
+
+out_list_id_not_found:
+	TRACE_DBG("list_id %d not found", list_id);
+	scst_set_invalid_field_in_cdb(cmd, 2, 0);
+	goto out_free;
+
+out_busy:
+	scst_set_busy(cmd);
+	goto out_free;
+}
+
 static void scst_cm_copy_status(struct scst_cmd *cmd)
 {
 	ssize_t length = 0;
@@ -2208,15 +2689,18 @@ enum scst_exec_res scst_cm_rcv_copy_res_exec(struct scst_cmd *cmd)
 	action = cmd->cdb[1] & 0x1F;
 
 	switch (action) {
-	case 0: /* copy status */
+	case RCR_SA_COPY_STATUS:
 		scst_cm_copy_status(cmd);
 		break;
-	case 3: /* operational parameters */
+	case RCR_SA_OPERATING_PARAMETERS:
 		scst_cm_oper_parameters(cmd);
 		break;
-	case 4: /* failed segment details */
+	case RCR_SA_FAILED_SEGMENT_DETAILS:
 		scst_cm_failed_seg_details(cmd);
 		break;
+	case RCR_SA_RECEIVE_ROD_TOKEN_INFO:
+		scst_cm_rcv_rod_token_info(cmd);
+		break;
 	default:
 		TRACE(TRACE_MINOR, "%s: action %d not supported",
 		      cmd->op_name, action);
@@ -2231,6 +2715,75 @@ enum scst_exec_res scst_cm_rcv_copy_res_exec(struct scst_cmd *cmd)
 	return res;
 }
 
+/**
+ * scst_cm_fill_tpc_vpd() - fill the Third-party Copy VPD page (8Fh)
+ * @dev:	device, for which the page is requested
+ * @buf:	buffer for the page, including the 4 bytes header
+ * @size:	size of buf
+ *
+ * Dev handlers should call it on INQUIRY EVPD=0x8F, so initiators, like
+ * Windows, can detect ROD token based copy offload support. The peripheral
+ * qualifier and device type in buf[0] are not touched. Returns the page length
+ * or -EINVAL if buf is too small.
+ */
+int scst_cm_fill_tpc_vpd(const struct scst_device *dev, uint8_t *buf, int size)
+{
+	uint8_t *p = &buf[4];
+	int res;
+
+	TRACE_ENTRY();
+
+	if (size < 4 + 16 + 36 + 16) {
+		res = -EINVAL;
+		goto out;
+	}
+
+	buf[1] = 0x8F;
+
+	/* Supported Commands descriptor */
+	put_unaligned_be16(0x0001, &p[0]);
+	put_unaligned_be16(12, &p[2]);
+	p[4] = 11; /* COMMANDS SUPPORTED LIST LENGTH */
+	p[5] = EXTENDED_COPY;
+	p[6] = 3;
+	p[7] = EC_SA_EXTENDED_COPY_LID1;
+	p[8] = EC_SA_POPULATE_TOKEN;
+	p[9] = EC_SA_WRITE_USING_TOKEN;
+	p[10] = RECEIVE_COPY_RESULTS;
+	p[11] = 4;
+	p[12] = RCR_SA_COPY_STATUS;
+	p[13] = RCR_SA_OPERATING_PARAMETERS;
+	p[14] = RCR_SA_FAILED_SEGMENT_DETAILS;
+	p[15] = RCR_SA_RECEIVE_ROD_TOKEN_INFO;
+	p += 16;
+
+	/* Block Device ROD Token Limits descriptor */
+	put_unaligned_be16(0x0000, &p[0]);
+	put_unaligned_be16(0x20, &p[2]);
+	put_unaligned_be16(SCST_CM_MAX_ROD_RANGES, &p[10]);
+	put_unaligned_be32(SCST_CM_ROD_MAX_TIMEOUT, &p[12]);
+	put_unaligned_be32(SCST_CM_ROD_DEF_TIMEOUT, &p[16]);
+	put_unaligned_be64(SCST_CM_MAX_TOKEN_TRANSFER_SIZE >> dev->block_shift, &p[20]);
+	put_unaligned_be64(SCST_CM_OPT_TOKEN_TRANSFER_SIZE >> dev->block_shift, &p[28]);
+	p += 36;
+
+	/* Supported ROD Types descriptor */
+	put_unaligned_be16(0x0108, &p[0]);
+	put_unaligned_be16(12, &p[2]);
+	put_unaligned_be16(8, &p[6]);
+	put_unaligned_be32(SCST_CM_ROD_TYPE_AUR, &p[8]);
+	p[12] = 3; /* TOKEN_IN and TOKEN_OUT */
+	p += 16;
+
+	res = p - buf;
+	put_unaligned_be16(res - 4, &buf[2]);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+EXPORT_SYMBOL_GPL(scst_cm_fill_tpc_vpd);
+
 struct scst_cm_init_inq_priv {
 	/* Must be the first for scst_finish_internal_cmd()! */
 	scst_i_finish_fn_t cm_init_inq_finish_fn;
@@ -2594,6 +3147,7 @@ static void scst_cm_dev_unregister(struct scst_device *dev)
 	TRACE_DBG("Unregister CM dev %s", dev->virt_name);
 
 	scst_cm_dev_free_designators(dev);
+	scst_cm_del_dev_rod_tokens(dev);
 
 	lun = scst_cm_get_lun(dev);
 	if (lun != SCST_MAX_LUN)
@@ -2805,6 +3359,7 @@ bool scst_cm_on_del_lun(struct scst_acg_dev *acg_dev, bool gen_report_luns_chang
 		goto out;
 
 	scst_cm_dev_free_designators(acg_dev->dev);
+	scst_cm_del_dev_rod_tokens(acg_dev->dev);
 
 	res = false;
 
@@ -3339,6 +3894,357 @@ static void scst_cm_free_ec_priv(struct scst_cmd *ec_cmd, bool unblock_dev)
 	TRACE_EXIT();
 }
 
+static struct scst_cm_ec_cmd_priv *scst_cm_alloc_ec_priv(struct scst_cmd *ec_cmd, int seg_cnt)
+{
+	struct scst_cm_ec_cmd_priv *p;
+
+	TRACE_ENTRY();
+
+	p = kzalloc(sizeof(*p) + seg_cnt * sizeof(struct scst_ext_copy_seg_descr), GFP_KERNEL);
+	if (!p) {
+		TRACE(TRACE_OUT_OF_MEM,
+		      "Unable to allocate Extended Copy descriptors (seg_cnt %d)", seg_cnt);
+		scst_set_busy(ec_cmd);
+		goto out;
+	}
+
+	INIT_LIST_HEAD(&p->cm_sorted_devs_list);
+	INIT_LIST_HEAD(&p->cm_internal_cmd_list);
+	p->cm_error = SCST_CM_ERROR_NONE;
+	mutex_init(&p->cm_mutex);
+
+	ec_cmd->cmd_data_descriptors = p;
+	ec_cmd->cmd_data_descriptors_cnt = seg_cnt;
+
+out:
+	TRACE_EXIT_HRES(p);
+	return p;
+}
+
+/*
+ * Maps the ROD token ranges src, starting from offset blocks, on the
+ * destination ranges dst. If d isn't NULL, fills the corresponding block to
+ * block segment descriptors there. Returns number of the segments or -1, if
+ * more than SCST_CM_MAX_SEG_DESCR_CNT segments are needed.
+ */
+static int scst_cm_wut_build_segs(struct scst_cmd *ec_cmd,
+				  const struct scst_cm_rod_range *src, int src_cnt, uint64_t offset,
+				  const struct scst_cm_rod_range *dst, int dst_cnt,
+				  struct scst_tgt_dev *src_tgt_dev, struct scst_tgt_dev *dst_tgt_dev,
+				  struct scst_ext_copy_seg_descr *d)
+{
+	int block_shift = ec_cmd->dev->block_shift;
+	uint64_t max_blocks = SCST_CM_MAX_SEG_LEN >> block_shift;
+	uint64_t src_done, dst_done = 0, blocks;
+	int si = 0, di = 0, cnt = 0;
+
+	TRACE_ENTRY();
+
+	while (si < src_cnt && offset >= src[si].blocks) {
+		offset -= src[si].blocks;
+		si++;
+	}
+	src_done = offset;
+
+	while (si < src_cnt && di < dst_cnt) {
+		blocks = min3(src[si].blocks - src_done, dst[di].blocks - dst_done, max_blocks);
+		if (blocks != 0) {
+			if (cnt == SCST_CM_MAX_SEG_DESCR_CNT) {
+				cnt = -1;
+				break;
+			}
+			if (d) {
+				d[cnt].type = SCST_EXT_COPY_SEG_DATA;
+				d[cnt].src_tgt_dev = src_tgt_dev;
+				d[cnt].dst_tgt_dev = dst_tgt_dev;
+				d[cnt].data_descr.src_lba = src[si].lba + src_done;
+				d[cnt].data_descr.dst_lba = dst[di].lba + dst_done;
+				d[cnt].data_descr.data_len = blocks << block_shift;
+				d[cnt].tgt_descr_offs = SCST_CM_WUT_RANGES_OFFS + di * 16;
+			}
+			cnt++;
+		}
+
+		src_done += blocks;
+		if (src_done == src[si].blocks) {
+			si++;
+			src_done = 0;
+		}
+		dst_done += blocks;
+		if (dst_done == dst[di].blocks) {
+			di++;
+			dst_done = 0;
+		}
+	}
+
+	TRACE_EXIT_RES(cnt);
+	return cnt;
+}
+
+/* Parse the WRITE USING TOKEN parameter list. */
+static int scst_cm_parse_wut_descriptors(struct scst_cmd *ec_cmd)
+{
+	int res = 0;
+	struct scst_device *dev = ec_cmd->dev;
+	struct scst_device *src_dev = NULL;
+	struct scst_cm_list_id *plist_id = NULL;
+	struct scst_cm_rod_token *tok;
+	struct scst_cm_rod_range *src_ranges, *dst_ranges;
+	struct scst_tgt_dev *src_tgt_dev, *dst_tgt_dev;
+	struct scst_cm_ec_cmd_priv *p;
+	const uint8_t *rod_token;
+	ssize_t length = 0;
+	uint8_t *buf;
+	uint64_t offset, src_blocks = 0, nr_blocks = ULLONG_MAX;
+	int list_id, rdl, src_cnt = 0, dst_cnt, seg_cnt, i;
+	bool found = false, read_only;
+
+	TRACE_ENTRY();
+
+	length = scst_get_buf_full_sense(ec_cmd, &buf);
+	if (unlikely(length <= 0)) {
+		if (length == 0)
+			goto out_put;
+		else
+			goto out_abn;
+	}
+
+	TRACE_BUFF_FLAG(TRACE_DEBUG, "buf", buf, length);
+
+	if (length < SCST_CM_WUT_RANGES_OFFS) {
+		PRINT_WARNING("Too small WRITE USING TOKEN data len %d", (int)length);
+		scst_set_cmd_error(ec_cmd,
+				   SCST_LOAD_SENSE(scst_sense_parameter_list_length_invalid));
+		goto out_abn_put;
+	}
+
+	list_id = get_unaligned_be32(&ec_cmd->cdb[6]);
+	plist_id = scst_cm_add_list_id(ec_cmd, list_id);
+	if (!plist_id)
+		goto out_abn_put;
+
+	plist_id->cm_sa = EC_SA_WRITE_USING_TOKEN;
+	plist_id->cm_block_shift = dev->block_shift;
+
+	rod_token = &buf[SCST_CM_WUT_TOKEN_OFFS];
+	if (get_unaligned_be32(&rod_token[0]) != SCST_CM_ROD_TYPE_AUR) {
+		PRINT_WARNING("Not supported ROD token type %x",
+			      get_unaligned_be32(&rod_token[0]));
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_unsupported_token_type));
+		goto out_keep_list_id;
+	}
+	if (get_unaligned_be16(&rod_token[6]) != SCST_CM_ROD_TOKEN_LEN - 8) {
+		PRINT_WARNING("Invalid ROD token len %d", get_unaligned_be16(&rod_token[6]));
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_invalid_token_length));
+		goto out_keep_list_id;
+	}
+
+	rdl = get_unaligned_be16(&buf[SCST_CM_WUT_RANGES_OFFS - 2]);
+	if ((rdl % 16) != 0 || (rdl + SCST_CM_WUT_RANGES_OFFS) > length) {
+		PRINT_WARNING("Invalid block device range descriptors len %d", rdl);
+		scst_set_cmd_error(ec_cmd,
+				   SCST_LOAD_SENSE(scst_sense_parameter_list_length_invalid));
+		goto out_keep_list_id;
+	}
+
+	dst_cnt = rdl / 16;
+	if (dst_cnt == 0) {
+		PRINT_WARNING("No block device range descriptors");
+		scst_set_invalid_field_in_parm_list(ec_cmd, SCST_CM_WUT_RANGES_OFFS - 2, 0);
+		goto out_keep_list_id;
+	} else if (dst_cnt > SCST_CM_MAX_ROD_RANGES) {
+		PRINT_WARNING("Too many block device range descriptors %d", dst_cnt);
+		scst_set_cmd_error(ec_cmd,
+				   SCST_LOAD_SENSE(scst_sense_too_many_segment_descriptors));
+		goto out_keep_list_id;
+	}
+
+	src_ranges = kmalloc_array(2 * SCST_CM_MAX_ROD_RANGES, sizeof(*src_ranges), GFP_KERNEL);
+	if (!src_ranges) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to allocate ROD token ranges");
+		scst_set_busy(ec_cmd);
+		goto out_keep_list_id;
+	}
+	dst_ranges = &src_ranges[SCST_CM_MAX_ROD_RANGES];
+
+	if (dev->handler->get_nr_blocks)
+		nr_blocks = dev->handler->get_nr_blocks(dev);
+
+	for (i = 0; i < dst_cnt; i++) {
+		const uint8_t *r = &buf[SCST_CM_WUT_RANGES_OFFS + i * 16];
+
+		dst_ranges[i].lba = get_unaligned_be64(&r[0]);
+		dst_ranges[i].blocks = get_unaligned_be32(&r[8]);
+		if (dst_ranges[i].lba > nr_blocks ||
+		    dst_ranges[i].blocks > nr_blocks - dst_ranges[i].lba) {
+			PRINT_WARNING("Range %d (lba %lld, blocks %d) is beyond the end of device %s (%lld blocks)",
+				      i, (unsigned long long)dst_ranges[i].lba,
+				      dst_ranges[i].blocks, dev->virt_name,
+				      (unsigned long long)nr_blocks);
+			scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_block_out_range_error));
+			goto out_free_ranges;
+		}
+	}
+
+	offset = get_unaligned_be64(&buf[8]);
+
+	/*
+	 * A device's designators are removed under scst_cm_mutex before its
+	 * ROD tokens are deleted and before the device is freed. Holding the
+	 * mutex from the token lookup until the source device has been
+	 * resolved therefore guarantees that a device found by the token's
+	 * device pointer is the device that created the token and not a new
+	 * device that has been allocated at the same address.
+	 */
+	mutex_lock(&scst_cm_mutex);
+	spin_lock_irq(&scst_cm_lock);
+	list_for_each_entry(tok, &scst_cm_rod_token_list, cm_tok_list_entry) {
+		if (memcmp(&tok->cm_tok_data[8], &rod_token[8], 8) == 0) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		spin_unlock_irq(&scst_cm_lock);
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_MINOR | TRACE_SCSI, "ROD token not found (initiator %s)",
+		      ec_cmd->sess->initiator_name);
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_token_unknown));
+		goto out_free_ranges;
+	}
+	if (memcmp(tok->cm_tok_data, rod_token, SCST_CM_ROD_TOKEN_LEN) != 0) {
+		spin_unlock_irq(&scst_cm_lock);
+		mutex_unlock(&scst_cm_mutex);
+		PRINT_WARNING("Corrupted ROD token (initiator %s)", ec_cmd->sess->initiator_name);
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_token_corrupt));
+		goto out_free_ranges;
+	}
+	if (time_after_eq(jiffies, tok->cm_tok_expires)) {
+		scst_cm_del_free_rod_token(tok);
+		spin_unlock_irq(&scst_cm_lock);
+		mutex_unlock(&scst_cm_mutex);
+		TRACE(TRACE_MINOR | TRACE_SCSI, "ROD token expired (initiator %s)",
+		      ec_cmd->sess->initiator_name);
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_token_expired));
+		goto out_free_ranges;
+	}
+
+	src_dev = tok->cm_tok_dev;
+	src_cnt = tok->cm_tok_ranges_cnt;
+	src_blocks = tok->cm_tok_blocks;
+	memcpy(src_ranges, tok->cm_tok_ranges, src_cnt * sizeof(*src_ranges));
+
+	if (buf[2] & 2) { /* DEL_TKN */
+		TRACE_DBG("Deleting ROD token %p", tok);
+		scst_cm_del_free_rod_token(tok);
+	} else {
+		tok->cm_tok_expires = jiffies + tok->cm_tok_timeout;
+	}
+	spin_unlock_irq(&scst_cm_lock);
+
+	src_tgt_dev = __scst_cm_find_cm_tgt_dev(src_dev, NULL);
+	dst_tgt_dev = __scst_cm_find_cm_tgt_dev(dev, NULL);
+	mutex_unlock(&scst_cm_mutex);
+	if (!src_tgt_dev || !dst_tgt_dev) {
+		PRINT_WARNING("Source or destination device not registered in the copy manager (initiator %s)",
+			      ec_cmd->sess->initiator_name);
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_invalid_token_operation));
+		goto out_free_ranges;
+	}
+
+	if (!scst_cm_check_access(ec_cmd->sess->initiator_name, src_tgt_dev->dev, &read_only)) {
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_invalid_token_operation));
+		goto out_free_ranges;
+	}
+
+	if (src_tgt_dev->dev->block_size != dev->block_size) {
+		PRINT_WARNING("Source block size %d doesn't match %d",
+			      src_tgt_dev->dev->block_size, dev->block_size);
+		scst_set_cmd_error(ec_cmd, SCST_LOAD_SENSE(scst_sense_invalid_token_operation));
+		goto out_free_ranges;
+	}
+
+	if (offset >= src_blocks) {
+		PRINT_WARNING("Offset into ROD %lld beyond the ROD token size %lld",
+			      (unsigned long long)offset, (unsigned long long)src_blocks);
+		scst_set_invalid_field_in_parm_list(ec_cmd, 8, 0);
+		goto out_free_ranges;
+	}
+
+	seg_cnt = scst_cm_wut_build_segs(ec_cmd, src_ranges, src_cnt, offset, dst_ranges,
+					 dst_cnt, src_tgt_dev, dst_tgt_dev, NULL);
+
+	TRACE_DBG("seg_cnt %d", seg_cnt);
+
+	if (seg_cnt < 0) {
+		PRINT_WARNING("Too many segments needed to write using token (initiator %s)",
+			      ec_cmd->sess->initiator_name);
+		scst_set_cmd_error(ec_cmd,
+				   SCST_LOAD_SENSE(scst_sense_too_many_segment_descriptors));
+		goto out_free_ranges;
+	} else if (seg_cnt == 0) {
+		/* Nothing to copy */
+		goto out_free_ranges_done;
+	}
+
+	p = scst_cm_alloc_ec_priv(ec_cmd, seg_cnt);
+	if (!p)
+		goto out_free_ranges;
+
+	scst_cm_wut_build_segs(ec_cmd, src_ranges, src_cnt, offset, dst_ranges, dst_cnt,
+			       src_tgt_dev, dst_tgt_dev, p->cm_seg_descrs);
+
+	res = scst_cm_add_to_descr_list(ec_cmd, ec_cmd->tgt_dev);
+	if (res != 0)
+		goto out_free_p;
+	res = scst_cm_add_to_descr_list(ec_cmd, src_tgt_dev);
+	if (res != 0)
+		goto out_free_p;
+	res = scst_cm_add_to_descr_list(ec_cmd, dst_tgt_dev);
+	if (res != 0)
+		goto out_free_p;
+
+	TRACE(TRACE_DEBUG | TRACE_SCSI,
+	      "ec_cmd %p, src dev %s, dst dev %s, offset %lld, segs %d",
+	      ec_cmd, src_tgt_dev->dev->virt_name, dev->virt_name,
+	      (unsigned long long)offset, seg_cnt);
+
+	p->cm_list_id = plist_id;
+	kfree(src_ranges);
+
+out_put:
+	scst_put_buf_full(ec_cmd, buf);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_free_ranges_done:
+	kfree(src_ranges);
+	__scst_cm_store_list_id_details(ec_cmd, plist_id);
+	__scst_cm_sched_del_list_id(ec_cmd, plist_id);
+	goto out_put;
+
+out_free_p:
+	scst_cm_free_ec_priv(ec_cmd, false);
+
+out_free_ranges:
+	kfree(src_ranges);
+
+out_keep_list_id:
+	/* Keep list_id for a while for RECEIVE ROD TOKEN INFORMATION */
+	__scst_cm_store_list_id_details(ec_cmd, plist_id);
+	__scst_cm_sched_del_list_id(ec_cmd, plist_id);
+
+out_abn_put:
+	scst_put_buf_full(ec_cmd, buf);
+
+out_abn:
+	scst_set_cmd_abnormal_done_state(ec_cmd);
+	res = -1;
+	goto out;
+}
+
 /* Parse the EXTENDED COPY parameter list. */
 int scst_cm_parse_descriptors(struct scst_cmd *ec_cmd)
 {
@@ -3356,7 +4262,12 @@ int scst_cm_parse_descriptors(struct scst_cmd *ec_cmd)
 
 	EXTRACHECKS_BUG_ON(ec_cmd->cmd_data_descriptors);
 
-	if (ec_cmd->cdb[1] != 0) {
+	if (ec_cmd->cdb[1] == EC_SA_WRITE_USING_TOKEN) {
+		res = scst_cm_parse_wut_descriptors(ec_cmd);
+		goto out;
+	}
+
+	if (ec_cmd->cdb[1] != EC_SA_EXTENDED_COPY_LID1) {
 		/*
 		 * SCST only supports the EXTENDED COPY(LID1) command.
 		 * Reject EXTENDED COPY(LID4) commands since these have a
@@ -3514,23 +4425,12 @@ int scst_cm_parse_descriptors(struct scst_cmd *ec_cmd)
 
 	TRACE_DBG("seg_cnt %d", seg_cnt);
 
-	p = kzalloc(sizeof(*p) + seg_cnt * sizeof(struct scst_ext_copy_seg_descr), GFP_KERNEL);
-	if (!p) {
-		TRACE(TRACE_OUT_OF_MEM,
-		      "Unable to allocate Extended Copy descriptors (seg_cnt %d)", seg_cnt);
-		scst_set_busy(ec_cmd);
+	p = scst_cm_alloc_ec_priv(ec_cmd, seg_cnt);
+	if (!p)
 		goto out_free_tgt_descr;
-	}
 
 	p->cm_list_id = plist_id;
 	plist_id = NULL;
-	INIT_LIST_HEAD(&p->cm_sorted_devs_list);
-	INIT_LIST_HEAD(&p->cm_internal_cmd_list);
-	p->cm_error = SCST_CM_ERROR_NONE;
-	mutex_init(&p->cm_mutex);
-
-	ec_cmd->cmd_data_descriptors = p;
-	ec_cmd->cmd_data_descriptors_cnt = seg_cnt;
 
 	res = scst_cm_add_to_descr_list(ec_cmd, ec_cmd->tgt_dev);
 	if (res != 0)
@@ -3805,8 +4705,15 @@ out_unreg_tgtt:
 
 void __exit scst_cm_exit(void)
 {
+	struct scst_cm_rod_token *tok, *t;
+
 	TRACE_ENTRY();
 
+	spin_lock_irq(&scst_cm_lock);
+	list_for_each_entry_safe(tok, t, &scst_cm_rod_token_list, cm_tok_list_entry)
+		scst_cm_del_free_rod_token(tok);
+	spin_unlock_irq(&scst_cm_lock);
+
 	scst_unregister_session(scst_cm_sess, true, NULL);
 	scst_unregister_target(scst_cm_tgt);
 	scst_unregister_target_template(&scst_cm_tgtt);
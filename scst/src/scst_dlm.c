@@ -282,10 +282,62 @@ static bool scst_copy_res_from_dlm(struct scst_device *dev, struct pr_lvb *lvb)
 	return modified_lvb;
 }
 
+/* Sequence number of the PR_DATA_LOCK LVB update that follows @seq. */
+static uint32_t scst_dlm_next_chg_seq(uint32_t seq)
+{
+	return seq + 1 ? : 1;
+}
+
+/*
+ * Record in the PR_DATA_LOCK LVB that the PR_REG_LOCK LVB with index @idx is
+ * modified by the update that is in progress. @nr_changed is the number of
+ * PR_REG_LOCK LVB's recorded so far.
+ */
+static void scst_dlm_add_changed(struct pr_lvb *lvb, int nr_changed, int idx)
+{
+	if (nr_changed < PR_LVB_MAX_CHANGED)
+		lvb->changed[nr_changed] = cpu_to_be32(idx);
+}
+
+/*
+ * Finish an update of the PR_DATA_LOCK LVB that modified @nr_changed
+ * PR_REG_LOCK LVB's or any PR_REG_LOCK LVB if @all is true. Caller must hold
+ * PR_DATA_LOCK in PW mode.
+ */
+static void scst_dlm_publish_changes(struct scst_pr_dlm_data *pr_dlm,
+				     int nr_changed, bool all)
+{
+	struct pr_lvb *lvb = (void *)pr_dlm->lvb;
+
+	if (all || nr_changed > PR_LVB_MAX_CHANGED)
+		nr_changed = PR_LVB_ALL_CHANGED;
+	pr_dlm->chg_seq = scst_dlm_next_chg_seq(be32_to_cpu(lvb->chg_seq));
+	lvb->chg_seq = cpu_to_be32(pr_dlm->chg_seq);
+	lvb->nr_changed = cpu_to_be16(nr_changed);
+}
+
+/* Whether @idx occurs in the first @n elements of @slot. */
+static bool scst_dlm_slot_listed(const uint32_t *slot, uint32_t n, int idx)
+{
+	uint32_t k;
+
+	for (k = 0; k < n; k++)
+		if (slot[k] == idx)
+			return true;
+
+	return false;
+}
+
 /*
  * Update local PR and registrant information from the content of the DLM LVB's.
  * Caller must hold PR_DATA_LOCK in PW mode.
  *
+ * If this node processed the previous update of the PR_DATA_LOCK LVB, only
+ * the PR_REG_LOCK LVB's listed in the PR_DATA_LOCK LVB are read. The
+ * registrants in the other slots are left alone since their reg->lvb still
+ * matches the contents of their slot. Otherwise all PR_REG_LOCK LVB's are
+ * read.
+ *
  * Returns -EINVAL if and only if an invalid lock value block has been
  * encountered.
  */
@@ -296,30 +348,65 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 	struct pr_lvb *lvb = (void *)pr_dlm->lvb;
 	struct scst_lksb *reg_lksb = NULL;
 	struct scst_dev_registrant *reg, *tmp_reg;
-	int i, res = -ENOMEM;
-	uint32_t nr_registrants;
+	int i, k, res = -ENOMEM, nr_written = 0;
+	uint32_t nr_registrants, nr_read, nr_changed, chg_seq;
+	uint32_t *slot = NULL;
+	u64 pr_jnl_seq;
 	void *reg_lvb_content = NULL;
+	bool all;
 
 	lockdep_assert_held(&pr_dlm->ls_mutex);
 
 	nr_registrants = be32_to_cpu(lvb->nr_registrants);
-	if (nr_registrants) {
-		reg_lksb = vcalloc(nr_registrants, sizeof(*reg_lksb) + PR_DLM_LVB_LEN);
+	chg_seq = be32_to_cpu(lvb->chg_seq);
+	nr_changed = be16_to_cpu(lvb->nr_changed);
+	all = pr_dlm->chg_seq == 0 ||
+		chg_seq != scst_dlm_next_chg_seq(pr_dlm->chg_seq) ||
+		nr_changed > PR_LVB_MAX_CHANGED;
+	pr_dlm->chg_seq = 0;
+
+	if (all) {
+		nr_read = nr_registrants;
+	} else {
+		nr_read = 0;
+		for (k = 0; k < nr_changed; k++)
+			if (be32_to_cpu(lvb->changed[k]) < nr_registrants)
+				nr_read++;
+	}
+
+	if (nr_read) {
+		reg_lksb = vcalloc(nr_read, sizeof(*reg_lksb) + PR_DLM_LVB_LEN +
+				   sizeof(*slot));
 		if (!reg_lksb) {
 			PRINT_ERROR("%s: failed to allocate %u * %zu bytes of memory",
-				    __func__, nr_registrants,
-				    sizeof(*reg_lksb) + PR_DLM_LVB_LEN);
+				    __func__, nr_read,
+				    sizeof(*reg_lksb) + PR_DLM_LVB_LEN +
+				    sizeof(*slot));
 			goto out;
 		}
 		reg_lvb_content = (void *)reg_lksb +
-			nr_registrants * sizeof(*reg_lksb);
+			nr_read * sizeof(*reg_lksb);
+		slot = reg_lvb_content + nr_read * PR_DLM_LVB_LEN;
 	}
 
-	for (i = 0; i < nr_registrants; i++) {
+	if (all) {
+		for (i = 0; i < nr_read; i++)
+			slot[i] = i;
+	} else {
+		i = 0;
+		for (k = 0; k < nr_changed; k++)
+			if (be32_to_cpu(lvb->changed[k]) < nr_registrants)
+				slot[i++] = be32_to_cpu(lvb->changed[k]);
+	}
+
+	TRACE_DBG("%s: reading %u of %u registrant LVBs", dev->virt_name,
+		  nr_read, nr_registrants);
+
+	for (i = 0; i < nr_read; i++) {
 		char reg_name[32];
 		struct pr_reg_lvb *reg_lvb;
 
-		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, i);
+		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, slot[i]);
 		reg_lvb = reg_lvb_content + i * PR_DLM_LVB_LEN;
 		reg_lksb[i].lksb.sb_lvbptr = (void *)reg_lvb;
 		res = scst_dlm_lock_wait(ls, DLM_LOCK_PW, &reg_lksb[i],
@@ -356,9 +443,11 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 
 	list_for_each_entry(reg, &dev->dev_registrants_list,
 			    dev_registrants_list_entry)
-		scst_dlm_pr_rm_reg_ls(ls, reg, false);
+		if (all || reg->dlm_idx >= (int)nr_registrants ||
+		    scst_dlm_slot_listed(slot, nr_read, reg->dlm_idx))
+			scst_dlm_pr_rm_reg_ls(ls, reg, false);
 
-	for (i = 0; i < nr_registrants; i++) {
+	for (i = 0; i < nr_read; i++) {
 		struct pr_reg_lvb *reg_lvb;
 		uint16_t rel_tgt_id;
 
@@ -366,7 +455,7 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 		rel_tgt_id = be16_to_cpu(reg_lvb->rel_tgt_id);
 #if 0
 		PRINT_INFO("Transport ID in %s." PR_REG_LOCK " (len %d):",
-			   dev->virt_name, i, scst_tid_size(reg_lvb->tid));
+			   dev->virt_name, slot[i], scst_tid_size(reg_lvb->tid));
 		print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16, 1,
 			       reg_lvb->tid, scst_tid_size(reg_lvb->tid), 1);
 #endif
@@ -382,19 +471,13 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 		if (reg) {
 			scst_dlm_pr_rm_reg_ls(ls, reg, false);
 			reg->lksb.lksb.sb_lkid = reg_lksb[i].lksb.sb_lkid;
-			reg->dlm_idx = i;
+			reg->dlm_idx = slot[i];
 			reg->registered_by_nodeid = be32_to_cpu(reg_lvb->registered_by_nodeid);
 			reg->next_rem_ua_idx = be16_to_cpu(reg_lvb->next_rem_ua_idx);
 			memcpy(reg->lvb, reg_lvb, sizeof(reg->lvb));
-			if (reg_lvb->is_holder) {
-				if (dev->pr_is_set)
-					scst_pr_clear_holder(dev);
-				scst_pr_set_holder(dev, reg, lvb->pr_scope,
-						   lvb->pr_type);
-			}
 		} else {
 			PRINT_ERROR("pr_add_registrant %s." PR_REG_LOCK
-				    " failed\n", dev->virt_name, i);
+				    " failed\n", dev->virt_name, slot[i]);
 			scst_dlm_unlock_wait(ls, &reg_lksb[i]);
 			continue;
 		}
@@ -418,6 +501,7 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 			reg->next_rem_ua_idx = 0;
 			reg_lvb->next_rem_ua_idx = cpu_to_be16(reg->next_rem_ua_idx);
 			memcpy(reg->lvb, reg_lvb, sizeof(reg->lvb));
+			scst_dlm_add_changed(lvb, nr_written++, slot[i]);
 			*modified_lvb = true;
 		}
 
@@ -426,16 +510,37 @@ static int scst_copy_from_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
 				   NULL);
 	}
 
+	/*
+	 * Restore the reservation holder. This also covers a holder whose
+	 * PR_REG_LOCK LVB has not been read because it did not change.
+	 */
+	list_for_each_entry(reg, &dev->dev_registrants_list,
+			    dev_registrants_list_entry) {
+		if (!reg->lksb.lksb.sb_lkid ||
+		    !((struct pr_reg_lvb *)reg->lvb)->is_holder)
+			continue;
+		if (dev->pr_is_set)
+			scst_pr_clear_holder(dev);
+		scst_pr_set_holder(dev, reg, lvb->pr_scope, lvb->pr_type);
+	}
+
 	/* Remove all registrants not found in any DLM LVB */
 	list_for_each_entry_safe(reg, tmp_reg, &dev->dev_registrants_list,
 				 dev_registrants_list_entry)
 		if (reg->lksb.lksb.sb_lkid == 0)
 			scst_pr_remove_registrant(dev, reg);
 
-	scst_pr_sync_device_file(dev);
+	pr_jnl_seq = scst_pr_sync_device_file(dev);
 
 	scst_pr_write_unlock(dev);
 
+	scst_pr_commit_device_file(pr_jnl_seq);
+
+	if (*modified_lvb)
+		scst_dlm_publish_changes(pr_dlm, nr_written, false);
+	else
+		pr_dlm->chg_seq = chg_seq;
+
 	res = 0;
 
 out:
@@ -443,7 +548,7 @@ out:
 	return res;
 
 cancel:
-	for (i = 0; i < nr_registrants; i++)
+	for (i = 0; i < nr_read; i++)
 		if (reg_lksb[i].lksb.sb_lkid)
 			scst_dlm_unlock_wait(ls, &reg_lksb[i]);
 
@@ -487,20 +592,55 @@ static void scst_copy_res_to_dlm(struct scst_device *dev, struct pr_lvb *lvb)
 	spin_unlock_bh(&dev->dev_lock);
 }
 
+/* Fill in @reg_lvb with the DLM representation of registrant @reg. */
+static void scst_fill_reg_lvb(struct scst_device *dev,
+			      struct scst_dev_registrant *reg,
+			      struct pr_reg_lvb *reg_lvb)
+{
+	uint32_t tid_size;
+
+	memset(reg_lvb, 0, sizeof(*reg_lvb));
+	reg_lvb->key = reg->key;
+	reg_lvb->rel_tgt_id = cpu_to_be16(reg->rel_tgt_id);
+	reg_lvb->version = 1;
+	reg_lvb->is_holder = dev->pr_holder == reg;
+	reg_lvb->registered_by_nodeid = cpu_to_be32(reg->registered_by_nodeid);
+	reg_lvb->next_rem_ua_idx = cpu_to_be16(reg->next_rem_ua_idx);
+	tid_size = scst_tid_size(reg->transport_id);
+#if 0
+	PRINT_INFO("Copying transport ID into %s." PR_REG_LOCK " (len %d)",
+		   dev->virt_name, reg->dlm_idx, tid_size);
+	print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16, 1,
+		       reg->transport_id, tid_size, 1);
+#endif
+	if (WARN(tid_size > sizeof(reg_lvb->tid), "tid_size %d > %zd\n",
+		 tid_size, sizeof(reg_lvb->tid)))
+		tid_size = sizeof(reg_lvb->tid);
+	memcpy(reg_lvb->tid, reg->transport_id, tid_size);
+}
+
 /*
  * Update PR and registrant information in the DLM LVB's. Caller must hold
  * PR_DATA_LOCK in PW mode.
+ *
+ * Unless @all is true, only the PR_REG_LOCK LVB's whose contents changed are
+ * rewritten. reg->lvb holds the contents this node most recently wrote into
+ * or read from the LVB of slot reg->dlm_idx, so comparing against it is
+ * sufficient to detect unchanged slots without having to convert their locks.
+ * The indexes of the rewritten slots are published in the PR_DATA_LOCK LVB
+ * such that the other nodes only have to read these.
  */
-static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
+static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls,
+			     bool all)
 {
 	struct scst_pr_dlm_data *const pr_dlm = dev->pr_dlm;
 	struct pr_lvb *lvb = (void *)pr_dlm->lvb;
-	struct pr_reg_lvb *reg_lvb;
+	struct pr_reg_lvb *reg_lvb, new_reg_lvb;
 	struct scst_dev_registrant *reg;
 	struct scst_dlm_rem_ua *ua;
-	int i;
+	int i, nr_written = 0;
 	char reg_name[32];
-	uint32_t nr_registrants, tid_size;
+	uint32_t nr_registrants;
 
 	lockdep_assert_held(&pr_dlm->ls_mutex);
 
@@ -530,6 +670,12 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 				reg->dlm_idx = i;
 				reg->registered_by_nodeid = pr_dlm->local_nodeid;
 				reg->next_rem_ua_idx = 0;
+				/*
+				 * The slot still holds the data of whatever
+				 * registrant used it before, so make sure
+				 * that it gets rewritten below.
+				 */
+				memset(reg->lvb, 0, sizeof(reg->lvb));
 			}
 		}
 	}
@@ -538,45 +684,33 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 			    dev_registrants_list_entry) {
 		if (WARN_ON(!reg->lksb.lksb.sb_lkid))
 			continue;
+
+		/*
+		 * If the destination has consumed all the UAs, then
+		 * remove any that we sent and recorded.
+		 */
+		if (reg->next_rem_ua_idx == 0) {
+			while (!list_empty(&reg->sent_rem_ua_list)) {
+				ua = list_first_entry(&reg->sent_rem_ua_list,
+						      struct scst_dlm_rem_ua,
+						      rem_ua_list_entry);
+				scst_dlm_rm_rem_ua_ls(ls, ua);
+				scst_dlm_pr_reg_release_rem_ua(ua);
+			}
+		}
+
+		scst_fill_reg_lvb(dev, reg, &new_reg_lvb);
+		if (!all && list_empty(&reg->pending_rem_ua_list) &&
+		    memcmp(reg->lvb, &new_reg_lvb, sizeof(new_reg_lvb)) == 0)
+			continue;
+
 		snprintf(reg_name, sizeof(reg_name), PR_REG_LOCK, reg->dlm_idx);
 		if (scst_dlm_lock_wait(ls, DLM_LOCK_PW, &reg->lksb,
 				       DLM_LKF_VALBLK | DLM_LKF_CONVERT,
 				       reg_name, NULL) >= 0) {
 			reg_lvb = (void *)reg->lksb.lksb.sb_lvbptr;
 			memset(reg->lvb, 0, sizeof(reg->lvb));
-			reg_lvb->key = reg->key;
-			reg_lvb->rel_tgt_id = cpu_to_be16(reg->rel_tgt_id);
-			reg_lvb->version = 1;
-			reg_lvb->is_holder = dev->pr_holder == reg;
-			reg_lvb->registered_by_nodeid = cpu_to_be32(reg->registered_by_nodeid);
-			reg_lvb->next_rem_ua_idx = cpu_to_be16(reg->next_rem_ua_idx);
-			tid_size = scst_tid_size(reg->transport_id);
-#if 0
-			PRINT_INFO("Copying transport ID into %s." PR_REG_LOCK
-				   " (len %d)", dev->virt_name, reg->dlm_idx,
-				   tid_size);
-			print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16,
-				       1, reg->transport_id, tid_size, 1);
-#endif
-			if (WARN(tid_size > sizeof(reg_lvb->tid),
-				 "tid_size %d > %zd\n", tid_size,
-				 sizeof(reg_lvb->tid)))
-				tid_size = sizeof(reg_lvb->tid);
-			memcpy(reg_lvb->tid, reg->transport_id, tid_size);
-
-			/*
-			 * If the destination has consumed all the UAs, then
-			 * remove any that we sent and recorded.
-			 */
-			if (reg->next_rem_ua_idx == 0) {
-				while (!list_empty(&reg->sent_rem_ua_list)) {
-					ua = list_first_entry(&reg->sent_rem_ua_list,
-							      struct scst_dlm_rem_ua,
-							      rem_ua_list_entry);
-					scst_dlm_rm_rem_ua_ls(ls, ua);
-					scst_dlm_pr_reg_release_rem_ua(ua);
-				}
-			}
+			memcpy(reg_lvb, &new_reg_lvb, sizeof(new_reg_lvb));
 
 			/*
 			 * Do we have UA's to deliver for this registrant?
@@ -605,6 +739,7 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 			scst_dlm_lock_wait(ls, DLM_LOCK_CR, &reg->lksb,
 					   DLM_LKF_CONVERT | DLM_LKF_VALBLK,
 					   reg_name, NULL);
+			scst_dlm_add_changed(lvb, nr_written++, reg->dlm_idx);
 		} else {
 			PRINT_ERROR("Failed to lock %s.%s", dev->virt_name,
 				    reg_name);
@@ -612,6 +747,11 @@ static void scst_copy_to_dlm(struct scst_device *dev, dlm_lockspace_t *ls)
 	}
 
 	scst_pr_write_unlock(dev);
+
+	scst_dlm_publish_changes(pr_dlm, nr_written, all);
+
+	TRACE_DBG("%s: rewrote %d of %u registrant LVBs", dev->virt_name,
+		  nr_written, nr_registrants);
 }
 
 /*
@@ -1044,9 +1184,11 @@ static dlm_lockspace_t *get_lockspace(struct scst_device *dev)
 	if (res < 0)
 		goto release_lockspace;
 
+	/* The registrants of this node do not hold any PR_REG_LOCK yet. */
+	pr_dlm->chg_seq = 0;
 	switch (lvb->version) {
 	case 0:
-		scst_copy_to_dlm(dev, ls);
+		scst_copy_to_dlm(dev, ls, true);
 		break;
 	case 1:
 		res = scst_copy_from_dlm(dev, ls, &modified_lvb);
@@ -1118,6 +1260,16 @@ static void scst_dlm_pr_write_lock(struct scst_device *dev,
 	if (!ls)
 		goto out;
 
+	spin_lock(&pr_dlm->batch_lock);
+	if (pr_dlm->batch_open) {
+		pr_dlm->batch_joined++;
+		pr_lksb->batched = true;
+		pr_lksb->batch_seq = pr_dlm->batch_seq;
+	}
+	spin_unlock(&pr_dlm->batch_lock);
+	if (pr_lksb->batched)
+		goto out;
+
 	scst_dlm_lock_wait(ls, DLM_LOCK_EX, pr_lksb, 0, PR_LOCK, NULL);
 	if (pr_lksb->lksb.sb_lkid) {
 		scst_pr_toggle_lock(pr_dlm, ls, PR_POST_UPDATE_LOCK);
@@ -1126,6 +1278,9 @@ static void scst_dlm_pr_write_lock(struct scst_device *dev,
 				   &pr_dlm->data_lksb,
 				   DLM_LKF_CONVERT | DLM_LKF_VALBLK,
 				   PR_DATA_LOCK, NULL);
+		spin_lock(&pr_dlm->batch_lock);
+		pr_dlm->batch_open = true;
+		spin_unlock(&pr_dlm->batch_lock);
 	}
 
 out:
@@ -1137,6 +1292,24 @@ out:
 	scst_pr_write_lock(dev);
 }
 
+/*
+ * Finish a PR update that joined the lock cycle of another PR update. Waits
+ * until the PR_LOCK holder has propagated the changes of the whole batch such
+ * that the PR OUT command does not complete before the other nodes know
+ * about its effects.
+ */
+static void scst_dlm_pr_leave_batch(struct scst_pr_dlm_data *pr_dlm,
+				    struct scst_lksb *pr_lksb)
+{
+	spin_lock(&pr_dlm->batch_lock);
+	if (--pr_dlm->batch_joined == 0)
+		wake_up_all(&pr_dlm->batch_wq);
+	spin_unlock(&pr_dlm->batch_lock);
+
+	wait_event(pr_dlm->batch_wq,
+		   READ_ONCE(pr_dlm->batch_seq) != pr_lksb->batch_seq);
+}
+
 static void scst_dlm_pr_write_unlock(struct scst_device *dev,
 				     struct scst_lksb *pr_lksb)
 {
@@ -1145,14 +1318,34 @@ static void scst_dlm_pr_write_unlock(struct scst_device *dev,
 
 	scst_pr_write_unlock(dev);
 
+	if (pr_lksb->batched) {
+		scst_dlm_pr_leave_batch(pr_dlm, pr_lksb);
+		return;
+	}
+
 	if (!pr_lksb->lksb.sb_lkid)
 		return;
 
-	scst_copy_to_dlm(dev, ls);
+	/*
+	 * Close the batch and wait until the PR updates that joined it have
+	 * released dev_pr_mutex.
+	 */
+	spin_lock(&pr_dlm->batch_lock);
+	pr_dlm->batch_open = false;
+	spin_unlock(&pr_dlm->batch_lock);
+	wait_event(pr_dlm->batch_wq, READ_ONCE(pr_dlm->batch_joined) == 0);
+
+	scst_copy_to_dlm(dev, ls, false);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
 	scst_pr_toggle_lock(pr_dlm, ls, PR_POST_UPDATE_LOCK);
+
+	spin_lock(&pr_dlm->batch_lock);
+	pr_dlm->batch_seq++;
+	spin_unlock(&pr_dlm->batch_lock);
+	wake_up_all(&pr_dlm->batch_wq);
+
 	scst_dlm_unlock_wait(ls, pr_lksb);
 }
 
@@ -1206,7 +1399,7 @@ static void scst_dlm_res_unlock(struct scst_device *dev,
 		      pr_dlm->reserved_by_nodeid);
 
 	if (update_lvb)
-		scst_copy_to_dlm(dev, ls);
+		scst_copy_to_dlm(dev, ls, false);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
@@ -1332,7 +1525,7 @@ static void scst_copy_to_dlm_work(struct work_struct *work)
 		PRINT_INFO("%s.%s LVB not valid\n", dev->virt_name,
 			   PR_DATA_LOCK);
 
-	scst_copy_to_dlm(dev, ls);
+	scst_copy_to_dlm(dev, ls, true);
 	scst_dlm_lock_wait(ls, DLM_LOCK_CR, &pr_dlm->data_lksb,
 			   DLM_LKF_CONVERT | DLM_LKF_VALBLK, PR_DATA_LOCK,
 			   NULL);
@@ -1508,6 +1701,8 @@ static int scst_pr_dlm_init(struct scst_device *dev, const char *cl_dev_id)
 	pr_dlm->dev = dev;
 	mutex_init(&pr_dlm->ls_cr_mutex);
 	mutex_init(&pr_dlm->ls_mutex);
+	spin_lock_init(&pr_dlm->batch_lock);
+	init_waitqueue_head(&pr_dlm->batch_wq);
 	pr_dlm->data_lksb.lksb.sb_lvbptr = pr_dlm->lvb;
 	INIT_WORK(&pr_dlm->pre_join_work, scst_pre_join_work);
 	INIT_WORK(&pr_dlm->pre_upd_work, scst_pre_upd_work);
@@ -20,6 +20,8 @@
 
 #include <linux/dlm.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
 #define SCST_DLM_LOCKSPACE_PFX	"scst-"
@@ -36,6 +38,10 @@
 #define PR_REG_LOCK		"pr_reg_%02d"
 #define PR_REG_UA_LOCK		"pr_reg_%02d_ua_%02d"
 
+/* Size of the changed PR_REG_LOCK index list in the PR_DATA_LOCK LVB. */
+#define PR_LVB_MAX_CHANGED	56
+#define PR_LVB_ALL_CHANGED	0xffff
+
 /*
  * Data members needed for managing PR data via the DLM.
  *
@@ -105,9 +111,32 @@ struct scst_pr_dlm_data {
 	struct scst_lksb pre_upd_lksb;
 	struct scst_lksb post_upd_lksb;
 
+	/*
+	 * Batching of concurrent PR updates. A PR update that starts while
+	 * another PR update on this node holds PR_LOCK joins the lock cycle
+	 * of the latter instead of acquiring PR_LOCK itself. The LVB's are
+	 * then updated and the other nodes notified once for the whole
+	 * batch. Protected by batch_lock.
+	 */
+	spinlock_t batch_lock;
+	/* Whether PR updates may join the current PR_LOCK holder. */
+	bool batch_open;
+	/* Number of PR updates that joined and did not yet finish. */
+	int batch_joined;
+	/* Incremented every time a batch has been propagated. */
+	unsigned int batch_seq;
+	wait_queue_head_t batch_wq;
+
 	/* PR_DATA_LOCK LVB. */
 	uint8_t  lvb[PR_DLM_LVB_LEN];
 
+	/*
+	 * Value of pr_lvb.chg_seq after the most recent update of the local
+	 * PR state from or to the DLM. Zero if the local state has to be
+	 * refreshed from all PR_REG_LOCK LVB's. Protected by ls_mutex.
+	 */
+	uint32_t chg_seq;
+
 	/* SPC-2 reservation state information. */
 	uint32_t reserved_by_nodeid;
 };
@@ -123,6 +152,17 @@ struct scst_pr_dlm_data {
  * @pr_aptpl:	    persistent reservation APTPL
  * @reserved_by_nodeid: Corosync node ID of the node holding an SPC-2
  *                  reservation. Zero if no SPC-2 reservation is held.
+ * @chg_seq:	    sequence number of the update that wrote @changed. Never
+ *		    zero once set.
+ * @nr_changed:	    number of elements in @changed or PR_LVB_ALL_CHANGED if
+ *		    the update may have modified any PR_REG_LOCK LVB.
+ * @changed:	    indexes of the PR_REG_LOCK LVB's modified by update
+ *		    @chg_seq.
+ *
+ * The members from @chg_seq on were added without changing @version. Nodes
+ * that predate them leave them alone, so @changed may only be used by a node
+ * that has processed update @chg_seq - 1 itself. Otherwise all PR_REG_LOCK
+ * LVB's must be read.
  */
 struct pr_lvb {
 	__be32	nr_registrants;
@@ -134,6 +174,10 @@ struct pr_lvb {
 	u8	pr_aptpl;
 	u8      reserved[3];
 	__be32  reserved_by_nodeid;
+	__be32	chg_seq;
+	__be16	nr_changed;
+	u8	reserved2[2];
+	__be32	changed[PR_LVB_MAX_CHANGED];
 };
 
 /**
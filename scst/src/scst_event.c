@@ -489,6 +489,55 @@ out:
 	return res;
 }
 
+/* scst_dg_mutex supposed to be held */
+int scst_event_queue_alua_state_changed(const struct scst_target_group *tg,
+					enum scst_tg_state prev_state,
+					int nr_luns, s64 publish_us,
+					s64 total_us)
+{
+	int res = 0, event_entry_len;
+	struct scst_event_entry *event_entry;
+	struct scst_event *event;
+	struct scst_event_alua_state_changed_payload *payload;
+
+	TRACE_ENTRY();
+
+	event_entry_len = sizeof(*event_entry) + sizeof(*payload);
+	event_entry = kzalloc(event_entry_len, GFP_KERNEL);
+	if (!event_entry) {
+		PRINT_ERROR("Unable to allocate event (size %d). ALUA state change event is lost (target group %s/%s)!",
+			    event_entry_len, tg->dg->name, tg->name);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	TRACE_MEM("event_entry %p (len %d) allocated",
+		  event_entry, event_entry_len);
+
+	event = &event_entry->event;
+
+	event->payload_len = sizeof(*payload);
+	payload = (struct scst_event_alua_state_changed_payload *)event->payload;
+
+	strscpy(payload->dg_name, tg->dg->name, sizeof(payload->dg_name));
+	strscpy(payload->tg_name, tg->name, sizeof(payload->tg_name));
+	strscpy(payload->prev_state, scst_alua_state_name(prev_state) ?: "",
+		sizeof(payload->prev_state));
+	strscpy(payload->new_state, scst_alua_state_name(tg->state) ?: "",
+		sizeof(payload->new_state));
+	payload->group_id = tg->group_id;
+	payload->nr_luns = nr_luns;
+	payload->publish_us = publish_us;
+	payload->total_us = total_us;
+
+	scst_event_queue(SCST_EVENT_ALUA_STATE_CHANGED,
+			 SCST_EVENT_SCST_CORE_ISSUER, event_entry);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 /* scst_event_mutex supposed to be held. Can release/reacquire it inside */
 static void scst_release_event_entry(struct scst_event_entry *e)
 {
@@ -12096,7 +12096,23 @@ static int get_cdb_info_compare_and_write(struct scst_cmd *cmd,
 static int get_cdb_info_ext_copy(struct scst_cmd *cmd,
 	const struct scst_sdbops *sdbops)
 {
-	if (unlikely(cmd->cdb[1] != 0)) {
+	switch (cmd->cdb[1]) {
+	case EC_SA_EXTENDED_COPY_LID1:
+		break;
+	case EC_SA_POPULATE_TOKEN:
+		/*
+		 * POPULATE TOKEN only records the source ranges, so it neither
+		 * writes the medium nor generates any third party commands.
+		 */
+		cmd->op_name = "POPULATE TOKEN";
+		cmd->op_flags &= ~(SCST_WRITE_MEDIUM |
+				   SCST_CAN_GEN_3PARTY_COMMANDS |
+				   SCST_DESCRIPTORS_BASED);
+		break;
+	case EC_SA_WRITE_USING_TOKEN:
+		cmd->op_name = "WRITE USING TOKEN";
+		break;
+	default:
 		PRINT_WARNING("Not supported %s service action 0x%x",
 			scst_get_opcode_name(cmd), cmd->cdb[1]);
 		scst_set_invalid_field_in_cdb(cmd, 1,
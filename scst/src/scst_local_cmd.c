@@ -858,6 +858,7 @@ enum scst_exec_res scst_persistent_reserve_out_local(struct scst_cmd *cmd)
 	int buffer_size;
 	struct scst_lksb pr_lksb;
 	bool aborted = false;
+	u64 pr_jnl_seq = 0;
 
 	TRACE_ENTRY();
 
@@ -975,7 +976,7 @@ enum scst_exec_res scst_persistent_reserve_out_local(struct scst_cmd *cmd)
 	}
 
 	if (cmd->status == SAM_STAT_GOOD)
-		scst_pr_sync_device_file(dev);
+		pr_jnl_seq = scst_pr_sync_device_file(dev);
 
 	/* sync file may change status */
 	if (cmd->devt->pr_cmds_notifications && cmd->status == SAM_STAT_GOOD)
@@ -984,6 +985,9 @@ enum scst_exec_res scst_persistent_reserve_out_local(struct scst_cmd *cmd)
 out_unlock:
 	dev->cl_ops->pr_write_unlock(dev, &pr_lksb);
 
+	/* Outside of the PR lock to group fsync()'s with other devices */
+	scst_pr_commit_device_file(pr_jnl_seq);
+
 	scst_put_buf_full(cmd, buffer);
 
 out_done:
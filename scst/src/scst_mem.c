@@ -1119,6 +1119,22 @@ void *sgv_get_priv(struct sgv_pool_obj *obj)
 }
 EXPORT_SYMBOL_GPL(sgv_get_priv);
 
+/**
+ * sgv_hiwmk_failures - return the number of failed allocations on hi wmk
+ *
+ * Description:
+ *    Returns how many SG vector allocations failed so far, because
+ *    together with the already allocated memory they would have exceeded
+ *    scst_max_cmd_mem. Target drivers can compare it with a previously
+ *    returned value to detect memory pressure. Note that the counter can
+ *    be reset via sysfs.
+ */
+unsigned int sgv_hiwmk_failures(void)
+{
+	return atomic_read(&sgv_releases_on_hiwmk_failed);
+}
+EXPORT_SYMBOL_GPL(sgv_hiwmk_failures);
+
 /**
  * sgv_pool_free - free previously allocated SG vector
  * @obj:	the SGV object to free
@@ -29,6 +29,8 @@
 #include <linux/delay.h>
 #include <linux/time.h>
 #include <linux/ctype.h>
+#include <linux/hash.h>
+#include <linux/crc32.h>
 #include <asm/byteorder.h>
 #include <linux/syscalls.h>
 #include <linux/file.h>
@@ -66,6 +68,44 @@
 #define SCST_PR_FILE_SIGN	0xBBEEEEAAEEBBDD77LLU
 #define SCST_PR_FILE_VERSION	1LLU
 
+/*
+ * The PR journal, <pr_file_name>.jnl, contains the signature, the version and
+ * then batches, one per scst_pr_sync_device_file() call: the payload length
+ * (4 bytes), the payload and the CRC32 of the payload (4 bytes). A payload
+ * consists of DEL records for the removed and REG records for the added or
+ * modified since the previous batch registrants, followed by a HDR record.
+ * Records have the same layout as in the PR file. Replaying the journal on top
+ * of a PR file, written after any of its batches, gives the same state, so
+ * the journal can be merged into the PR file without an atomic switch.
+ */
+#define SCST_PR_JNL_SIGN	0xBBEEEEAAEEBBDD78LLU
+#define SCST_PR_JNL_VERSION	1LLU
+
+/* Journal size, after which it is merged into the PR file */
+#define SCST_PR_JNL_MAX_SIZE	(64 * 1024)
+
+enum {
+	SCST_PR_JNL_REC_HDR = 1,	/* APTPL, pr_is_set, type, scope */
+	SCST_PR_JNL_REC_REG,		/* is_holder, TransportID, key, rel_tgt_id */
+	SCST_PR_JNL_REC_DEL,		/* TransportID, rel_tgt_id */
+};
+
+/*
+ * Journals written, but not fsync()'ed yet. Their fsync()'s are done by
+ * scst_pr_commit_device_file() in groups.
+ */
+struct scst_pr_jnl_dirty {
+	struct list_head jnl_dirty_list_entry;
+	struct file *jnl_file;
+};
+
+static DEFINE_SPINLOCK(scst_pr_jnl_lock);
+static LIST_HEAD(scst_pr_jnl_dirty_list);	/* protected by scst_pr_jnl_lock */
+static u64 scst_pr_jnl_seq;			/* protected by scst_pr_jnl_lock */
+
+static DEFINE_MUTEX(scst_pr_jnl_commit_mutex);
+static u64 scst_pr_jnl_committed_seq;		/* protected by scst_pr_jnl_commit_mutex */
+
 #define FILE_BUFFER_SIZE	512
 
 #ifndef isblank
@@ -188,6 +228,104 @@ out_error:
 	return false;
 }
 
+/*
+ * Returns hash of the transport ID tid and rel_tgt_id. Transport IDs equal
+ * according to tid_equal() have equal hashes.
+ */
+static u32 scst_pr_tid_hash(const uint8_t *tid, uint16_t rel_tgt_id, unsigned int bits)
+{
+	u32 h = tid[0] & 0x0f;
+	int i;
+
+	if ((tid[0] & 0x0f) == SCSI_TRANSPORTID_PROTOCOLID_ISCSI) {
+		const uint8_t fmt = tid[0] & 0xc0;
+		const uint8_t *name = tid + 4;
+		uint32_t max = scst_tid_size(tid) - 4;
+
+		/* Case insensitive and without ",i,0x<ISID>", see tid_equal() */
+		for (i = 0; i < max && name[i] != '\0'; i++) {
+			if (fmt == 0x40 && name[i] == ',')
+				break;
+			h = h * 31 + tolower(name[i]);
+		}
+	} else {
+		for (i = 0; i < TID_COMMON_SIZE; i++)
+			h = h * 31 + tid[i];
+	}
+
+	return hash_32(h ^ rel_tgt_id, bits);
+}
+
+static inline struct list_head *scst_pr_tid_hash_head(struct scst_device *dev,
+						      const uint8_t *tid, uint16_t rel_tgt_id)
+{
+	return &dev->dev_reg_tid_hash[scst_pr_tid_hash(tid, rel_tgt_id, dev->dev_reg_hash_bits)];
+}
+
+static inline struct list_head *scst_pr_key_hash_head(struct scst_device *dev, __be64 key)
+{
+	return &dev->dev_reg_key_hash[hash_64((__force u64)key, dev->dev_reg_hash_bits)];
+}
+
+/*
+ * Grows the registrants hash tables of dev, if there are more than two
+ * registrants per bucket on average. On allocation failure the current
+ * tables are kept, the lookups just get slower.
+ *
+ * Must be called under dev_pr_mutex. Might sleep.
+ */
+static void scst_pr_grow_reg_hash(struct scst_device *dev)
+{
+	struct scst_dev_registrant *reg;
+	struct list_head *tid_hash, *key_hash;
+	unsigned int bits = dev->dev_reg_hash_bits;
+	int i;
+
+	scst_assert_pr_mutex_held(dev);
+
+	if (dev->dev_registrants_cnt <= (2 << bits) || bits >= SCST_PR_REG_HASH_MAX_BITS)
+		return;
+
+	bits = min(bits + 2, (unsigned int)SCST_PR_REG_HASH_MAX_BITS);
+
+	tid_hash = kvmalloc_array(2 << bits, sizeof(*tid_hash), GFP_KERNEL | __GFP_NOWARN);
+	if (!tid_hash) {
+		TRACE(TRACE_OUT_OF_MEM, "Unable to grow registrants hash of dev %s to %d buckets",
+		      dev->virt_name, 1 << bits);
+		return;
+	}
+	key_hash = &tid_hash[1 << bits];
+	for (i = 0; i < (2 << bits); i++)
+		INIT_LIST_HEAD(&tid_hash[i]);
+
+	list_for_each_entry(reg, &dev->dev_registrants_list, dev_registrants_list_entry) {
+		list_move_tail(&reg->dev_reg_tid_hash_entry,
+			       &tid_hash[scst_pr_tid_hash(reg->transport_id, reg->rel_tgt_id, bits)]);
+		list_move_tail(&reg->dev_reg_key_hash_entry,
+			       &key_hash[hash_64((__force u64)reg->key, bits)]);
+	}
+
+	if (dev->dev_reg_tid_hash != dev->dev_reg_hash_init)
+		kvfree(dev->dev_reg_tid_hash);
+	dev->dev_reg_tid_hash = tid_hash;
+	dev->dev_reg_key_hash = key_hash;
+	dev->dev_reg_hash_bits = bits;
+
+	TRACE_PR("Registrants hash of dev %s grown to %d buckets (%d registrants)",
+		 dev->virt_name, 1 << bits, dev->dev_registrants_cnt);
+}
+
+/* Must be called under dev_pr_mutex */
+static void scst_pr_set_reg_key(struct scst_device *dev, struct scst_dev_registrant *reg,
+				__be64 key)
+{
+	scst_assert_pr_mutex_held(dev);
+
+	if (reg->key != key)
+		list_move_tail(&reg->dev_reg_key_hash_entry, scst_pr_key_hash_head(dev, key));
+	reg->key = key;
+}
+
 /* Must be called under dev_pr_mutex */
 void scst_pr_set_holder(struct scst_device *dev, struct scst_dev_registrant *holder, uint8_t scope,
 			uint8_t type)
@@ -311,7 +449,7 @@ static void scst_pr_find_registrants_list_key(struct scst_device *dev, __be64 ke
 	TRACE_PR("Finding registrants for device '%s' with key %016llx",
 		 dev->virt_name, be64_to_cpu(key));
 
-	list_for_each_entry(reg, &dev->dev_registrants_list, dev_registrants_list_entry) {
+	list_for_each_entry(reg, scst_pr_key_hash_head(dev, key), dev_reg_key_hash_entry) {
 		if (reg->key == key) {
 			TRACE_PR("Adding registrant %s/%d (%p) to the find list (key %016llx)",
 				 debug_transport_id_to_initiator_name(reg->transport_id),
@@ -333,7 +471,8 @@ struct scst_dev_registrant *scst_pr_find_reg(struct scst_device *dev, const uint
 
 	scst_assert_pr_mutex_held(dev);
 
-	list_for_each_entry(reg, &dev->dev_registrants_list, dev_registrants_list_entry) {
+	list_for_each_entry(reg, scst_pr_tid_hash_head(dev, transport_id, rel_tgt_id),
+			    dev_reg_tid_hash_entry) {
 		if (reg->rel_tgt_id == rel_tgt_id && tid_equal(reg->transport_id, transport_id)) {
 			res = reg;
 			break;
@@ -462,6 +601,14 @@ struct scst_dev_registrant *scst_pr_add_registrant(struct scst_device *dev,
 #endif
 
 	list_add_tail(&reg->dev_registrants_list_entry, &dev->dev_registrants_list);
+	list_add_tail(&reg->dev_reg_tid_hash_entry,
+		      scst_pr_tid_hash_head(dev, transport_id, rel_tgt_id));
+	list_add_tail(&reg->dev_reg_key_hash_entry, scst_pr_key_hash_head(dev, key));
+	dev->dev_registrants_cnt++;
+
+	/* Growing needs GFP_KERNEL, so postponed until the next add, if locked */
+	if (!dev_lock_locked)
+		scst_pr_grow_reg_hash(dev);
 
 	TRACE_PR("Reg %p registered (dev %s, tgt_dev %p)",
 		 reg, dev->virt_name, reg->tgt_dev);
@@ -476,6 +623,12 @@ out_free:
 	goto out;
 }
 
+static void scst_pr_free_registrant(struct scst_dev_registrant *reg)
+{
+	kfree(reg->transport_id);
+	kfree(reg);
+}
+
 /* Must be called under dev_pr_mutex */
 void scst_pr_remove_registrant(struct scst_device *dev, struct scst_dev_registrant *reg)
 {
@@ -488,6 +641,9 @@ void scst_pr_remove_registrant(struct scst_device *dev, struct scst_dev_registra
 		 reg, reg->tgt_dev, be64_to_cpu(reg->key), dev->virt_name);
 
 	list_del(&reg->dev_registrants_list_entry);
+	list_del(&reg->dev_reg_tid_hash_entry);
+	list_del(&reg->dev_reg_key_hash_entry);
+	dev->dev_registrants_cnt--;
 
 	dev->cl_ops->pr_rm_reg(dev, reg);
 
@@ -497,8 +653,12 @@ void scst_pr_remove_registrant(struct scst_device *dev, struct scst_dev_registra
 	if (reg->tgt_dev)
 		reg->tgt_dev->registrant = NULL;
 
-	kfree(reg->transport_id);
-	kfree(reg);
+	if (dev->pr_jnl_file && reg->jnl_saved) {
+		/* Will be freed after its removal is journaled */
+		list_add_tail(&reg->dev_registrants_list_entry, &dev->pr_jnl_del_list);
+	} else {
+		scst_pr_free_registrant(reg);
+	}
 
 	TRACE_EXIT();
 }
@@ -775,6 +935,228 @@ out:
 	return res;
 }
 
+/* Must be called under dev_pr_mutex */
+static void scst_pr_jnl_free_del_list(struct scst_device *dev)
+{
+	struct scst_dev_registrant *reg, *t;
+
+	list_for_each_entry_safe(reg, t, &dev->pr_jnl_del_list, dev_registrants_list_entry) {
+		list_del(&reg->dev_registrants_list_entry);
+		scst_pr_free_registrant(reg);
+	}
+}
+
+/* Must be called under dev_pr_mutex */
+static void scst_pr_jnl_close(struct scst_device *dev)
+{
+	scst_pr_jnl_free_del_list(dev);
+
+	if (dev->pr_jnl_file) {
+		filp_close(dev->pr_jnl_file, NULL);
+		dev->pr_jnl_file = NULL;
+	}
+}
+
+/* Must be called under dev_pr_mutex */
+static void scst_pr_jnl_mark_saved(struct scst_device *dev)
+{
+	struct scst_dev_registrant *reg;
+
+	list_for_each_entry(reg, &dev->dev_registrants_list, dev_registrants_list_entry) {
+		reg->jnl_key = reg->key;
+		reg->jnl_saved = 1;
+		reg->jnl_is_holder = (dev->pr_holder == reg);
+	}
+
+	scst_pr_jnl_free_del_list(dev);
+
+	dev->pr_jnl_aptpl = dev->pr_aptpl;
+	dev->pr_jnl_is_set = dev->pr_is_set;
+	dev->pr_jnl_type = dev->pr_type;
+	dev->pr_jnl_scope = dev->pr_scope;
+}
+
+/* Must be called under dev_pr_mutex */
+static int scst_pr_replay_batch(struct scst_device *dev, const uint8_t *p, uint32_t len)
+{
+	const uint8_t *end = p + len, *tid;
+	struct scst_dev_registrant *reg;
+	uint8_t type = 0, is_holder;
+	uint16_t rel_tgt_id;
+	__be64 key;
+
+	while (p < end) {
+		type = *p++;
+		switch (type) {
+		case SCST_PR_JNL_REC_HDR:
+			if (end - p < 4)
+				goto out_corrupted;
+			dev->pr_aptpl = p[0] ? 1 : 0;
+			dev->pr_is_set = p[1] ? 1 : 0;
+			dev->pr_type = p[2];
+			dev->pr_scope = p[3];
+			p += 4;
+			break;
+
+		case SCST_PR_JNL_REC_REG:
+			if (end - p < 1 + 4)
+				goto out_corrupted;
+			is_holder = *p++;
+			tid = p;
+			if (end - p < scst_tid_size(tid) + sizeof(key) + sizeof(rel_tgt_id))
+				goto out_corrupted;
+			p += scst_tid_size(tid);
+			key = get_unaligned((__be64 *)p);
+			p += sizeof(key);
+			rel_tgt_id = get_unaligned((uint16_t *)p);
+			p += sizeof(rel_tgt_id);
+
+			reg = scst_pr_find_reg(dev, tid, rel_tgt_id);
+			if (reg) {
+				scst_pr_set_reg_key(dev, reg, key);
+			} else {
+				reg = scst_pr_add_registrant(dev, tid, rel_tgt_id, key, false);
+				if (!reg)
+					return -ENOMEM;
+			}
+
+			if (is_holder)
+				dev->pr_holder = reg;
+			else if (dev->pr_holder == reg)
+				dev->pr_holder = NULL;
+			break;
+
+		case SCST_PR_JNL_REC_DEL:
+			if (end - p < 4)
+				goto out_corrupted;
+			tid = p;
+			if (end - p < scst_tid_size(tid) + sizeof(rel_tgt_id))
+				goto out_corrupted;
+			p += scst_tid_size(tid);
+			rel_tgt_id = get_unaligned((uint16_t *)p);
+			p += sizeof(rel_tgt_id);
+
+			reg = scst_pr_find_reg(dev, tid, rel_tgt_id);
+			if (reg) {
+				/* The reservation is restored by the following HDR record */
+				if (dev->pr_holder == reg)
+					dev->pr_holder = NULL;
+				scst_pr_remove_registrant(dev, reg);
+			}
+			break;
+
+		default:
+			goto out_corrupted;
+		}
+	}
+
+	return 0;
+
+out_corrupted:
+	PRINT_ERROR("Corrupted PR journal record (type %d, dev %s)", type, dev->virt_name);
+	return -EINVAL;
+}
+
+/*
+ * Replays the PR journal on top of the just loaded PR file. Returns the number
+ * of the replayed batches or a negative error code.
+ */
+static int scst_pr_replay_journal(struct scst_device *dev)
+{
+	int res = 0, rc;
+	struct file *file;
+	uint8_t *buf = NULL;
+	loff_t file_size, pos;
+	uint32_t len;
+
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	file_size = scst_file_or_bdev_size(dev->pr_jnl_file_name);
+	if (file_size < 0) {
+		if (file_size != -ENOENT)
+			res = file_size;
+		goto out;
+	}
+
+	/* Nothing journaled */
+	if (file_size <= 2 * sizeof(uint64_t))
+		goto out;
+
+	if (file_size >= 15 * 1024 * 1024) {
+		PRINT_ERROR("Invalid PR journal size %lld", file_size);
+		res = -EINVAL;
+		goto out;
+	}
+
+	TRACE_PR("Replaying PR journal '%s'", dev->pr_jnl_file_name);
+
+	file = filp_open(dev->pr_jnl_file_name, O_RDONLY, 0);
+	if (IS_ERR(file)) {
+		res = PTR_ERR(file);
+		PRINT_ERROR("Unable to open PR journal '%s' - error %d",
+			    dev->pr_jnl_file_name, res);
+		goto out;
+	}
+
+	buf = vmalloc(file_size);
+	if (!buf) {
+		res = -ENOMEM;
+		PRINT_ERROR("Unable to allocate buffer");
+		goto out_close;
+	}
+
+	pos = 0;
+	rc = kernel_read(file, buf, file_size, &pos);
+	if (rc != file_size) {
+		PRINT_ERROR("Unable to read PR journal '%s' - error %d",
+			    dev->pr_jnl_file_name, rc);
+		res = rc < 0 ? rc : -EIO;
+		goto out_close;
+	}
+
+	if (get_unaligned((uint64_t *)&buf[0]) != SCST_PR_JNL_SIGN ||
+	    get_unaligned((uint64_t *)&buf[sizeof(uint64_t)]) != SCST_PR_JNL_VERSION) {
+		PRINT_WARNING("Ignoring PR journal '%s' with invalid signature or version",
+			      dev->pr_jnl_file_name);
+		goto out_close;
+	}
+
+	pos = 2 * sizeof(uint64_t);
+	while (pos + 2 * sizeof(uint32_t) <= file_size) {
+		len = get_unaligned((uint32_t *)&buf[pos]);
+		if (len > file_size - pos - 2 * sizeof(uint32_t))
+			break;
+		if (get_unaligned((uint32_t *)&buf[pos + sizeof(uint32_t) + len]) !=
+		    crc32_le(~0, &buf[pos + sizeof(uint32_t)], len))
+			break;
+
+		rc = scst_pr_replay_batch(dev, &buf[pos + sizeof(uint32_t)], len);
+		if (rc != 0) {
+			res = rc;
+			goto out_close;
+		}
+
+		pos += sizeof(uint32_t) + len + sizeof(uint32_t);
+		res++;
+	}
+
+	/* A batch, which was being written when we crashed, is lost */
+	if (pos != file_size)
+		PRINT_WARNING("Ignoring incomplete tail of PR journal '%s' (offset %lld, size %lld)",
+			      dev->pr_jnl_file_name, pos, file_size);
+
+out_close:
+	filp_close(file, NULL);
+
+out:
+	vfree(buf);
+
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
 static int scst_pr_load_device_file(struct scst_device *dev)
 {
 	int res, rc;
@@ -791,7 +1173,7 @@ static int scst_pr_load_device_file(struct scst_device *dev)
 
 	res = scst_pr_do_load_device_file(dev, dev->pr_file_name);
 	if (res == 0)
-		goto out_dump;
+		goto out_replay;
 	if (res == -ENOMEM)
 		goto out;
 
@@ -801,10 +1183,23 @@ static int scst_pr_load_device_file(struct scst_device *dev)
 	if (res != 0) {
 		if (res == -ENOENT)
 			res = rc;
+		/* The journal is useless without the PR file it was made for */
+		if (res != -ENOMEM)
+			scst_remove_file(dev->pr_jnl_file_name);
+		goto out;
+	}
+
+out_replay:
+	rc = scst_pr_replay_journal(dev);
+	if (rc < 0) {
+		res = rc;
 		goto out;
 	}
 
-out_dump:
+	/* Merge the replayed journal into the PR file and start a new one */
+	if (rc > 0)
+		scst_pr_sync_device_file(dev);
+
 	scst_pr_dump_prs(dev, false);
 
 out:
@@ -818,16 +1213,20 @@ static void scst_pr_remove_device_files(struct scst_device *dev)
 
 	scst_assert_pr_mutex_held(dev);
 
+	scst_pr_jnl_close(dev);
+
 	if (dev->pr_file_name)
 		scst_remove_file(dev->pr_file_name);
 	if (dev->pr_file_name1)
 		scst_remove_file(dev->pr_file_name1);
+	if (dev->pr_jnl_file_name)
+		scst_remove_file(dev->pr_jnl_file_name);
 
 	TRACE_EXIT();
 }
 
-/* Must be called under dev_pr_mutex */
-void scst_pr_sync_device_file(struct scst_device *dev)
+/* Rewrites the PR file. Must be called under dev_pr_mutex. */
+static int scst_pr_write_device_file(struct scst_device *dev)
 {
 	int res = 0;
 	struct file *file;
@@ -841,11 +1240,6 @@ void scst_pr_sync_device_file(struct scst_device *dev)
 
 	scst_assert_pr_mutex_held(dev);
 
-	if (dev->pr_aptpl == 0 || list_empty(&dev->dev_registrants_list)) {
-		scst_pr_remove_device_files(dev);
-		goto out;
-	}
-
 	scst_copy_file(dev->pr_file_name, dev->pr_file_name1);
 
 	file = filp_open(dev->pr_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
@@ -951,21 +1345,13 @@ void scst_pr_sync_device_file(struct scst_device *dev)
 	filp_close(file, NULL);
 
 out:
-	if (res != 0) {
-		PRINT_CRIT_ERROR("Unable to save persistent information (device %s)",
-				 dev->virt_name);
-		 /*
-		  * It's safer to not return any error to the initiator and expect
-		  * operator's intervention to be able to save the PR's state next
-		  * time, than to screw up all the interactions with this initiator.
-		  */
-	}
-
-	TRACE_EXIT();
-	return;
+	TRACE_EXIT_RES(res);
+	return res;
 
 write_error:
 	PRINT_ERROR("Error writing to '%s' - error %d", dev->pr_file_name, res);
+	if (res >= 0)
+		res = -EIO;
 
 write_error_close:
 	filp_close(file, NULL);
@@ -984,6 +1370,340 @@ write_error_close:
 	goto out;
 }
 
+/*
+ * Builds in buf, if not NULL, the journal batch payload with the PR changes
+ * since the last journal write. Returns the payload size, 0 if nothing changed.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_jnl_build_batch(struct scst_device *dev, uint8_t *buf)
+{
+	struct scst_dev_registrant *reg;
+	uint32_t size;
+	bool is_holder;
+	int res = 0;
+
+	list_for_each_entry(reg, &dev->pr_jnl_del_list, dev_registrants_list_entry) {
+		size = scst_tid_size(reg->transport_id);
+		if (buf) {
+			buf[res] = SCST_PR_JNL_REC_DEL;
+			memcpy(&buf[res + 1], reg->transport_id, size);
+			put_unaligned(reg->rel_tgt_id, (uint16_t *)&buf[res + 1 + size]);
+		}
+		res += 1 + size + sizeof(reg->rel_tgt_id);
+	}
+
+	list_for_each_entry(reg, &dev->dev_registrants_list, dev_registrants_list_entry) {
+		is_holder = (dev->pr_holder == reg);
+		if (reg->jnl_saved && reg->jnl_key == reg->key && reg->jnl_is_holder == is_holder)
+			continue;
+
+		size = scst_tid_size(reg->transport_id);
+		if (buf) {
+			buf[res] = SCST_PR_JNL_REC_REG;
+			buf[res + 1] = is_holder;
+			memcpy(&buf[res + 2], reg->transport_id, size);
+			put_unaligned(reg->key, (__be64 *)&buf[res + 2 + size]);
+			put_unaligned(reg->rel_tgt_id,
+				      (uint16_t *)&buf[res + 2 + size + sizeof(reg->key)]);
+		}
+		res += 2 + size + sizeof(reg->key) + sizeof(reg->rel_tgt_id);
+	}
+
+	if (res == 0 && dev->pr_jnl_aptpl == dev->pr_aptpl &&
+	    dev->pr_jnl_is_set == dev->pr_is_set && dev->pr_jnl_type == dev->pr_type &&
+	    dev->pr_jnl_scope == dev->pr_scope)
+		goto out;
+
+	/* Always the last, because removal of a holder can change the reservation */
+	if (buf) {
+		buf[res] = SCST_PR_JNL_REC_HDR;
+		buf[res + 1] = dev->pr_aptpl;
+		buf[res + 2] = dev->pr_is_set;
+		buf[res + 3] = dev->pr_type;
+		buf[res + 4] = dev->pr_scope;
+	}
+	res += 5;
+
+out:
+	return res;
+}
+
+/*
+ * Appends to the journal a batch with the PR changes since the last journal
+ * write. Returns 0 on success, 1 if there was nothing to append, or a negative
+ * error code.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_jnl_append(struct scst_device *dev, bool fsync)
+{
+	int res, size;
+	uint8_t *buf;
+	loff_t pos;
+
+	TRACE_ENTRY();
+
+	size = scst_pr_jnl_build_batch(dev, NULL);
+	if (size == 0) {
+		res = 1;
+		goto out;
+	}
+
+	buf = vmalloc(sizeof(uint32_t) + size + sizeof(uint32_t));
+	if (!buf) {
+		PRINT_ERROR("Unable to allocate PR journal batch (size %d)", size);
+		res = -ENOMEM;
+		goto out;
+	}
+
+	put_unaligned(size, (uint32_t *)&buf[0]);
+	scst_pr_jnl_build_batch(dev, &buf[sizeof(uint32_t)]);
+	put_unaligned(crc32_le(~0, &buf[sizeof(uint32_t)], size),
+		      (uint32_t *)&buf[sizeof(uint32_t) + size]);
+	size += 2 * sizeof(uint32_t);
+
+	TRACE_PR("Appending %d bytes to PR journal '%s' (pos %lld)", size,
+		 dev->pr_jnl_file_name, dev->pr_jnl_pos);
+
+	pos = dev->pr_jnl_pos;
+	res = kernel_write(dev->pr_jnl_file, buf, size, &pos);
+	vfree(buf);
+	if (res != size) {
+		PRINT_ERROR("Error writing to '%s' - error %d", dev->pr_jnl_file_name, res);
+		res = res < 0 ? res : -EIO;
+		goto out;
+	}
+	dev->pr_jnl_pos = pos;
+
+	if (fsync) {
+		res = vfs_fsync(dev->pr_jnl_file, 1);
+		if (res != 0) {
+			PRINT_ERROR("fsync() of the PR journal failed: %d", res);
+			goto out;
+		}
+	}
+
+	scst_pr_jnl_mark_saved(dev);
+	res = 0;
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+}
+
+/*
+ * Merges the journal into the PR file and starts a new, empty, journal. Before
+ * the PR file is rewritten, either the journal must be up to date, so its
+ * replay on top of the new PR file doesn't change anything, or not exist.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+static int scst_pr_jnl_merge(struct scst_device *dev)
+{
+	int res;
+	struct file *file;
+	uint64_t hdr[2] = { SCST_PR_JNL_SIGN, SCST_PR_JNL_VERSION };
+	loff_t pos = 0;
+
+	TRACE_ENTRY();
+
+	TRACE_PR("Merging PR journal '%s'", dev->pr_jnl_file_name);
+
+	if (dev->pr_jnl_file) {
+		res = scst_pr_jnl_append(dev, true);
+		if (res < 0) {
+			/* We don't know what is in it now */
+			scst_pr_jnl_close(dev);
+			scst_remove_file(dev->pr_jnl_file_name);
+		}
+	}
+
+	res = scst_pr_write_device_file(dev);
+	if (res != 0)
+		goto out;
+
+	scst_pr_jnl_close(dev);
+
+	file = filp_open(dev->pr_jnl_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (IS_ERR(file)) {
+		res = PTR_ERR(file);
+		PRINT_ERROR("Unable to (re)create PR journal '%s' - error %d",
+			    dev->pr_jnl_file_name, res);
+		/* The PR file is up to date, so the old journal isn't needed */
+		scst_remove_file(dev->pr_jnl_file_name);
+		goto out;
+	}
+
+	res = kernel_write(file, hdr, sizeof(hdr), &pos);
+	if (res != sizeof(hdr)) {
+		PRINT_ERROR("Error writing to '%s' - error %d", dev->pr_jnl_file_name, res);
+		res = res < 0 ? res : -EIO;
+		goto out_close;
+	}
+
+	res = vfs_fsync(file, 1);
+	if (res != 0) {
+		PRINT_ERROR("fsync() of the PR journal failed: %d", res);
+		goto out_close;
+	}
+
+	dev->pr_jnl_file = file;
+	dev->pr_jnl_pos = pos;
+	scst_pr_jnl_mark_saved(dev);
+
+out:
+	TRACE_EXIT_RES(res);
+	return res;
+
+out_close:
+	filp_close(file, NULL);
+	scst_remove_file(dev->pr_jnl_file_name);
+	goto out;
+}
+
+/* Returns the sequence number for scst_pr_commit_device_file() */
+static u64 scst_pr_jnl_queue_commit(struct file *file)
+{
+	struct scst_pr_jnl_dirty *d, *new_d;
+	u64 res;
+
+	new_d = kmalloc(sizeof(*new_d), GFP_KERNEL);
+
+	spin_lock(&scst_pr_jnl_lock);
+	list_for_each_entry(d, &scst_pr_jnl_dirty_list, jnl_dirty_list_entry) {
+		if (d->jnl_file == file)
+			goto found;
+	}
+	if (!new_d) {
+		spin_unlock(&scst_pr_jnl_lock);
+		PRINT_ERROR("Unable to allocate PR journal commit entry");
+		if (vfs_fsync(file, 1) != 0)
+			PRINT_ERROR("fsync() of the PR journal failed");
+		res = 0;
+		goto out;
+	}
+	get_file(file);
+	new_d->jnl_file = file;
+	list_add_tail(&new_d->jnl_dirty_list_entry, &scst_pr_jnl_dirty_list);
+	new_d = NULL;
+
+found:
+	res = ++scst_pr_jnl_seq;
+	spin_unlock(&scst_pr_jnl_lock);
+
+out:
+	kfree(new_d);
+	return res;
+}
+
+/**
+ * scst_pr_sync_device_file() - save the PR state of a device
+ * @dev: device.
+ *
+ * Appends the PR changes to the device's PR journal, or, if it has grown too
+ * big, merges the journal into the PR file. The appended changes are not
+ * durable until scst_pr_commit_device_file() is called with the returned
+ * sequence number, which should be done after dev_pr_mutex has been released,
+ * so fsync()'s of journals of many devices, changed at the same time, are
+ * grouped together.
+ *
+ * Must be called under dev_pr_mutex.
+ */
+u64 scst_pr_sync_device_file(struct scst_device *dev)
+{
+	int res;
+	u64 seq = 0;
+
+	TRACE_ENTRY();
+
+	scst_assert_pr_mutex_held(dev);
+
+	if (dev->pr_aptpl == 0 || list_empty(&dev->dev_registrants_list)) {
+		scst_pr_remove_device_files(dev);
+		goto out;
+	}
+
+	if (!dev->pr_jnl_file || dev->pr_jnl_pos >= SCST_PR_JNL_MAX_SIZE) {
+		res = scst_pr_jnl_merge(dev);
+		goto out_check;
+	}
+
+	res = scst_pr_jnl_append(dev, false);
+	if (res == 0)
+		seq = scst_pr_jnl_queue_commit(dev->pr_jnl_file);
+	else if (res < 0)
+		res = scst_pr_jnl_merge(dev);
+	else
+		res = 0;
+
+out_check:
+	if (res != 0) {
+		PRINT_CRIT_ERROR("Unable to save persistent information (device %s)",
+				 dev->virt_name);
+		 /*
+		  * It's safer to not return any error to the initiator and expect
+		  * operator's intervention to be able to save the PR's state next
+		  * time, than to screw up all the interactions with this initiator.
+		  */
+	}
+
+out:
+	TRACE_EXIT();
+	return seq;
+}
+
+/**
+ * scst_pr_commit_device_file() - make PR journal writes durable
+ * @seq: sequence number returned by scst_pr_sync_device_file().
+ *
+ * Returns after all the journal writes up to @seq are on the stable storage.
+ * If there are several callers at the same time, one of them fsync()'s all
+ * the journals written so far, the others wait for it and then, most likely,
+ * have nothing to do.
+ *
+ * Must not be called under dev_pr_mutex.
+ */
+void scst_pr_commit_device_file(u64 seq)
+{
+	struct scst_pr_jnl_dirty *d, *t;
+	LIST_HEAD(dirty_list);
+	u64 last_seq;
+	int rc;
+
+	TRACE_ENTRY();
+
+	if (seq == 0)
+		goto out;
+
+	mutex_lock(&scst_pr_jnl_commit_mutex);
+
+	if (scst_pr_jnl_committed_seq >= seq)
+		goto out_unlock;
+
+	spin_lock(&scst_pr_jnl_lock);
+	list_splice_init(&scst_pr_jnl_dirty_list, &dirty_list);
+	last_seq = scst_pr_jnl_seq;
+	spin_unlock(&scst_pr_jnl_lock);
+
+	list_for_each_entry_safe(d, t, &dirty_list, jnl_dirty_list_entry) {
+		rc = vfs_fsync(d->jnl_file, 1);
+		if (rc != 0)
+			PRINT_CRIT_ERROR("fsync() of the PR journal failed: %d", rc);
+		list_del(&d->jnl_dirty_list_entry);
+		fput(d->jnl_file);
+		kfree(d);
+	}
+
+	scst_pr_jnl_committed_seq = last_seq;
+
+out_unlock:
+	mutex_unlock(&scst_pr_jnl_commit_mutex);
+
+out:
+	TRACE_EXIT();
+}
+
 /**
  * scst_pr_set_file_name - set name of file in which to save PR information
  * @dev:  SCST device.
@@ -999,7 +1719,7 @@ int scst_pr_set_file_name(struct scst_device *dev, char **prev,
 			  const char *fmt, ...)
 {
 	va_list args;
-	char *pr_file_name = NULL, *bkp = NULL;
+	char *pr_file_name = NULL, *bkp = NULL, *jnl = NULL;
 	int file_mode, res = -EINVAL;
 
 	scst_assert_pr_mutex_held(dev);
@@ -1041,6 +1761,14 @@ int scst_pr_set_file_name(struct scst_device *dev, char **prev,
 		PRINT_ERROR("Unable to kasprintf() backup PR file name");
 		goto out;
 	}
+	jnl = kasprintf(GFP_KERNEL, "%s.jnl", pr_file_name);
+	if (!jnl) {
+		PRINT_ERROR("Unable to kasprintf() PR journal file name");
+		goto out;
+	}
+
+	scst_pr_jnl_close(dev);
+
 	if (prev) {
 		*prev = dev->pr_file_name;
 		dev->pr_file_name = pr_file_name;
@@ -1049,17 +1777,21 @@ int scst_pr_set_file_name(struct scst_device *dev, char **prev,
 		swap(dev->pr_file_name, pr_file_name);
 	}
 	swap(dev->pr_file_name1, bkp);
+	swap(dev->pr_jnl_file_name, jnl);
 	res = 0;
 
 out:
 	kfree(pr_file_name);
 	kfree(bkp);
+	kfree(jnl);
 	return res;
 }
 
 /* Initialize the PR members in *dev. */
 int scst_pr_init(struct scst_device *dev)
 {
+	int i;
+
 	mutex_init(&dev->dev_pr_mutex);
 	dev->cl_ops = &scst_no_dlm_cl_ops;
 	dev->pr_generation = 0;
@@ -1068,6 +1800,13 @@ int scst_pr_init(struct scst_device *dev)
 	dev->pr_scope = SCOPE_LU;
 	dev->pr_type = TYPE_UNSPECIFIED;
 	INIT_LIST_HEAD(&dev->dev_registrants_list);
+	dev->dev_registrants_cnt = 0;
+	dev->dev_reg_hash_bits = SCST_PR_REG_HASH_MIN_BITS;
+	dev->dev_reg_tid_hash = dev->dev_reg_hash_init;
+	dev->dev_reg_key_hash = &dev->dev_reg_hash_init[1 << SCST_PR_REG_HASH_MIN_BITS];
+	for (i = 0; i < ARRAY_SIZE(dev->dev_reg_hash_init); i++)
+		INIT_LIST_HEAD(&dev->dev_reg_hash_init[i]);
+	INIT_LIST_HEAD(&dev->pr_jnl_del_list);
 
 	return 0;
 }
@@ -1076,6 +1815,9 @@ int scst_pr_init(struct scst_device *dev)
 void scst_pr_cleanup(struct scst_device *dev)
 {
 	dev->cl_ops->pr_cleanup(dev);
+
+	if (dev->dev_reg_tid_hash != dev->dev_reg_hash_init)
+		kvfree(dev->dev_reg_tid_hash);
 }
 
 /* Caller must hold scst_mutex and activity must be suspended. */
@@ -1138,9 +1880,11 @@ void scst_pr_clear_dev(struct scst_device *dev)
 	TRACE_ENTRY();
 
 	scst_pr_remove_registrants(dev);
+	scst_pr_jnl_close(dev);
 
 	kfree(dev->pr_file_name);
 	kfree(dev->pr_file_name1);
+	kfree(dev->pr_jnl_file_name);
 
 	TRACE_EXIT();
 }
@@ -1292,7 +2036,7 @@ static int scst_pr_register_with_spec_i_pt(struct scst_cmd *cmd, const uint16_t
 				} else if (reg->key != action_key) {
 					TRACE_PR("Changing key of reg %p (tgt_dev %p)", reg, t);
 					reg->rollback_key = reg->key;
-					reg->key = action_key;
+					scst_pr_set_reg_key(dev, reg, action_key);
 				} else {
 					continue;
 				}
@@ -1308,7 +2052,7 @@ static int scst_pr_register_with_spec_i_pt(struct scst_cmd *cmd, const uint16_t
 				TRACE_PR("Changing key of reg %p (tgt_dev %p)",
 					 reg, reg->tgt_dev);
 				reg->rollback_key = reg->key;
-				reg->key = action_key;
+				scst_pr_set_reg_key(dev, reg, action_key);
 			} else {
 				reg = scst_pr_add_registrant(dev, transport_id, rel_tgt_id,
 							     action_key, false);
@@ -1575,7 +2319,7 @@ out_rollback:
 		if (reg->rollback_key == 0) {
 			scst_pr_remove_registrant(cmd->dev, reg);
 		} else {
-			reg->key = reg->rollback_key;
+			scst_pr_set_reg_key(cmd->dev, reg, reg->rollback_key);
 			reg->rollback_key = 0;
 		}
 	}
@@ -1650,7 +2394,7 @@ void scst_pr_register(struct scst_cmd *cmd, uint8_t *buffer, int buffer_size)
 			else
 				scst_pr_unregister(dev, reg);
 		} else {
-			reg->key = action_key;
+			scst_pr_set_reg_key(dev, reg, action_key);
 		}
 	}
 
@@ -1711,7 +2455,7 @@ void scst_pr_register_and_ignore(struct scst_cmd *cmd, uint8_t *buffer, int buff
 			else
 				scst_pr_unregister(dev, reg);
 		} else {
-			reg->key = action_key;
+			scst_pr_set_reg_key(dev, reg, action_key);
 		}
 	}
 
@@ -1840,7 +2584,7 @@ void scst_pr_register_and_move(struct scst_cmd *cmd, uint8_t *buffer, int buffer
 		}
 	} else if (reg_move->key != action_key) {
 		TRACE_PR("Changing key for reg %p", reg);
-		reg_move->key = action_key;
+		scst_pr_set_reg_key(dev, reg_move, action_key);
 	}
 
 	TRACE_PR("Register and move: from initiator %s/%d (%p, tgt_dev %p) to initiator %s/%d (%p, tgt_dev %p), key %016llx (unreg %d)",
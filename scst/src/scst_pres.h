@@ -150,7 +150,8 @@ void scst_pr_set_holder(struct scst_device *dev,
 			uint8_t type);
 void scst_pr_clear_holder(struct scst_device *dev);
 
-void scst_pr_sync_device_file(struct scst_device *dev);
+u64 scst_pr_sync_device_file(struct scst_device *dev);
+void scst_pr_commit_device_file(u64 seq);
 
 ssize_t scst_pr_state_show(struct scst_device *dev, char *buf, size_t buf_size);
 int scst_pr_state_store(struct scst_device *dev, const char *buf, size_t count);
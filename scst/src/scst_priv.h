@@ -816,6 +816,10 @@ int scst_event_queue_negative_luns_inquiry(const struct scst_tgt *tgt, const cha
 int scst_event_queue_ext_blocking_done(struct scst_device *dev, void *data, int len);
 int scst_event_queue_tm_fn_received(struct scst_mgmt_cmd *mcmd);
 int scst_event_queue_reg_vdev(const char *dev_name);
+int scst_event_queue_alua_state_changed(const struct scst_target_group *tg,
+					enum scst_tg_state prev_state,
+					int nr_luns, s64 publish_us,
+					s64 total_us);
 
 typedef void __printf(2, 3) (*scst_show_fn)(void *arg, const char *fmt, ...);
 void scst_trace_cmds(scst_show_fn show, void *arg);
@@ -2696,10 +2696,16 @@ out_done:
 
 static inline bool scst_check_alua(struct scst_cmd *cmd, int *out_res)
 {
-	int (*alua_filter)(struct scst_cmd *cmd);
+	int (*alua_filter)(struct scst_cmd *cmd) = NULL;
+	struct scst_target_group *tg;
 	bool res = false;
 
-	alua_filter = READ_ONCE(cmd->tgt_dev->alua_filter);
+	rcu_read_lock();
+	tg = rcu_dereference(cmd->tgt_dev->alua_tg);
+	if (tg)
+		alua_filter = READ_ONCE(tg->alua_filter);
+	rcu_read_unlock();
+
 	if (unlikely(alua_filter)) {
 		int ac = alua_filter(cmd);
 
@@ -18,6 +18,7 @@
 #include <linux/moduleparam.h>
 #include <linux/delay.h>
 #include <linux/kmod.h>
+#include <linux/ktime.h>
 #ifdef INSIDE_KERNEL_TREE
 #include <scst/scst.h>
 #include <scst/scst_event.h>
@@ -522,7 +523,6 @@ static void scst_check_alua_invariant(void)
 	struct scst_tgt_dev *tgt_dev;
 	struct scst_dev_group *dg;
 	struct scst_target_group *tg;
-	enum scst_tg_state expected_state;
 
 #if 0
 	lockdep_assert_held(&scst_mutex); /* scst_dev_list, dev_tgt_dev_list */
@@ -532,6 +532,16 @@ static void scst_check_alua_invariant(void)
 	if (!alua_invariant_check)
 		return;
 
+	list_for_each_entry(dg, &scst_dev_group_list, entry) {
+		list_for_each_entry(tg, &dg->tg_list, entry) {
+			if (tg->alua_filter != scst_alua_filter[tg->state])
+				PRINT_ERROR("TG %s/%s: ALUA filter %p <> %p",
+					    dg->name, tg->name,
+					    tg->alua_filter,
+					    scst_alua_filter[tg->state]);
+		}
+	}
+
 	list_for_each_entry(dev, &scst_dev_list, dev_list_entry) {
 		dg = __lookup_dg_by_dev(dev);
 		list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
@@ -539,35 +549,36 @@ static void scst_check_alua_invariant(void)
 			tg = dg ?
 			    __lookup_tg_by_tgt(dg, tgt_dev->acg_dev->acg->tgt) :
 			    NULL;
-			expected_state = tg ? tg->state :
-				SCST_TG_STATE_OPTIMIZED;
-			if (tgt_dev->alua_filter !=
-				   scst_alua_filter[expected_state]) {
-				PRINT_ERROR("LUN %s/%s/%s/%lld/%s: ALUA filter %p <> %p",
+			if (tgt_dev->alua_tg != tg) {
+				PRINT_ERROR("LUN %s/%s/%s/%lld/%s: ALUA target group %s <> %s",
 					    tgt_dev->acg_dev->acg->tgt->tgt_name,
 					    tgt_dev->acg_dev->acg->acg_name ?: "(default)",
 					    tgt_dev->sess->initiator_name,
 					    tgt_dev->lun,
 					    tgt_dev->dev->virt_name ?: "(null)",
-					    tgt_dev->alua_filter,
-					    scst_alua_filter[expected_state]);
+					    tgt_dev->alua_tg ?
+					    tgt_dev->alua_tg->name : "(none)",
+					    tg ? tg->name : "(none)");
 			}
 		}
 	}
 }
 
-/* Update the ALUA filter of a tgt_dev */
+/*
+ * Associate a tgt_dev with ALUA target group @tg. A NULL @tg means that the
+ * LUN is not subject to ALUA, which is equivalent to the active/optimized
+ * state.
+ */
 static void scst_update_tgt_dev_alua_filter(struct scst_tgt_dev *tgt_dev,
-					    enum scst_tg_state state)
+					    struct scst_target_group *tg)
 {
 	lockdep_assert_held(&scst_dg_mutex);
 
-	tgt_dev->alua_filter = scst_alua_filter[state];
+	rcu_assign_pointer(tgt_dev->alua_tg, tg);
 }
 
-/* Update the ALUA filter after an ALUA state change and generate UA */
+/* Generate a UA after the ALUA state of a LUN has changed */
 static void scst_tg_change_tgt_dev_state(struct scst_tgt_dev *tgt_dev,
-					 enum scst_tg_state state,
 					 bool gen_ua)
 {
 	lockdep_assert_held(&scst_dg_mutex);
@@ -575,7 +586,6 @@ static void scst_tg_change_tgt_dev_state(struct scst_tgt_dev *tgt_dev,
 	TRACE_MGMT_DBG("ALUA state of tgt_dev %p has changed (gen_ua %d)",
 		       tgt_dev, gen_ua);
 
-	scst_update_tgt_dev_alua_filter(tgt_dev, state);
 	if (gen_ua)
 		scst_gen_aen_or_ua(tgt_dev, SCST_LOAD_SENSE(scst_sense_asym_access_state_changed));
 }
@@ -591,7 +601,7 @@ void scst_tg_init_tgt_dev(struct scst_tgt_dev *tgt_dev)
 	if (dg) {
 		tg = __lookup_tg_by_tgt(dg, tgt_dev->acg_dev->acg->tgt);
 		if (tg) {
-			scst_update_tgt_dev_alua_filter(tgt_dev, tg->state);
+			scst_update_tgt_dev_alua_filter(tgt_dev, tg);
 			scst_check_alua_invariant();
 		}
 	}
@@ -614,8 +624,7 @@ static void scst_update_tgt_alua_filter(struct scst_target_group *tg,
 		list_for_each_entry(tgt_dev, &dgd->dev->dev_tgt_dev_list,
 				    dev_tgt_dev_list_entry) {
 			if (tgt_dev->acg_dev->acg->tgt == tgt)
-				scst_update_tgt_dev_alua_filter(tgt_dev,
-								tg->state);
+				scst_update_tgt_dev_alua_filter(tgt_dev, tg);
 		}
 	}
 
@@ -638,7 +647,7 @@ static void scst_reset_tgt_alua_filter(struct scst_target_group *tg,
 		list_for_each_entry(tgt_dev, &dgd->dev->dev_tgt_dev_list,
 				    dev_tgt_dev_list_entry) {
 			if (tgt_dev->acg_dev->acg->tgt == tgt)
-				scst_update_tgt_dev_alua_filter(tgt_dev, SCST_TG_STATE_OPTIMIZED);
+				scst_update_tgt_dev_alua_filter(tgt_dev, NULL);
 		}
 	}
 
@@ -793,6 +802,7 @@ int scst_tg_add(struct scst_dev_group *dg, const char *name)
 		goto out_put;
 	tg->dg = dg;
 	tg->state = SCST_TG_STATE_OPTIMIZED;
+	tg->alua_filter = scst_alua_filter[tg->state];
 	INIT_LIST_HEAD(&tg->tgt_list);
 
 	res = mutex_lock_interruptible(&scst_dg_mutex);
@@ -833,6 +843,8 @@ static void __scst_tg_remove(struct scst_dev_group *dg,
 	}
 	list_del(&tg->entry);
 	scst_tg_sysfs_del(tg);
+	/* Wait until scst_check_alua() no longer can access @tg. */
+	synchronize_rcu();
 	kobject_put(&tg->kobj);
 	TRACE_EXIT();
 }
@@ -935,25 +947,18 @@ out_fail:
 }
 
 /*
- * __scst_tgt_set_state - Update the ALUA filter of a LUN and invoke callbacks
- * @tg: ALUA target group of which the state is changing.
- * @tgt_dev: LUN to be updated.
+ * __scst_tgt_set_state - Report an ALUA state change to a LUN
+ * @tg: ALUA target group of which the state has changed.
+ * @tgt_dev: LUN to be notified.
  * @state: new ALUA state.
- * @invoke_callbacks: Whether or not to invoke the on_alua_state_changed_*
- *	callback functions.
  */
 static void __scst_tgt_set_state(struct scst_target_group *tg, struct scst_tgt_dev *tgt_dev,
-				 enum scst_tg_state state, bool invoke_callbacks)
+				 enum scst_tg_state state)
 {
 	bool gen_ua = state != SCST_TG_STATE_TRANSITIONING;
 	struct scst_tgt *tgt = tgt_dev->sess->tgt;
-	enum scst_tg_state old_state = tg->state;
-	struct scst_device *dev = tgt_dev->dev;
 	struct scst_dev_group *dg = tg->dg;
 
-	if (invoke_callbacks && dev->handler->on_alua_state_change_start)
-		dev->handler->on_alua_state_change_start(dev, old_state,
-							 state);
 	/*
 	 * If the ALUA state transition is caused by an STPG command and if
 	 * the STPG command has been received through the target port of which
@@ -962,26 +967,61 @@ static void __scst_tgt_set_state(struct scst_target_group *tg, struct scst_tgt_d
 	if (dg->stpg_rel_tgt_id == tgt->rel_tgt_id &&
 	    tid_equal(dg->stpg_transport_id, tgt_dev->sess->transport_id))
 		gen_ua = false;
-	scst_tg_change_tgt_dev_state(tgt_dev, state, gen_ua);
-	if (invoke_callbacks && dev->handler->on_alua_state_change_finish)
-		dev->handler->on_alua_state_change_finish(dev, old_state,
-							  state);
+	scst_tg_change_tgt_dev_state(tgt_dev, gen_ua);
 }
 
 /*
- * Update the ALUA filter of those LUNs (tgt_dev) whose target port is a member
- * of target group @tg and that export a device that is a member of the device
- * group @tg->dg.
+ * Whether or not to invoke the on_alua_state_change_*() callbacks of @dev
+ * for an ALUA state change of target group @tg.
+ *
+ * The callbacks are invoked if @dev has at least one LUN in target group @tg.
+ * They are also invoked if the SCST device still doesn't have any target
+ * devices, or has only those that aren't included in the given target group
+ * (e.g. the default copy manager for a blockio device), unless the target
+ * group has remote targets. A target with NULL target device is a remote
+ * target.
+ *
+ * See also 29548a4a ("scst: Remove the on_alua_state_change_*() callback
+ * functions"), d333ce82 ("Restore the on_alua_state_change_*() callback
+ * functions") and https://github.com/SCST-project/scst/issues/55.
+ */
+static bool __scst_tg_invoke_callbacks(struct scst_target_group *tg,
+				       struct scst_device *dev,
+				       bool tg_is_remote)
+{
+	struct scst_tgt_dev *tgt_dev;
+
+	lockdep_assert_held(&scst_dg_mutex);
+
+	if (!tg_is_remote)
+		return true;
+
+	list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
+			    dev_tgt_dev_list_entry)
+		if (tgt_dev->alua_tg == tg)
+			return true;
+
+	return false;
+}
+
+/*
+ * Change the ALUA state of target group @tg. The LUNs (tgt_dev) whose target
+ * port is a member of @tg and that export a device that is a member of
+ * @tg->dg look up their ALUA filter via @tg, so all of them switch to the
+ * new state at once when the new filter is published. Generating unit
+ * attentions and invoking the device handler callbacks happens afterwards.
  */
 static void __scst_tg_set_state(struct scst_target_group *tg,
 				enum scst_tg_state state)
 {
+	enum scst_tg_state old_state = tg->state;
 	struct scst_dg_dev *dg_dev;
 	struct scst_device *dev;
 	struct scst_tgt_dev *tgt_dev;
-	struct scst_tgt *tgt;
+	ktime_t start, published, done;
 	bool invoke_callbacks;
 	bool tg_is_remote;
+	int nr_luns = 0;
 
 	sBUG_ON(state >= ARRAY_SIZE(scst_alua_filter));
 	lockdep_assert_held(&scst_dg_mutex);
@@ -989,61 +1029,52 @@ static void __scst_tg_set_state(struct scst_target_group *tg,
 	if (tg->state == state)
 		return;
 
-	/*
-	 * If the target group has a target with NULL target device,
-	 * that means that this target is remote one, so we shouldn't
-	 * call on_alua_state_change_*() callbacks then.
-	 *
-	 * See also 29548a4a ("scst: Remove the on_alua_state_change_*()
-	 * callback functions") and d333ce82 ("Restore the
-	 * on_alua_state_change_*() callback functions").
-	 */
+	start = ktime_get();
+
 	tg_is_remote = __scst_tg_have_tgt(tg, NULL);
 
 	list_for_each_entry(dg_dev, &tg->dg->dev_list, entry) {
-		invoke_callbacks = true;
+		dev = dg_dev->dev;
+		if (dev->handler->on_alua_state_change_start &&
+		    __scst_tg_invoke_callbacks(tg, dev, tg_is_remote))
+			dev->handler->on_alua_state_change_start(dev, old_state,
+								 state);
+	}
+
+	tg->state = state;
+	WRITE_ONCE(tg->alua_filter, scst_alua_filter[state]);
+	published = ktime_get();
+
+	list_for_each_entry(dg_dev, &tg->dg->dev_list, entry) {
+		invoke_callbacks = !tg_is_remote;
 		dev = dg_dev->dev;
 
 		list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
 				    dev_tgt_dev_list_entry) {
-			tgt = tgt_dev->sess->tgt;
-
-			if (__scst_tg_have_tgt(tg, tgt)) {
-				__scst_tgt_set_state(tg, tgt_dev, state,
-						     invoke_callbacks);
-				invoke_callbacks = false;
-			}
+			if (tgt_dev->alua_tg != tg)
+				continue;
+			__scst_tgt_set_state(tg, tgt_dev, state);
+			invoke_callbacks = true;
+			nr_luns++;
 		}
 
-		/*
-		 * There are several cases when `invoke_callbacks` can
-		 * still be true here:
-		 * - The SCST device still doesn't have any target
-		 *   devices, or have only those that aren't included
-		 *   in the given target group (e.g. the default copy
-		 *   manager for a blockio devices).
-		 * - Target group has remote targets.
-		 *
-		 * We should call on_alua_state_chage_*() callbacks only
-		 * in the first case.
-		 *
-		 * See also https://github.com/SCST-project/scst/issues/55.
-		 */
-		if (invoke_callbacks && !tg_is_remote) {
-			if (dev->handler->on_alua_state_change_start)
-				dev->handler->on_alua_state_change_start(dev, tg->state, state);
-
-			if (dev->handler->on_alua_state_change_finish)
-				dev->handler->on_alua_state_change_finish(dev, tg->state, state);
-		}
+		if (invoke_callbacks && dev->handler->on_alua_state_change_finish)
+			dev->handler->on_alua_state_change_finish(dev, old_state,
+								  state);
 	}
 
-	tg->state = state;
+	done = ktime_get();
 
 	scst_check_alua_invariant();
 
-	PRINT_INFO("Changed ALUA state of %s/%s into %s", tg->dg->name,
-		   tg->name, scst_alua_state_name(state));
+	PRINT_INFO("Changed ALUA state of %s/%s into %s (%d LUNs, published after %lld us, done after %lld us)",
+		   tg->dg->name, tg->name, scst_alua_state_name(state),
+		   nr_luns, ktime_us_delta(published, start),
+		   ktime_us_delta(done, start));
+
+	scst_event_queue_alua_state_changed(tg, old_state, nr_luns,
+					    ktime_us_delta(published, start),
+					    ktime_us_delta(done, start));
 }
 
 int scst_tg_set_state(struct scst_target_group *tg, enum scst_tg_state state)
@@ -1148,7 +1179,7 @@ static void scst_update_dev_alua_filter(struct scst_dev_group *dg,
 			    dev_tgt_dev_list_entry) {
 		tg = __lookup_tg_by_tgt(dg, tgt_dev->acg_dev->acg->tgt);
 		if (tg)
-			scst_update_tgt_dev_alua_filter(tgt_dev, tg->state);
+			scst_update_tgt_dev_alua_filter(tgt_dev, tg);
 	}
 
 	scst_check_alua_invariant();
@@ -1166,8 +1197,7 @@ static void scst_reset_dev_alua_filter(struct scst_device *dev)
 
 	list_for_each_entry(tgt_dev, &dev->dev_tgt_dev_list,
 			    dev_tgt_dev_list_entry)
-		scst_update_tgt_dev_alua_filter(tgt_dev,
-						SCST_TG_STATE_OPTIMIZED);
+		scst_update_tgt_dev_alua_filter(tgt_dev, NULL);
 
 	scst_check_alua_invariant();
 }
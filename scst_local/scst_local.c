@@ -84,6 +84,11 @@ module_param_named(add_default_tgt, scst_local_add_default_tgt, bool, 0444);
 MODULE_PARM_DESC(add_default_tgt,
 		 "add (default) or not on start default target scst_local_tgt with default session scst_local_host");
 
+static bool scst_local_fake_pi;
+module_param_named(fake_pi, scst_local_fake_pi, bool, 0444);
+MODULE_PARM_DESC(fake_pi,
+		 "emulate a T10-PI (DIF/DIX type 1 and 3) capable transport (default: false)");
+
 static struct workqueue_struct *aen_workqueue;
 
 struct scst_aen_work_item {
@@ -864,6 +869,21 @@ static int scst_local_queuecommand(struct Scsi_Host *host,
 
 	scsi_set_resid(scmd, 0);
 
+	/*
+	 * Only DIX pass-through is emulated: the protection information is
+	 * generated and verified by the initiator block integrity layer and
+	 * passed to SCST as is. STRIP and INSERT would require this driver to
+	 * verify or generate guard tags in software.
+	 */
+	if (unlikely(scsi_get_prot_op(scmd) != SCSI_PROT_NORMAL &&
+		     scsi_prot_sg_count(scmd) == 0)) {
+		PRINT_ERROR_RATELIMITED("Unsupported protection operation %d (cmd 0x%02X)",
+					scsi_get_prot_op(scmd), scmd->cmnd[0]);
+		scmd->result = DID_ERROR << 16;
+		scsi_done(scmd);
+		return 0;
+	}
+
 	/*
 	 * Tell the target that we have a command ... but first we need
 	 * to get the LUN into a format that SCST understand
@@ -935,6 +955,14 @@ static int scst_local_queuecommand(struct Scsi_Host *host,
 		scst_cmd_set_expected(scst_cmd, dir, 0);
 	}
 
+	if (scsi_prot_sg_count(scmd) != 0) {
+		/* 8 bytes of DIF tags per logical block */
+		scst_cmd_set_expected(scst_cmd, dir, scsi_bufflen(scmd) +
+				      (scsi_bufflen(scmd) / scmd->device->sector_size) * 8);
+		scst_cmd_set_tgt_dif_sg(scst_cmd, scsi_prot_sglist(scmd),
+					scsi_prot_sg_count(scmd));
+	}
+
 	/* Save the correct thing below depending on version */
 	scst_cmd_set_tgt_priv(scst_cmd, scmd);
 
@@ -947,13 +975,36 @@ static int scst_local_queuecommand(struct Scsi_Host *host,
 static int scst_local_targ_pre_exec(struct scst_cmd *scst_cmd)
 {
 	int res = SCST_PREPROCESS_STATUS_SUCCESS;
+	enum scst_dif_actions action;
 
 	TRACE_ENTRY();
 
+	/*
+	 * A DIF-enabled LU may receive commands without protection
+	 * information, e.g. SG_IO READs and WRITEs with RDPROTECT or WRPROTECT
+	 * zero. The target would then have to insert or strip the tags, which
+	 * scst_local can't do, and there is no DIF buffer to pass to the dev
+	 * handler. Reject such commands.
+	 */
+	action = scst_get_dif_action(scst_get_tgt_dif_actions(scst_cmd->cmd_dif_actions));
+	if (unlikely(action != SCST_DIF_ACTION_NONE &&
+		     (action == SCST_DIF_ACTION_STRIP ||
+		      action == SCST_DIF_ACTION_INSERT ||
+		      !scst_cmd->tgt_i_dif_sg))) {
+		PRINT_ERROR_RATELIMITED("Unsupported DIF action %x (cmd %p, op %s)",
+					action, scst_cmd,
+					scst_get_opcode_name(scst_cmd));
+		scst_set_cmd_error(scst_cmd,
+				   SCST_LOAD_SENSE(scst_sense_invalid_field_in_cdb));
+		res = SCST_PREPROCESS_STATUS_ERROR_SENSE_SET;
+		goto out;
+	}
+
 	if (scst_cmd_get_dh_data_buff_alloced(scst_cmd) &&
 	    (scst_cmd_get_data_direction(scst_cmd) & SCST_DATA_WRITE))
 		scst_copy_sg(scst_cmd, SCST_SG_COPY_FROM_TARGET);
 
+out:
 	TRACE_EXIT_RES(res);
 	return res;
 }
@@ -1464,6 +1515,14 @@ static int scst_local_driver_probe(struct device *dev)
 	 */
 	hpnt->max_cmd_len = 260;
 
+	if (scst_local_fake_pi) {
+		scsi_host_set_prot(hpnt, SHOST_DIF_TYPE1_PROTECTION |
+				   SHOST_DIX_TYPE1_PROTECTION |
+				   SHOST_DIF_TYPE3_PROTECTION |
+				   SHOST_DIX_TYPE3_PROTECTION);
+		scsi_host_set_guard(hpnt, SHOST_DIX_GUARD_CRC);
+	}
+
 	ret = scsi_add_host(hpnt, &sess->dev);
 	if (ret) {
 		PRINT_ERROR("scsi_add_host() failed");
@@ -1696,6 +1755,16 @@ static int scst_local_add_target(const char *target_name, struct scst_local_tgt
 
 	scst_tgt_set_tgt_priv(tgt->scst_tgt, tgt);
 
+	if (scst_local_fake_pi) {
+		/*
+		 * The initiator block integrity layer takes the place of the
+		 * HBA and checks the tags of every block it reads or writes.
+		 */
+		scst_tgt_set_dif_supported(tgt->scst_tgt, true);
+		scst_tgt_set_hw_dif_type1_supported(tgt->scst_tgt, true);
+		scst_tgt_set_hw_dif_type3_supported(tgt->scst_tgt, true);
+	}
+
 	mutex_lock(&scst_local_mutex);
 	list_add_tail(&tgt->tgts_list_entry, &scst_local_tgts_list);
 	mutex_unlock(&scst_local_mutex);
@@ -44,6 +44,7 @@
 #include <linux/kthread.h>
 #include <linux/string.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #if !defined(INSIDE_KERNEL_TREE)
 #include <linux/version.h>
 #endif
@@ -116,10 +117,32 @@ module_param(srpt_srq_size, int, 0644);
 MODULE_PARM_DESC(srpt_srq_size,
 		 "Shared receive queue (SRQ) size.");
 
+static unsigned int srpt_srq_ch_size = DEFAULT_SRPT_SRQ_CH_SIZE;
+module_param(srpt_srq_ch_size, uint, 0644);
+MODULE_PARM_DESC(srpt_srq_ch_size,
+		 "Number of SRQ receive buffers to post per channel (0: post srpt_srq_size buffers at once).");
+
+static unsigned int srpt_poll_usecs;
+module_param(srpt_poll_usecs, uint, 0644);
+MODULE_PARM_DESC(srpt_poll_usecs,
+		 "Time in microseconds to keep polling the CQ of a new channel after the last completion before reenabling completion interrupts. Commands are then processed in the polling context (0: interrupt driven).");
+
 static int srpt_sq_size = DEF_SRPT_SQ_SIZE;
 module_param(srpt_sq_size, int, 0444);
 MODULE_PARM_DESC(srpt_sq_size, "Per-channel send queue (SQ) size.");
 
+#ifdef SRPT_FAST_REG
+static bool use_fast_reg = true;
+module_param(use_fast_reg, bool, 0444);
+MODULE_PARM_DESC(use_fast_reg,
+		 "Whether or not to use fast registration MRs for RDMA transfers with many S/G elements.");
+
+static unsigned int srpt_fast_reg_sg_threshold;
+module_param(srpt_fast_reg_sg_threshold, uint, 0644);
+MODULE_PARM_DESC(srpt_fast_reg_sg_threshold,
+		 "Minimum number of S/G elements above which a fast registration MR is used (0: more than fit in one work request).");
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 10, 0)
 static int srpt_get_u64_x(char *buffer, struct kernel_param *kp)
 #else
@@ -142,6 +165,24 @@ static const enum scst_exec_context srpt_new_iu_context = SCST_CONTEXT_THREAD;
 static const enum scst_exec_context srpt_xmt_rsp_context = SCST_CONTEXT_THREAD;
 static const enum scst_exec_context srpt_send_context = SCST_CONTEXT_DIRECT;
 
+/*
+ * Context for new information units and for RDMA read completions on channels
+ * in polling mode (srpt_poll_usecs > 0). The channel's completion work keeps
+ * running while completions arrive, so processing commands in that context
+ * does not delay completion processing the way it does in interrupt mode.
+ */
+static inline enum scst_exec_context
+srpt_new_iu_ctx(const struct srpt_rdma_ch *ch)
+{
+	return ch->poll_usecs ? SCST_CONTEXT_DIRECT : srpt_new_iu_context;
+}
+
+static inline enum scst_exec_context
+srpt_xmt_rsp_ctx(const struct srpt_rdma_ch *ch)
+{
+	return ch->poll_usecs ? SCST_CONTEXT_DIRECT : srpt_xmt_rsp_context;
+}
+
 static struct ib_client srpt_client;
 static struct scst_tgt_template srpt_template;
 static struct workqueue_struct *srpt_wq;
@@ -782,11 +823,12 @@ static struct srpt_ioctx *srpt_alloc_ioctx(struct srpt_device *sdev,
 {
 	struct srpt_ioctx *ioctx;
 
-	ioctx = kzalloc(ioctx_size, GFP_KERNEL);
+	ioctx = kzalloc_node(ioctx_size, GFP_KERNEL, sdev->numa_node);
 	if (!ioctx)
 		goto err;
 
-	ioctx->buf = kmem_cache_alloc(buf_cache, GFP_KERNEL);
+	ioctx->buf = kmem_cache_alloc_node(buf_cache, GFP_KERNEL,
+					   sdev->numa_node);
 	if (!ioctx->buf)
 		goto err_free_ioctx;
 
@@ -845,7 +887,8 @@ static struct srpt_ioctx **srpt_alloc_ioctx_ring(struct srpt_device *sdev, int r
 	WARN_ON(ioctx_size != sizeof(struct srpt_recv_ioctx) &&
 		ioctx_size != sizeof(struct srpt_send_ioctx));
 
-	ring = kvmalloc_array(ring_size, sizeof(ring[0]), GFP_KERNEL);
+	ring = kvmalloc_array_node(ring_size, sizeof(ring[0]), GFP_KERNEL,
+				   sdev->numa_node);
 	if (!ring)
 		goto out;
 	for (i = 0; i < ring_size; ++i) {
@@ -959,7 +1002,7 @@ static int srpt_post_recv(struct srpt_device *sdev, struct srpt_rdma_ch *ch,
 	wr.num_sge = 1;
 
 	if (sdev->use_srq)
-		return ib_post_srq_recv(sdev->srq, &wr, &bad_wr);
+		return ib_post_srq_recv(ioctx->srq->srq, &wr, &bad_wr);
 	else
 		return ib_post_recv(ch->qp, &wr, &bad_wr);
 }
@@ -1326,21 +1369,19 @@ static int srpt_ch_qp_err(struct srpt_rdma_ch *ch)
 static struct srpt_send_ioctx *srpt_get_send_ioctx(struct srpt_rdma_ch *ch)
 {
 	struct srpt_send_ioctx *ioctx;
-	unsigned long flags;
+	struct llist_node *node;
 
 	BUG_ON(!ch);
 
-	ioctx = NULL;
-	spin_lock_irqsave(&ch->spinlock, flags);
-	if (!list_empty(&ch->free_list)) {
-		ioctx = list_first_entry(&ch->free_list,
-					 struct srpt_send_ioctx, free_list);
-		list_del(&ioctx->free_list);
-	}
-	spin_unlock_irqrestore(&ch->spinlock, flags);
-
-	if (!ioctx)
-		return ioctx;
+	/*
+	 * This function is only called from the completion work of @ch.
+	 * Since a work item never runs concurrently with itself there is
+	 * only a single consumer, which makes llist_del_first() safe.
+	 */
+	node = llist_del_first(&ch->free_list);
+	if (!node)
+		return NULL;
+	ioctx = llist_entry(node, struct srpt_send_ioctx, free_node);
 
 	BUG_ON(ioctx->ch != ch);
 	ioctx->state = SRPT_STATE_NEW;
@@ -1348,6 +1389,8 @@ static struct srpt_send_ioctx *srpt_get_send_ioctx(struct srpt_rdma_ch *ch)
 	ioctx->n_rbuf = 0;
 	ioctx->rbufs = NULL;
 	ioctx->n_rdma = 0;
+	ioctx->n_reg_wr = 0;
+	ioctx->mr = NULL;
 	ioctx->n_rdma_ius = 0;
 	ioctx->rdma_ius = NULL;
 	ioctx->mapped_sg_count = 0;
@@ -1364,7 +1407,6 @@ static void srpt_put_send_ioctx(struct srpt_send_ioctx *ioctx)
 {
 	struct srpt_rdma_ch *ch = ioctx->ch;
 	struct srpt_recv_ioctx *recv_ioctx = ioctx->recv_ioctx;
-	unsigned long flags;
 
 	if (recv_ioctx) {
 		EXTRACHECKS_WARN_ON(!list_empty(&recv_ioctx->wait_list));
@@ -1384,9 +1426,7 @@ static void srpt_put_send_ioctx(struct srpt_send_ioctx *ioctx)
 		ioctx->n_rbuf = 0;
 	}
 
-	spin_lock_irqsave(&ch->spinlock, flags);
-	list_add(&ioctx->free_list, &ch->free_list);
-	spin_unlock_irqrestore(&ch->spinlock, flags);
+	llist_add(&ioctx->free_node, &ch->free_list);
 }
 
 /**
@@ -1982,11 +2022,11 @@ static void srpt_process_rcv_completion(struct ib_cq *cq,
 		if (unlikely(req_lim < 0))
 			pr_err("req_lim = %d < 0\n", req_lim);
 		if (ch->sport->sdev->use_srq)
-			ioctx = ch->sport->sdev->ioctx_ring[index];
+			ioctx = ch->srq->ioctx_ring[index];
 		else
 			ioctx = ch->ioctx_recv_ring[index];
 		ioctx->byte_len = wc->byte_len;
-		srpt_handle_new_iu(ch, ioctx, srpt_new_iu_context);
+		srpt_handle_new_iu(ch, ioctx, srpt_new_iu_ctx(ch));
 	} else if (ch->state <= CH_LIVE) {
 		pr_info("receiving failed for idx %u with status %d\n", index,
 			wc->status);
@@ -2011,7 +2051,7 @@ static void srpt_process_wait_list(struct srpt_rdma_ch *ch)
 	ch->processing_wait_list = true;
 	list_for_each_entry_safe(recv_ioctx, tmp, &ch->cmd_wait_list,
 				 wait_list) {
-		if (!srpt_handle_new_iu(ch, recv_ioctx, srpt_new_iu_context))
+		if (!srpt_handle_new_iu(ch, recv_ioctx, srpt_new_iu_ctx(ch)))
 			break;
 	}
 	ch->processing_wait_list = false;
@@ -2048,7 +2088,7 @@ static void srpt_process_send_completion(struct ib_cq *cq,
 		} else if (opcode == SRPT_RDMA_READ_LAST ||
 			   opcode == SRPT_RDMA_ABORT) {
 			srpt_handle_rdma_comp(ch, ch->ioctx_ring[index], opcode,
-					      srpt_xmt_rsp_context);
+					      srpt_xmt_rsp_ctx(ch));
 		} else if (opcode == SRPT_RDMA_ZEROLENGTH_WRITE) {
 			WARN_ONCE(ch->state != CH_LIVE,
 				  "%s-%d: QP not in 'live' state\n",
@@ -2134,8 +2174,11 @@ static int srpt_process_completion(struct srpt_rdma_ch *ch, int budget)
 static void srpt_completion(struct ib_cq *cq, void *ctx)
 {
 	struct srpt_rdma_ch *ch = ctx;
+	int cpu = ch->cpu;
 
-	queue_work_on(raw_smp_processor_id(), srpt_wq, &ch->compl);
+	if (unlikely(!cpu_online(cpu)))
+		cpu = raw_smp_processor_id();
+	queue_work_on(cpu, srpt_wq, &ch->compl);
 }
 
 static void srpt_free_ch(struct kref *kref)
@@ -2202,16 +2245,200 @@ static void srpt_unregister_ch(struct srpt_rdma_ch *ch)
 	scst_unregister_session(ch->sess, false, srpt_unreg_sess);
 }
 
+/*
+ * srpt_busy_poll() - Polling mode counterpart of srpt_process_completion().
+ *
+ * Keep the completion work requeued while completions arrive and until no
+ * completion has arrived for ch->poll_usecs, such that new completions are
+ * processed without waiting for a completion interrupt. Requeueing instead of
+ * spinning inside the work function lets the completion work of other
+ * channels on the same CPU run in between. Completion interrupts are only
+ * reenabled once the CQ is idle.
+ */
+static void srpt_busy_poll(struct srpt_rdma_ch *ch, int budget)
+{
+	if (srpt_poll(ch, budget) > 0) {
+		ch->poll_last = ktime_get();
+		goto requeue;
+	}
+
+	if (ch->state < CH_DISCONNECTED &&
+	    ktime_us_delta(ktime_get(), ch->poll_last) < ch->poll_usecs)
+		goto requeue;
+
+	if (ib_req_notify_cq(ch->cq, IB_CQ_NEXT_COMP |
+			     IB_CQ_REPORT_MISSED_EVENTS) > 0)
+		goto requeue;
+
+	return;
+
+requeue:
+	srpt_completion(ch->cq, ch);
+}
+
 static void srpt_do_compl_work(struct work_struct *work)
 {
 	struct srpt_rdma_ch *ch = container_of(work, typeof(*ch), compl);
 	enum { poll_budget = 256 };
 	int n;
 
+	if (ch->poll_usecs) {
+		srpt_busy_poll(ch, poll_budget);
+		return;
+	}
+
 	n = srpt_process_completion(ch, poll_budget);
 	if (n >= poll_budget)
-		schedule_work(work);
+		srpt_completion(ch->cq, ch);
+}
+
+/*
+ * srpt_srq_target() - Number of receive buffers that should be posted on @srq.
+ *
+ * Called with srq->mutex held.
+ */
+static int srpt_srq_target(struct srpt_srq *srq)
+{
+	unsigned int ch_size = READ_ONCE(srpt_srq_ch_size);
+
+	if (ch_size == 0)
+		return srq->size;
+	return clamp_t(u64, (u64)srq->ch_count * ch_size, MIN_SRPT_SRQ_SIZE,
+		       srq->size);
+}
+
+/*
+ * srpt_srq_grow() - Allocate and post receive buffers until srpt_srq_target()
+ * buffers have been posted on @srq.
+ *
+ * Called with srq->mutex held. Receive buffers are never taken back from an
+ * SRQ, so the number of posted buffers only grows.
+ */
+static void srpt_srq_grow(struct srpt_srq *srq)
+{
+	struct srpt_device *sdev = srq->sdev;
+	struct srpt_recv_ioctx *ioctx;
+	int target = srpt_srq_target(srq);
+	int ret;
+
+	lockdep_assert_held(&srq->mutex);
+
+	while (srq->posted < target) {
+		ioctx = (struct srpt_recv_ioctx *)
+			srpt_alloc_ioctx(sdev, sizeof(*ioctx),
+					 sdev->req_buf_cache, DMA_FROM_DEVICE);
+		if (!ioctx)
+			break;
+		ioctx->ioctx.index = srq->posted;
+		ioctx->ioctx.offset = 0;
+		INIT_LIST_HEAD(&ioctx->wait_list);
+		ioctx->srq = srq;
+		srq->ioctx_ring[srq->posted] = ioctx;
+		ret = srpt_post_recv(sdev, NULL, ioctx);
+		if (ret) {
+			srq->ioctx_ring[srq->posted] = NULL;
+			srpt_free_ioctx(sdev, &ioctx->ioctx,
+					sdev->req_buf_cache, DMA_FROM_DEVICE);
+			break;
+		}
+		srq->posted++;
+	}
+
+	if (srq->posted < target)
+		pr_info("%s: posted %d instead of %d receive buffers on SRQ %td\n",
+			dev_name(&sdev->device->dev), srq->posted, target,
+			srq - sdev->srqs);
+}
+
+/*
+ * srpt_srq_attach() - Select the SRQ for a new channel and make sure that
+ * enough receive buffers have been posted on it.
+ *
+ * The SRQ associated with the completion vector of the channel is selected
+ * such that receive processing for the channel stays on the CPU that handles
+ * its completions.
+ */
+static void srpt_srq_attach(struct srpt_rdma_ch *ch)
+{
+	struct srpt_device *sdev = ch->sport->sdev;
+	struct srpt_srq *srq;
+
+	srq = &sdev->srqs[ch->comp_vector % sdev->srq_count];
+	ch->srq = srq;
+
+	mutex_lock(&srq->mutex);
+	srq->ch_count++;
+	srpt_srq_grow(srq);
+	mutex_unlock(&srq->mutex);
+}
+
+static void srpt_srq_detach(struct srpt_rdma_ch *ch)
+{
+	struct srpt_srq *srq = ch->srq;
+
+	if (!srq)
+		return;
+
+	mutex_lock(&srq->mutex);
+	srq->ch_count--;
+	mutex_unlock(&srq->mutex);
+}
+
+#ifdef SRPT_FAST_REG
+/**
+ * srpt_init_mr_pool - allocate the fast registration MRs of a channel
+ * @ch: SRPT RDMA channel.
+ *
+ * Failure to allocate the MR pool is not fatal: RDMA transfers then use one
+ * work request per max_send_sge S/G elements, as before.
+ */
+static void srpt_init_mr_pool(struct srpt_rdma_ch *ch)
+{
+	struct srpt_device *sdev = ch->sport->sdev;
+	u32 max_pages;
+	int nr, ret;
+
+	INIT_LIST_HEAD(&ch->mr_pool);
+	ch->mr_pool_size = 0;
+
+	if (!use_fast_reg ||
+	    !(sdev->dev_attr.device_cap_flags & IB_DEVICE_MEM_MGT_EXTENSIONS))
+		return;
+
+	max_pages = min_t(u32, sdev->dev_attr.max_fast_reg_page_list_len,
+			  SRPT_MR_MAX_PAGES);
+	nr = min_t(int, ch->rq_size, SRPT_MR_POOL_SIZE);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
+	ret = ib_mr_pool_init(ch->qp, &ch->mr_pool, nr, IB_MR_TYPE_MEM_REG,
+			      max_pages);
+#else
+	ret = ib_mr_pool_init(ch->qp, &ch->mr_pool, nr, IB_MR_TYPE_MEM_REG,
+			      max_pages, 0);
+#endif
+	if (ret) {
+		pr_info("%s-%d: allocating %d fast registration MRs failed (%d)\n",
+			ch->sess_name, ch->qp->qp_num, nr, ret);
+		return;
+	}
+
+	ch->mr_pool_size = nr;
+}
+
+static void srpt_destroy_mr_pool(struct srpt_rdma_ch *ch)
+{
+	if (ch->mr_pool_size)
+		ib_mr_pool_destroy(ch->qp, &ch->mr_pool);
+	ch->mr_pool_size = 0;
+}
+#else
+static inline void srpt_init_mr_pool(struct srpt_rdma_ch *ch)
+{
+}
+
+static inline void srpt_destroy_mr_pool(struct srpt_rdma_ch *ch)
+{
 }
+#endif
 
 /**
  * srpt_create_ch_ib - create receive and send completion queues
@@ -2230,6 +2457,9 @@ static int srpt_create_ch_ib(struct srpt_rdma_ch *ch)
 	if (!qp_init)
 		goto out;
 
+	if (sdev->use_srq)
+		srpt_srq_attach(ch);
+
 retry:
 #if !defined(IB_CREATE_CQ_HAS_INIT_ATTR)
 	ch->cq = ib_create_cq(sdev->device, srpt_completion, NULL, ch,
@@ -2247,7 +2477,7 @@ retry:
 		ret = PTR_ERR(ch->cq);
 		pr_err("failed to create CQ: cqe %d; c.v. %d; ret %d\n",
 		       ch->rq_size + sq_size, ch->comp_vector, ret);
-		goto out;
+		goto err_detach_srq;
 	}
 
 	ib_req_notify_cq(ch->cq, IB_CQ_NEXT_COMP);
@@ -2267,7 +2497,7 @@ retry:
 	qp_init->cap.max_send_sge = ch->max_send_sge;
 	qp_init->cap.max_recv_sge = 1;
 	if (sdev->use_srq)
-		qp_init->srq = sdev->srq;
+		qp_init->srq = ch->srq->srq;
 	else
 		qp_init->cap.max_recv_wr = ch->rq_size;
 
@@ -2302,6 +2532,8 @@ retry:
 
 	pr_debug("qp_num = %#x\n", ch->qp->qp_num);
 
+	srpt_init_mr_pool(ch);
+
 	if (!sdev->use_srq)
 		for (i = 0; i < ch->rq_size; i++)
 			srpt_post_recv(sdev, ch, ch->ioctx_recv_ring[i]);
@@ -2319,13 +2551,18 @@ out:
 err_destroy_cq:
 	ch->qp = NULL;
 	ib_destroy_cq(ch->cq);
+err_detach_srq:
+	srpt_srq_detach(ch);
+	ch->srq = NULL;
 	goto out;
 }
 
 static void srpt_destroy_ch_ib(struct srpt_rdma_ch *ch)
 {
+	srpt_destroy_mr_pool(ch);
 	ib_destroy_qp(ch->qp);
 	ib_destroy_cq(ch->cq);
+	srpt_srq_detach(ch);
 }
 
 /**
@@ -2496,17 +2733,53 @@ static bool srpt_is_target_enabled(struct scst_tgt *scst_tgt)
 }
 
 /*
- * srpt_next_comp_vector() - Next completion vector >= sport->comp_vector
+ * srpt_comp_vector_cpu() - CPU that services a completion vector
+ *
+ * Assumes the completion vector spreading of the common HCA drivers:
+ * vector i is bound to the i-th CPU returned by cpumask_local_spread() for
+ * the NUMA node of the HCA, i.e. the local CPUs come first.
  */
-static u16 srpt_next_comp_vector(struct srpt_port *sport)
+static int srpt_comp_vector_cpu(struct srpt_device *sdev, u16 comp_vector)
 {
-	u16 comp_vector;
+	return cpumask_local_spread(comp_vector, sdev->numa_node);
+}
 
-	mutex_lock(&sport->mutex);
-	comp_vector = cpumask_next(sport->comp_vector, &sport->comp_v_mask);
+static u16 srpt_comp_vector_after(struct srpt_port *sport, u16 comp_vector)
+{
+	comp_vector = cpumask_next(comp_vector, &sport->comp_v_mask);
 	if (comp_vector >= nr_cpu_ids)
 		comp_vector = cpumask_next(-1, &sport->comp_v_mask);
 	sBUG_ON(comp_vector >= nr_cpu_ids);
+	return comp_vector;
+}
+
+/*
+ * srpt_next_comp_vector() - Next completion vector >= sport->comp_vector
+ *
+ * Vectors serviced by a CPU on the NUMA node of the HCA are preferred. Falls
+ * back to plain round-robin if there is no such vector in comp_v_mask.
+ */
+static u16 srpt_next_comp_vector(struct srpt_port *sport)
+{
+	struct srpt_device *sdev = sport->sdev;
+	u16 first, comp_vector;
+	int i, n;
+
+	mutex_lock(&sport->mutex);
+	first = srpt_comp_vector_after(sport, sport->comp_vector);
+	comp_vector = first;
+	if (sdev->numa_node != NUMA_NO_NODE) {
+		n = cpumask_weight(&sport->comp_v_mask);
+		for (i = 0; i < n; i++) {
+			if (cpu_to_node(srpt_comp_vector_cpu(sdev,
+					comp_vector)) == sdev->numa_node)
+				break;
+			comp_vector = srpt_comp_vector_after(sport,
+							     comp_vector);
+		}
+		if (i == n)
+			comp_vector = first;
+	}
 	sport->comp_vector = comp_vector;
 	mutex_unlock(&sport->mutex);
 
@@ -2594,7 +2867,7 @@ static int srpt_cm_req_recv(struct srpt_device *const sdev,
 	}
 
 	ret = -ENOMEM;
-	ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+	ch = kzalloc_node(sizeof(*ch), GFP_KERNEL, sdev->numa_node);
 	if (!ch) {
 		rej->reason = cpu_to_be32(SRP_LOGIN_REJ_INSUFFICIENT_RESOURCES);
 		pr_err("rejected SRP_LOGIN_REQ because out of memory.\n");
@@ -2640,10 +2913,10 @@ static int srpt_cm_req_recv(struct srpt_device *const sdev,
 		goto free_rsp_cache;
 	}
 
-	INIT_LIST_HEAD(&ch->free_list);
-	for (i = 0; i < ch->rq_size; i++) {
+	init_llist_head(&ch->free_list);
+	for (i = ch->rq_size - 1; i >= 0; i--) {
 		ch->ioctx_ring[i]->ch = ch;
-		list_add_tail(&ch->ioctx_ring[i]->free_list, &ch->free_list);
+		llist_add(&ch->ioctx_ring[i]->free_node, &ch->free_list);
 	}
 	if (!sdev->use_srq) {
 		u16 imm_data_offset = req->req_flags & SRP_IMMED_REQUESTED ?
@@ -2685,6 +2958,8 @@ static int srpt_cm_req_recv(struct srpt_device *const sdev,
 	}
 
 	ch->comp_vector = srpt_next_comp_vector(sport);
+	ch->cpu = srpt_comp_vector_cpu(sdev, ch->comp_vector);
+	ch->poll_usecs = READ_ONCE(srpt_poll_usecs);
 
 	ret = srpt_create_ch_ib(ch);
 	if (ret) {
@@ -3138,6 +3413,109 @@ static int srpt_rdma_cm_handler(struct rdma_cm_id *cm_id,
 	return ret;
 }
 
+#ifdef SRPT_FAST_REG
+/*
+ * srpt_map_sg_to_mr() - Map a fragmented SG list through a fast registration
+ * MR such that the whole transfer needs a single RDMA work request.
+ *
+ * Returns true if the SG list has been mapped. Otherwise the caller falls back
+ * to building one RDMA work request per max_sge SG elements.
+ */
+static bool srpt_map_sg_to_mr(struct srpt_rdma_ch *ch,
+			      struct srpt_send_ioctx *ioctx,
+			      struct scatterlist *sg, int count, int max_sge,
+			      u32 tsize, struct ib_sge *sge)
+{
+	unsigned int threshold = READ_ONCE(srpt_fast_reg_sg_threshold);
+	struct srp_direct_buf *db = ioctx->rbufs;
+	struct rdma_iu *riu = ioctx->rdma_ius;
+	struct ib_mr *mr;
+	int n;
+
+	if (!ch->mr_pool_size || ioctx->n_rbuf != 1 || tsize == 0)
+		return false;
+	if (count <= (threshold ? threshold : max_sge))
+		return false;
+
+	mr = ib_mr_pool_get(ch->qp, &ch->mr_pool);
+	if (!mr)
+		return false;
+
+	n = ib_map_mr_sg(mr, sg, count, NULL, PAGE_SIZE);
+	if (n < count) {
+		/* The SG list has gaps or more pages than the MR supports. */
+		ib_mr_pool_put(ch->qp, &ch->mr_pool, mr);
+		return false;
+	}
+
+	riu->raddr = be64_to_cpu(db->va);
+	riu->rkey = be32_to_cpu(db->key);
+	riu->sge = sge;
+	riu->sge_cnt = 1;
+	sge->addr = mr->iova;
+	sge->length = min_t(u64, min(tsize, be32_to_cpu(db->len)), mr->length);
+	/* sge->lkey is set in srpt_prep_reg_wrs() after the key update. */
+
+	ioctx->mr = mr;
+	ioctx->n_reg_wr = mr->need_inval ? 2 : 1;
+	ioctx->n_rdma = 1 + ioctx->n_reg_wr;
+
+	return true;
+}
+
+/*
+ * srpt_prep_reg_wrs() - Build the LOCAL_INV and REG_MR work requests that
+ * have to precede the RDMA work request that uses ioctx->mr.
+ *
+ * Returns the first work request of the chain.
+ */
+static struct ib_send_wr *srpt_prep_reg_wrs(struct srpt_rdma_ch *ch,
+					    struct srpt_send_ioctx *ioctx,
+					    scst_data_direction dir,
+					    struct ib_send_wr *inv_wr,
+					    struct ib_reg_wr *reg_wr,
+					    struct ib_send_wr *rdma_wr)
+{
+	struct ib_mr *mr = ioctx->mr;
+	struct ib_send_wr *first = &reg_wr->wr;
+
+	memset(reg_wr, 0, sizeof(*reg_wr));
+	if (ioctx->n_reg_wr > 1) {
+		memset(inv_wr, 0, sizeof(*inv_wr));
+		inv_wr->opcode = IB_WR_LOCAL_INV;
+		inv_wr->wr_id = encode_wr_id(SRPT_RDMA_MID, ioctx->ioctx.index);
+		inv_wr->ex.invalidate_rkey = mr->rkey;
+		inv_wr->next = &reg_wr->wr;
+		first = inv_wr;
+	}
+
+	ib_update_fast_reg_key(mr, ib_inc_rkey(mr->rkey));
+	mr->need_inval = true;
+
+	reg_wr->wr.opcode = IB_WR_REG_MR;
+	reg_wr->wr.wr_id = encode_wr_id(SRPT_RDMA_MID, ioctx->ioctx.index);
+	reg_wr->wr.next = rdma_wr;
+	reg_wr->mr = mr;
+	reg_wr->key = mr->lkey;
+	reg_wr->access = IB_ACCESS_LOCAL_WRITE;
+	/*
+	 * iWARP requires the sink of an RDMA READ to be remotely writable. Let
+	 * the RDMA READ invalidate the MR, as rdma_rw does, such that it does
+	 * not stay remotely writable after the transfer has finished.
+	 */
+	if (dir == SCST_DATA_WRITE &&
+	    rdma_protocol_iwarp(ch->sport->sdev->device, ch->sport->port)) {
+		reg_wr->access |= IB_ACCESS_REMOTE_WRITE;
+		rdma_wr->opcode = IB_WR_RDMA_READ_WITH_INV;
+		rdma_wr->ex.invalidate_rkey = mr->lkey;
+	}
+
+	ioctx->rdma_ius[0].sge->lkey = mr->lkey;
+
+	return first;
+}
+#endif
+
 /*
  * srpt_map_sg_to_ib_sge() - Map an SG list to an IB SGE list.
  */
@@ -3208,6 +3586,12 @@ static int srpt_map_sg_to_ib_sge(struct srpt_rdma_ch *ch,
 	tsize = (dir == SCST_DATA_READ)
 		? scst_cmd_get_adjusted_resp_data_len(cmd)
 		: scst_cmd_get_bufflen(cmd);
+
+#ifdef SRPT_FAST_REG
+	if (srpt_map_sg_to_mr(ch, ioctx, sg, count, max_sge, tsize, sge_array))
+		return 0;
+#endif
+
 	dma_len = ib_sg_dma_len(dev, &sg[0]);
 	riu = ioctx->rdma_ius;
 	sge = sge_array;
@@ -3351,6 +3735,14 @@ static void srpt_unmap_sg_to_ib_sge(struct srpt_rdma_ch *ch,
 	ioctx->rdma_ius = NULL;
 	ioctx->n_rdma = 0;
 
+#ifdef SRPT_FAST_REG
+	if (ioctx->mr) {
+		ib_mr_pool_put(ch->qp, &ch->mr_pool, ioctx->mr);
+		ioctx->mr = NULL;
+	}
+#endif
+	ioctx->n_reg_wr = 0;
+
 	if (ioctx->mapped_sg_count) {
 		EXTRACHECKS_WARN_ON(ioctx
 				    != scst_cmd_get_tgt_priv(&ioctx->cmd));
@@ -3377,6 +3769,11 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 	struct ib_send_wr wr;
 #else
 	struct ib_rdma_wr wr;
+#endif
+#ifdef SRPT_FAST_REG
+	struct ib_send_wr inv_wr;
+	struct ib_reg_wr reg_wr;
+	struct ib_send_wr *first;
 #endif
 	BAD_WR_MODIFIER struct ib_send_wr *bad_wr;
 	struct rdma_iu *riu;
@@ -3384,6 +3781,8 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 	int ret = -ENOMEM;
 	int sq_wr_avail;
 	const int n_rdma = ioctx->n_rdma;
+	/* Number of RDMA READ / WRITE work requests. */
+	const int n_riu = n_rdma - ioctx->n_reg_wr;
 
 	sq_wr_avail = srpt_adjust_sq_wr_avail(ch, -n_rdma);
 	if (sq_wr_avail < 0) {
@@ -3397,17 +3796,17 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 	riu = ioctx->rdma_ius;
 	memset(&wr, 0, sizeof(wr));
 
-	for (i = 0; i < n_rdma; ++i, ++riu) {
+	for (i = 0; i < n_riu; ++i, ++riu) {
 #ifdef USE_PRE_440_WR_STRUCTURE
 		if (dir == SCST_DATA_READ) {
 			wr.opcode = IB_WR_RDMA_WRITE;
-			wr.wr_id = encode_wr_id(i == n_rdma - 1 ?
+			wr.wr_id = encode_wr_id(i == n_riu - 1 ?
 						SRPT_RDMA_WRITE_LAST :
 						SRPT_RDMA_MID,
 						ioctx->ioctx.index);
 		} else {
 			wr.opcode = IB_WR_RDMA_READ;
-			wr.wr_id = encode_wr_id(i == n_rdma - 1 ?
+			wr.wr_id = encode_wr_id(i == n_riu - 1 ?
 						SRPT_RDMA_READ_LAST :
 						SRPT_RDMA_MID,
 						ioctx->ioctx.index);
@@ -3419,20 +3818,20 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 		wr.sg_list = riu->sge;
 
 		/* only get completion event for the last rdma wr */
-		if (i == (n_rdma - 1) && dir == SCST_DATA_WRITE)
+		if (i == (n_riu - 1) && dir == SCST_DATA_WRITE)
 			wr.send_flags = IB_SEND_SIGNALED;
 
 		ret = ib_post_send(ch->qp, &wr, &bad_wr);
 #else
 		if (dir == SCST_DATA_READ) {
 			wr.wr.opcode = IB_WR_RDMA_WRITE;
-			wr.wr.wr_id = encode_wr_id(i == n_rdma - 1 ?
+			wr.wr.wr_id = encode_wr_id(i == n_riu - 1 ?
 						SRPT_RDMA_WRITE_LAST :
 						SRPT_RDMA_MID,
 						ioctx->ioctx.index);
 		} else {
 			wr.wr.opcode = IB_WR_RDMA_READ;
-			wr.wr.wr_id = encode_wr_id(i == n_rdma - 1 ?
+			wr.wr.wr_id = encode_wr_id(i == n_riu - 1 ?
 						SRPT_RDMA_READ_LAST :
 						SRPT_RDMA_MID,
 						ioctx->ioctx.index);
@@ -3444,10 +3843,21 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 		wr.wr.sg_list = riu->sge;
 
 		/* only get completion event for the last rdma wr */
-		if (i == (n_rdma - 1) && dir == SCST_DATA_WRITE)
+		if (i == (n_riu - 1) && dir == SCST_DATA_WRITE)
 			wr.wr.send_flags = IB_SEND_SIGNALED;
 
+#ifdef SRPT_FAST_REG
+		if (i == 0 && ioctx->mr) {
+			/* Register the MR before the RDMA that uses it. */
+			first = srpt_prep_reg_wrs(ch, ioctx, dir, &inv_wr,
+						  &reg_wr, &wr.wr);
+			ret = ib_post_send(ch->qp, first, &bad_wr);
+		} else {
+			ret = ib_post_send(ch->qp, &wr.wr, &bad_wr);
+		}
+#else
 		ret = ib_post_send(ch->qp, &wr.wr, &bad_wr);
+#endif
 #endif
 		if (ret)
 			break;
@@ -3455,7 +3865,7 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 
 	if (ret)
 		pr_err("%s: ib_post_send() returned %d for %d/%d\n", __func__,
-		       ret, i, n_rdma);
+		       ret, i, n_riu);
 	if (ret && i > 0) {
 #ifdef USE_PRE_440_WR_STRUCTURE
 		wr.num_sge = 0;
@@ -3500,6 +3910,13 @@ static int srpt_perform_rdmas(struct srpt_rdma_ch *ch,
 		pr_info("%s[%d]: done\n", __func__, __LINE__);
 	}
 
+	if (ret == 0) {
+		atomic_long_inc(&ch->rdma_cmds);
+		atomic_long_add(n_rdma, &ch->rdma_wrs);
+		if (ioctx->n_reg_wr)
+			atomic_long_inc(&ch->rdma_mr_cmds);
+	}
+
 out:
 	if (unlikely(ret < 0))
 		srpt_adjust_sq_wr_avail(ch, n_rdma);
@@ -4199,6 +4616,51 @@ static ssize_t show_comp_vector(struct kobject *kobj,
 	return sysfs_emit(buf, "%u\n", ch->comp_vector);
 }
 
+static ssize_t show_rdma_cmds(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *sess;
+	struct srpt_rdma_ch *ch;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	ch = scst_sess_get_tgt_priv(sess);
+	if (!ch)
+		return -ENOENT;
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&ch->rdma_cmds));
+}
+
+static ssize_t show_rdma_wrs(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *sess;
+	struct srpt_rdma_ch *ch;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	ch = scst_sess_get_tgt_priv(sess);
+	if (!ch)
+		return -ENOENT;
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&ch->rdma_wrs));
+}
+
+static ssize_t show_rdma_mr_cmds(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	struct scst_session *sess;
+	struct srpt_rdma_ch *ch;
+
+	sess = container_of(kobj, struct scst_session, sess_kobj);
+
+	ch = scst_sess_get_tgt_priv(sess);
+	if (!ch)
+		return -ENOENT;
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&ch->rdma_mr_cmds));
+}
+
 static const struct kobj_attribute srpt_req_lim_attr =
 	__ATTR(req_lim, 0444, show_req_lim, NULL);
 static const struct kobj_attribute srpt_req_lim_delta_attr =
@@ -4207,12 +4669,21 @@ static const struct kobj_attribute srpt_ch_state_attr =
 	__ATTR(ch_state, 0444, show_ch_state, NULL);
 static const struct kobj_attribute srpt_comp_vector_attr =
 	__ATTR(comp_vector, 0444, show_comp_vector, NULL);
+static const struct kobj_attribute srpt_rdma_cmds_attr =
+	__ATTR(rdma_cmds, 0444, show_rdma_cmds, NULL);
+static const struct kobj_attribute srpt_rdma_wrs_attr =
+	__ATTR(rdma_wrs, 0444, show_rdma_wrs, NULL);
+static const struct kobj_attribute srpt_rdma_mr_cmds_attr =
+	__ATTR(rdma_mr_cmds, 0444, show_rdma_mr_cmds, NULL);
 
 static const struct attribute *srpt_sess_attrs[] = {
 	&srpt_req_lim_attr.attr,
 	&srpt_req_lim_delta_attr.attr,
 	&srpt_ch_state_attr.attr,
 	&srpt_comp_vector_attr.attr,
+	&srpt_rdma_cmds_attr.attr,
+	&srpt_rdma_wrs_attr.attr,
+	&srpt_rdma_mr_cmds_attr.attr,
 	NULL
 };
 
@@ -4251,6 +4722,113 @@ static void srpt_init_sport(struct srpt_port *sport, struct ib_device *ib_dev)
 		cpumask_set_cpu(i, &sport->comp_v_mask);
 }
 
+/*
+ * srpt_free_srqs() - Destroy the SRQs of an HCA and free their receive buffers.
+ */
+static void srpt_free_srqs(struct srpt_device *sdev)
+{
+	struct srpt_srq *srq;
+	int i;
+
+	for (i = 0; i < sdev->srq_count; i++) {
+		srq = &sdev->srqs[i];
+		WARN_ON_ONCE(srq->ch_count);
+		if (srq->srq)
+			ib_destroy_srq(srq->srq);
+		srpt_free_ioctx_ring((struct srpt_ioctx **)srq->ioctx_ring,
+				     sdev, srq->size, sdev->req_buf_cache,
+				     DMA_FROM_DEVICE);
+	}
+	kfree(sdev->srqs);
+	sdev->srqs = NULL;
+	sdev->srq_count = 0;
+	kmem_cache_destroy(sdev->req_buf_cache);
+	sdev->req_buf_cache = NULL;
+}
+
+/*
+ * srpt_alloc_srqs() - Create one SRQ per completion vector of an HCA.
+ *
+ * The number of SRQs is limited by the number of online CPUs. If
+ * srpt_srq_ch_size is zero, the srpt_srq_size receive buffers are divided
+ * over the SRQs and are posted immediately. Otherwise up to srpt_srq_size
+ * buffers are posted per SRQ, in proportion to the number of channels that
+ * use the SRQ.
+ *
+ * Returns zero upon success or a negative error code upon failure.
+ */
+static int srpt_alloc_srqs(struct srpt_device *sdev)
+{
+	struct ib_srq_init_attr srq_attr;
+	struct srpt_srq *srq;
+	int i, ret;
+
+	sdev->req_buf_cache = kmem_cache_create("srpt-srq-req-buf",
+						srp_max_req_size, 0, 0, NULL);
+	if (!sdev->req_buf_cache)
+		return -ENOMEM;
+
+	ret = -ENOMEM;
+	sdev->srq_count = clamp_t(int, sdev->device->num_comp_vectors, 1,
+				  num_online_cpus());
+	sdev->srqs = kcalloc_node(sdev->srq_count, sizeof(*sdev->srqs),
+				  GFP_KERNEL, sdev->numa_node);
+	if (!sdev->srqs) {
+		sdev->srq_count = 0;
+		goto err;
+	}
+
+	if (READ_ONCE(srpt_srq_ch_size) == 0)
+		sdev->srq_size = max_t(int, sdev->srq_size / sdev->srq_count,
+				       MIN_SRPT_SRQ_SIZE);
+
+	for (i = 0; i < sdev->srq_count; i++) {
+		srq = &sdev->srqs[i];
+		srq->sdev = sdev;
+		srq->size = sdev->srq_size;
+		mutex_init(&srq->mutex);
+
+		srq->ioctx_ring = kvmalloc_array_node(srq->size,
+						      sizeof(srq->ioctx_ring[0]),
+						      GFP_KERNEL | __GFP_ZERO,
+						      sdev->numa_node);
+		if (!srq->ioctx_ring) {
+			ret = -ENOMEM;
+			goto err;
+		}
+
+		memset(&srq_attr, 0, sizeof(srq_attr));
+		srq_attr.event_handler = srpt_srq_event;
+		srq_attr.srq_context = (void *)srq;
+		srq_attr.attr.max_wr = srq->size;
+		srq_attr.attr.max_sge = 1;
+		srq_attr.attr.srq_limit = 0;
+		srq_attr.srq_type = IB_SRQT_BASIC;
+
+		srq->srq = ib_create_srq(sdev->pd, &srq_attr);
+		if (IS_ERR(srq->srq)) {
+			ret = PTR_ERR(srq->srq);
+			srq->srq = NULL;
+			pr_debug("ib_create_srq() failed: %d\n", ret);
+			goto err;
+		}
+
+		mutex_lock(&srq->mutex);
+		srpt_srq_grow(srq);
+		mutex_unlock(&srq->mutex);
+	}
+
+	pr_debug("created %d SRQs with max #wr= %d max_allow=%d dev= %s\n",
+		 sdev->srq_count, sdev->srq_size, sdev->dev_attr.max_srq_wr,
+		 dev_name(&sdev->device->dev));
+
+	return 0;
+
+err:
+	srpt_free_srqs(sdev);
+	return ret;
+}
+
 /*
  * srpt_add_one() - Infiniband device addition callback function.
  */
@@ -4259,7 +4837,6 @@ static int srpt_add_one(struct ib_device *device)
 	struct ib_cm_id *cm_id;
 	struct srpt_device *sdev;
 	struct srpt_port *sport;
-	struct ib_srq_init_attr srq_attr;
 	int i, ret;
 
 	pr_debug("device = %p\n", device);
@@ -4271,6 +4848,8 @@ static int srpt_add_one(struct ib_device *device)
 	}
 
 	sdev->device = device;
+	sdev->numa_node = device->dev.parent ?
+		dev_to_node(device->dev.parent) : NUMA_NO_NODE;
 
 #ifdef HAVE_IB_QUERY_DEVICE
 	ret = ib_query_device(device, &sdev->dev_attr);
@@ -4304,52 +4883,14 @@ static int srpt_add_one(struct ib_device *device)
 	sdev->srq_size = min(max(srpt_srq_size, MIN_SRPT_SRQ_SIZE),
 			     sdev->dev_attr.max_srq_wr);
 
-	memset(&srq_attr, 0, sizeof(srq_attr));
-	srq_attr.event_handler = srpt_srq_event;
-	srq_attr.srq_context = (void *)sdev;
-	srq_attr.attr.max_wr = sdev->srq_size;
-	srq_attr.attr.max_sge = 1;
-	srq_attr.attr.srq_limit = 0;
-	srq_attr.srq_type = IB_SRQT_BASIC;
-
-	sdev->srq = use_srq ? ib_create_srq(sdev->pd, &srq_attr) :
-		ERR_PTR(-EOPNOTSUPP);
-	if (IS_ERR(sdev->srq)) {
-		if (use_srq)
-			pr_debug("ib_create_srq() failed: %ld\n",
-				 PTR_ERR(sdev->srq));
-
-		/* SRQ disabled or not supported. */
-		sdev->use_srq = false;
-	} else {
-		pr_debug("create SRQ #wr= %d max_allow=%d dev= %s\n",
-			 sdev->srq_size, sdev->dev_attr.max_srq_wr,
-			 device->name);
-
-		sdev->req_buf_cache = kmem_cache_create("srpt-srq-req-buf", srp_max_req_size,
-							0, 0, NULL);
-		if (!sdev->req_buf_cache) {
-			ret = -ENOMEM;
-			goto free_srq;
-		}
-
-		sdev->ioctx_ring = (struct srpt_recv_ioctx **)
-			srpt_alloc_ioctx_ring(sdev, sdev->srq_size,
-					      sizeof(*sdev->ioctx_ring[0]),
-					      sdev->req_buf_cache,
-					      0, DMA_FROM_DEVICE);
-		if (!sdev->ioctx_ring) {
-			ret = -ENOMEM;
-			pr_err("srpt_alloc_ioctx_ring() failed\n");
-			goto free_cache;
-		}
-
-		sdev->use_srq = true;
-
-		for (i = 0; i < sdev->srq_size; ++i) {
-			INIT_LIST_HEAD(&sdev->ioctx_ring[i]->wait_list);
-			srpt_post_recv(sdev, NULL, sdev->ioctx_ring[i]);
-		}
+	/* Without SRQ support, fall back to a receive queue per channel. */
+	sdev->use_srq = use_srq;
+	if (sdev->use_srq) {
+		ret = srpt_alloc_srqs(sdev);
+		if (ret)
+			sdev->use_srq = false;
+		if (ret == -ENOMEM)
+			goto err_ring;
 	}
 
 	WARN_ON(sdev->device->phys_port_cnt > ARRAY_SIZE(sdev->port));
@@ -4417,15 +4958,7 @@ out:
 err_cm:
 	ib_destroy_cm_id(sdev->cm_id);
 err_ring:
-	srpt_free_ioctx_ring((struct srpt_ioctx **)sdev->ioctx_ring, sdev,
-			     sdev->srq_size, sdev->req_buf_cache,
-			     DMA_FROM_DEVICE);
-free_cache:
-	kmem_cache_destroy(sdev->req_buf_cache);
-
-free_srq:
-	if (sdev->use_srq)
-		ib_destroy_srq(sdev->srq);
+	srpt_free_srqs(sdev);
 
 #ifndef IB_PD_HAS_LOCAL_DMA_LKEY
 	ib_dereg_mr(sdev->mr);
@@ -4494,12 +5027,7 @@ static void srpt_remove_one(struct ib_device *device, void *client_data)
 		}
 	}
 
-	if (sdev->use_srq)
-		ib_destroy_srq(sdev->srq);
-	srpt_free_ioctx_ring((struct srpt_ioctx **)sdev->ioctx_ring, sdev,
-			     sdev->srq_size, sdev->req_buf_cache,
-			     DMA_FROM_DEVICE);
-	kmem_cache_destroy(sdev->req_buf_cache);
+	srpt_free_srqs(sdev);
 #ifndef IB_PD_HAS_LOCAL_DMA_LKEY
 	ib_dereg_mr(sdev->mr);
 #endif
@@ -37,6 +37,8 @@
 
 #include <linux/types.h>
 #include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/mutex.h>
 #include <linux/wait.h>
 #include <rdma/ib_verbs.h>
 #include <rdma/ib_sa.h>
@@ -52,6 +54,16 @@
 #include <rdma/rdma_cm.h>
 #include "ib_dm_mad.h"
 
+/*
+ * Whether fast registration MRs can be used for RDMA transfers with a
+ * fragmented local S/G list. See also srpt_map_sg_to_mr().
+ */
+#if !defined(USE_PRE_440_WR_STRUCTURE) &&		\
+	LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+#define SRPT_FAST_REG 1
+#include <rdma/mr_pool.h>
+#endif
+
 /*
  * The prefix the ServiceName field must start with in the device management
  * ServiceEntries attribute pair. See also the SRP specification.
@@ -175,6 +187,10 @@ enum {
 	MIN_SRPT_SRQ_SIZE = 4,
 	DEFAULT_SRPT_SRQ_SIZE = 4095,
 	MAX_SRPT_SRQ_SIZE = 65535,
+	DEFAULT_SRPT_SRQ_CH_SIZE = 128,
+
+	SRPT_MR_POOL_SIZE = 64,
+	SRPT_MR_MAX_PAGES = 256,
 
 	SRP_MAX_ADD_CDB_LEN = 16,
 	SRP_MAX_IMM_DATA_OFFSET = 80,
@@ -272,11 +288,13 @@ struct srpt_ioctx {
  * struct srpt_recv_ioctx - SRPT receive I/O context
  * @ioctx:     See above.
  * @wait_list: Node for insertion in srpt_rdma_ch.cmd_wait_list.
+ * @srq:       SRQ this I/O context is posted on or NULL if not using an SRQ.
  * @byte_len:  Number of bytes in @ioctx.buf.
  */
 struct srpt_recv_ioctx {
 	struct srpt_ioctx	ioctx;
 	struct list_head	wait_list;
+	struct srpt_srq		*srq;
 	int			byte_len;
 };
 
@@ -302,12 +320,14 @@ struct srpt_tsk_mgmt {
  * @state:       I/O context state.
  * @rdma_aborted: If initiating a multipart RDMA transfer failed, whether
  *               the already initiated transfers have finished.
- * @free_list:   Node in srpt_rdma_ch.free_list.
+ * @free_node:   Node in srpt_rdma_ch.free_list.
  * @sg_cnt:      SG-list size.
  * @mapped_sg_count: ib_dma_map_sg() return value.
  * @n_rdma_ius:  Size of the rdma_ius array.
- * @n_rdma:      Number of elements used of the rdma_ius array.
+ * @n_rdma:      Number of RDMA work requests, including @n_reg_wr.
  * @n_rbuf:      Number of data buffers in the received SRP command.
+ * @n_reg_wr:    Number of memory registration work requests.
+ * @mr:          Fast registration MR the data buffer is mapped through.
  * @req_lim_delta: Value of the req_lim_delta value field in the latest
  *               SRP response sent.
  * @tsk_mgmt:    SRPT task management function context information.
@@ -324,7 +344,7 @@ struct srpt_send_ioctx {
 	struct srp_direct_buf	*rbufs;
 	struct srp_direct_buf	single_rbuf;
 	struct scatterlist	*sg;
-	struct list_head	free_list;
+	struct llist_node	free_node;
 	enum srpt_command_state	state;
 	bool			rdma_aborted;
 	int			sg_cnt;
@@ -332,6 +352,8 @@ struct srpt_send_ioctx {
 	u16			n_rdma_ius;
 	u8			n_rdma;
 	u8			n_rbuf;
+	u8			n_reg_wr;
+	struct ib_mr		*mr;
 	int			req_lim_delta;
 	struct srpt_tsk_mgmt	tsk_mgmt;
 	u8			rdma_ius_buf[2 * sizeof(struct rdma_iu)
@@ -379,8 +401,10 @@ enum rdma_ch_state {
  *                 by the initiator without having received a response.
  * @req_lim_delta: Number of credits not yet sent back to the initiator.
  * @imm_data_offset: Offset from start of SRP_CMD for immediate data.
- * @spinlock:      Protects free_list and state.
- * @free_list:     Head of list with free send I/O contexts.
+ * @spinlock:      Protects req_lim, req_lim_delta and state.
+ * @free_list:     Head of list with free send I/O contexts. Entries are only
+ *                 removed from the completion work of this channel, which
+ *                 is never run concurrently with itself.
  * @wc:            Work completion array.
  * @state:         channel state. See also enum rdma_ch_state.
  * @using_rdma_cm: Whether the RDMA/CM or IB/CM is used for this channel.
@@ -395,6 +419,17 @@ enum rdma_ch_state {
  *                 against concurrent modification by the cm_id spinlock.
  * @pkey:          P_Key of the IB partition for this SRP channel.
  * @comp_vector:   Completion vector assigned to the QP.
+ * @cpu:           CPU on which the completions of this channel are processed.
+ * @srq:           SRQ the QP of this channel receives on if the HCA uses SRQs.
+ * @poll_usecs:    If not zero, the completion work polls the CQ until it has
+ *                 been idle for this many microseconds. See also
+ *                 srpt_busy_poll().
+ * @poll_last:     Time at which the last completion was polled.
+ * @mr_pool:       Fast registration MRs for fragmented RDMA transfers.
+ * @mr_pool_size:  Number of MRs allocated for @mr_pool; zero if not used.
+ * @rdma_cmds:     Number of commands that transferred data via RDMA.
+ * @rdma_wrs:      Number of work requests posted for these transfers.
+ * @rdma_mr_cmds:  Number of these commands that used a fast registration MR.
  * @sess:          Session information associated with this SRP channel.
  * @sess_name:     Session name.
  */
@@ -423,7 +458,7 @@ struct srpt_rdma_ch {
 	int			req_lim_delta;
 	u16			imm_data_offset;
 	spinlock_t		spinlock;
-	struct list_head	free_list;
+	struct llist_head	free_list;
 	enum rdma_ch_state	state;
 	struct kmem_cache	*rsp_buf_cache;
 	struct srpt_send_ioctx	**ioctx_ring;
@@ -434,6 +469,15 @@ struct srpt_rdma_ch {
 	struct list_head	cmd_wait_list;
 	uint16_t		pkey;
 	u16			comp_vector;
+	int			cpu;
+	struct srpt_srq		*srq;
+	unsigned int		poll_usecs;
+	ktime_t			poll_last;
+	struct list_head	mr_pool;
+	int			mr_pool_size;
+	atomic_long_t		rdma_cmds;
+	atomic_long_t		rdma_wrs;
+	atomic_long_t		rdma_mr_cmds;
 	bool			using_rdma_cm;
 	bool			processing_wait_list;
 	struct scst_session	*sess;
@@ -492,22 +536,47 @@ struct srpt_port {
 	u8			port_id[64];
 };
 
+/**
+ * struct srpt_srq - shared receive queue
+ * @srq:        IB SRQ.
+ * @sdev:       HCA this SRQ belongs to.
+ * @ioctx_ring: Receive I/O contexts. Only the first @posted entries have been
+ *              allocated.
+ * @mutex:      Serializes growing of the SRQ and changes of @ch_count.
+ * @size:       Maximum number of receive buffers that can be posted.
+ * @posted:     Number of receive buffers allocated and posted.
+ * @ch_count:   Number of channels whose QP receives on this SRQ.
+ *
+ * Each completion vector of an HCA has its own SRQ such that the receive
+ * buffers of a channel are local to the CPU that processes its completions.
+ */
+struct srpt_srq {
+	struct ib_srq		*srq;
+	struct srpt_device	*sdev;
+	struct srpt_recv_ioctx	**ioctx_ring;
+	struct mutex		mutex;
+	int			size;
+	int			posted;
+	int			ch_count;
+};
+
 /**
  * struct srpt_device - information associated by SRPT with a single HCA
  * @device:        Backpointer to the struct ib_device managed by the IB core.
  * @pd:            IB protection domain.
  * @mr:            MR with write access to all local memory.
  * @lkey:          L_Key (local key) with write access to all local memory.
- * @srq:           Per-HCA SRQ (shared receive queue).
+ * @srqs:          Per-completion vector SRQs (shared receive queues).
+ * @srq_count:     Number of elements in @srqs.
  * @cm_id:         Connection identifier.
  * @dev_attr:      Attributes of the InfiniBand device as obtained during the
  *                 ib_client.add() callback.
- * @srq_size:      SRQ size.
+ * @srq_size:      Maximum number of receive buffers per SRQ.
  * @use_srq:       Whether or not to use SRQ.
- * @req_buf_cache: kmem_cache for @ioctx_ring buffers.
- * @ioctx_ring:    Per-HCA SRQ.
+ * @req_buf_cache: kmem_cache for the SRQ receive buffers.
  * @port:          Information about the ports owned by this HCA.
  * @event_handler: Per-HCA asynchronous IB event handler.
+ * @numa_node:     NUMA node of the HCA or NUMA_NO_NODE.
  */
 struct srpt_device {
 	struct ib_device	*device;
@@ -515,16 +584,17 @@ struct srpt_device {
 #ifndef IB_PD_HAS_LOCAL_DMA_LKEY
 	struct ib_mr		*mr;
 #endif
-	struct ib_srq		*srq;
+	struct srpt_srq		*srqs;
+	int			srq_count;
 	struct ib_cm_id		*cm_id;
 	struct ib_device_attr	dev_attr;
 	u32			lkey;
 	int			srq_size;
 	bool			use_srq;
 	struct kmem_cache	*req_buf_cache;
-	struct srpt_recv_ioctx	**ioctx_ring;
 	struct srpt_port	port[2];
 	struct ib_event_handler	event_handler;
+	int			numa_node;
 };
 
 #endif				/* IB_SRPT_H */
@@ -93,6 +93,20 @@ static void handle_reg_vdev_received(struct scst_event_user *event_user)
 	return;
 }
 
+static void handle_alua_state_changed(struct scst_event_user *event_user)
+{
+	struct scst_event_alua_state_changed_payload *p = (struct scst_event_alua_state_changed_payload *)event_user->out_event.payload;
+
+	printf("ALUA state of %s/%s (group id %d) changed from %s into %s: "
+		"%u LUNs, published after %llu us, done after %llu us\n",
+		p->dg_name, p->tg_name, p->group_id, p->prev_state,
+		p->new_state, p->nr_luns,
+		(unsigned long long)p->publish_us,
+		(unsigned long long)p->total_us);
+
+	return;
+}
+
 static void handle_tm_received(struct scst_event_user *event_user)
 {
 	struct scst_event_tm_fn_received_payload *p = (struct scst_event_tm_fn_received_payload *)event_user->out_event.payload;
@@ -288,6 +302,8 @@ again_poll:
 					"(res %d)", strerror(errno), res);
 		} else if (event_user->out_event.event_code == SCST_EVENT_REG_VIRT_DEV) {
 			handle_reg_vdev_received(event_user);
+		} else if (event_user->out_event.event_code == SCST_EVENT_ALUA_STATE_CHANGED) {
+			handle_alua_state_changed(event_user);
 		} else if (event_user->out_event.event_code == SCST_EVENT_TM_FN_RECEIVED)
 			handle_tm_received(event_user);
 		else if (event_user->out_event.event_code == SCST_EVENT_TM_FN_RECEIVED) {